@@ -0,0 +1,164 @@
+"""
+Closed loop load generator.
+
+Every client runs on its own thread and connection and sends its next command only
+after the previous one was answered. With --rate the clients are paced to the target
+total rate and the latency is measured from the time the command was scheduled, so
+a slow server is not hidden by the clients waiting for it.
+
+    python3 bench/loadgen.py --preload 100000 --clients 16 --duration 30 \
+        --write-ratio 0.1 -k "10:0.8,100:0.2" --rate 2000
+
+    python3 bench/loadgen.py --cluster --port 30001 --clients 32 --duration 60
+
+Requires redis-py and numpy.
+"""
+
+import argparse
+import random
+import threading
+import time
+import numpy as np
+import redis
+
+VEC_SIZE = 128
+
+
+def connect(args):
+    if args.cluster:
+        from redis.cluster import RedisCluster
+        return RedisCluster(host=args.host, port=args.port)
+    return redis.Redis(host=args.host, port=args.port)
+
+
+def parse_k(spec):
+    # "10" or a weighted distribution "1:0.2,10:0.5,100:0.3"
+    values, weights = [], []
+    for part in spec.split(','):
+        if ':' in part:
+            k, w = part.split(':')
+        else:
+            k, w = part, 1
+        values.append(int(k))
+        weights.append(float(w))
+    return values, weights
+
+
+def random_vec(rng):
+    return rng.random(VEC_SIZE, dtype=np.float32).tobytes()
+
+
+def preload(conn, n, prefix, batch):
+    rng = np.random.default_rng(0)
+    p = conn.pipeline(transaction=False)
+    for i in range(n):
+        p.execute_command('RG.VEC_ADD', '%spreload:%d' % (prefix, i), random_vec(rng))
+        if (i + 1) % batch == 0:
+            p.execute()
+            p = conn.pipeline(transaction=False)
+    p.execute()
+
+
+class Client(threading.Thread):
+    def __init__(self, cid, args, kValues, kWeights, deadline, interval):
+        threading.Thread.__init__(self)
+        self.cid = cid
+        self.args = args
+        self.kValues = kValues
+        self.kWeights = kWeights
+        self.deadline = deadline
+        self.interval = interval
+        self.latencies = {'read': [], 'write': []}
+        self.errors = {'read': 0, 'write': 0}
+
+    def run(self):
+        conn = connect(self.args)
+        rng = np.random.default_rng(self.cid + 1)
+        choice = random.Random(self.cid)
+        writes = 0
+        # spread the clients start over a single interval
+        scheduled = time.perf_counter() + (self.interval * self.cid / self.args.clients if self.interval else 0)
+        while True:
+            now = time.perf_counter()
+            if self.interval:
+                if scheduled > now:
+                    time.sleep(scheduled - now)
+                start = scheduled
+                scheduled += self.interval
+            else:
+                start = now
+            if start >= self.deadline:
+                break
+
+            if choice.random() < self.args.write_ratio:
+                op = 'write'
+                cmd = ['RG.VEC_ADD', '%s%d:%d' % (self.args.prefix, self.cid, writes), random_vec(rng)]
+                writes += 1
+            else:
+                op = 'read'
+                k = choice.choices(self.kValues, self.kWeights)[0]
+                cmd = ['RG.VEC_SIM', k, random_vec(rng)]
+
+            try:
+                res = conn.execute_command(*cmd)
+                if op == 'read' and res[1]:
+                    self.errors[op] += 1
+                    continue
+            except redis.RedisError:
+                self.errors[op] += 1
+                continue
+            self.latencies[op].append(time.perf_counter() - start)
+
+
+def report(name, latencies, errors, duration):
+    if not latencies:
+        print('%-6s %10d ops %8d errors' % (name, 0, errors))
+        return
+    ms = np.array(latencies) * 1000
+    print('%-6s %10d ops %8d errors %10.1f ops/sec  p50 %8.3f  p90 %8.3f  p99 %8.3f  p999 %8.3f  max %8.3f ms' % (
+        name, len(ms), errors, len(ms) / duration, np.percentile(ms, 50), np.percentile(ms, 90),
+        np.percentile(ms, 99), np.percentile(ms, 99.9), ms.max()))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Closed loop load generator')
+    parser.add_argument('--host', default='localhost')
+    parser.add_argument('--port', type=int, default=6379)
+    parser.add_argument('--cluster', action='store_true', help='connect to an oss cluster')
+    parser.add_argument('--clients', type=int, default=8, help='amount of concurrent clients')
+    parser.add_argument('--duration', type=float, default=10, help='seconds to run')
+    parser.add_argument('--rate', type=float, default=0, help='target total ops/sec (default: as fast as possible)')
+    parser.add_argument('--write-ratio', type=float, default=0, help='fraction of RG.VEC_ADD out of all the commands')
+    parser.add_argument('-k', default='10', help='k of the searches, a value or a weighted list like "10:0.8,100:0.2"')
+    parser.add_argument('--preload', type=int, default=0, help='add that many vectors before starting')
+    parser.add_argument('--batch', type=int, default=1000, help='pipeline size while preloading')
+    parser.add_argument('--prefix', default='load:')
+    args = parser.parse_args()
+
+    kValues, kWeights = parse_k(args.k)
+
+    if args.preload:
+        start = time.perf_counter()
+        preload(connect(args), args.preload, args.prefix, args.batch)
+        print('preloaded %d vectors in %.2f seconds' % (args.preload, time.perf_counter() - start))
+
+    interval = args.clients / args.rate if args.rate else 0
+    start = time.perf_counter()
+    deadline = start + args.duration
+    clients = [Client(i, args, kValues, kWeights, deadline, interval) for i in range(args.clients)]
+    for c in clients:
+        c.start()
+    for c in clients:
+        c.join()
+    duration = time.perf_counter() - start
+
+    for op in ['read', 'write']:
+        latencies = [l for c in clients for l in c.latencies[op]]
+        errors = sum(c.errors[op] for c in clients)
+        report(op, latencies, errors, duration)
+    total = sum(len(c.latencies[op]) for c in clients for op in c.latencies)
+    print('total  %10d ops %10.1f ops/sec over %.2f seconds with %d clients' % (total, total / duration, duration, args.clients))
+
+
+if __name__ == '__main__':
+    main()
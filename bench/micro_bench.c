@@ -0,0 +1,655 @@
+/*
+ * micro_bench.c
+ *
+ * Micro benchmarks of the vector similarity hot paths, linked directly with the
+ * storage core (no redis or gears needed). Each result is printed as a single
+ * json line so runs can be compared over time.
+ *
+ * Usage: micro_bench [-n <max vectors>] [-r <repeats>] [-b <bench name>]
+ */
+
+#include "vec_store.h"
+#include "topk.h"
+#include "vec_disk.h"
+#include "vec_sparse.h"
+#include "arr_rm_alloc.h"
+#include <cblas.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+static void Bench_InitRedisModule(){
+    RedisModule_Alloc = malloc;
+    RedisModule_Calloc = calloc;
+    RedisModule_Realloc = realloc;
+    RedisModule_Free = free;
+    RedisModule_Strdup = strdup;
+}
+
+static double Bench_Now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t rngState = 88172645463325252ULL;
+
+static float Bench_Rand(){
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return (rngState >> 40) / (float)(1 << 24);
+}
+
+static void Bench_RandVec(float* v){
+    for(size_t i = 0 ; i < VEC_SIZE ; ++i){
+        v[i] = Bench_Rand();
+    }
+}
+
+static int cmpDouble(const void* a, const void* b){
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double Bench_Median(double* samples, size_t n){
+    qsort(samples, n, sizeof(*samples), cmpDouble);
+    return samples[n / 2];
+}
+
+static void Bench_Report(const char* bench, size_t n, size_t k, size_t ops, double seconds, double flops, double bytes){
+    printf("{\"bench\": \"%s\", \"n\": %zu, \"k\": %zu, \"ops\": %zu, \"seconds\": %.9f, \"ns_per_op\": %.3f, \"ops_per_sec\": %.1f",
+           bench, n, k, ops, seconds, seconds * 1e9 / ops, ops / seconds);
+    if(flops > 0){
+        printf(", \"gflops\": %.3f", flops / seconds / 1e9);
+    }
+    if(bytes > 0){
+        printf(", \"gbps\": %.3f", bytes / seconds / 1e9);
+    }
+    printf("}\n");
+    fflush(stdout);
+}
+
+static float scores[VEC_HOLDER_SIZE];
+static uint64_t mask[VEC_HOLDER_SIZE / 64];
+
+/*
+ * Fill the store with n random vectors.
+ */
+static void Bench_Fill(size_t n, VecDT** vDTs){
+    float v[VEC_SIZE];
+    char key[32];
+    for(size_t i = 0 ; i < n ; ++i){
+        Bench_RandVec(v);
+        size_t len = snprintf(key, sizeof(key), "key%zu", i);
+        VecDT* vDT = vec_insert(key, len, v);
+        if(vDTs){
+            vDTs[i] = vDT;
+        }
+    }
+}
+
+static void Bench_Clear(){
+    while(vecList){
+        VecsHolder* last = vecList[array_len(vecList) - 1];
+        vec_delete(HOLDER_KEY(last, last->size - 1)->vDT);
+    }
+}
+
+/*
+ * The distance kernel, score every vector of the store against a query.
+ */
+static void Bench_Scan(size_t n, size_t repeats){
+    Bench_Fill(n, NULL);
+
+    float q[VEC_SIZE];
+    Bench_RandVec(q);
+    vec_set_data(q, q);
+
+    double samples[repeats];
+    for(size_t r = 0 ; r < repeats ; ++r){
+        double start = Bench_Now();
+        for(size_t h = 0 ; h < array_len(vecList) ; ++h){
+            vec_score_holder(vecList[h], q, NULL, scores, mask);
+        }
+        samples[r] = Bench_Now() - start;
+    }
+
+    double t = Bench_Median(samples, repeats);
+    Bench_Report("scan", n, 0, n, t, 2.0 * n * VEC_SIZE, (double)n * VEC_SIZE * sizeof(float));
+
+    Bench_Clear();
+}
+
+/*
+ * The pruned top k scan against the full scan followed by the top k, on vectors whose
+ * energy decays along the dimensions as it does after a PCA rotation (on uniform
+ * random vectors almost nothing is pruned).
+ */
+static void Bench_Prune(size_t n, size_t k, size_t repeats){
+    float v[VEC_SIZE];
+    char key[32];
+    for(size_t i = 0 ; i < n ; ++i){
+        for(size_t j = 0 ; j < VEC_SIZE ; ++j){
+            v[j] = (Bench_Rand() - 0.5f) * expf(-(float)j / 16);
+        }
+        size_t len = snprintf(key, sizeof(key), "key%zu", i);
+        vec_insert(key, len, v);
+    }
+
+    float q[VEC_SIZE];
+    for(size_t j = 0 ; j < VEC_SIZE ; ++j){
+        q[j] = (Bench_Rand() - 0.5f) * expf(-(float)j / 16);
+    }
+    vec_set_data(q, q);
+
+    TopK* t = TopK_Create(k);
+    double exact[repeats];
+    double pruned[repeats];
+    size_t scored = 0;
+    size_t candidates = 0;
+    size_t heapOps = 0;
+    for(size_t r = 0 ; r < repeats ; ++r){
+        double start = Bench_Now();
+        for(size_t h = 0 ; h < array_len(vecList) ; ++h){
+            TopK_Clear(t);
+            vec_score_holder(vecList[h], q, NULL, scores, mask);
+            for(size_t i = 0 ; i < vecList[h]->size ; ++i){
+                TopK_Push(t, scores[i], i);
+            }
+        }
+        exact[r] = Bench_Now() - start;
+
+        start = Bench_Now();
+        scored = 0;
+        for(size_t h = 0 ; h < array_len(vecList) ; ++h){
+            TopK_Clear(t);
+            scored += vec_topk_holder_pruned(vecList[h], q, -INFINITY, t, scores, &candidates, &heapOps);
+        }
+        pruned[r] = Bench_Now() - start;
+    }
+    TopK_Free(t);
+
+    Bench_Report("prune_exact", n, k, n, Bench_Median(exact, repeats), 0, (double)n * VEC_SIZE * sizeof(float));
+    Bench_Report("prune", n, k, n, Bench_Median(pruned, repeats), 0, 0);
+    printf("{\"bench\": \"prune_scored\", \"n\": %zu, \"k\": %zu, \"scored\": %zu}\n", n, k, scored);
+    fflush(stdout);
+
+    Bench_Clear();
+}
+
+/*
+ * The coarse scan of the vector prefixes followed by the re-rank of r candidates on
+ * the full vectors.
+ */
+static void Bench_Coarse(size_t n, size_t r, size_t repeats){
+    Bench_Fill(n, NULL);
+
+    float q[VEC_SIZE];
+    Bench_RandVec(q);
+    vec_set_data(q, q);
+    float prefix[VEC_PREFIX_DIMS];
+    vec_set_prefix(prefix, q);
+
+    TopK* candidates = TopK_Create(r);
+    TopK* t = TopK_Create(10);
+    vec_prefixes_set(true);
+
+    double samples[repeats];
+    for(size_t rep = 0 ; rep < repeats ; ++rep){
+        double start = Bench_Now();
+        for(size_t h = 0 ; h < array_len(vecList) ; ++h){
+            VecsHolder* holder = vecList[h];
+            TopK_Clear(candidates);
+            TopK_Clear(t);
+            vec_coarse_holder(holder, prefix, NULL, candidates, scores);
+            for(size_t c = 0 ; c < candidates->count ; ++c){
+                size_t i = candidates->items[c].id;
+                TopK_Push(t, cblas_sdot(VEC_SIZE, &HOLDER_VEC(holder, i), 1, q, 1), i);
+            }
+        }
+        samples[rep] = Bench_Now() - start;
+    }
+    TopK_Free(candidates);
+    TopK_Free(t);
+
+    double s = Bench_Median(samples, repeats);
+    Bench_Report("coarse", n, r, n, s, 2.0 * n * VEC_PREFIX_DIMS, (double)n * VEC_PREFIX_DIMS * sizeof(float));
+
+    vec_prefixes_set(false);
+    Bench_Clear();
+}
+
+/*
+ * The late interaction scan of multi vector documents of 32 vectors against a query
+ * of 32 vectors, in full and on the candidates of the per vector prefix pass. n is the
+ * total amount of vectors.
+ */
+static void Bench_Multi(size_t n, size_t c, size_t repeats){
+    size_t docLen = 32, nq = 32;
+    size_t nDocs = n / docLen;
+    float* data = malloc(docLen * VEC_SIZE * sizeof(float));
+    char key[32];
+    for(size_t i = 0 ; i < nDocs ; ++i){
+        for(size_t j = 0 ; j < docLen ; ++j){
+            Bench_RandVec(&data[j * VEC_SIZE]);
+        }
+        size_t len = snprintf(key, sizeof(key), "doc%zu", i);
+        vec_multi_insert(key, len, data, docLen);
+    }
+
+    float* queries = malloc(nq * VEC_SIZE * sizeof(float));
+    float* prefixes = malloc(nq * VEC_PREFIX_DIMS * sizeof(float));
+    TopK* candidates[nq];
+    for(size_t q = 0 ; q < nq ; ++q){
+        Bench_RandVec(&queries[q * VEC_SIZE]);
+        vec_set_data(&queries[q * VEC_SIZE], &queries[q * VEC_SIZE]);
+        vec_set_prefix(&prefixes[q * VEC_PREFIX_DIMS], &queries[q * VEC_SIZE]);
+        candidates[q] = TopK_Create(c);
+    }
+    TopK* t = TopK_Create(10);
+    vec_prefixes_set(true);
+
+    double exact[repeats], pruned[repeats];
+    for(size_t r = 0 ; r < repeats ; ++r){
+        double start = Bench_Now();
+        for(size_t h = 0 ; h < array_len(multiList) ; ++h){
+            TopK_Clear(t);
+            vec_maxsim_holder(multiList[h], queries, nq, NULL, -INFINITY, t, scores);
+        }
+        exact[r] = Bench_Now() - start;
+
+        start = Bench_Now();
+        for(size_t h = 0 ; h < array_len(multiList) ; ++h){
+            TopK_Clear(t);
+            vec_multi_candidates(multiList[h], prefixes, nq, candidates, mask, scores);
+            vec_maxsim_holder(multiList[h], queries, nq, mask, -INFINITY, t, scores);
+        }
+        pruned[r] = Bench_Now() - start;
+    }
+
+    Bench_Report("multi_exact", n, nq, nDocs, Bench_Median(exact, repeats), 2.0 * n * nq * VEC_SIZE, (double)n * VEC_SIZE * sizeof(float));
+    Bench_Report("multi_candidates", n, c, nDocs, Bench_Median(pruned, repeats), 0, 0);
+
+    for(size_t q = 0 ; q < nq ; ++q){
+        TopK_Free(candidates[q]);
+    }
+    TopK_Free(t);
+    free(queries);
+    free(prefixes);
+    free(data);
+    vec_prefixes_set(false);
+    while(multiList){
+        VecsHolder* last = multiList[array_len(multiList) - 1];
+        vec_delete(HOLDER_KEY(last, last->size - 1)->vDT);
+    }
+}
+
+/*
+ * The batched distance kernel, score every vector of the store against nq queries
+ * at once in tiles of rows, as the reader does on batch mode.
+ */
+static void Bench_ScanBatch(size_t n, size_t nq, size_t repeats){
+    Bench_Fill(n, NULL);
+
+    float* queries = malloc(nq * VEC_SIZE * sizeof(float));
+    for(size_t q = 0 ; q < nq ; ++q){
+        Bench_RandVec(&queries[q * VEC_SIZE]);
+        vec_set_data(&queries[q * VEC_SIZE], &queries[q * VEC_SIZE]);
+    }
+    size_t tile = 1024 < VEC_HOLDER_SIZE / nq ? 1024 : VEC_HOLDER_SIZE / nq;
+
+    double samples[repeats];
+    for(size_t r = 0 ; r < repeats ; ++r){
+        double start = Bench_Now();
+        for(size_t h = 0 ; h < array_len(vecList) ; ++h){
+            VecsHolder* holder = vecList[h];
+            for(size_t first = 0 ; first < holder->size ; first += tile){
+                size_t rows = tile < holder->size - first ? tile : holder->size - first;
+                vec_score_holder_batch(holder, first, rows, queries, nq, scores);
+            }
+        }
+        samples[r] = Bench_Now() - start;
+    }
+
+    double t = Bench_Median(samples, repeats);
+    Bench_Report("batch", n, nq, n * nq, t, 2.0 * n * nq * VEC_SIZE, (double)n * VEC_SIZE * sizeof(float));
+
+    free(queries);
+    Bench_Clear();
+}
+
+/*
+ * The top k selection out of n scores, the same bounded top k as the reader.
+ */
+static void Bench_TopK(size_t n, size_t k, size_t repeats){
+    for(size_t i = 0 ; i < n ; ++i){
+        scores[i] = Bench_Rand();
+    }
+
+    double samples[repeats];
+    for(size_t r = 0 ; r < repeats ; ++r){
+        double start = Bench_Now();
+        TopK* t = TopK_Create(k);
+        for(size_t i = 0 ; i < n ; ++i){
+            TopK_Push(t, scores[i], i);
+        }
+        TopK_Sort(t);
+        TopK_Free(t);
+        samples[r] = Bench_Now() - start;
+    }
+
+    Bench_Report("topk", n, k, n, Bench_Median(samples, repeats), 0, 0);
+}
+
+static int cmpItem(const void* a, const void* b){
+    const TopKItem* x = a;
+    const TopKItem* y = b;
+    return (x->score > y->score) - (x->score < y->score);
+}
+
+/*
+ * Merge of two sorted results lists of n items each into the best n, as done
+ * when the shards results are accumulated.
+ */
+static void Bench_Merge(size_t n, size_t repeats){
+    TopKItem* a = malloc(sizeof(*a) * n);
+    TopKItem* b = malloc(sizeof(*b) * n);
+    TopKItem* out = malloc(sizeof(*out) * n);
+    for(size_t i = 0 ; i < n ; ++i){
+        a[i] = (TopKItem){.score = Bench_Rand(), .id = i};
+        b[i] = (TopKItem){.score = Bench_Rand(), .id = n + i};
+    }
+    qsort(a, n, sizeof(*a), cmpItem);
+    qsort(b, n, sizeof(*b), cmpItem);
+
+    double samples[repeats];
+    for(size_t r = 0 ; r < repeats ; ++r){
+        double start = Bench_Now();
+        TopK_MergeSorted(a, n, b, n, n, out);
+        samples[r] = Bench_Now() - start;
+    }
+
+    Bench_Report("merge", n, n, 2 * n, Bench_Median(samples, repeats), 0, 0);
+
+    free(a);
+    free(b);
+    free(out);
+}
+
+/*
+ * Insert n vectors and then delete them in a random order (every delete moves
+ * the last vector into the freed slot).
+ */
+static void Bench_InsertDelete(size_t n, size_t repeats){
+    VecDT** vDTs = malloc(sizeof(*vDTs) * n);
+
+    double insertSamples[repeats];
+    double deleteSamples[repeats];
+    for(size_t r = 0 ; r < repeats ; ++r){
+        double start = Bench_Now();
+        Bench_Fill(n, vDTs);
+        insertSamples[r] = Bench_Now() - start;
+
+        for(size_t i = n - 1 ; i > 0 ; --i){
+            size_t j = rngState % (i + 1);
+            Bench_Rand();
+            VecDT* tmp = vDTs[i];
+            vDTs[i] = vDTs[j];
+            vDTs[j] = tmp;
+        }
+
+        start = Bench_Now();
+        for(size_t i = 0 ; i < n ; ++i){
+            vec_delete(vDTs[i]);
+        }
+        deleteSamples[r] = Bench_Now() - start;
+    }
+
+    Bench_Report("vec_insert", n, 0, n, Bench_Median(insertSamples, repeats), 0, 0);
+    Bench_Report("vec_delete", n, 0, n, Bench_Median(deleteSamples, repeats), 0, 0);
+
+    free(vDTs);
+}
+
+/*
+ * Build a disk index of n random vectors on a temporary file and search it with a few
+ * search list lengths, the nodes read per query are reported along with the latency.
+ */
+static void Bench_Disk(size_t n, size_t repeats){
+    float* vecs = malloc(n * VEC_SIZE * sizeof(float));
+    char** names = malloc(n * sizeof(*names));
+    uint32_t* nameLens = malloc(n * sizeof(*nameLens));
+    for(size_t i = 0 ; i < n ; ++i){
+        Bench_RandVec(&vecs[i * VEC_SIZE]);
+        vec_set_data(&vecs[i * VEC_SIZE], &vecs[i * VEC_SIZE]);
+        names[i] = malloc(32);
+        nameLens[i] = snprintf(names[i], 32, "key%zu", i);
+    }
+
+    char path[] = "/tmp/micro_bench_disk_XXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0){
+        fprintf(stderr, "failed creating a temporary file\n");
+        return;
+    }
+    close(fd);
+
+    const char* err = NULL;
+    double start = Bench_Now();
+    VecDisk* d = NULL;
+    if(VecDisk_Build(path, vecs, names, nameLens, n, VEC_DISK_DEFAULT_DEGREE, VEC_DISK_DEFAULT_LIST, &err) == REDISMODULE_OK){
+        Bench_Report("disk_build", n, 0, n, Bench_Now() - start, 0, 0);
+        d = VecDisk_Open(path, &err);
+    }
+    if(!d){
+        fprintf(stderr, "disk index failed: %s\n", err);
+    }
+
+    size_t queries = 100;
+    TopKItem out[10];
+    for(size_t l = 16 ; d && l <= 256 ; l *= 4){
+        double samples[repeats];
+        size_t reads = 0;
+        for(size_t r = 0 ; r < repeats ; ++r){
+            uint64_t seed = rngState;
+            start = Bench_Now();
+            reads = 0;
+            for(size_t q = 0 ; q < queries ; ++q){
+                float v[VEC_SIZE];
+                Bench_RandVec(v);
+                vec_set_data(v, v);
+                size_t qReads;
+                VecDisk_Search(d, v, 10, l, out, &qReads);
+                reads += qReads;
+            }
+            samples[r] = Bench_Now() - start;
+            rngState = seed;
+        }
+        char bench[32];
+        snprintf(bench, sizeof(bench), "disk_search_l%zu", l);
+        Bench_Report(bench, n, 10, queries, Bench_Median(samples, repeats), 0, (double)reads * 4096);
+        printf("{\"bench\": \"%s_reads\", \"n\": %zu, \"k\": 10, \"reads_per_query\": %.1f}\n", bench, n, (double)reads / queries);
+        fflush(stdout);
+    }
+
+    if(d){
+        VecDisk_Free(d);
+    }
+    unlink(path);
+    for(size_t i = 0 ; i < n ; ++i){
+        free(names[i]);
+    }
+    free(nameLens);
+    free(names);
+    free(vecs);
+}
+
+/*
+ * A random sparse vector of nnz weights, the dimensions are skewed to the low ones
+ * of a vocab of 30000 as the terms of a text are.
+ */
+static void Bench_RandSparse(uint32_t* dims, float* weights, size_t nnz){
+    for(size_t i = 0 ; i < nnz ; ++i){
+        float u = Bench_Rand();
+        dims[i] = (uint32_t)(30000 * u * u * u);
+        weights[i] = Bench_Rand() + 0.01f;
+    }
+}
+
+/*
+ * Sparse vectors searched by MaxScore over the posting lists against scoring every
+ * document on its own sparse vector.
+ */
+static void Bench_Sparse(size_t n, size_t repeats){
+    size_t docNnz = 100, queryNnz = 30, queries = 20;
+    uint32_t dims[docNnz];
+    float weights[docNnz];
+    VecSparseDoc** docs = malloc(n * sizeof(*docs));
+    char key[32];
+    for(size_t i = 0 ; i < n ; ++i){
+        Bench_RandSparse(dims, weights, docNnz);
+        size_t len = snprintf(key, sizeof(key), "doc%zu", i);
+        docs[i] = VecSparse_Insert(key, len, dims, weights, docNnz);
+    }
+
+    uint32_t* qDims = malloc(queries * queryNnz * sizeof(*qDims));
+    float* qWeights = malloc(queries * queryNnz * sizeof(*qWeights));
+    size_t qNnz[queries];
+    for(size_t q = 0 ; q < queries ; ++q){
+        Bench_RandSparse(&qDims[q * queryNnz], &qWeights[q * queryNnz], queryNnz);
+        qNnz[q] = VecSparse_Sort(&qDims[q * queryNnz], &qWeights[q * queryNnz], queryNnz);
+    }
+
+    TopK* t = TopK_Create(10);
+    double exact[repeats], maxScore[repeats];
+    size_t scored = 0;
+    for(size_t r = 0 ; r < repeats ; ++r){
+        double start = Bench_Now();
+        for(size_t q = 0 ; q < queries ; ++q){
+            const uint32_t* d = &qDims[q * queryNnz];
+            const float* w = &qWeights[q * queryNnz];
+            TopK_Clear(t);
+            for(size_t i = 0 ; i < n ; ++i){
+                float score = 0;
+                for(size_t a = 0, b = 0 ; a < qNnz[q] && b < docs[i]->nnz ;){
+                    if(d[a] == docs[i]->dims[b]){
+                        score += w[a++] * docs[i]->weights[b++];
+                    }else if(d[a] < docs[i]->dims[b]){
+                        ++a;
+                    }else{
+                        ++b;
+                    }
+                }
+                TopK_Push(t, score, i);
+            }
+        }
+        exact[r] = Bench_Now() - start;
+
+        start = Bench_Now();
+        scored = 0;
+        for(size_t q = 0 ; q < queries ; ++q){
+            TopK_Clear(t);
+            for(uint32_t lo = 0 ; lo < VecSparse_IdEnd() ; lo += VEC_SPARSE_RANGE){
+                scored += VecSparse_TopK(&qDims[q * queryNnz], &qWeights[q * queryNnz], qNnz[q], lo, lo + VEC_SPARSE_RANGE,
+                                         TopK_Threshold(t), t);
+            }
+        }
+        maxScore[r] = Bench_Now() - start;
+    }
+
+    Bench_Report("sparse_exact", n, 10, queries, Bench_Median(exact, repeats), 0, 0);
+    Bench_Report("sparse_maxscore", n, 10, queries, Bench_Median(maxScore, repeats), 0, 0);
+    printf("{\"bench\": \"sparse_maxscore_scored\", \"n\": %zu, \"k\": 10, \"scored_per_query\": %.1f, \"memory\": %zu}\n",
+           n, (double)scored / queries, VecSparse_MemUsage());
+    fflush(stdout);
+
+    TopK_Free(t);
+    free(qDims);
+    free(qWeights);
+    for(size_t i = 0 ; i < n ; ++i){
+        VecSparse_Delete(docs[i]);
+    }
+    free(docs);
+}
+
+static int Bench_Enabled(const char* filter, const char* bench){
+    return !filter || strcmp(filter, bench) == 0;
+}
+
+int main(int argc, char** argv){
+    size_t maxSize = VEC_HOLDER_SIZE;
+    size_t repeats = 5;
+    const char* filter = NULL;
+
+    int opt;
+    while((opt = getopt(argc, argv, "n:r:b:")) != -1){
+        switch(opt){
+        case 'n':
+            maxSize = strtoull(optarg, NULL, 10);
+            break;
+        case 'r':
+            repeats = strtoull(optarg, NULL, 10);
+            break;
+        case 'b':
+            filter = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n <max vectors>] [-r <repeats>] [-b scan|batch|topk|merge|insert|prune|coarse|disk|multi|sparse]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if(repeats == 0 || maxSize == 0){
+        fprintf(stderr, "repeats and max vectors must be positive\n");
+        return 1;
+    }
+
+    Bench_InitRedisModule();
+    openblas_set_num_threads(1);
+
+    for(size_t n = 10000 ; n <= maxSize ; n *= 10){
+        if(Bench_Enabled(filter, "scan")){
+            Bench_Scan(n, repeats);
+        }
+        if(Bench_Enabled(filter, "batch")){
+            for(size_t nq = 1 ; nq <= 256 ; nq *= 4){
+                Bench_ScanBatch(n, nq, repeats);
+            }
+        }
+        if(Bench_Enabled(filter, "topk")){
+            for(size_t k = 1 ; k <= n && k <= 10000 ; k *= 10){
+                Bench_TopK(n, k, repeats);
+            }
+        }
+        if(Bench_Enabled(filter, "merge")){
+            Bench_Merge(n, repeats);
+        }
+        if(Bench_Enabled(filter, "insert")){
+            Bench_InsertDelete(n, repeats);
+        }
+        if(Bench_Enabled(filter, "prune")){
+            Bench_Prune(n, 10, repeats);
+        }
+        if(Bench_Enabled(filter, "disk") && n <= 100000){
+            // the build is much slower than the searches
+            Bench_Disk(n, repeats);
+        }
+        if(Bench_Enabled(filter, "coarse")){
+            for(size_t r = 10 ; r <= 1000 ; r *= 10){
+                Bench_Coarse(n, r, repeats);
+            }
+        }
+        if(Bench_Enabled(filter, "multi")){
+            Bench_Multi(n, 64, repeats);
+        }
+        if(Bench_Enabled(filter, "sparse")){
+            Bench_Sparse(n, repeats);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,175 @@
+"""
+Recall vs throughput benchmark.
+
+Loads a data set (fvecs files such as SIFT, or synthetic clustered data) into the
+module, computes the exact ground truth with the plain brute force RG.VEC_SIM and then
+runs the queries once per configuration, reporting recall@k, QPS, p50/p99 latency and
+memory. A configuration is the raw list of extra RG.VEC_SIM arguments, for example:
+
+    python3 bench/recall.py --synthetic 100000 --queries 200 -k 10 \
+        --config "" --config "TWOPHASE" --config "TWOPHASE SAMPLE 1000"
+
+    python3 bench/recall.py --base sift_base.fvecs --query sift_query.fvecs -k 100
+
+Requires redis-py and numpy.
+"""
+
+import argparse
+import json
+import time
+import numpy as np
+import redis
+
+VEC_SIZE = 128
+
+
+def read_fvecs(path, limit=None):
+    # every vector is stored as an int32 dimension followed by dimension float32 values
+    raw = np.fromfile(path, dtype=np.int32)
+    dim = raw[0]
+    vecs = raw.reshape(-1, dim + 1)[:, 1:].copy().view(np.float32)
+    if limit:
+        vecs = vecs[:limit]
+    return fit_dim(vecs)
+
+
+def fit_dim(vecs):
+    # the module works on 128 dimensions vectors, pad or truncate other data sets
+    dim = vecs.shape[1]
+    if dim < VEC_SIZE:
+        vecs = np.hstack([vecs, np.zeros((vecs.shape[0], VEC_SIZE - dim), dtype=np.float32)])
+    elif dim > VEC_SIZE:
+        vecs = vecs[:, :VEC_SIZE]
+    return np.ascontiguousarray(vecs, dtype=np.float32)
+
+
+def synthetic(n, clusters, seed):
+    rng = np.random.default_rng(seed)
+    centers = rng.normal(size=(clusters, VEC_SIZE)).astype(np.float32)
+    labels = rng.integers(0, clusters, size=n)
+    return (centers[labels] + 0.3 * rng.normal(size=(n, VEC_SIZE))).astype(np.float32)
+
+
+def connect(args):
+    if args.cluster:
+        from redis.cluster import RedisCluster
+        return RedisCluster(host=args.host, port=args.port)
+    return redis.Redis(host=args.host, port=args.port)
+
+
+def load(conn, vecs, prefix, batch):
+    p = conn.pipeline(transaction=False)
+    for i, v in enumerate(vecs):
+        p.execute_command('RG.VEC_ADD', '%s%d' % (prefix, i), v.tobytes())
+        if (i + 1) % batch == 0:
+            p.execute()
+            p = conn.pipeline(transaction=False)
+    p.execute()
+
+
+def search(conn, k, vec, config):
+    start = time.perf_counter()
+    res = conn.execute_command('RG.VEC_SIM', k, vec.tobytes(), *config)
+    took = time.perf_counter() - start
+    if res[1]:
+        raise Exception('search failed: %s' % res[1])
+    keys = [k.decode() if isinstance(k, bytes) else k for k, _ in res[0]]
+    return keys, took
+
+
+def used_memory(conn, cluster):
+    # the module memory summed over all the shards
+    nodes = conn.get_nodes() if cluster else [None]
+    total = 0
+    for node in nodes:
+        if node is None:
+            res = conn.execute_command('RG.VEC_STATS')
+        else:
+            res = conn.execute_command('RG.VEC_STATS', target_nodes=node)
+        stats = {(res[i].decode() if isinstance(res[i], bytes) else res[i]): res[i + 1] for i in range(0, len(res), 2)}
+        total += stats['used_memory']
+    return total
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Recall vs throughput benchmark')
+    parser.add_argument('--host', default='localhost')
+    parser.add_argument('--port', type=int, default=6379)
+    parser.add_argument('--cluster', action='store_true', help='connect to an oss cluster')
+    parser.add_argument('--base', help='fvecs file of the data set vectors')
+    parser.add_argument('--query', help='fvecs file of the query vectors (default: sample of the base)')
+    parser.add_argument('--synthetic', type=int, default=0, help='generate that many clustered vectors instead of --base')
+    parser.add_argument('--clusters', type=int, default=100, help='amount of clusters of the synthetic data')
+    parser.add_argument('--limit', type=int, help='only load that many base vectors')
+    parser.add_argument('--queries', type=int, default=100, help='amount of queries to run')
+    parser.add_argument('-k', type=int, default=10)
+    parser.add_argument('--config', action='append', default=None,
+                        help='extra RG.VEC_SIM arguments, can be given multiple times (default: brute force only)')
+    parser.add_argument('--prefix', default='vec:')
+    parser.add_argument('--batch', type=int, default=1000, help='pipeline size while loading')
+    parser.add_argument('--no-load', action='store_true', help='the data set is already loaded')
+    parser.add_argument('--seed', type=int, default=0)
+    parser.add_argument('--json', action='store_true', help='print a json line per configuration')
+    args = parser.parse_args()
+
+    if args.synthetic:
+        base = synthetic(args.synthetic, args.clusters, args.seed)
+    elif args.base:
+        base = read_fvecs(args.base, args.limit)
+    else:
+        parser.error('either --base or --synthetic is required')
+
+    if args.query:
+        queries = read_fvecs(args.query, args.queries)
+    else:
+        rng = np.random.default_rng(args.seed + 1)
+        queries = base[rng.choice(len(base), size=min(args.queries, len(base)), replace=False)]
+        queries = queries + 0.05 * rng.normal(size=queries.shape).astype(np.float32)
+        queries = queries.astype(np.float32)
+
+    conn = connect(args)
+
+    if not args.no_load:
+        start = time.perf_counter()
+        load(conn, base, args.prefix, args.batch)
+        print('loaded %d vectors in %.2f seconds' % (len(base), time.perf_counter() - start))
+
+    # the exact results, using the brute force search
+    truth = [set(search(conn, args.k, q, [])[0]) for q in queries]
+
+    memory = used_memory(conn, args.cluster)
+
+    configs = args.config if args.config else ['']
+    if not args.json:
+        print('%-30s %8s %10s %10s %10s %12s' % ('config', 'recall', 'qps', 'p50 ms', 'p99 ms', 'memory MB'))
+    for config in configs:
+        params = config.split()
+        latencies = []
+        hits = 0
+        start = time.perf_counter()
+        for q, expected in zip(queries, truth):
+            keys, took = search(conn, args.k, q, params)
+            latencies.append(took)
+            hits += len(expected.intersection(keys))
+        total = time.perf_counter() - start
+
+        res = {
+            'config': config,
+            'k': args.k,
+            'vectors': len(base),
+            'queries': len(queries),
+            'recall': hits / float(sum(len(t) for t in truth) or 1),
+            'qps': len(queries) / total,
+            'p50_ms': float(np.percentile(latencies, 50)) * 1000,
+            'p99_ms': float(np.percentile(latencies, 99)) * 1000,
+            'memory_bytes': memory,
+        }
+        if args.json:
+            print(json.dumps(res))
+        else:
+            print('%-30s %8.4f %10.1f %10.3f %10.3f %12.1f' % (config or 'brute force', res['recall'], res['qps'],
+                                                             res['p50_ms'], res['p99_ms'], memory / 1024.0 / 1024.0))
+
+
+if __name__ == '__main__':
+    main()
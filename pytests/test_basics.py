@@ -1,6 +1,9 @@
 from common import DecoratorTest, decodeStr
 import numpy as np
 from scipy import spatial
+import time
+import os
+import struct
 
 @DecoratorTest
 def test_basic(env, conn):
@@ -140,3 +143,607 @@ def test_vectorWrongSize(env, conn):
 	env.skipOnCluster()
 	vec = np.random.rand(1, 129).astype(np.float32)
 	env.expect('RG.VEC_ADD', 'key', vec.tobytes()).error().contains('not float vector of size')
+
+@DecoratorTest
+def test_set(env, conn):
+	targetVector = np.random.rand(1, 128).astype(np.float32)
+	for i in range(100):
+		conn.execute_command('RG.VEC_ADD', 'key%d' % i, np.random.rand(1, 128).astype(np.float32).tobytes(), 'TAG', 'category', 'c%d' % (i % 2))
+
+	# overwrite an existing vector, its other attributes are kept
+	env.assertEqual(conn.execute_command('RG.VEC_SET', 'key7', targetVector.tobytes(), 'NUMERIC', 'price', 10), b'OK')
+	res = conn.execute_command('RG.VEC_SIM', '1', targetVector.tobytes(), 'FILTER', 'TAG', 'category', 'c1', 'FILTER', 'NUMERIC', 'price', 10, 10)
+	env.assertEqual(decodeStr(res[0][0][0]), 'key7')
+	env.assertLessEqual(1 - float(res[0][0][1]), 0.00001)
+
+	# a new key is added
+	env.assertEqual(conn.execute_command('RG.VEC_SET', 'newkey', (targetVector * 2).tobytes()), b'OK')
+	res = conn.execute_command('RG.VEC_SIM', '2', targetVector.tobytes())
+	env.assertEqual(sorted([decodeStr(k) for k, _ in res[0]]), ['key7', 'newkey'])
+
+	conn.execute_command('SET', 'strkey', 'foo')
+	try:
+		conn.execute_command('RG.VEC_SET', 'strkey', targetVector.tobytes())
+		env.assertTrue(False)
+	except Exception as e:
+		env.assertContains('WRONGTYPE', str(e))
+
+@DecoratorTest
+def test_get(env, conn):
+	vectors = {}
+	for i in range(10):
+		vectors['{v}key%d' % i] = np.random.rand(128).astype(np.float32)
+		conn.execute_command('RG.VEC_ADD', '{v}key%d' % i, vectors['{v}key%d' % i].tobytes())
+
+	# vectors are stored normalized
+	v = np.frombuffer(conn.execute_command('RG.VEC_GET', '{v}key3'), dtype=np.float32)
+	env.assertLessEqual(np.abs(v - vectors['{v}key3'] / np.linalg.norm(vectors['{v}key3'])).max(), 0.00001)
+	env.assertEqual(conn.execute_command('RG.VEC_GET', '{v}nokey'), None)
+
+	res = conn.execute_command('RG.VEC_MGET', '{v}key1', '{v}nokey', '{v}key2')
+	env.assertEqual(len(res), 3)
+	env.assertEqual(res[0], conn.execute_command('RG.VEC_GET', '{v}key1'))
+	env.assertEqual(res[1], None)
+	env.assertEqual(res[2], conn.execute_command('RG.VEC_GET', '{v}key2'))
+
+	res = conn.execute_command('RG.VEC_SIM', '3', vectors['{v}key5'].tobytes(), 'WITHVECTORS')
+	env.assertEqual(len(res[0]), 3)
+	for key, _, vec in res[0]:
+		env.assertEqual(vec, conn.execute_command('RG.VEC_GET', key))
+	env.assertEqual(decodeStr(res[0][0][0]), '{v}key5')
+
+	conn.execute_command('SET', '{v}strkey', 'foo')
+	try:
+		conn.execute_command('RG.VEC_GET', '{v}strkey')
+		env.assertTrue(False)
+	except Exception as e:
+		env.assertContains('WRONGTYPE', str(e))
+	env.assertEqual(conn.execute_command('RG.VEC_MGET', '{v}strkey'), [None])
+
+@DecoratorTest
+def test_twoPhase(env, conn):
+	targetVector = np.random.rand(1, 128).astype(np.float32)
+	vectors = []
+	for i in range(10000):
+		vectors.append(('key%d' % i, np.random.rand(1, 128).astype(np.float32)))
+
+	# setting the data into redis
+	for v in vectors:
+		conn.execute_command('RG.VEC_ADD', v[0], v[1].tobytes())
+
+	# calculating dist
+	dists = [(1 - spatial.distance.cosine(targetVector[0], v[0]), k) for k, v in vectors]
+	dists = sorted(dists)
+
+	keys = sorted([k for _, k in dists[-20:]])
+
+	redisKeys = conn.execute_command('RG.VEC_SIM', '20', targetVector.tobytes(), 'TWOPHASE', 'SAMPLE', '100')
+
+	redisKeys = sorted([decodeStr(k) for k, _ in redisKeys[0]])
+
+	env.assertEqual(keys, redisKeys)
+
+	# a sample of all the vectors is the full scan, its results are replied as is
+	redisKeys = conn.execute_command('RG.VEC_SIM', '20', targetVector.tobytes(), 'TWOPHASE', 'SAMPLE', '100000')
+	env.assertEqual(keys, sorted([decodeStr(k) for k, _ in redisKeys[0]]))
+
+	# the sample threshold is exact, it does not mix with the approximate searches
+	env.expect('RG.VEC_SIM', '20', targetVector.tobytes(), 'TWOPHASE', 'NPROBE', '1').error().contains('TWOPHASE can not be used')
+	env.expect('RG.VEC_SIM', '20', targetVector.tobytes(), 'TWOPHASE', 'COARSE', '100').error().contains('TWOPHASE can not be used')
+
+@DecoratorTest
+def test_filter(env, conn):
+	targetVector = np.random.rand(1, 128).astype(np.float32)
+	vectors = []
+	for i in range(1000):
+		vectors.append(('key%d' % i, np.random.rand(1, 128).astype(np.float32), 'c%d' % (i % 10), i))
+
+	# setting the data into redis
+	for k, v, category, price in vectors:
+		conn.execute_command('RG.VEC_ADD', k, v.tobytes(), 'TAG', 'category', category, 'NUMERIC', 'price', price)
+
+	# calculating dist only on the vectors that pass the filter
+	dists = [(1 - spatial.distance.cosine(targetVector[0], v[0]), k) for k, v, category, price in vectors if category == 'c3' and price < 500]
+	dists = sorted(dists)
+
+	keys = sorted([k for _, k in dists[-4:]])
+
+	redisKeys = conn.execute_command('RG.VEC_SIM', '4', targetVector.tobytes(), 'FILTER', 'TAG', 'category', 'c3', 'FILTER', 'NUMERIC', 'price', '-inf', '499')
+
+	redisKeys = sorted([decodeStr(k) for k, _ in redisKeys[0]])
+
+	env.assertEqual(keys, redisKeys)
+
+	# unknown tag value matches nothing
+	res = conn.execute_command('RG.VEC_SIM', '4', targetVector.tobytes(), 'FILTER', 'TAG', 'category', 'nosuchcategory')
+	env.assertEqual(len(res[0]), 0)
+
+	# numeric attributes keep integers above 2^24 exact
+	conn.execute_command('RG.VEC_ADD', 'big1', targetVector.tobytes(), 'NUMERIC', 'big', 16777216)
+	conn.execute_command('RG.VEC_ADD', 'big2', targetVector.tobytes(), 'NUMERIC', 'big', 16777217)
+	res = conn.execute_command('RG.VEC_SIM', '4', targetVector.tobytes(), 'FILTER', 'NUMERIC', 'big', '16777217', '16777217')
+	env.assertEqual([decodeStr(k) for k, _ in res[0]], ['big2'])
+
+	# a rejected add does not register its attribute fields
+	conn.execute_command('SET', 'notvec', 'foo')
+	env.expect('RG.VEC_ADD', 'notvec', targetVector.tobytes(), 'TAG', 'newfield', 'a').error()
+	conn.execute_command('RG.VEC_ADD', 'newkey', targetVector.tobytes(), 'NUMERIC', 'newfield', 1)
+
+@DecoratorTest
+def test_range(env, conn):
+	targetVector = np.random.rand(1, 128).astype(np.float32)
+	vectors = []
+	for i in range(1000):
+		vectors.append(('key%d' % i, np.random.rand(1, 128).astype(np.float32)))
+
+	for k, v in vectors:
+		conn.execute_command('RG.VEC_ADD', k, v.tobytes())
+
+	dists = sorted([(1 - spatial.distance.cosine(targetVector[0], v[0]), k) for k, v in vectors])
+
+	# pick a threshold in the middle of two scores so float rounding will not matter
+	threshold = (dists[-50][0] + dists[-51][0]) / 2
+	keys = sorted([k for _, k in dists[-50:]])
+
+	res = conn.execute_command('RG.VEC_RANGE', str(threshold), targetVector.tobytes())
+	env.assertEqual(len(res[1]), 0)
+	env.assertEqual(keys, sorted([decodeStr(k) for k, _ in res[0]]))
+
+	res = conn.execute_command('RG.VEC_RANGE', str(threshold), targetVector.tobytes(), 'LIMIT', '10')
+	env.assertEqual(len(res[0]), 10)
+	for k, _ in res[0]:
+		env.assertContains(decodeStr(k), keys)
+
+	res = conn.execute_command('RG.VEC_RANGE', '1.1', targetVector.tobytes())
+	env.assertEqual(len(res[0]), 0)
+
+@DecoratorTest
+def test_stats(env, conn):
+	# stats are per shard, query and check a single shard
+	shardConn = env.getConnection()
+	env.assertEqual(shardConn.execute_command('RG.VEC_STATS', 'RESET'), b'OK')
+
+	for i in range(100):
+		conn.execute_command('RG.VEC_ADD', 'key%d' % i, np.random.rand(1, 128).astype(np.float32).tobytes())
+	for i in range(10):
+		shardConn.execute_command('RG.VEC_SIM', '4', np.random.rand(1, 128).astype(np.float32).tobytes())
+
+	res = shardConn.execute_command('RG.VEC_STATS')
+	stats = {decodeStr(res[i]): res[i + 1] for i in range(0, len(res), 2)}
+	env.assertEqual(stats['queries'], 10)
+	env.assertGreater(stats['inserts'], 0)
+	for stage in ['lock_wait', 'scan', 'topk', 'collect', 'reply', 'total']:
+		count, mean, p50, p90, p99, p999, maxVal = stats[stage]
+		env.assertGreater(count, 0)
+		env.assertLessEqual(p50, p99)
+		env.assertLessEqual(p99, maxVal)
+
+	mem = [stats[f] for f in ['used_memory_vectors', 'used_memory_metadata', 'used_memory_index', 'used_memory_slack']]
+	env.assertEqual(stats['used_memory'], sum(mem))
+	env.assertGreaterEqual(stats['used_memory_vectors'], 128 * 4)
+
+	# each key is charged its slot, not a share of the mostly empty holder
+	env.assertGreater(conn.execute_command('MEMORY', 'USAGE', 'key0'), 128 * 4)
+	env.assertLess(conn.execute_command('MEMORY', 'USAGE', 'key0'), 4096)
+
+	env.expect('RG.VEC_STATS', 'FOO').error().contains('Unknown argument')
+
+@DecoratorTest
+def test_profile(env, conn):
+	targetVector = np.random.rand(1, 128).astype(np.float32)
+	for i in range(1000):
+		conn.execute_command('RG.VEC_ADD', 'key%d' % i, np.random.rand(1, 128).astype(np.float32).tobytes())
+
+	expected = conn.execute_command('RG.VEC_SIM', '4', targetVector.tobytes())
+	res = conn.execute_command('RG.VEC_SIM', '4', targetVector.tobytes(), 'PROFILE')
+	env.assertEqual(len(res), 3)
+	env.assertEqual(sorted([k for k, _ in expected[0]]), sorted([k for k, _ in res[0]]))
+
+	profile = {decodeStr(res[2][i]): res[2][i + 1] for i in range(0, len(res[2]), 2)}
+	env.assertGreaterEqual(profile['total_usec'], profile['collect_usec'])
+	shards = [{decodeStr(s[i]): s[i + 1] for i in range(0, len(s), 2)} for s in profile['shards']]
+	env.assertEqual(len(shards), env.shardsCount)
+	env.assertEqual(sum([s['vectors_scored'] for s in shards]), 1000)
+	for s in shards:
+		env.assertLessEqual(s['candidates'], s['vectors_scored'])
+
+@DecoratorTest
+def test_slowlog(env, conn):
+	# the slowlog is kept by the shard that got the query
+	shardConn = env.getConnection()
+	env.assertEqual(shardConn.execute_command('RG.VEC_CONFIG', 'SET', 'slowlog-log-slower-than', '0'), b'OK')
+	env.assertEqual(shardConn.execute_command('RG.VEC_SLOWLOG', 'RESET'), b'OK')
+
+	for i in range(100):
+		conn.execute_command('RG.VEC_ADD', 'key%d' % i, np.random.rand(1, 128).astype(np.float32).tobytes())
+	for i in range(5):
+		shardConn.execute_command('RG.VEC_SIM', '4', np.random.rand(1, 128).astype(np.float32).tobytes(), 'FILTER', 'TAG', 'category', 'c%d' % i)
+
+	env.assertEqual(shardConn.execute_command('RG.VEC_SLOWLOG', 'LEN'), 5)
+	entries = shardConn.execute_command('RG.VEC_SLOWLOG', 'GET', '2')
+	env.assertEqual(len(entries), 2)
+	# newest first, the vector blob is not kept
+	env.assertEqual(decodeStr(entries[0][3]), 'RG.VEC_SIM 4 <blob> FILTER TAG category c4')
+	env.assertGreater(entries[0][0], entries[1][0])
+
+	env.assertEqual(shardConn.execute_command('RG.VEC_CONFIG', 'SET', 'slowlog-max-len', '3'), b'OK')
+	shardConn.execute_command('RG.VEC_SIM', '4', np.random.rand(1, 128).astype(np.float32).tobytes())
+	env.assertEqual(shardConn.execute_command('RG.VEC_SLOWLOG', 'LEN'), 3)
+
+	env.assertEqual(shardConn.execute_command('RG.VEC_CONFIG', 'SET', 'slowlog-log-slower-than', '10000'), b'OK')
+	env.assertEqual(shardConn.execute_command('RG.VEC_CONFIG', 'SET', 'slowlog-max-len', '128'), b'OK')
+	env.assertEqual(shardConn.execute_command('RG.VEC_CONFIG', 'GET', 'slowlog-max-len'), [b'slowlog-max-len', 128])
+	env.expect('RG.VEC_CONFIG', 'SET', 'slowlog-max-len', '-5').error().contains('out of range')
+	env.expect('RG.VEC_CONFIG', 'GET', 'nosuchparam').error().contains('Unknown config')
+
+@DecoratorTest
+def test_batch(env, conn):
+	for i in range(1000):
+		conn.execute_command('RG.VEC_ADD', 'key%d' % i, np.random.rand(1, 128).astype(np.float32).tobytes())
+	queries = [np.random.rand(1, 128).astype(np.float32).tobytes() for i in range(10)]
+	expected = [conn.execute_command('RG.VEC_SIM', str(i + 1), q) for i, q in enumerate(queries)]
+
+	# the batching is done by the shard that got the queries, pipeline them so they
+	# are batched together: two full batches and one that is sent by the timer
+	shardConn = env.getConnection()
+	env.assertEqual(shardConn.execute_command('RG.VEC_CONFIG', 'SET', 'batch-window-ms', '10'), b'OK')
+	env.assertEqual(shardConn.execute_command('RG.VEC_CONFIG', 'SET', 'batch-max-size', '4'), b'OK')
+	p = shardConn.pipeline(transaction=False)
+	for i, q in enumerate(queries):
+		p.execute_command('RG.VEC_SIM', str(i + 1), q)
+	res = p.execute()
+	env.assertEqual(shardConn.execute_command('RG.VEC_CONFIG', 'SET', 'batch-window-ms', '0'), b'OK')
+	env.assertEqual(shardConn.execute_command('RG.VEC_CONFIG', 'SET', 'batch-max-size', '32'), b'OK')
+
+	for r, e in zip(res, expected):
+		env.assertEqual([decodeStr(k) for k, _ in r[0]], [decodeStr(k) for k, _ in e[0]])
+		env.assertEqual(r[1], [])
+
+@DecoratorTest
+def test_cache(env, conn):
+	# the cache is kept by the shard that got the query, on cluster it is only used with a ttl
+	shardConn = env.getConnection()
+	env.assertEqual(shardConn.execute_command('RG.VEC_CONFIG', 'SET', 'cache-max-memory', '1000000'), b'OK')
+	if env.shardsCount > 1:
+		env.assertEqual(shardConn.execute_command('RG.VEC_CONFIG', 'SET', 'cache-ttl-ms', '100000'), b'OK')
+	env.assertEqual(shardConn.execute_command('RG.VEC_STATS', 'RESET'), b'OK')
+
+	for i in range(100):
+		conn.execute_command('RG.VEC_ADD', 'key%d' % i, np.random.rand(1, 128).astype(np.float32).tobytes())
+	targetVector = np.random.rand(1, 128).astype(np.float32)
+	res1 = shardConn.execute_command('RG.VEC_SIM', '5', targetVector.tobytes())
+	res2 = shardConn.execute_command('RG.VEC_SIM', '5', targetVector.tobytes())
+	env.assertEqual(res1, res2)
+	# the same vector scaled is the same query
+	shardConn.execute_command('RG.VEC_SIM', '5', (targetVector * 3).tobytes())
+	# other arguments are another query
+	shardConn.execute_command('RG.VEC_SIM', '6', targetVector.tobytes())
+
+	res = shardConn.execute_command('RG.VEC_STATS')
+	stats = {decodeStr(res[i]): res[i + 1] for i in range(0, len(res), 2)}
+	env.assertEqual(stats['cache_hits'], 2)
+	env.assertEqual(stats['cache_misses'], 2)
+	env.assertEqual(stats['cache_entries'], 2)
+	env.assertGreater(stats['cache_used_memory'], 0)
+
+	if env.shardsCount == 1:
+		# a write invalidates the cached results
+		conn.execute_command('RG.VEC_ADD', 'target', targetVector.tobytes())
+		res = shardConn.execute_command('RG.VEC_SIM', '5', targetVector.tobytes())
+		env.assertEqual(decodeStr(res[0][-1][0]), 'target')
+		res = shardConn.execute_command('RG.VEC_STATS')
+		stats = {decodeStr(res[i]): res[i + 1] for i in range(0, len(res), 2)}
+		env.assertEqual(stats['cache_invalidations'], 1)
+
+	env.assertEqual(shardConn.execute_command('RG.VEC_CONFIG', 'SET', 'cache-max-memory', '0'), b'OK')
+	env.assertEqual(shardConn.execute_command('RG.VEC_CONFIG', 'SET', 'cache-ttl-ms', '0'), b'OK')
+
+@DecoratorTest
+def test_ivf(env, conn):
+	env.broadcast('RG.VEC_CONFIG', 'SET', 'ivf-lists', '4')
+	for i in range(1000):
+		conn.execute_command('RG.VEC_ADD', 'key%d' % i, np.random.rand(1, 128).astype(np.float32).tobytes())
+
+	# the vectors are indexed by a background worker
+	shardConn = env.getConnection()
+	for _ in range(100):
+		res = shardConn.execute_command('RG.VEC_STATS')
+		stats = {decodeStr(res[i]): res[i + 1] for i in range(0, len(res), 2)}
+		if stats['ivf_lists'] == 4 and stats['ivf_unindexed'] == 0:
+			break
+		time.sleep(0.1)
+	env.assertEqual(stats['ivf_lists'], 4)
+	env.assertEqual(stats['ivf_unindexed'], 0)
+
+	# probing all the lists is an exact search
+	targetVector = np.random.rand(1, 128).astype(np.float32)
+	expected = conn.execute_command('RG.VEC_SIM', '10', targetVector.tobytes())
+	res = conn.execute_command('RG.VEC_SIM', '10', targetVector.tobytes(), 'NPROBE', '4')
+	env.assertEqual([decodeStr(k) for k, _ in res[0]], [decodeStr(k) for k, _ in expected[0]])
+	res = conn.execute_command('RG.VEC_SIM', '10', targetVector.tobytes(), 'NPROBE', '1')
+	env.assertEqual(len(res[0]), 10)
+
+	# a new vector is searched before it is indexed
+	conn.execute_command('RG.VEC_ADD', 'target', targetVector.tobytes())
+	res = conn.execute_command('RG.VEC_SIM', '1', targetVector.tobytes(), 'NPROBE', '1')
+	env.assertEqual(decodeStr(res[0][0][0]), 'target')
+
+	env.expect('RG.VEC_SIM', '1', targetVector.tobytes(), 'NPROBE', '0').error().contains('Failed extracting <nprobe>')
+	env.broadcast('RG.VEC_CONFIG', 'SET', 'ivf-lists', '0')
+
+@DecoratorTest
+def test_scanPrune(env, conn):
+	# the energy of the vectors decays along the dimensions so most of them are pruned
+	decay = np.exp(-np.arange(128) / 16.0).astype(np.float32)
+	for i in range(1000):
+		conn.execute_command('RG.VEC_ADD', 'key%d' % i, ((np.random.rand(1, 128) - 0.5) * decay).astype(np.float32).tobytes())
+
+	targetVector = ((np.random.rand(1, 128) - 0.5) * decay).astype(np.float32)
+	expected = conn.execute_command('RG.VEC_SIM', '10', targetVector.tobytes())
+	env.broadcast('RG.VEC_CONFIG', 'SET', 'scan-prune', '1')
+	res = conn.execute_command('RG.VEC_SIM', '10', targetVector.tobytes())
+	env.broadcast('RG.VEC_CONFIG', 'SET', 'scan-prune', '0')
+	env.assertEqual([decodeStr(k) for k, _ in res[0]], [decodeStr(k) for k, _ in expected[0]])
+
+@DecoratorTest
+def test_coarse(env, conn):
+	env.expect('RG.VEC_SIM', '1', np.random.rand(1, 128).astype(np.float32).tobytes(), 'COARSE', '10').error().contains('coarse-prefixes')
+	env.broadcast('RG.VEC_CONFIG', 'SET', 'coarse-prefixes', '1')
+	for i in range(1000):
+		conn.execute_command('RG.VEC_ADD', 'key%d' % i, np.random.rand(1, 128).astype(np.float32).tobytes())
+
+	# re-ranking all the vectors is an exact search
+	targetVector = np.random.rand(1, 128).astype(np.float32)
+	expected = conn.execute_command('RG.VEC_SIM', '10', targetVector.tobytes())
+	res = conn.execute_command('RG.VEC_SIM', '10', targetVector.tobytes(), 'COARSE', '1000')
+	env.assertEqual([decodeStr(k) for k, _ in res[0]], [decodeStr(k) for k, _ in expected[0]])
+
+	# the prefixes follow writes made after they were created
+	conn.execute_command('RG.VEC_ADD', 'target', targetVector.tobytes())
+	res = conn.execute_command('RG.VEC_SIM', '1', targetVector.tobytes(), 'COARSE', '10')
+	env.assertEqual(decodeStr(res[0][0][0]), 'target')
+
+	env.expect('RG.VEC_SIM', '1', targetVector.tobytes(), 'COARSE', '0').error().contains('Failed extracting <r>')
+	env.broadcast('RG.VEC_CONFIG', 'SET', 'coarse-prefixes', '0')
+
+@DecoratorTest
+def test_hashIndex(env, conn):
+	env.broadcast('RG.VEC_HASH_INDEX', 'doc:', 'embedding')
+
+	targetVector = np.random.rand(1, 128).astype(np.float32)
+	vectors = []
+	for i in range(1000):
+		vectors.append(('doc:%d' % i, np.random.rand(1, 128).astype(np.float32)))
+
+	for k, v in vectors:
+		conn.execute_command('HSET', k, 'embedding', v.tobytes(), 'title', k)
+
+	# keys that do not match the prefix are not indexed
+	conn.execute_command('HSET', 'other:1', 'embedding', targetVector.tobytes())
+
+	# delete some of the keys and remove the vector field from others
+	for k, _ in vectors[:100]:
+		conn.execute_command('DEL', k)
+	for k, _ in vectors[100:200]:
+		conn.execute_command('HDEL', k, 'embedding')
+	vectors = vectors[200:]
+
+	dists = [(1 - spatial.distance.cosine(targetVector[0], v[0]), k) for k, v in vectors]
+	dists = sorted(dists)
+
+	keys = sorted([k for _, k in dists[-10:]])
+
+	redisKeys = conn.execute_command('RG.VEC_SIM', '10', targetVector.tobytes())
+
+	redisKeys = sorted([decodeStr(k) for k, _ in redisKeys[0]])
+
+	env.assertEqual(keys, redisKeys)
+
+	# updating the hash field updates the indexed vector
+	conn.execute_command('HSET', vectors[0][0], 'embedding', targetVector.tobytes())
+	res = conn.execute_command('RG.VEC_SIM', '1', targetVector.tobytes())[0]
+	env.assertEqual(decodeStr(res[0][0]), vectors[0][0])
+
+	# changing another field keeps the indexed vector as is
+	shardConn = env.getConnection()
+	def inserts():
+		res = shardConn.execute_command('RG.VEC_STATS')
+		return {decodeStr(res[i]): res[i + 1] for i in range(0, len(res), 2)}['inserts']
+	before = inserts()
+	for k, _ in vectors:
+		conn.execute_command('HSET', k, 'title', 'changed')
+	env.assertEqual(inserts(), before)
+
+@DecoratorTest
+def test_streamIngestion(env, conn):
+	env.assertEqual(conn.execute_command('RG.VEC_STREAM_REGISTER', 'vecstream:', 'BATCH', '10', 'DURATION', '50'), b'OK')
+
+	vectors = [('doc:%d' % i, np.random.rand(1, 128).astype(np.float32)) for i in range(100)]
+	for k, v in vectors:
+		conn.execute_command('XADD', 'vecstream:1', '*', 'key', k, 'vec', v.tobytes())
+	# a bad entry is skipped
+	conn.execute_command('XADD', 'vecstream:1', '*', 'key', 'bad', 'vec', 'not a vector')
+
+	for _ in range(100):
+		res = conn.execute_command('RG.VEC_SIM', '200', vectors[0][1].tobytes())
+		if len(res[0]) == len(vectors) and conn.execute_command('XLEN', 'vecstream:1') == 0:
+			break
+		time.sleep(0.1)
+	env.assertEqual(sorted([decodeStr(k) for k, _ in res[0]]), sorted([k for k, _ in vectors]))
+	env.assertEqual(decodeStr(res[0][-1][0]), vectors[0][0])
+	# the consumed entries are trimmed
+	env.assertEqual(conn.execute_command('XLEN', 'vecstream:1'), 0)
+
+	for r in conn.execute_command('RG.DUMPREGISTRATIONS'):
+		conn.execute_command('RG.UNREGISTER', r[1])
+
+@DecoratorTest
+def test_diskIndex(env, conn):
+	# every shard needs its own file
+	env.skipOnCluster()
+	path = '/tmp/vecsim_test_%d.disk' % int(time.time() * 1000)
+	vectors = [('key%d' % i, np.random.rand(1, 128).astype(np.float32)) for i in range(1000)]
+	for k, v in vectors:
+		conn.execute_command('RG.VEC_ADD', k, v.tobytes())
+
+	env.expect('RG.VEC_SIM', '1', vectors[0][1].tobytes(), 'DISK', '0').error().contains('Failed extracting <l>')
+	env.expect('RG.VEC_SIM', '1', vectors[0][1].tobytes(), 'DISK', '10', 'COARSE', '10').error().contains('DISK can not be used')
+	env.expect('RG.VEC_DISK', 'LOAD', path).error().contains('Failed opening the disk index file')
+
+	env.assertEqual(conn.execute_command('RG.VEC_DISK', 'BUILD', path, 'DEGREE', '16'), b'OK')
+	for _ in range(100):
+		res = conn.execute_command('RG.VEC_STATS')
+		stats = {decodeStr(res[i]): res[i + 1] for i in range(0, len(res), 2)}
+		if stats['disk_building'] == 0:
+			break
+		time.sleep(0.1)
+	env.assertEqual(stats['disk_vectors'], len(vectors))
+
+	# a search list as long as the data reads every node
+	res = conn.execute_command('RG.VEC_SIM', '10', vectors[0][1].tobytes(), 'DISK', '1000')
+	expected = conn.execute_command('RG.VEC_SIM', '10', vectors[0][1].tobytes())
+	env.assertEqual([decodeStr(k) for k, _ in res[0]], [decodeStr(k) for k, _ in expected[0]])
+
+	# the index is searched without the vectors
+	conn.execute_command('FLUSHALL')
+	env.assertEqual(conn.execute_command('RG.VEC_DISK', 'LOAD', path), b'OK')
+	res = conn.execute_command('RG.VEC_SIM', '1', vectors[0][1].tobytes(), 'DISK', '64')
+	env.assertEqual(decodeStr(res[0][0][0]), vectors[0][0])
+
+	# a header whose nodes do not fit in a sector (degree, node size and nodes per sector) is rejected
+	with open(path, 'rb') as f:
+		data = bytearray(f.read())
+	struct.pack_into('<III', data, 16, 1000, 128 * 4 + 4 + 1000 * 4, 0)
+	badPath = path + '.bad'
+	with open(badPath, 'wb') as f:
+		f.write(data)
+	env.expect('RG.VEC_DISK', 'LOAD', badPath).error().contains('Not a disk index file')
+	os.remove(badPath)
+	os.remove(path)
+
+@DecoratorTest
+def test_multiVector(env, conn):
+	def normalize(m):
+		return m / np.linalg.norm(m, axis=1, keepdims=True)
+
+	docs = [('doc%d' % i, np.random.rand(np.random.randint(1, 20), 128).astype(np.float32)) for i in range(300)]
+	for k, m in docs:
+		conn.execute_command('RG.VEC_MULTI_ADD', k, m.tobytes())
+	# single vectors are not searched by MaxSim
+	conn.execute_command('RG.VEC_ADD', 'single', docs[0][1][0].tobytes())
+
+	env.expect('RG.VEC_MULTI_ADD', 'doc0', docs[0][1].tobytes()).error().contains('Key is not empty')
+	env.expect('RG.VEC_MULTI_ADD', 'bad', b'abc').error().contains('float vectors of size 128')
+	env.assertEqual(len(conn.execute_command('RG.VEC_GET', 'doc1')), docs[1][1].nbytes)
+
+	# deleted documents leave their slots dead until the holder is compacted
+	for k, _ in docs[:200:2]:
+		conn.execute_command('DEL', k)
+	docs = docs[1:200:2] + docs[200:]
+
+	query = np.random.rand(8, 128).astype(np.float32)
+	scored = sorted([(float(np.sum(np.max(normalize(query) @ normalize(m).T, axis=1))), k) for k, m in docs], reverse=True)
+
+	res = conn.execute_command('RG.VEC_MULTI_SIM', '10', query.tobytes())
+	env.assertEqual([decodeStr(k) for k, _ in res[0]], [k for _, k in scored[:10]])
+	env.assertLess(abs(float(res[0][0][1]) - scored[0][0]), 1e-3)
+
+	# with every vector a candidate the results are exact
+	env.broadcast('RG.VEC_CONFIG', 'SET', 'coarse-prefixes', '1')
+	res = conn.execute_command('RG.VEC_MULTI_SIM', '10', query.tobytes(), 'CANDIDATES', '10000')
+	env.assertEqual([decodeStr(k) for k, _ in res[0]], [k for _, k in scored[:10]])
+	env.broadcast('RG.VEC_CONFIG', 'SET', 'coarse-prefixes', '0')
+
+	env.expect('RG.VEC_MULTI_SIM', '10', query.tobytes(), 'CANDIDATES', '0').error().contains('Failed extracting <c>')
+	env.expect('RG.VEC_MULTI_SIM', '10', b'abc').error().contains('not at the right size')
+
+@DecoratorTest
+def test_metrics(env, conn):
+	vectors = [('key%d' % i, (np.random.rand(128) * 4 - 2).astype(np.float32)) for i in range(1000)]
+	query = (np.random.rand(128) * 4 - 2).astype(np.float32)
+
+	env.broadcast('RG.VEC_CONFIG', 'SET', 'metric', 'IP')
+	env.assertEqual(env.getConnection().execute_command('RG.VEC_CONFIG', 'GET', 'metric'), [b'metric', b'IP'])
+	for k, v in vectors:
+		conn.execute_command('RG.VEC_ADD', k, v.tobytes())
+	conn.execute_command('RG.VEC_ADD', 'zero', np.zeros(128, dtype=np.float32).tobytes())
+	env.expect('RG.VEC_CONFIG', 'SET', 'metric', 'L2').error().contains('no vectors')
+
+	# the vectors are kept as is
+	env.assertEqual(conn.execute_command('RG.VEC_GET', 'key0'), vectors[0][1].tobytes())
+	scored = sorted([(float(np.dot(v, query)), k) for k, v in vectors], reverse=True)
+	res = conn.execute_command('RG.VEC_SIM', '10', query.tobytes())
+	env.assertEqual([decodeStr(k) for k, _ in res[0]], [k for _, k in scored[:10]])
+	env.assertLess(abs(float(res[0][0][1]) - scored[0][0]), 1e-2)
+
+	conn.execute_command('FLUSHALL')
+	env.broadcast('RG.VEC_CONFIG', 'SET', 'metric', 'L2')
+	for k, v in vectors:
+		conn.execute_command('RG.VEC_ADD', k, v.tobytes())
+
+	# the closest vectors come first with their distance as score
+	scored = sorted([(float(np.linalg.norm(v - query)), k) for k, v in vectors])
+	res = conn.execute_command('RG.VEC_SIM', '10', query.tobytes())
+	env.assertEqual([decodeStr(k) for k, _ in res[0]], [k for _, k in scored[:10]])
+	env.assertLess(abs(float(res[0][0][1]) - scored[0][0]), 1e-2)
+
+	res = conn.execute_command('RG.VEC_RANGE', str(scored[4][0] + 1e-3), query.tobytes())
+	env.assertEqual(sorted([decodeStr(k) for k, _ in res[0]]), sorted([k for _, k in scored[:5]]))
+
+	env.expect('RG.VEC_MULTI_ADD', 'doc', query.tobytes()).error().contains('not supported on the L2 metric')
+	env.expect('RG.VEC_CONFIG', 'SET', 'metric', 'HAMMING').error().contains('Unknown metric')
+
+	conn.execute_command('FLUSHALL')
+	env.broadcast('RG.VEC_CONFIG', 'SET', 'metric', 'COSINE')
+
+@DecoratorTest
+def test_sparse(env, conn):
+	def randSparse(nnz):
+		dims = np.random.choice(5000, nnz, replace=False).astype(np.uint32)
+		return dims, np.random.rand(nnz).astype(np.float32)
+
+	def dot(a, b):
+		wa = dict(zip(a[0].tolist(), a[1].tolist()))
+		return sum(wa.get(d, 0.0) * w for d, w in zip(b[0].tolist(), b[1].tolist()))
+
+	docs = [('sparse%d' % i, randSparse(np.random.randint(20, 200))) for i in range(2000)]
+	for k, (dims, weights) in docs:
+		conn.execute_command('RG.VEC_SPARSE_ADD', k, dims.tobytes(), weights.tobytes())
+
+	env.expect('RG.VEC_SPARSE_ADD', 'sparse0', docs[0][1][0].tobytes(), docs[0][1][1].tobytes()).error().contains('Key is not empty')
+	env.expect('RG.VEC_SPARSE_ADD', 'bad', docs[0][1][0].tobytes(), b'abc').error().contains('same amount')
+	env.expect('RG.VEC_SPARSE_ADD', 'bad', np.array([1 << 20], dtype=np.uint32).tobytes(), np.ones(1, dtype=np.float32).tobytes()).error().contains('out of range')
+	dims, weights = conn.execute_command('RG.VEC_GET', 'sparse1')
+	order = np.argsort(docs[1][1][0])
+	env.assertEqual(dims, docs[1][1][0][order].tobytes())
+	env.assertEqual(weights, docs[1][1][1][order].tobytes())
+
+	# deleted documents leave their postings behind
+	for k, _ in docs[:1000:3]:
+		conn.execute_command('DEL', k)
+	docs = [d for i, d in enumerate(docs) if i >= 1000 or i % 3 != 0]
+
+	query = randSparse(40)
+	scored = sorted([(dot(query, v), k) for k, v in docs], reverse=True)
+	res = conn.execute_command('RG.VEC_SPARSE_SIM', '10', query[0].tobytes(), query[1].tobytes())
+	env.assertEqual([decodeStr(k) for k, _ in res[0]], [k for _, k in scored[:10]])
+	env.assertLess(abs(float(res[0][0][1]) - scored[0][0]), 1e-3)
+
+	# the dense and the sparse vectors are ranked together
+	vectors = [('key%d' % i, np.random.rand(128).astype(np.float32)) for i in range(500)]
+	for k, v in vectors:
+		conn.execute_command('RG.VEC_ADD', k, v.tobytes())
+	target = np.random.rand(128).astype(np.float32)
+	# scaled so both kinds are on the top 20
+	scale = np.float32(1 - spatial.distance.cosine(target, vectors[0][1])) / np.float32(scored[5][0])
+	hybrid = [(s * scale, k) for s, k in scored] + [(1 - spatial.distance.cosine(target, v), k) for k, v in vectors]
+	hybrid = sorted(hybrid, reverse=True)
+	res = conn.execute_command('RG.VEC_SIM', '20', target.tobytes(), 'SPARSE', query[0].tobytes(), (query[1] * scale).tobytes())
+	env.assertEqual(set([decodeStr(k) for k, _ in res[0]]), set([k for _, k in hybrid[:20]]))
+
+	env.expect('RG.VEC_SIM', '20', target.tobytes(), 'SPARSE', query[0].tobytes(), query[1].tobytes(), 'TWOPHASE').error().contains('SPARSE can not be used')
+	env.expect('RG.VEC_SPARSE_SIM', '10', query[0].tobytes(), np.zeros(40, dtype=np.float32).tobytes()).error().contains('non zero weight')
+
+	conn.execute_command('FLUSHALL')
+	res = conn.execute_command('RG.VEC_SPARSE_SIM', '10', query[0].tobytes(), query[1].tobytes())
+	env.assertEqual(len(res[0]), 0)
@@ -0,0 +1,60 @@
+#include "topk.h"
+#include "redisgears_memory.h"
+
+#define TOPK_INITIAL_CAP 64
+
+TopK* TopK_Create(size_t k){
+    TopK* t = RG_ALLOC(sizeof(*t));
+    t->k = k;
+    t->count = 0;
+    t->cap = k < TOPK_INITIAL_CAP ? k : TOPK_INITIAL_CAP;
+    t->items = t->cap ? RG_ALLOC(sizeof(*t->items) * t->cap) : NULL;
+    return t;
+}
+
+void TopK_Free(TopK* t){
+    if(t->items){
+        RG_FREE(t->items);
+    }
+    RG_FREE(t);
+}
+
+void TopK_Clear(TopK* t){
+    t->count = 0;
+}
+
+void TopK_Grow(TopK* t){
+    t->cap = t->cap * 2 < t->k ? t->cap * 2 : t->k;
+    t->items = RG_REALLOC(t->items, sizeof(*t->items) * t->cap);
+}
+
+size_t TopK_Sort(TopK* t){
+    // heap sort, every step moves the current worst item to the end so we get a
+    // descending array and reverse it.
+    for(size_t n = t->count ; n > 1 ; --n){
+        TopKItem worst = t->items[0];
+        t->items[0] = t->items[n - 1];
+        t->items[n - 1] = worst;
+        TopK_SiftDown(t->items, n - 1, 0);
+    }
+    for(size_t i = 0, j = t->count ; i + 1 < j ; ++i, --j){
+        TopKItem tmp = t->items[i];
+        t->items[i] = t->items[j - 1];
+        t->items[j - 1] = tmp;
+    }
+    return t->count;
+}
+
+size_t TopK_MergeSorted(const TopKItem* a, size_t na, const TopKItem* b, size_t nb, size_t k, TopKItem* out){
+    size_t n = na + nb < k ? na + nb : k;
+
+    // the best items are at the end of the inputs, fill out from its end
+    for(size_t i = n ; i > 0 ; --i){
+        if(nb == 0 || (na > 0 && a[na - 1].score >= b[nb - 1].score)){
+            out[i - 1] = a[--na];
+        }else{
+            out[i - 1] = b[--nb];
+        }
+    }
+    return n;
+}
@@ -0,0 +1,107 @@
+/*
+ * topk.h
+ *
+ * Bounded top k selection over (score, id) pairs. The items are kept inline in a
+ * min heap so the worst kept score is always at items[0] and the push path can be
+ * inlined into the scan loops. Sorted item arrays can be merged in bulk.
+ */
+
+#ifndef SRC_TOPK_H_
+#define SRC_TOPK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <math.h>
+
+typedef struct TopKItem{
+    float score;
+    uint32_t id;
+}TopKItem;
+
+typedef struct TopK{
+    size_t k;
+    size_t count;
+    size_t cap; // grows up to k, k might be much larger than the amount of results
+    TopKItem* items;
+}TopK;
+
+TopK* TopK_Create(size_t k);
+void TopK_Free(TopK* t);
+void TopK_Clear(TopK* t);
+
+void TopK_Grow(TopK* t);
+
+/*
+ * Sort the items ascending by score, the heap order is lost so the TopK must be
+ * cleared before it is pushed to again. Returns the amount of items.
+ */
+size_t TopK_Sort(TopK* t);
+
+/*
+ * Merge a and b, both sorted ascending by score, into out keeping only the best k.
+ * out is sorted ascending and should have room for MIN(na + nb, k) items, it can
+ * not be any of the inputs. Returns the amount of items written to out.
+ */
+size_t TopK_MergeSorted(const TopKItem* a, size_t na, const TopKItem* b, size_t nb, size_t k, TopKItem* out);
+
+static inline bool TopK_Full(const TopK* t){
+    return t->count >= t->k;
+}
+
+/*
+ * The score an item has to beat to get in, -INFINITY while the TopK is not full.
+ */
+static inline float TopK_Threshold(const TopK* t){
+    return TopK_Full(t) && t->k > 0 ? t->items[0].score : -INFINITY;
+}
+
+static inline void TopK_SiftDown(TopKItem* items, size_t count, size_t i){
+    TopKItem item = items[i];
+    while(true){
+        size_t child = 2 * i + 1;
+        if(child >= count){
+            break;
+        }
+        if(child + 1 < count && items[child + 1].score < items[child].score){
+            ++child;
+        }
+        if(items[child].score >= item.score){
+            break;
+        }
+        items[i] = items[child];
+        i = child;
+    }
+    items[i] = item;
+}
+
+/*
+ * Offer an item, returns true if it was kept.
+ */
+static inline bool TopK_Push(TopK* t, float score, uint32_t id){
+    if(t->count < t->k){
+        if(t->count == t->cap){
+            TopK_Grow(t);
+        }
+        size_t i = t->count++;
+        while(i > 0){
+            size_t parent = (i - 1) / 2;
+            if(t->items[parent].score <= score){
+                break;
+            }
+            t->items[i] = t->items[parent];
+            i = parent;
+        }
+        t->items[i] = (TopKItem){.score = score, .id = id};
+        return true;
+    }
+
+    if(t->k == 0 || score <= t->items[0].score){
+        return false;
+    }
+    t->items[0] = (TopKItem){.score = score, .id = id};
+    TopK_SiftDown(t->items, t->count, 0);
+    return true;
+}
+
+#endif /* SRC_TOPK_H_ */
@@ -0,0 +1,567 @@
+#include "vec_attrs.h"
+#include "arr_rm_alloc.h"
+#include <math.h>
+
+typedef struct VecAttrField{
+    char* name;
+    int type;
+    char** values; // tag values by id
+    RedisModuleDict* valuesDict; // tag value -> id + 1
+}VecAttrField;
+
+/*
+ * The slots of a holder that have a tag value. Few slots are kept as a sorted array,
+ * once the array would be larger than a bitmap of the holder the set becomes a bitmap
+ * and it goes back to an array when it shrinks to half of that. The set is freed once
+ * it is empty.
+ */
+typedef struct VecTagSet{
+    size_t count;
+    uint32_t* slots; // sorted, NULL on a bitmap set
+    uint64_t* bitmap;
+}VecTagSet;
+
+typedef struct VecAttrsColumn{
+    // numeric column, NAN marks a missing value
+    double* nums;
+    double* blockMin;
+    double* blockMax;
+
+    // tag column, value id + 1 per slot (0 marks a missing value) and a set per value id
+    uint32_t* tags;
+    VecTagSet** sets;
+}VecAttrsColumn;
+
+struct VecAttrs{
+    size_t capacity;
+    VecAttrsColumn* columns; // indexed by field id
+};
+
+static VecAttrField* fields = NULL;
+
+#define MASK_WORDS(size) (((size) + 63) / 64)
+
+// the amount of slots above which a tag set is a bitmap
+#define TAG_SET_DENSE(capacity) (MASK_WORDS(capacity) * sizeof(uint64_t) / sizeof(uint32_t))
+
+static int VecAttrs_GetFieldLen(const char* name, size_t len, int type, bool create){
+    for(size_t i = 0 ; i < array_len(fields) ; ++i){
+        if(strlen(fields[i].name) == len && memcmp(fields[i].name, name, len) == 0){
+            return fields[i].type == type ? i : -1;
+        }
+    }
+
+    if(!create){
+        return -1;
+    }
+
+    if(!fields){
+        fields = array_new(VecAttrField, 10);
+    }
+
+    VecAttrField f = {
+        .name = RG_ALLOC(len + 1),
+        .type = type,
+        .values = NULL,
+        .valuesDict = NULL,
+    };
+    memcpy(f.name, name, len);
+    f.name[len] = '\0';
+    if(type == VEC_ATTR_TAG){
+        f.values = array_new(char*, 10);
+        f.valuesDict = RedisModule_CreateDict(NULL);
+    }
+    fields = array_append(fields, f);
+
+    return array_len(fields) - 1;
+}
+
+int VecAttrs_GetField(const char* name, int type, bool create){
+    return VecAttrs_GetFieldLen(name, strlen(name), type, create);
+}
+
+int VecAttrs_FieldType(const char* name){
+    for(size_t i = 0 ; i < array_len(fields) ; ++i){
+        if(strcmp(fields[i].name, name) == 0){
+            return fields[i].type;
+        }
+    }
+    return 0;
+}
+
+static size_t VecTagSet_MemUsage(VecTagSet* set, size_t capacity){
+    if(set->slots){
+        return sizeof(*set) + array_sizeof(array_hdr(set->slots));
+    }
+    return sizeof(*set) + MASK_WORDS(capacity) * sizeof(uint64_t);
+}
+
+static void VecTagSet_Free(VecTagSet* set){
+    if(set->slots){
+        array_free(set->slots);
+    }
+    if(set->bitmap){
+        RG_FREE(set->bitmap);
+    }
+    RG_FREE(set);
+}
+
+/*
+ * The position of slot on the sorted slots array, or where it should be inserted.
+ */
+static size_t VecTagSet_Find(VecTagSet* set, uint32_t slot){
+    size_t lo = 0, hi = set->count;
+    while(lo < hi){
+        size_t mid = (lo + hi) / 2;
+        if(set->slots[mid] < slot){
+            lo = mid + 1;
+        }else{
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void VecTagSet_Add(VecTagSet* set, size_t capacity, uint32_t slot){
+    if(set->bitmap){
+        set->bitmap[slot / 64] |= (1ULL << (slot % 64));
+        ++set->count;
+        return;
+    }
+
+    if(set->count + 1 > TAG_SET_DENSE(capacity)){
+        set->bitmap = RG_CALLOC(MASK_WORDS(capacity), sizeof(uint64_t));
+        for(size_t i = 0 ; i < set->count ; ++i){
+            set->bitmap[set->slots[i] / 64] |= (1ULL << (set->slots[i] % 64));
+        }
+        array_free(set->slots);
+        set->slots = NULL;
+        set->bitmap[slot / 64] |= (1ULL << (slot % 64));
+        ++set->count;
+        return;
+    }
+
+    // slots are mostly added at the end of the holder
+    size_t pos = VecTagSet_Find(set, slot);
+    set->slots = array_append(set->slots, slot);
+    memmove(&set->slots[pos + 1], &set->slots[pos], (set->count - pos) * sizeof(uint32_t));
+    set->slots[pos] = slot;
+    ++set->count;
+}
+
+static void VecTagSet_Remove(VecTagSet* set, size_t capacity, uint32_t slot){
+    if(set->slots){
+        size_t pos = VecTagSet_Find(set, slot);
+        memmove(&set->slots[pos], &set->slots[pos + 1], (set->count - pos - 1) * sizeof(uint32_t));
+        array_pop(set->slots);
+        --set->count;
+        // give back the capacity once the set shrank to a quarter of it, trimming leaves no spare room
+        if(set->count > 0 && set->count < array_hdr(set->slots)->cap / 4){
+            set->slots = array_trimm_cap(set->slots, set->count);
+        }
+        return;
+    }
+
+    set->bitmap[slot / 64] &= ~(1ULL << (slot % 64));
+    --set->count;
+    if(set->count < TAG_SET_DENSE(capacity) / 2){
+        set->slots = array_new(uint32_t, MAX(set->count * 2, 8));
+        for(size_t w = 0 ; w < MASK_WORDS(capacity) ; ++w){
+            uint64_t bits = set->bitmap[w];
+            while(bits){
+                int bit = __builtin_ctzll(bits);
+                bits &= bits - 1;
+                set->slots = array_append(set->slots, w * 64 + bit);
+            }
+        }
+        RG_FREE(set->bitmap);
+        set->bitmap = NULL;
+    }
+}
+
+/*
+ * mask &= set, on the first words slots.
+ */
+static void VecTagSet_And(VecTagSet* set, uint64_t* mask, size_t words){
+    if(set->bitmap){
+        for(size_t w = 0 ; w < words ; ++w){
+            mask[w] &= set->bitmap[w];
+        }
+        return;
+    }
+    size_t i = 0;
+    for(size_t w = 0 ; w < words ; ++w){
+        uint64_t bits = 0;
+        while(i < set->count && set->slots[i] / 64 == w){
+            bits |= 1ULL << (set->slots[i++] % 64);
+        }
+        mask[w] &= bits;
+    }
+}
+
+/*
+ * Return the tag value id + 1, or 0 if the value does not exists (and create is false).
+ */
+static uint32_t VecAttrs_GetTagId(VecAttrField* f, const char* val, size_t len, bool create){
+    int nokey;
+    void* id = RedisModule_DictGetC(f->valuesDict, (void*)val, len, &nokey);
+    if(!nokey){
+        return (uint32_t)(uintptr_t)id;
+    }
+
+    if(!create){
+        return 0;
+    }
+
+    char* v = RG_ALLOC(len + 1);
+    memcpy(v, val, len);
+    v[len] = '\0';
+    f->values = array_append(f->values, v);
+    uint32_t newId = array_len(f->values);
+    RedisModule_DictSetC(f->valuesDict, (void*)val, len, (void*)(uintptr_t)newId);
+
+    return newId;
+}
+
+VecAttrs* VecAttrs_Create(size_t capacity){
+    VecAttrs* attrs = RG_ALLOC(sizeof(*attrs));
+    attrs->capacity = capacity;
+    attrs->columns = array_new(VecAttrsColumn, 1);
+    return attrs;
+}
+
+void VecAttrs_Free(VecAttrs* attrs){
+    for(size_t i = 0 ; i < array_len(attrs->columns) ; ++i){
+        VecAttrsColumn* col = &attrs->columns[i];
+        if(col->nums){
+            RG_FREE(col->nums);
+            RG_FREE(col->blockMin);
+            RG_FREE(col->blockMax);
+        }
+        if(col->tags){
+            RG_FREE(col->tags);
+            for(size_t j = 0 ; j < array_len(col->sets) ; ++j){
+                if(col->sets[j]){
+                    VecTagSet_Free(col->sets[j]);
+                }
+            }
+            array_free(col->sets);
+        }
+    }
+    array_free(attrs->columns);
+    RG_FREE(attrs);
+}
+
+size_t VecAttrs_MemUsage(VecAttrs* attrs){
+    size_t blocks = (attrs->capacity + VEC_ATTRS_BLOCK_SIZE - 1) / VEC_ATTRS_BLOCK_SIZE;
+    size_t res = sizeof(*attrs) + array_len(attrs->columns) * sizeof(VecAttrsColumn);
+    for(size_t i = 0 ; i < array_len(attrs->columns) ; ++i){
+        VecAttrsColumn* col = &attrs->columns[i];
+        if(col->nums){
+            res += attrs->capacity * sizeof(double) + 2 * blocks * sizeof(double);
+        }
+        if(col->tags){
+            res += attrs->capacity * sizeof(uint32_t) + array_len(col->sets) * sizeof(VecTagSet*);
+            for(size_t j = 0 ; j < array_len(col->sets) ; ++j){
+                if(col->sets[j]){
+                    res += VecTagSet_MemUsage(col->sets[j], attrs->capacity);
+                }
+            }
+        }
+    }
+    return res;
+}
+
+static VecAttrsColumn* VecAttrs_GetColumn(VecAttrs* attrs, int field){
+    while(array_len(attrs->columns) <= field){
+        VecAttrsColumn col = {0};
+        attrs->columns = array_append(attrs->columns, col);
+    }
+    VecAttrsColumn* col = &attrs->columns[field];
+
+    if(fields[field].type == VEC_ATTR_NUMERIC && !col->nums){
+        size_t blocks = (attrs->capacity + VEC_ATTRS_BLOCK_SIZE - 1) / VEC_ATTRS_BLOCK_SIZE;
+        col->nums = RG_ALLOC(attrs->capacity * sizeof(double));
+        col->blockMin = RG_ALLOC(blocks * sizeof(double));
+        col->blockMax = RG_ALLOC(blocks * sizeof(double));
+        for(size_t i = 0 ; i < attrs->capacity ; ++i){
+            col->nums[i] = NAN;
+        }
+        for(size_t i = 0 ; i < blocks ; ++i){
+            col->blockMin[i] = INFINITY;
+            col->blockMax[i] = -INFINITY;
+        }
+    }
+
+    if(fields[field].type == VEC_ATTR_TAG && !col->tags){
+        col->tags = RG_CALLOC(attrs->capacity, sizeof(uint32_t));
+        col->sets = array_new(VecTagSet*, 10);
+    }
+
+    return col;
+}
+
+static void VecAttrs_SetTagId(VecAttrs* attrs, size_t slot, int field, uint32_t id){
+    VecAttrsColumn* col = VecAttrs_GetColumn(attrs, field);
+
+    uint32_t old = col->tags[slot];
+    if(old == id){
+        return;
+    }
+    if(old){
+        VecTagSet* set = col->sets[old - 1];
+        VecTagSet_Remove(set, attrs->capacity, slot);
+        if(set->count == 0){
+            VecTagSet_Free(set);
+            col->sets[old - 1] = NULL;
+        }
+    }
+
+    col->tags[slot] = id;
+    if(!id){
+        return;
+    }
+
+    while(array_len(col->sets) < id){
+        col->sets = array_append(col->sets, NULL);
+    }
+    if(!col->sets[id - 1]){
+        VecTagSet* set = RG_ALLOC(sizeof(*set));
+        set->count = 0;
+        set->slots = array_new(uint32_t, 8);
+        set->bitmap = NULL;
+        col->sets[id - 1] = set;
+    }
+    VecTagSet_Add(col->sets[id - 1], attrs->capacity, slot);
+}
+
+void VecAttrs_SetTag(VecAttrs* attrs, size_t slot, int field, const char* val, size_t len){
+    uint32_t id = VecAttrs_GetTagId(&fields[field], val, len, true);
+    VecAttrs_SetTagId(attrs, slot, field, id);
+}
+
+void VecAttrs_SetNumeric(VecAttrs* attrs, size_t slot, int field, double val){
+    VecAttrsColumn* col = VecAttrs_GetColumn(attrs, field);
+    col->nums[slot] = val;
+    if(isnan(val)){
+        return;
+    }
+
+    // the zone map is only widened, so it might be loose after deletes but it is never wrong
+    size_t block = slot / VEC_ATTRS_BLOCK_SIZE;
+    if(val < col->blockMin[block]){
+        col->blockMin[block] = val;
+    }
+    if(val > col->blockMax[block]){
+        col->blockMax[block] = val;
+    }
+}
+
+void VecAttrs_Clear(VecAttrs* attrs, size_t slot){
+    for(size_t i = 0 ; i < array_len(attrs->columns) ; ++i){
+        VecAttrsColumn* col = &attrs->columns[i];
+        if(col->nums){
+            col->nums[slot] = NAN;
+        }
+        if(col->tags && col->tags[slot]){
+            VecAttrs_SetTagId(attrs, slot, i, 0);
+        }
+    }
+}
+
+void VecAttrs_Move(VecAttrs* from, size_t fromSlot, VecAttrs* to, size_t toSlot){
+    if(from == to && fromSlot == toSlot){
+        return;
+    }
+    VecAttrs_Clear(to, toSlot);
+    for(size_t i = 0 ; i < array_len(from->columns) ; ++i){
+        VecAttrsColumn* col = &from->columns[i];
+        if(col->nums && !isnan(col->nums[fromSlot])){
+            VecAttrs_SetNumeric(to, toSlot, i, col->nums[fromSlot]);
+        }
+        if(col->tags && col->tags[fromSlot]){
+            VecAttrs_SetTagId(to, toSlot, i, col->tags[fromSlot]);
+        }
+    }
+    VecAttrs_Clear(from, fromSlot);
+}
+
+void VecAttrs_RdbSave(RedisModuleIO *rdb, VecAttrs* attrs, size_t slot){
+    size_t n = 0;
+    for(size_t i = 0 ; attrs && i < array_len(attrs->columns) ; ++i){
+        VecAttrsColumn* col = &attrs->columns[i];
+        if((col->nums && !isnan(col->nums[slot])) || (col->tags && col->tags[slot])){
+            ++n;
+        }
+    }
+
+    RedisModule_SaveUnsigned(rdb, n);
+
+    for(size_t i = 0 ; attrs && i < array_len(attrs->columns) ; ++i){
+        VecAttrsColumn* col = &attrs->columns[i];
+        if(col->nums && !isnan(col->nums[slot])){
+            RedisModule_SaveStringBuffer(rdb, fields[i].name, strlen(fields[i].name));
+            RedisModule_SaveUnsigned(rdb, VEC_ATTR_NUMERIC);
+            RedisModule_SaveDouble(rdb, col->nums[slot]);
+        }
+        if(col->tags && col->tags[slot]){
+            const char* val = fields[i].values[col->tags[slot] - 1];
+            RedisModule_SaveStringBuffer(rdb, fields[i].name, strlen(fields[i].name));
+            RedisModule_SaveUnsigned(rdb, VEC_ATTR_TAG);
+            RedisModule_SaveStringBuffer(rdb, val, strlen(val));
+        }
+    }
+}
+
+void VecAttrs_RdbLoad(RedisModuleIO *rdb, VecAttrs** attrs, size_t capacity, size_t slot, bool floats){
+    size_t n = RedisModule_LoadUnsigned(rdb);
+    for(size_t i = 0 ; i < n ; ++i){
+        size_t nameLen;
+        char* name = RedisModule_LoadStringBuffer(rdb, &nameLen);
+        int type = RedisModule_LoadUnsigned(rdb);
+        int field = VecAttrs_GetFieldLen(name, nameLen, type, true);
+        RedisModule_Free(name);
+
+        if(!*attrs){
+            *attrs = VecAttrs_Create(capacity);
+        }
+
+        if(type == VEC_ATTR_NUMERIC){
+            double val = floats ? RedisModule_LoadFloat(rdb) : RedisModule_LoadDouble(rdb);
+            if(field >= 0){
+                VecAttrs_SetNumeric(*attrs, slot, field, val);
+            }
+        }else{
+            size_t valLen;
+            char* val = RedisModule_LoadStringBuffer(rdb, &valLen);
+            if(field >= 0){
+                VecAttrs_SetTag(*attrs, slot, field, val, valLen);
+            }
+            RedisModule_Free(val);
+        }
+    }
+}
+
+VecFilter* VecFilter_Create(){
+    VecFilter* filter = RG_ALLOC(sizeof(*filter));
+    filter->clauses = array_new(VecFilterClause, 2);
+    return filter;
+}
+
+VecFilter* VecFilter_Dup(VecFilter* filter){
+    VecFilter* dup = VecFilter_Create();
+    for(size_t i = 0 ; i < array_len(filter->clauses) ; ++i){
+        VecFilterClause* c = &filter->clauses[i];
+        if(c->type == VEC_ATTR_TAG){
+            VecFilter_AddTag(dup, c->fieldName, c->tag);
+        }else{
+            VecFilter_AddNumeric(dup, c->fieldName, c->min, c->max);
+        }
+    }
+    return dup;
+}
+
+void VecFilter_Free(VecFilter* filter){
+    for(size_t i = 0 ; i < array_len(filter->clauses) ; ++i){
+        VecFilterClause* c = &filter->clauses[i];
+        RG_FREE(c->fieldName);
+        if(c->tag){
+            RG_FREE(c->tag);
+        }
+    }
+    array_free(filter->clauses);
+    RG_FREE(filter);
+}
+
+void VecFilter_AddTag(VecFilter* filter, const char* field, const char* tag){
+    VecFilterClause c = {
+        .type = VEC_ATTR_TAG,
+        .fieldName = RG_STRDUP(field),
+        .tag = RG_STRDUP(tag),
+        .field = -1,
+        .tagId = 0,
+    };
+    filter->clauses = array_append(filter->clauses, c);
+}
+
+void VecFilter_AddNumeric(VecFilter* filter, const char* field, double min, double max){
+    VecFilterClause c = {
+        .type = VEC_ATTR_NUMERIC,
+        .fieldName = RG_STRDUP(field),
+        .tag = NULL,
+        .min = min,
+        .max = max,
+        .field = -1,
+        .tagId = 0,
+    };
+    filter->clauses = array_append(filter->clauses, c);
+}
+
+void VecFilter_Resolve(VecFilter* filter){
+    for(size_t i = 0 ; i < array_len(filter->clauses) ; ++i){
+        VecFilterClause* c = &filter->clauses[i];
+        c->field = VecAttrs_GetField(c->fieldName, c->type, false);
+        if(c->type == VEC_ATTR_TAG && c->field >= 0){
+            c->tagId = VecAttrs_GetTagId(&fields[c->field], c->tag, strlen(c->tag), false);
+        }
+    }
+}
+
+size_t VecFilter_Eval(VecFilter* filter, VecAttrs* attrs, size_t size, uint64_t* mask){
+    size_t words = MASK_WORDS(size);
+    memset(mask, 0xff, words * sizeof(uint64_t));
+    if(size % 64){
+        mask[words - 1] = (1ULL << (size % 64)) - 1;
+    }
+
+    for(size_t i = 0 ; i < array_len(filter->clauses) ; ++i){
+        VecFilterClause* c = &filter->clauses[i];
+        VecAttrsColumn* col = NULL;
+        if(attrs && c->field >= 0 && c->field < array_len(attrs->columns)){
+            col = &attrs->columns[c->field];
+        }
+
+        if(c->type == VEC_ATTR_TAG){
+            VecTagSet* set = NULL;
+            if(col && col->tags && c->tagId && c->tagId <= array_len(col->sets)){
+                set = col->sets[c->tagId - 1];
+            }
+            if(!set){
+                memset(mask, 0, words * sizeof(uint64_t));
+                return 0;
+            }
+            VecTagSet_And(set, mask, words);
+        }else{
+            if(!col || !col->nums){
+                memset(mask, 0, words * sizeof(uint64_t));
+                return 0;
+            }
+            for(size_t b = 0 ; b * VEC_ATTRS_BLOCK_SIZE < size ; ++b){
+                size_t startWord = b * VEC_ATTRS_BLOCK_SIZE / 64;
+                size_t endWord = MIN(words, (b + 1) * VEC_ATTRS_BLOCK_SIZE / 64);
+                if(col->blockMax[b] < c->min || col->blockMin[b] > c->max){
+                    // the entire block is out of range
+                    memset(&mask[startWord], 0, (endWord - startWord) * sizeof(uint64_t));
+                    continue;
+                }
+                for(size_t w = startWord ; w < endWord ; ++w){
+                    uint64_t bits = mask[w];
+                    while(bits){
+                        int bit = __builtin_ctzll(bits);
+                        bits &= bits - 1;
+                        double v = col->nums[w * 64 + bit];
+                        if(!(v >= c->min && v <= c->max)){
+                            mask[w] &= ~(1ULL << bit);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    size_t count = 0;
+    for(size_t w = 0 ; w < words ; ++w){
+        count += __builtin_popcountll(mask[w]);
+    }
+    return count;
+}
@@ -0,0 +1,93 @@
+/*
+ * vec_attrs.h
+ *
+ * Tag and numeric attributes stored next to the vectors. Each holder owns a
+ * VecAttrs with one column per attribute field, tag columns are also indexed
+ * with a set of slots per value (a sorted array or a bitmap, whichever is smaller)
+ * and numeric columns (doubles) with a min/max zone map per block.
+ */
+
+#ifndef SRC_VEC_ATTRS_H_
+#define SRC_VEC_ATTRS_H_
+
+#include "redismodule.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define VEC_ATTR_TAG 1
+#define VEC_ATTR_NUMERIC 2
+
+#define VEC_ATTRS_BLOCK_SIZE 4096
+
+typedef struct VecAttrs VecAttrs;
+
+typedef struct VecFilterClause{
+    int type;
+    char* fieldName;
+    char* tag;
+    double min;
+    double max;
+
+    // resolved against the local fields registry by VecFilter_Resolve
+    int field;
+    uint32_t tagId;
+}VecFilterClause;
+
+typedef struct VecFilter{
+    VecFilterClause* clauses;
+}VecFilter;
+
+/*
+ * Return the id of the given field, -1 if it does not exists (and create is false)
+ * or if it exists with another type.
+ */
+int VecAttrs_GetField(const char* name, int type, bool create);
+
+/*
+ * The type of the given field, 0 if it does not exists.
+ */
+int VecAttrs_FieldType(const char* name);
+
+VecAttrs* VecAttrs_Create(size_t capacity);
+void VecAttrs_Free(VecAttrs* attrs);
+void VecAttrs_SetTag(VecAttrs* attrs, size_t slot, int field, const char* val, size_t len);
+void VecAttrs_SetNumeric(VecAttrs* attrs, size_t slot, int field, double val);
+void VecAttrs_Clear(VecAttrs* attrs, size_t slot);
+
+/*
+ * Move all the attributes of fromSlot to toSlot, fromSlot is left empty.
+ */
+void VecAttrs_Move(VecAttrs* from, size_t fromSlot, VecAttrs* to, size_t toSlot);
+
+/*
+ * Bytes allocated by the attributes columns and their indexes.
+ */
+size_t VecAttrs_MemUsage(VecAttrs* attrs);
+
+void VecAttrs_RdbSave(RedisModuleIO *rdb, VecAttrs* attrs, size_t slot);
+
+/*
+ * Load the attributes of a single slot, attrs is created if needed. floats is set
+ * for rdbs that saved the numeric values as floats.
+ */
+void VecAttrs_RdbLoad(RedisModuleIO *rdb, VecAttrs** attrs, size_t capacity, size_t slot, bool floats);
+
+VecFilter* VecFilter_Create();
+VecFilter* VecFilter_Dup(VecFilter* filter);
+void VecFilter_Free(VecFilter* filter);
+void VecFilter_AddTag(VecFilter* filter, const char* field, const char* tag);
+void VecFilter_AddNumeric(VecFilter* filter, const char* field, double min, double max);
+
+/*
+ * Resolve the fields and tag values names to local ids, should be called under the lock.
+ */
+void VecFilter_Resolve(VecFilter* filter);
+
+/*
+ * Set on mask the bits of all the slots (out of size) that pass the filter,
+ * returns the amount of slots that passed.
+ */
+size_t VecFilter_Eval(VecFilter* filter, VecAttrs* attrs, size_t size, uint64_t* mask);
+
+#endif /* SRC_VEC_ATTRS_H_ */
@@ -0,0 +1,277 @@
+#include "vec_cache.h"
+#include "vec_config.h"
+#include "vec_stats.h"
+#include "vec_store.h"
+#include "redisgears_memory.h"
+#include <math.h>
+#include <pthread.h>
+
+#define VEC_CACHE_INITIAL_BUCKETS 64
+
+/*
+ * On the COSINE metric the vector components are rounded to 16 bits on the key, so
+ * queries that only differ by floating point noise (after normalizing) share an entry.
+ * The raw vectors of the other metrics are not bounded, their components are kept as is.
+ */
+#define VEC_CACHE_QUANT_SCALE 32767
+
+typedef struct VecCacheEntry{
+    struct VecCacheEntry* chain; // the next entry on the same bucket
+    struct VecCacheEntry* moreRecent;
+    struct VecCacheEntry* lessRecent;
+    uint64_t hash;
+    uint64_t generation;
+    uint64_t created;
+    size_t size;
+    size_t keyLen;
+    size_t count;
+    char data[]; // the key followed by the results, each is a float score, an uint32_t length and the name
+}VecCacheEntry;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static VecCacheEntry** buckets = NULL;
+static size_t nBuckets = 0;
+static VecCacheEntry* head = NULL; // the most recently used
+static VecCacheEntry* tail = NULL; // the least recently used, evicted first
+static VecCacheStats stats;
+
+static uint64_t VecCache_Hash(const char* data, size_t len){
+    // FNV-1a
+    uint64_t h = 14695981039346656037ULL;
+    for(size_t i = 0 ; i < len ; ++i){
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+char* VecCache_Key(const float* vec, const char* params, size_t* len){
+    size_t paramsLen = strlen(params);
+    size_t vecLen = VEC_SIZE * (vecMetric == VEC_METRIC_COSINE ? sizeof(int16_t) : sizeof(float));
+    *len = vecLen + paramsLen;
+    char* key = RG_ALLOC(*len);
+    if(vecMetric == VEC_METRIC_COSINE){
+        int16_t* quantized = (int16_t*)key;
+        for(size_t i = 0 ; i < VEC_SIZE ; ++i){
+            quantized[i] = (int16_t)lrintf(vec[i] * VEC_CACHE_QUANT_SCALE);
+        }
+    }else{
+        memcpy(key, vec, vecLen);
+    }
+    memcpy(key + vecLen, params, paramsLen);
+    return key;
+}
+
+static void VecCache_Unlink(VecCacheEntry* e){
+    if(e->moreRecent){
+        e->moreRecent->lessRecent = e->lessRecent;
+    }else{
+        head = e->lessRecent;
+    }
+    if(e->lessRecent){
+        e->lessRecent->moreRecent = e->moreRecent;
+    }else{
+        tail = e->moreRecent;
+    }
+}
+
+static void VecCache_PushFront(VecCacheEntry* e){
+    e->moreRecent = NULL;
+    e->lessRecent = head;
+    if(head){
+        head->moreRecent = e;
+    }
+    head = e;
+    if(!tail){
+        tail = e;
+    }
+}
+
+/*
+ * Find the entry of the key, prev is set to the entry before it on the bucket chain.
+ */
+static VecCacheEntry* VecCache_Find(const char* key, size_t len, uint64_t hash, VecCacheEntry** prev){
+    *prev = NULL;
+    if(!buckets){
+        return NULL;
+    }
+    for(VecCacheEntry* e = buckets[hash & (nBuckets - 1)] ; e ; e = e->chain){
+        if(e->hash == hash && e->keyLen == len && memcmp(e->data, key, len) == 0){
+            return e;
+        }
+        *prev = e;
+    }
+    return NULL;
+}
+
+static void VecCache_Remove(VecCacheEntry* e, VecCacheEntry* prev){
+    if(prev){
+        prev->chain = e->chain;
+    }else{
+        buckets[e->hash & (nBuckets - 1)] = e->chain;
+    }
+    VecCache_Unlink(e);
+    stats.memory -= e->size;
+    --stats.entries;
+    RG_FREE(e);
+}
+
+/*
+ * Remove the entry when we do not know its place on the bucket chain.
+ */
+static void VecCache_Evict(VecCacheEntry* e){
+    VecCacheEntry* prev = NULL;
+    for(VecCacheEntry* curr = buckets[e->hash & (nBuckets - 1)] ; curr != e ; curr = curr->chain){
+        prev = curr;
+    }
+    VecCache_Remove(e, prev);
+}
+
+static void VecCache_Grow(){
+    size_t n = nBuckets ? nBuckets * 2 : VEC_CACHE_INITIAL_BUCKETS;
+    VecCacheEntry** newBuckets = RG_CALLOC(n, sizeof(*newBuckets));
+    for(size_t i = 0 ; i < nBuckets ; ++i){
+        VecCacheEntry* e = buckets[i];
+        while(e){
+            VecCacheEntry* next = e->chain;
+            e->chain = newBuckets[e->hash & (n - 1)];
+            newBuckets[e->hash & (n - 1)] = e;
+            e = next;
+        }
+    }
+    if(buckets){
+        RG_FREE(buckets);
+    }
+    buckets = newBuckets;
+    nBuckets = n;
+}
+
+static bool VecCache_Valid(VecCacheEntry* e){
+    long long ttl = VecConfig_Get(VEC_CONFIG_CACHE_TTL_MS);
+    if(ttl > 0){
+        return VecStats_Now() - e->created < (uint64_t)ttl * 1000;
+    }
+    return e->generation == vec_generation();
+}
+
+bool VecCache_Reply(RedisModuleCtx* ctx, const char* key, size_t len){
+    uint64_t hash = VecCache_Hash(key, len);
+
+    pthread_mutex_lock(&lock);
+    VecCacheEntry* prev;
+    VecCacheEntry* e = VecCache_Find(key, len, hash, &prev);
+    if(e && !VecCache_Valid(e)){
+        VecCache_Remove(e, prev);
+        ++stats.invalidations;
+        e = NULL;
+    }
+    if(!e){
+        ++stats.misses;
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+    ++stats.hits;
+    VecCache_Unlink(e);
+    VecCache_PushFront(e);
+
+    RedisModule_ReplyWithArray(ctx, 2);
+    RedisModule_ReplyWithArray(ctx, e->count);
+    const char* curr = e->data + e->keyLen;
+    for(size_t i = 0 ; i < e->count ; ++i){
+        float score;
+        uint32_t nameLen;
+        memcpy(&score, curr, sizeof(score));
+        memcpy(&nameLen, curr + sizeof(score), sizeof(nameLen));
+        curr += sizeof(score) + sizeof(nameLen);
+        RedisModule_ReplyWithArray(ctx, 2);
+        RedisModule_ReplyWithStringBuffer(ctx, curr, nameLen);
+        RedisModule_ReplyWithDouble(ctx, vec_reply_score(score));
+        curr += nameLen;
+    }
+    RedisModule_ReplyWithArray(ctx, 0);
+    pthread_mutex_unlock(&lock);
+
+    return true;
+}
+
+void VecCache_Add(const char* key, size_t len, uint64_t generation, const VecCacheResult* results, size_t count){
+    long long maxMemory = VecConfig_Get(VEC_CONFIG_CACHE_MAX_MEMORY);
+    if(VecConfig_Get(VEC_CONFIG_CACHE_TTL_MS) == 0 && generation != vec_generation()){
+        // the vectors changed while the query ran
+        return;
+    }
+
+    size_t size = sizeof(VecCacheEntry) + len;
+    for(size_t i = 0 ; i < count ; ++i){
+        size += sizeof(float) + sizeof(uint32_t) + results[i].len;
+    }
+    if(size > (size_t)maxMemory){
+        return;
+    }
+
+    VecCacheEntry* e = RG_ALLOC(size);
+    e->hash = VecCache_Hash(key, len);
+    e->generation = generation;
+    e->created = VecStats_Now();
+    e->size = size;
+    e->keyLen = len;
+    e->count = count;
+    memcpy(e->data, key, len);
+    char* curr = e->data + len;
+    for(size_t i = 0 ; i < count ; ++i){
+        uint32_t nameLen = results[i].len;
+        memcpy(curr, &results[i].score, sizeof(float));
+        memcpy(curr + sizeof(float), &nameLen, sizeof(nameLen));
+        curr += sizeof(float) + sizeof(nameLen);
+        memcpy(curr, results[i].key, nameLen);
+        curr += nameLen;
+    }
+
+    pthread_mutex_lock(&lock);
+    VecCacheEntry* prev;
+    VecCacheEntry* old = VecCache_Find(key, len, e->hash, &prev);
+    if(old){
+        VecCache_Remove(old, prev);
+    }
+    while(tail && stats.memory + size > (size_t)maxMemory){
+        VecCache_Evict(tail);
+        ++stats.evictions;
+    }
+    if(stats.entries >= nBuckets){
+        VecCache_Grow();
+    }
+    e->chain = buckets[e->hash & (nBuckets - 1)];
+    buckets[e->hash & (nBuckets - 1)] = e;
+    VecCache_PushFront(e);
+    stats.memory += size;
+    ++stats.entries;
+    pthread_mutex_unlock(&lock);
+}
+
+void VecCache_GetStats(VecCacheStats* s){
+    pthread_mutex_lock(&lock);
+    *s = stats;
+    pthread_mutex_unlock(&lock);
+}
+
+void VecCache_ResetStats(){
+    pthread_mutex_lock(&lock);
+    stats.hits = 0;
+    stats.misses = 0;
+    stats.evictions = 0;
+    stats.invalidations = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+void VecCache_Clear(){
+    pthread_mutex_lock(&lock);
+    while(tail){
+        VecCache_Evict(tail);
+    }
+    if(buckets){
+        RG_FREE(buckets);
+    }
+    buckets = NULL;
+    nBuckets = 0;
+    pthread_mutex_unlock(&lock);
+}
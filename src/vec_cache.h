@@ -0,0 +1,60 @@
+/*
+ * vec_cache.h
+ *
+ * LRU cache of RG.VEC_SIM results, keyed by the quantized normalized query and the
+ * rest of the query arguments. An entry is valid as long as the vectors were not
+ * changed since its query started (see vec_generation) or, when cache-ttl-ms is set,
+ * for that long after it was added regardless of the changes. The entries take at
+ * most cache-max-memory bytes, the least recently used are evicted first.
+ */
+
+#ifndef SRC_VEC_CACHE_H_
+#define SRC_VEC_CACHE_H_
+
+#include "redismodule.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct VecCacheResult{
+    const char* key;
+    size_t len;
+    float score;
+}VecCacheResult;
+
+typedef struct VecCacheStats{
+    size_t entries;
+    size_t memory;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions; // dropped to make room for new entries
+    uint64_t invalidations; // dropped on lookup as the vectors changed or the ttl passed
+}VecCacheStats;
+
+/*
+ * Build the lookup key of a query out of its vector (see vec_set_data) and its arguments
+ * (without the vector), the key is allocated and its length set on len.
+ */
+char* VecCache_Key(const float* vec, const char* params, size_t* len);
+
+/*
+ * Reply with the cached results of the key, in the RG.VEC_SIM reply format.
+ * Returns false (and replies nothing) on a miss.
+ */
+bool VecCache_Reply(RedisModuleCtx* ctx, const char* key, size_t len);
+
+/*
+ * Add the results (sorted as they should be replied) of a query that started on
+ * the given generation. The results are copied.
+ */
+void VecCache_Add(const char* key, size_t len, uint64_t generation, const VecCacheResult* results, size_t count);
+
+void VecCache_GetStats(VecCacheStats* stats);
+void VecCache_ResetStats();
+
+/*
+ * Drop all the entries.
+ */
+void VecCache_Clear();
+
+#endif /* SRC_VEC_CACHE_H_ */
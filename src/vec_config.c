@@ -0,0 +1,49 @@
+#include "vec_config.h"
+#include "redismodule.h"
+#include <strings.h>
+
+typedef struct VecConfigDef{
+    const char* name;
+    long long val;
+    long long min;
+    long long max;
+}VecConfigDef;
+
+static VecConfigDef params[VEC_CONFIG_COUNT] = {
+    [VEC_CONFIG_SLOWLOG_LOG_SLOWER_THAN] = {"slowlog-log-slower-than", 10000, -1, 1LL << 40},
+    [VEC_CONFIG_SLOWLOG_MAX_LEN] = {"slowlog-max-len", 128, 0, 1 << 20},
+    [VEC_CONFIG_BATCH_WINDOW_MS] = {"batch-window-ms", 0, 0, 1000},
+    [VEC_CONFIG_BATCH_MAX_SIZE] = {"batch-max-size", 32, 1, 1024},
+    [VEC_CONFIG_CACHE_MAX_MEMORY] = {"cache-max-memory", 0, 0, 1LL << 40},
+    [VEC_CONFIG_CACHE_TTL_MS] = {"cache-ttl-ms", 0, 0, 1LL << 31},
+    [VEC_CONFIG_IVF_LISTS] = {"ivf-lists", 0, 0, 65534},
+    [VEC_CONFIG_IVF_BATCH_SIZE] = {"ivf-batch-size", 4096, 1, 1 << 20},
+    [VEC_CONFIG_SCAN_PRUNE] = {"scan-prune", 0, 0, 1},
+    [VEC_CONFIG_COARSE_PREFIXES] = {"coarse-prefixes", 0, 0, 1},
+};
+
+long long VecConfig_Get(VecConfigParam param){
+    return __atomic_load_n(&params[param].val, __ATOMIC_RELAXED);
+}
+
+int VecConfig_Set(VecConfigParam param, long long val, const char** err){
+    if(val < params[param].min || val > params[param].max){
+        *err = "Value out of range";
+        return REDISMODULE_ERR;
+    }
+    __atomic_store_n(&params[param].val, val, __ATOMIC_RELAXED);
+    return REDISMODULE_OK;
+}
+
+int VecConfig_Find(const char* name){
+    for(int i = 0 ; i < VEC_CONFIG_COUNT ; ++i){
+        if(strcasecmp(params[i].name, name) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char* VecConfig_Name(VecConfigParam param){
+    return params[param].name;
+}
@@ -0,0 +1,39 @@
+/*
+ * vec_config.h
+ *
+ * Runtime configuration parameters, read with VecConfig_Get from any thread
+ * and changed with RG.VEC_CONFIG SET.
+ */
+
+#ifndef SRC_VEC_CONFIG_H_
+#define SRC_VEC_CONFIG_H_
+
+typedef enum VecConfigParam{
+    VEC_CONFIG_SLOWLOG_LOG_SLOWER_THAN, // microseconds, negative disables the slowlog
+    VEC_CONFIG_SLOWLOG_MAX_LEN,
+    VEC_CONFIG_BATCH_WINDOW_MS, // hold RG.VEC_SIM queries up to that long to search them together, 0 disables batching
+    VEC_CONFIG_BATCH_MAX_SIZE, // a batch is searched as soon as it has that many queries
+    VEC_CONFIG_CACHE_MAX_MEMORY, // bytes of cached RG.VEC_SIM results, 0 disables the cache
+    VEC_CONFIG_CACHE_TTL_MS, // if not 0, cached results are used for that long even if the vectors changed
+    VEC_CONFIG_IVF_LISTS, // the amount of IVF lists (up to 65534), 0 disables the IVF index
+    VEC_CONFIG_IVF_BATCH_SIZE, // the amount of vectors the IVF worker assigns per lock hold
+    VEC_CONFIG_SCAN_PRUNE, // 1 to skip vectors whose leading dimensions already rule them out of the top k
+    VEC_CONFIG_COARSE_PREFIXES, // 1 to keep the vector prefixes searched by COARSE and CANDIDATES
+    VEC_CONFIG_COUNT,
+}VecConfigParam;
+
+long long VecConfig_Get(VecConfigParam param);
+
+/*
+ * Set the param value, on failure returns REDISMODULE_ERR and sets err (a static string).
+ */
+int VecConfig_Set(VecConfigParam param, long long val, const char** err);
+
+/*
+ * Return the param with the given name (case insensitive), -1 if there is no such param.
+ */
+int VecConfig_Find(const char* name);
+
+const char* VecConfig_Name(VecConfigParam param);
+
+#endif /* SRC_VEC_CONFIG_H_ */
@@ -0,0 +1,1188 @@
+#include "vec_disk.h"
+#include "redisgears_memory.h"
+#include "arr_rm_alloc.h"
+#include <cblas.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifndef VEC_DISK_NO_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
+
+#define VEC_DISK_MAGIC "VECDISK1"
+
+// the nodes are packed on sectors of that size, a node is never split between sectors
+#define VEC_DISK_SECTOR 4096
+
+// the vectors are split to that many subspaces, each is encoded on a byte
+#define VEC_DISK_PQ_SUBSPACES 16
+#define VEC_DISK_PQ_SUBDIM (VEC_SIZE / VEC_DISK_PQ_SUBSPACES)
+#define VEC_DISK_PQ_CENTROIDS 256
+#define VEC_DISK_PQ_SAMPLE (64 * 1024)
+#define VEC_DISK_PQ_ITERATIONS 10
+
+// the amount of subvectors assigned with a single matrix product
+#define VEC_DISK_PQ_TILE 256
+
+// the amount of nodes read at once by a search
+#define VEC_DISK_BEAM_WIDTH 4
+
+// the second build pass keeps longer edges, alpha 1 keeps only the strictly needed ones
+#define VEC_DISK_ALPHA 1.2f
+
+// while building, reverse edges are added up to that factor of the degree before the
+// node is pruned, so we do not prune on every added edge
+#define VEC_DISK_DEGREE_SLACK 1.3
+
+#define VEC_DISK_NODE_SIZE(degree) (VEC_SIZE * sizeof(float) + sizeof(uint32_t) + (degree) * sizeof(uint32_t))
+
+typedef struct VecDiskHeader{
+    char magic[8];
+    uint32_t dim;
+    uint32_t pqSubspaces;
+    uint32_t degree;
+    uint32_t nodeSize;
+    uint32_t nodesPerSector;
+    uint32_t reserved;
+    uint64_t size;
+    uint64_t medoid;
+    uint64_t pqOffset; // the PQ centroids, per subspace
+    uint64_t codesOffset; // the PQ code of every node
+    uint64_t namesIndexOffset; // size + 1 offsets of the names
+    uint64_t namesOffset;
+    uint64_t nodesOffset; // the graph nodes, each is the vector, the degree and the neighbors
+}VecDiskHeader;
+
+struct VecDisk{
+    int fd;
+    VecDiskHeader h;
+    float* pq;
+    uint8_t* codes;
+    uint64_t* nameOffsets;
+    size_t refs;
+};
+
+static int VecDisk_PRead(int fd, void* buf, size_t len, uint64_t offset){
+    char* curr = buf;
+    while(len > 0){
+        ssize_t n = pread(fd, curr, len, offset);
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            return -1;
+        }
+        curr += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+#ifndef VEC_DISK_NO_IO_URING
+
+/*
+ * A minimal io_uring, created per thread on its first search. We only need to submit
+ * a beam of reads and wait for all of them.
+ */
+typedef struct VecDiskRing{
+    int fd;
+    unsigned entries;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sqRing;
+    size_t sqRingLen;
+    void* cqRing;
+    size_t cqRingLen;
+    size_t sqesLen;
+}VecDiskRing;
+
+static pthread_key_t ringKey;
+static pthread_once_t ringOnce = PTHREAD_ONCE_INIT;
+static __thread bool ringFailed = false;
+
+static void VecDiskRing_Free(void* arg){
+    VecDiskRing* r = arg;
+    if(r->sqes && r->sqes != MAP_FAILED){
+        munmap(r->sqes, r->sqesLen);
+    }
+    if(r->cqRing && r->cqRing != MAP_FAILED){
+        munmap(r->cqRing, r->cqRingLen);
+    }
+    if(r->sqRing && r->sqRing != MAP_FAILED){
+        munmap(r->sqRing, r->sqRingLen);
+    }
+    close(r->fd);
+    RG_FREE(r);
+}
+
+static VecDiskRing* VecDiskRing_Create(unsigned entries){
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = syscall(__NR_io_uring_setup, entries, &p);
+    if(fd < 0){
+        // not supported by the kernel or not allowed (e.g. by seccomp)
+        return NULL;
+    }
+
+    VecDiskRing* r = RG_CALLOC(1, sizeof(*r));
+    r->fd = fd;
+    r->entries = p.sq_entries;
+    r->sqRingLen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cqRingLen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqesLen = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqRing = mmap(NULL, r->sqRingLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    r->cqRing = mmap(NULL, r->cqRingLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, r->sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(r->sqRing == MAP_FAILED || r->cqRing == MAP_FAILED || r->sqes == MAP_FAILED){
+        VecDiskRing_Free(r);
+        return NULL;
+    }
+
+    char* sq = r->sqRing;
+    char* cq = r->cqRing;
+    r->sqHead = (unsigned*)(sq + p.sq_off.head);
+    r->sqTail = (unsigned*)(sq + p.sq_off.tail);
+    r->sqMask = (unsigned*)(sq + p.sq_off.ring_mask);
+    r->sqArray = (unsigned*)(sq + p.sq_off.array);
+    r->cqHead = (unsigned*)(cq + p.cq_off.head);
+    r->cqTail = (unsigned*)(cq + p.cq_off.tail);
+    r->cqMask = (unsigned*)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return r;
+}
+
+/*
+ * Read count sectors, returns -1 if any of the reads failed or was short. Either way
+ * all the submitted reads completed on return, so bufs can be reused.
+ */
+static int VecDiskRing_Read(VecDiskRing* r, int fd, char* bufs, const uint64_t* offsets, size_t count){
+    unsigned tail = *r->sqTail;
+    for(size_t i = 0 ; i < count ; ++i){
+        unsigned idx = tail & *r->sqMask;
+        struct io_uring_sqe* sqe = &r->sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)(bufs + i * VEC_DISK_SECTOR);
+        sqe->len = VEC_DISK_SECTOR;
+        sqe->off = offsets[i];
+        sqe->user_data = i;
+        r->sqArray[idx] = idx;
+        ++tail;
+    }
+    __atomic_store_n(r->sqTail, tail, __ATOMIC_RELEASE);
+
+    size_t toSubmit = count;
+    size_t submitted = 0;
+    size_t done = 0;
+    bool failed = false;
+    while(toSubmit > 0 || done < submitted){
+        int ret = syscall(__NR_io_uring_enter, r->fd, toSubmit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if(ret < 0 && errno != EINTR){
+            // the reads that were not submitted are dropped, the ones in flight write into
+            // bufs so we keep reaping them until they all complete
+            failed = true;
+            toSubmit = 0;
+            sched_yield();
+        }else if(ret > 0){
+            submitted += MIN((size_t)ret, toSubmit);
+            toSubmit -= MIN((size_t)ret, toSubmit);
+        }
+
+        unsigned head = *r->cqHead;
+        while(head != __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE)){
+            struct io_uring_cqe* cqe = &r->cqes[head & *r->cqMask];
+            if(cqe->res != VEC_DISK_SECTOR){
+                failed = true;
+            }
+            ++head;
+            ++done;
+        }
+        __atomic_store_n(r->cqHead, head, __ATOMIC_RELEASE);
+    }
+    return failed ? -1 : 0;
+}
+
+static void VecDisk_RingKeyCreate(){
+    pthread_key_create(&ringKey, VecDiskRing_Free);
+}
+
+static VecDiskRing* VecDisk_Ring(){
+    if(ringFailed){
+        return NULL;
+    }
+    pthread_once(&ringOnce, VecDisk_RingKeyCreate);
+    VecDiskRing* r = pthread_getspecific(ringKey);
+    if(!r){
+        r = VecDiskRing_Create(VEC_DISK_BEAM_WIDTH);
+        if(!r){
+            ringFailed = true;
+            return NULL;
+        }
+        pthread_setspecific(ringKey, r);
+    }
+    return r;
+}
+
+#endif
+
+/*
+ * Read count sectors into bufs, one after the other.
+ */
+static int VecDisk_ReadSectors(VecDisk* d, char* bufs, const uint64_t* offsets, size_t count){
+#ifndef VEC_DISK_NO_IO_URING
+    VecDiskRing* r = VecDisk_Ring();
+    if(r){
+        if(VecDiskRing_Read(r, d->fd, bufs, offsets, count) == 0){
+            return 0;
+        }
+        // e.g. IORING_OP_READ is not supported by the kernel, nothing is in flight anymore so
+        // the ring is dropped and we do not try again on this thread
+        pthread_setspecific(ringKey, NULL);
+        VecDiskRing_Free(r);
+        ringFailed = true;
+    }
+#endif
+    for(size_t i = 0 ; i < count ; ++i){
+        if(VecDisk_PRead(d->fd, bufs + i * VEC_DISK_SECTOR, VEC_DISK_SECTOR, offsets[i]) != 0){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * The search list, sorted descending by score and bounded to cap items.
+ */
+typedef struct VecDiskCand{
+    uint32_t id;
+    float score;
+    bool expanded;
+}VecDiskCand;
+
+typedef struct VecDiskList{
+    VecDiskCand* items;
+    size_t count;
+    size_t cap;
+}VecDiskList;
+
+static void VecDiskList_Insert(VecDiskList* l, uint32_t id, float score){
+    if(isnan(score) || (l->count == l->cap && score <= l->items[l->count - 1].score)){
+        return;
+    }
+    size_t lo = 0, hi = l->count;
+    while(lo < hi){
+        size_t mid = (lo + hi) / 2;
+        if(l->items[mid].score >= score){
+            lo = mid + 1;
+        }else{
+            hi = mid;
+        }
+    }
+    size_t moved = MIN(l->count, l->cap - 1) - lo;
+    memmove(&l->items[lo + 1], &l->items[lo], moved * sizeof(*l->items));
+    l->items[lo] = (VecDiskCand){.id = id, .score = score, .expanded = false};
+    if(l->count < l->cap){
+        ++l->count;
+    }
+}
+
+/*
+ * Replace the approximate score of an expanded candidate with its exact score, it
+ * might have been pushed out of the list in the meantime.
+ */
+static void VecDiskList_Rescore(VecDiskList* l, uint32_t id, float score){
+    size_t i = 0;
+    while(i < l->count && l->items[i].id != id){
+        ++i;
+    }
+    if(i == l->count){
+        return;
+    }
+    memmove(&l->items[i], &l->items[i + 1], (l->count - i - 1) * sizeof(*l->items));
+    --l->count;
+    VecDiskList_Insert(l, id, score);
+    for(size_t j = 0 ; j < l->count ; ++j){
+        if(l->items[j].id == id){
+            l->items[j].expanded = true;
+            break;
+        }
+    }
+}
+
+/*
+ * The ids seen by a search, open addressing.
+ */
+typedef struct VecDiskSet{
+    uint32_t* slots;
+    size_t cap;
+    size_t count;
+}VecDiskSet;
+
+#define VEC_DISK_SET_EMPTY UINT32_MAX
+
+static void VecDiskSet_Init(VecDiskSet* s, size_t cap){
+    s->cap = 64;
+    while(s->cap < cap * 2){
+        s->cap *= 2;
+    }
+    s->count = 0;
+    s->slots = RG_ALLOC(s->cap * sizeof(*s->slots));
+    memset(s->slots, 0xff, s->cap * sizeof(*s->slots));
+}
+
+static void VecDiskSet_Clear(VecDiskSet* s){
+    s->count = 0;
+    memset(s->slots, 0xff, s->cap * sizeof(*s->slots));
+}
+
+static bool VecDiskSet_Add(VecDiskSet* s, uint32_t id);
+
+static void VecDiskSet_Grow(VecDiskSet* s){
+    uint32_t* old = s->slots;
+    size_t oldCap = s->cap;
+    s->cap *= 2;
+    s->count = 0;
+    s->slots = RG_ALLOC(s->cap * sizeof(*s->slots));
+    memset(s->slots, 0xff, s->cap * sizeof(*s->slots));
+    for(size_t i = 0 ; i < oldCap ; ++i){
+        if(old[i] != VEC_DISK_SET_EMPTY){
+            VecDiskSet_Add(s, old[i]);
+        }
+    }
+    RG_FREE(old);
+}
+
+/*
+ * Returns true if the id was not on the set.
+ */
+static bool VecDiskSet_Add(VecDiskSet* s, uint32_t id){
+    if(s->count * 2 >= s->cap){
+        VecDiskSet_Grow(s);
+    }
+    size_t i = (id * 2654435761u) & (s->cap - 1);
+    while(s->slots[i] != VEC_DISK_SET_EMPTY){
+        if(s->slots[i] == id){
+            return false;
+        }
+        i = (i + 1) & (s->cap - 1);
+    }
+    s->slots[i] = id;
+    ++s->count;
+    return true;
+}
+
+/*
+ * PQ
+ */
+
+static float VecDisk_SubDist(const float* a, const float* b){
+    float d = 0;
+    for(size_t i = 0 ; i < VEC_DISK_PQ_SUBDIM ; ++i){
+        d += (a[i] - b[i]) * (a[i] - b[i]);
+    }
+    return d;
+}
+
+static uint8_t VecDisk_SubClosest(const float* cents, const float* v){
+    size_t best = 0;
+    float bestDist = INFINITY;
+    for(size_t c = 0 ; c < VEC_DISK_PQ_CENTROIDS ; ++c){
+        float d = VecDisk_SubDist(&cents[c * VEC_DISK_PQ_SUBDIM], v);
+        if(d < bestDist){
+            bestDist = d;
+            best = c;
+        }
+    }
+    return best;
+}
+
+/*
+ * Set assign[i] to the closest centroid of the i-th of the n subvectors, the distances
+ * are |c|^2 - 2 * x.c (|x|^2 does not change the order) so we can use a matrix product.
+ * buf should have room for (VEC_DISK_PQ_TILE + 1) * VEC_DISK_PQ_CENTROIDS floats.
+ */
+static void VecDisk_SubAssign(const float* subs, size_t n, const float* cents, uint8_t* assign, float* buf){
+    float* norms = buf + VEC_DISK_PQ_TILE * VEC_DISK_PQ_CENTROIDS;
+    for(size_t c = 0 ; c < VEC_DISK_PQ_CENTROIDS ; ++c){
+        const float* cent = &cents[c * VEC_DISK_PQ_SUBDIM];
+        norms[c] = cblas_sdot(VEC_DISK_PQ_SUBDIM, cent, 1, cent, 1);
+    }
+    for(size_t first = 0 ; first < n ; first += VEC_DISK_PQ_TILE){
+        size_t rows = MIN(VEC_DISK_PQ_TILE, n - first);
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, rows, VEC_DISK_PQ_CENTROIDS, VEC_DISK_PQ_SUBDIM, 1,
+                    &subs[first * VEC_DISK_PQ_SUBDIM], VEC_DISK_PQ_SUBDIM, cents, VEC_DISK_PQ_SUBDIM, 0, buf, VEC_DISK_PQ_CENTROIDS);
+        for(size_t r = 0 ; r < rows ; ++r){
+            const float* dots = &buf[r * VEC_DISK_PQ_CENTROIDS];
+            size_t best = 0;
+            float bestDist = INFINITY;
+            for(size_t c = 0 ; c < VEC_DISK_PQ_CENTROIDS ; ++c){
+                float d = norms[c] - 2 * dots[c];
+                if(d < bestDist){
+                    bestDist = d;
+                    best = c;
+                }
+            }
+            assign[first + r] = best;
+        }
+    }
+}
+
+/*
+ * Train the centroids of every subspace with k-means on a sample of the vectors, pq
+ * should have room for VEC_DISK_PQ_SUBSPACES * VEC_DISK_PQ_CENTROIDS * VEC_DISK_PQ_SUBDIM floats.
+ */
+static void VecDisk_PQTrain(const float* vecs, size_t n, float* pq){
+    size_t ns = MIN(n, VEC_DISK_PQ_SAMPLE);
+    size_t stride = n / ns;
+    float* sample = RG_ALLOC(ns * VEC_DISK_PQ_SUBDIM * sizeof(float));
+    uint8_t* assign = RG_ALLOC(ns);
+    size_t* counts = RG_ALLOC(VEC_DISK_PQ_CENTROIDS * sizeof(*counts));
+    float* buf = RG_ALLOC((VEC_DISK_PQ_TILE + 1) * VEC_DISK_PQ_CENTROIDS * sizeof(float));
+
+    for(size_t m = 0 ; m < VEC_DISK_PQ_SUBSPACES ; ++m){
+        for(size_t i = 0 ; i < ns ; ++i){
+            memcpy(&sample[i * VEC_DISK_PQ_SUBDIM], &vecs[i * stride * VEC_SIZE + m * VEC_DISK_PQ_SUBDIM],
+                   VEC_DISK_PQ_SUBDIM * sizeof(float));
+        }
+        float* cents = &pq[m * VEC_DISK_PQ_CENTROIDS * VEC_DISK_PQ_SUBDIM];
+        for(size_t c = 0 ; c < VEC_DISK_PQ_CENTROIDS ; ++c){
+            memcpy(&cents[c * VEC_DISK_PQ_SUBDIM], &sample[(c * ns / VEC_DISK_PQ_CENTROIDS) * VEC_DISK_PQ_SUBDIM],
+                   VEC_DISK_PQ_SUBDIM * sizeof(float));
+        }
+
+        for(size_t iter = 0 ; iter < VEC_DISK_PQ_ITERATIONS ; ++iter){
+            VecDisk_SubAssign(sample, ns, cents, assign, buf);
+            memset(cents, 0, VEC_DISK_PQ_CENTROIDS * VEC_DISK_PQ_SUBDIM * sizeof(float));
+            memset(counts, 0, VEC_DISK_PQ_CENTROIDS * sizeof(*counts));
+            for(size_t i = 0 ; i < ns ; ++i){
+                float* cent = &cents[assign[i] * VEC_DISK_PQ_SUBDIM];
+                for(size_t j = 0 ; j < VEC_DISK_PQ_SUBDIM ; ++j){
+                    cent[j] += sample[i * VEC_DISK_PQ_SUBDIM + j];
+                }
+                ++counts[assign[i]];
+            }
+            for(size_t c = 0 ; c < VEC_DISK_PQ_CENTROIDS ; ++c){
+                float* cent = &cents[c * VEC_DISK_PQ_SUBDIM];
+                if(counts[c] == 0){
+                    // reseed an empty centroid with some other sample vector
+                    memcpy(cent, &sample[((c * 7919 + iter) % ns) * VEC_DISK_PQ_SUBDIM], VEC_DISK_PQ_SUBDIM * sizeof(float));
+                    continue;
+                }
+                for(size_t j = 0 ; j < VEC_DISK_PQ_SUBDIM ; ++j){
+                    cent[j] /= counts[c];
+                }
+            }
+        }
+    }
+
+    RG_FREE(buf);
+    RG_FREE(counts);
+    RG_FREE(assign);
+    RG_FREE(sample);
+}
+
+static void VecDisk_PQEncode(const float* pq, const float* v, uint8_t* code){
+    for(size_t m = 0 ; m < VEC_DISK_PQ_SUBSPACES ; ++m){
+        code[m] = VecDisk_SubClosest(&pq[m * VEC_DISK_PQ_CENTROIDS * VEC_DISK_PQ_SUBDIM], &v[m * VEC_DISK_PQ_SUBDIM]);
+    }
+}
+
+/*
+ * The dot product of the query with every centroid, the approximate score of a code
+ * is the sum of its centroids entries.
+ */
+static void VecDisk_PQTable(const float* pq, const float* vec, float* table){
+    for(size_t m = 0 ; m < VEC_DISK_PQ_SUBSPACES ; ++m){
+        cblas_sgemv(CblasRowMajor, CblasNoTrans, VEC_DISK_PQ_CENTROIDS, VEC_DISK_PQ_SUBDIM, 1,
+                    &pq[m * VEC_DISK_PQ_CENTROIDS * VEC_DISK_PQ_SUBDIM], VEC_DISK_PQ_SUBDIM,
+                    &vec[m * VEC_DISK_PQ_SUBDIM], 1, 0, &table[m * VEC_DISK_PQ_CENTROIDS], 1);
+    }
+}
+
+static float VecDisk_PQScore(const float* table, const uint8_t* code){
+    float score = 0;
+    for(size_t m = 0 ; m < VEC_DISK_PQ_SUBSPACES ; ++m){
+        score += table[m * VEC_DISK_PQ_CENTROIDS + code[m]];
+    }
+    return score;
+}
+
+/*
+ * Vamana
+ */
+
+typedef struct VecDiskGraph{
+    const float* vecs;
+    size_t n;
+    size_t degree;
+    size_t slack; // the room for neighbors of every node, degree with slack
+    uint32_t* nbrs; // slack per node
+    uint32_t* degrees;
+    uint32_t medoid;
+    uint64_t rng;
+}VecDiskGraph;
+
+#define GRAPH_VEC(g, i) (&(g)->vecs[(size_t)(i) * VEC_SIZE])
+#define GRAPH_NBRS(g, i) (&(g)->nbrs[(size_t)(i) * (g)->slack])
+
+static uint64_t VecDisk_Rand(VecDiskGraph* g){
+    g->rng ^= g->rng << 13;
+    g->rng ^= g->rng >> 7;
+    g->rng ^= g->rng << 17;
+    return g->rng;
+}
+
+/*
+ * The vectors are normalized, the squared euclidean distance is 2 - 2 * dot.
+ */
+static float VecDisk_Dist(const float* a, const float* b){
+    return MAX(0, 2 - 2 * cblas_sdot(VEC_SIZE, a, 1, b, 1));
+}
+
+/*
+ * Greedy search of vec on the graph, the ids of the expanded nodes are appended to expanded.
+ */
+static void VecDisk_GreedySearch(VecDiskGraph* g, const float* vec, VecDiskList* l, VecDiskSet* seen, uint32_t** expanded){
+    l->count = 0;
+    VecDiskSet_Clear(seen);
+    VecDiskSet_Add(seen, g->medoid);
+    VecDiskList_Insert(l, g->medoid, cblas_sdot(VEC_SIZE, GRAPH_VEC(g, g->medoid), 1, vec, 1));
+    while(true){
+        size_t i = 0;
+        while(i < l->count && l->items[i].expanded){
+            ++i;
+        }
+        if(i == l->count){
+            break;
+        }
+        l->items[i].expanded = true;
+        uint32_t id = l->items[i].id;
+        *expanded = array_append(*expanded, id);
+        uint32_t* nbrs = GRAPH_NBRS(g, id);
+        for(size_t j = 0 ; j < g->degrees[id] ; ++j){
+            if(VecDiskSet_Add(seen, nbrs[j])){
+                VecDiskList_Insert(l, nbrs[j], cblas_sdot(VEC_SIZE, GRAPH_VEC(g, nbrs[j]), 1, vec, 1));
+            }
+        }
+    }
+}
+
+typedef struct VecDiskEdge{
+    uint32_t id;
+    float dist;
+}VecDiskEdge;
+
+static int cmpEdge(const void* a, const void* b){
+    const VecDiskEdge* x = a;
+    const VecDiskEdge* y = b;
+    if(x->dist != y->dist){
+        return x->dist < y->dist ? -1 : 1;
+    }
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+/*
+ * Set the neighbors of p to the closest candidates, a candidate is dropped if one of
+ * the chosen neighbors is closer to it by alpha than p is.
+ */
+static void VecDisk_RobustPrune(VecDiskGraph* g, uint32_t p, const uint32_t* cands, size_t nCands, float alpha){
+    VecDiskEdge* edges = RG_ALLOC(MAX(nCands, 1) * sizeof(*edges));
+    size_t n = 0;
+    for(size_t i = 0 ; i < nCands ; ++i){
+        if(cands[i] != p){
+            edges[n++] = (VecDiskEdge){.id = cands[i], .dist = VecDisk_Dist(GRAPH_VEC(g, p), GRAPH_VEC(g, cands[i]))};
+        }
+    }
+    qsort(edges, n, sizeof(*edges), cmpEdge);
+
+    uint32_t* nbrs = GRAPH_NBRS(g, p);
+    size_t degree = 0;
+    for(size_t i = 0 ; i < n && degree < g->degree ; ++i){
+        if(edges[i].dist == INFINITY || (i > 0 && edges[i].id == edges[i - 1].id)){
+            // pruned or a duplicate
+            continue;
+        }
+        nbrs[degree++] = edges[i].id;
+        const float* v = GRAPH_VEC(g, edges[i].id);
+        for(size_t j = i + 1 ; j < n ; ++j){
+            if(edges[j].dist != INFINITY && alpha * VecDisk_Dist(v, GRAPH_VEC(g, edges[j].id)) <= edges[j].dist){
+                edges[j].dist = INFINITY;
+            }
+        }
+    }
+    g->degrees[p] = degree;
+    RG_FREE(edges);
+}
+
+static void VecDisk_BuildGraph(VecDiskGraph* g, size_t listSize){
+    size_t n = g->n;
+
+    // the medoid, the closest vector to the mean, is the entry point of every search
+    float* mean = RG_CALLOC(VEC_SIZE, sizeof(float));
+    for(size_t i = 0 ; i < n ; ++i){
+        cblas_saxpy(VEC_SIZE, 1, GRAPH_VEC(g, i), 1, mean, 1);
+    }
+    float best = -INFINITY;
+    for(size_t i = 0 ; i < n ; ++i){
+        float s = cblas_sdot(VEC_SIZE, GRAPH_VEC(g, i), 1, mean, 1);
+        if(s > best){
+            best = s;
+            g->medoid = i;
+        }
+    }
+    RG_FREE(mean);
+
+    // start from random neighbors
+    for(size_t i = 0 ; i < n ; ++i){
+        size_t degree = MIN(g->degree, n - 1);
+        uint32_t* nbrs = GRAPH_NBRS(g, i);
+        for(size_t j = 0 ; j < degree ; ++j){
+            uint32_t nbr = VecDisk_Rand(g) % (n - 1);
+            nbrs[j] = nbr >= i ? nbr + 1 : nbr;
+        }
+        g->degrees[i] = degree;
+    }
+
+    uint32_t* order = RG_ALLOC(n * sizeof(*order));
+    for(size_t i = 0 ; i < n ; ++i){
+        order[i] = i;
+    }
+    VecDiskList l = {.items = RG_ALLOC(listSize * sizeof(VecDiskCand)), .count = 0, .cap = listSize};
+    VecDiskSet seen;
+    VecDiskSet_Init(&seen, listSize * g->degree);
+    uint32_t* cands = array_new(uint32_t, listSize + g->degree);
+
+    float alphas[] = {1, VEC_DISK_ALPHA};
+    for(size_t pass = 0 ; pass < sizeof(alphas) / sizeof(*alphas) ; ++pass){
+        for(size_t i = n - 1 ; i > 0 ; --i){
+            size_t j = VecDisk_Rand(g) % (i + 1);
+            uint32_t tmp = order[i];
+            order[i] = order[j];
+            order[j] = tmp;
+        }
+
+        for(size_t o = 0 ; o < n ; ++o){
+            uint32_t p = order[o];
+            cands = array_trimm_len(cands, 0);
+            VecDisk_GreedySearch(g, GRAPH_VEC(g, p), &l, &seen, &cands);
+            for(size_t j = 0 ; j < g->degrees[p] ; ++j){
+                cands = array_append(cands, GRAPH_NBRS(g, p)[j]);
+            }
+            VecDisk_RobustPrune(g, p, cands, array_len(cands), alphas[pass]);
+
+            // add the reverse edges, pruning the neighbors that overflow
+            for(size_t j = 0 ; j < g->degrees[p] ; ++j){
+                uint32_t nbr = GRAPH_NBRS(g, p)[j];
+                uint32_t* back = GRAPH_NBRS(g, nbr);
+                bool found = false;
+                for(size_t b = 0 ; b < g->degrees[nbr] && !found ; ++b){
+                    found = back[b] == p;
+                }
+                if(found){
+                    continue;
+                }
+                if(g->degrees[nbr] < g->slack){
+                    back[g->degrees[nbr]++] = p;
+                    continue;
+                }
+                cands = array_trimm_len(cands, 0);
+                for(size_t b = 0 ; b < g->degrees[nbr] ; ++b){
+                    cands = array_append(cands, back[b]);
+                }
+                cands = array_append(cands, p);
+                VecDisk_RobustPrune(g, nbr, cands, array_len(cands), alphas[pass]);
+            }
+        }
+    }
+
+    // the nodes still on slack
+    for(size_t p = 0 ; p < n ; ++p){
+        if(g->degrees[p] > g->degree){
+            cands = array_trimm_len(cands, 0);
+            for(size_t j = 0 ; j < g->degrees[p] ; ++j){
+                cands = array_append(cands, GRAPH_NBRS(g, p)[j]);
+            }
+            VecDisk_RobustPrune(g, p, cands, array_len(cands), VEC_DISK_ALPHA);
+        }
+    }
+
+    array_free(cands);
+    RG_FREE(seen.slots);
+    RG_FREE(l.items);
+    RG_FREE(order);
+}
+
+static int VecDisk_WriteZeros(FILE* f, size_t len){
+    char zeros[VEC_DISK_SECTOR] = {0};
+    while(len > 0){
+        size_t n = MIN(len, sizeof(zeros));
+        if(fwrite(zeros, 1, n, f) != n){
+            return -1;
+        }
+        len -= n;
+    }
+    return 0;
+}
+
+static int VecDisk_Write(FILE* f, const VecDiskGraph* g, const float* pq, const uint8_t* codes,
+                         char** names, const uint32_t* nameLens){
+    size_t n = g->n;
+    VecDiskHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, VEC_DISK_MAGIC, sizeof(h.magic));
+    h.dim = VEC_SIZE;
+    h.pqSubspaces = VEC_DISK_PQ_SUBSPACES;
+    h.degree = g->degree;
+    h.nodeSize = VEC_DISK_NODE_SIZE(g->degree);
+    h.nodesPerSector = VEC_DISK_SECTOR / h.nodeSize;
+    h.size = n;
+    h.medoid = g->medoid;
+    h.pqOffset = VEC_DISK_SECTOR;
+    h.codesOffset = h.pqOffset + VEC_DISK_PQ_SUBSPACES * VEC_DISK_PQ_CENTROIDS * VEC_DISK_PQ_SUBDIM * sizeof(float);
+    h.namesIndexOffset = h.codesOffset + n * VEC_DISK_PQ_SUBSPACES;
+    h.namesOffset = h.namesIndexOffset + (n + 1) * sizeof(uint64_t);
+    uint64_t namesLen = 0;
+    for(size_t i = 0 ; i < n ; ++i){
+        namesLen += nameLens[i];
+    }
+    h.nodesOffset = (h.namesOffset + namesLen + VEC_DISK_SECTOR - 1) / VEC_DISK_SECTOR * VEC_DISK_SECTOR;
+
+    if(fwrite(&h, sizeof(h), 1, f) != 1 || VecDisk_WriteZeros(f, VEC_DISK_SECTOR - sizeof(h)) != 0){
+        return -1;
+    }
+    if(fwrite(pq, sizeof(float), VEC_DISK_PQ_SUBSPACES * VEC_DISK_PQ_CENTROIDS * VEC_DISK_PQ_SUBDIM, f) !=
+       VEC_DISK_PQ_SUBSPACES * VEC_DISK_PQ_CENTROIDS * VEC_DISK_PQ_SUBDIM){
+        return -1;
+    }
+    if(fwrite(codes, VEC_DISK_PQ_SUBSPACES, n, f) != n){
+        return -1;
+    }
+    uint64_t offset = 0;
+    for(size_t i = 0 ; i <= n ; ++i){
+        if(fwrite(&offset, sizeof(offset), 1, f) != 1){
+            return -1;
+        }
+        offset += i < n ? nameLens[i] : 0;
+    }
+    for(size_t i = 0 ; i < n ; ++i){
+        if(fwrite(names[i], 1, nameLens[i], f) != nameLens[i]){
+            return -1;
+        }
+    }
+    if(VecDisk_WriteZeros(f, h.nodesOffset - h.namesOffset - namesLen) != 0){
+        return -1;
+    }
+
+    char sector[VEC_DISK_SECTOR];
+    for(size_t first = 0 ; first < n ; first += h.nodesPerSector){
+        memset(sector, 0, sizeof(sector));
+        for(size_t i = first ; i < MIN(n, first + h.nodesPerSector) ; ++i){
+            char* node = sector + (i - first) * h.nodeSize;
+            uint32_t degree = g->degrees[i];
+            memcpy(node, GRAPH_VEC(g, i), VEC_SIZE * sizeof(float));
+            memcpy(node + VEC_SIZE * sizeof(float), &degree, sizeof(degree));
+            memcpy(node + VEC_SIZE * sizeof(float) + sizeof(degree), GRAPH_NBRS(g, i), degree * sizeof(uint32_t));
+        }
+        if(fwrite(sector, 1, sizeof(sector), f) != sizeof(sector)){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int VecDisk_Build(const char* path, const float* vecs, char** names, const uint32_t* nameLens, size_t n,
+                  size_t degree, size_t listSize, const char** err){
+    if(n == 0){
+        *err = "No vectors to index";
+        return REDISMODULE_ERR;
+    }
+    if(degree == 0 || VEC_DISK_NODE_SIZE(degree) > VEC_DISK_SECTOR){
+        *err = "The degree does not fit a node on a sector";
+        return REDISMODULE_ERR;
+    }
+    if(n >= UINT32_MAX){
+        *err = "Too many vectors to index";
+        return REDISMODULE_ERR;
+    }
+
+    VecDiskGraph g = {
+        .vecs = vecs,
+        .n = n,
+        .degree = degree,
+        .slack = degree * VEC_DISK_DEGREE_SLACK + 1,
+        .nbrs = RG_ALLOC(n * (size_t)(degree * VEC_DISK_DEGREE_SLACK + 1) * sizeof(uint32_t)),
+        .degrees = RG_CALLOC(n, sizeof(uint32_t)),
+        .medoid = 0,
+        .rng = 88172645463325252ULL,
+    };
+    float* pq = RG_ALLOC(VEC_DISK_PQ_SUBSPACES * VEC_DISK_PQ_CENTROIDS * VEC_DISK_PQ_SUBDIM * sizeof(float));
+    uint8_t* codes = RG_ALLOC(n * VEC_DISK_PQ_SUBSPACES);
+
+    VecDisk_PQTrain(vecs, n, pq);
+    for(size_t i = 0 ; i < n ; ++i){
+        VecDisk_PQEncode(pq, GRAPH_VEC(&g, i), &codes[i * VEC_DISK_PQ_SUBSPACES]);
+    }
+    VecDisk_BuildGraph(&g, MAX(listSize, degree));
+
+    // write next to the target and rename, so a crash never leaves a partial index on path
+    size_t pathLen = strlen(path);
+    char* tmpPath = RG_ALLOC(pathLen + 5);
+    memcpy(tmpPath, path, pathLen);
+    memcpy(tmpPath + pathLen, ".tmp", 5);
+
+    int res = REDISMODULE_ERR;
+    FILE* f = fopen(tmpPath, "wb");
+    if(!f){
+        *err = "Failed creating the disk index file";
+    }else{
+        bool written = VecDisk_Write(f, &g, pq, codes, names, nameLens) == 0 && fflush(f) == 0 && fsync(fileno(f)) == 0;
+        if(fclose(f) != 0 || !written){
+            *err = "Failed writing the disk index file";
+            unlink(tmpPath);
+        }else if(rename(tmpPath, path) != 0){
+            *err = "Failed renaming the disk index file";
+            unlink(tmpPath);
+        }else{
+            res = REDISMODULE_OK;
+        }
+    }
+
+    RG_FREE(tmpPath);
+    RG_FREE(codes);
+    RG_FREE(pq);
+    RG_FREE(g.degrees);
+    RG_FREE(g.nbrs);
+    return res;
+}
+
+/*
+ * Whether len bytes at offset are inside a file of the given size, without overflowing.
+ */
+static bool VecDisk_InFile(uint64_t offset, uint64_t len, uint64_t fileSize){
+    return offset <= fileSize && len <= fileSize - offset;
+}
+
+VecDisk* VecDisk_Open(const char* path, const char** err){
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        *err = "Failed opening the disk index file";
+        return NULL;
+    }
+
+    VecDisk* d = RG_CALLOC(1, sizeof(*d));
+    d->fd = fd;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || VecDisk_PRead(fd, &d->h, sizeof(d->h), 0) != 0){
+        *err = "Failed reading the disk index file";
+        VecDisk_Free(d);
+        return NULL;
+    }
+
+    // a node must fit in a sector, the searches divide by nodesPerSector
+    VecDiskHeader* h = &d->h;
+    if(memcmp(h->magic, VEC_DISK_MAGIC, sizeof(h->magic)) != 0 || h->dim != VEC_SIZE ||
+       h->pqSubspaces != VEC_DISK_PQ_SUBSPACES || h->degree == 0 || h->nodeSize != VEC_DISK_NODE_SIZE(h->degree) ||
+       h->nodeSize > VEC_DISK_SECTOR || h->nodesPerSector == 0 || h->nodesPerSector != VEC_DISK_SECTOR / h->nodeSize ||
+       h->size == 0 || h->size >= UINT32_MAX || h->medoid >= h->size){
+        *err = "Not a disk index file";
+        VecDisk_Free(d);
+        return NULL;
+    }
+
+    size_t sectors = (h->size + h->nodesPerSector - 1) / h->nodesPerSector;
+    size_t pqLen = VEC_DISK_PQ_SUBSPACES * VEC_DISK_PQ_CENTROIDS * VEC_DISK_PQ_SUBDIM * sizeof(float);
+    uint64_t fileSize = st.st_size;
+    if(!VecDisk_InFile(h->nodesOffset, sectors * VEC_DISK_SECTOR, fileSize) ||
+       !VecDisk_InFile(h->pqOffset, pqLen, fileSize) ||
+       !VecDisk_InFile(h->codesOffset, h->size * VEC_DISK_PQ_SUBSPACES, fileSize) ||
+       !VecDisk_InFile(h->namesIndexOffset, (h->size + 1) * sizeof(uint64_t), fileSize)){
+        *err = "Not a disk index file";
+        VecDisk_Free(d);
+        return NULL;
+    }
+
+    d->pq = RG_ALLOC(pqLen);
+    d->codes = RG_ALLOC(h->size * VEC_DISK_PQ_SUBSPACES);
+    d->nameOffsets = RG_ALLOC((h->size + 1) * sizeof(uint64_t));
+    if(VecDisk_PRead(fd, d->pq, pqLen, h->pqOffset) != 0 ||
+       VecDisk_PRead(fd, d->codes, h->size * VEC_DISK_PQ_SUBSPACES, h->codesOffset) != 0 ||
+       VecDisk_PRead(fd, d->nameOffsets, (h->size + 1) * sizeof(uint64_t), h->namesIndexOffset) != 0){
+        *err = "Failed reading the disk index file";
+        VecDisk_Free(d);
+        return NULL;
+    }
+
+    // the names are read by their offsets, they must not go backwards or past the file end
+    bool namesValid = VecDisk_InFile(h->namesOffset, d->nameOffsets[h->size], fileSize);
+    for(size_t i = 0 ; namesValid && i < h->size ; ++i){
+        namesValid = d->nameOffsets[i] <= d->nameOffsets[i + 1];
+    }
+    if(!namesValid){
+        *err = "Not a disk index file";
+        VecDisk_Free(d);
+        return NULL;
+    }
+
+    return d;
+}
+
+void VecDisk_Free(VecDisk* d){
+    if(d->pq){
+        RG_FREE(d->pq);
+    }
+    if(d->codes){
+        RG_FREE(d->codes);
+    }
+    if(d->nameOffsets){
+        RG_FREE(d->nameOffsets);
+    }
+    close(d->fd);
+    RG_FREE(d);
+}
+
+size_t VecDisk_Size(VecDisk* d){
+    return d->h.size;
+}
+
+size_t VecDisk_MemUsage(VecDisk* d){
+    return sizeof(*d) + VEC_DISK_PQ_SUBSPACES * VEC_DISK_PQ_CENTROIDS * VEC_DISK_PQ_SUBDIM * sizeof(float) +
+           d->h.size * VEC_DISK_PQ_SUBSPACES + (d->h.size + 1) * sizeof(uint64_t);
+}
+
+size_t VecDisk_Search(VecDisk* d, const float* vec, size_t k, size_t listSize, TopKItem* out, size_t* reads){
+    VecDiskHeader* h = &d->h;
+    *reads = 0;
+    if(k == 0){
+        return 0;
+    }
+
+    float* table = RG_ALLOC(VEC_DISK_PQ_SUBSPACES * VEC_DISK_PQ_CENTROIDS * sizeof(float));
+    VecDisk_PQTable(d->pq, vec, table);
+
+    size_t cap = MAX(listSize, k);
+    VecDiskList l = {.items = RG_ALLOC(cap * sizeof(VecDiskCand)), .count = 0, .cap = cap};
+    VecDiskSet seen;
+    VecDiskSet_Init(&seen, cap * h->degree);
+    TopK* t = TopK_Create(k);
+    char* bufs = RG_ALLOC(VEC_DISK_BEAM_WIDTH * VEC_DISK_SECTOR);
+    uint32_t ids[VEC_DISK_BEAM_WIDTH];
+    uint64_t offsets[VEC_DISK_BEAM_WIDTH];
+
+    VecDiskSet_Add(&seen, h->medoid);
+    VecDiskList_Insert(&l, h->medoid, VecDisk_PQScore(table, &d->codes[h->medoid * VEC_DISK_PQ_SUBSPACES]));
+
+    while(true){
+        // the beam, the best nodes that were not read yet
+        size_t count = 0;
+        for(size_t i = 0 ; i < l.count && count < VEC_DISK_BEAM_WIDTH ; ++i){
+            if(!l.items[i].expanded){
+                l.items[i].expanded = true;
+                ids[count] = l.items[i].id;
+                offsets[count] = h->nodesOffset + (uint64_t)(ids[count] / h->nodesPerSector) * VEC_DISK_SECTOR;
+                ++count;
+            }
+        }
+        if(count == 0 || VecDisk_ReadSectors(d, bufs, offsets, count) != 0){
+            break;
+        }
+        *reads += count;
+
+        for(size_t i = 0 ; i < count ; ++i){
+            const char* node = bufs + i * VEC_DISK_SECTOR + (ids[i] % h->nodesPerSector) * h->nodeSize;
+            float score = cblas_sdot(VEC_SIZE, (const float*)node, 1, vec, 1);
+            if(score > TopK_Threshold(t)){
+                TopK_Push(t, score, ids[i]);
+            }
+            // steer the search with the exact score now that we have it
+            VecDiskList_Rescore(&l, ids[i], score);
+            uint32_t degree;
+            memcpy(&degree, node + VEC_SIZE * sizeof(float), sizeof(degree));
+            const uint32_t* nbrs = (const uint32_t*)(node + VEC_SIZE * sizeof(float) + sizeof(degree));
+            for(size_t j = 0 ; j < MIN(degree, h->degree) ; ++j){
+                uint32_t nbr = nbrs[j];
+                if(nbr < h->size && VecDiskSet_Add(&seen, nbr)){
+                    VecDiskList_Insert(&l, nbr, VecDisk_PQScore(table, &d->codes[(size_t)nbr * VEC_DISK_PQ_SUBSPACES]));
+                }
+            }
+        }
+    }
+
+    size_t n = TopK_Sort(t);
+    memcpy(out, t->items, n * sizeof(*out));
+
+    RG_FREE(bufs);
+    TopK_Free(t);
+    RG_FREE(seen.slots);
+    RG_FREE(l.items);
+    RG_FREE(table);
+    return n;
+}
+
+char* VecDisk_Name(VecDisk* d, uint32_t id, size_t* len){
+    *len = d->nameOffsets[id + 1] - d->nameOffsets[id];
+    char* name = RG_ALLOC(MAX(*len, 1));
+    if(VecDisk_PRead(d->fd, name, *len, d->h.namesOffset + d->nameOffsets[id]) != 0){
+        RG_FREE(name);
+        return NULL;
+    }
+    return name;
+}
+
+static pthread_mutex_t diskLock = PTHREAD_MUTEX_INITIALIZER;
+static VecDisk* current = NULL;
+static bool building = false;
+
+VecDisk* VecDisk_Acquire(){
+    pthread_mutex_lock(&diskLock);
+    VecDisk* d = current;
+    if(d){
+        ++d->refs;
+    }
+    pthread_mutex_unlock(&diskLock);
+    return d;
+}
+
+void VecDisk_Release(VecDisk* d){
+    pthread_mutex_lock(&diskLock);
+    size_t refs = --d->refs;
+    pthread_mutex_unlock(&diskLock);
+    if(refs == 0){
+        VecDisk_Free(d);
+    }
+}
+
+void VecDisk_Set(VecDisk* d){
+    pthread_mutex_lock(&diskLock);
+    VecDisk* old = current;
+    d->refs = 1; // held by current
+    current = d;
+    pthread_mutex_unlock(&diskLock);
+    if(old){
+        VecDisk_Release(old);
+    }
+    // cached DISK results came from the old index
+    vec_generation_bump();
+}
+
+bool VecDisk_Building(){
+    return __atomic_load_n(&building, __ATOMIC_ACQUIRE);
+}
+
+typedef struct VecDiskBuildArgs{
+    char* path;
+    size_t degree;
+    size_t listSize;
+}VecDiskBuildArgs;
+
+static void* VecDisk_BuildThread(void* arg){
+    VecDiskBuildArgs* args = arg;
+
+    // copy the vectors and their names, the lock is held for a single holder at a time
+    RedisModuleCtx* ctx = RedisModule_GetThreadSafeContext(NULL);
+    size_t n = 0;
+    size_t cap = 0;
+    float* vecs = NULL;
+    char** names = NULL;
+    uint32_t* nameLens = NULL;
+    for(size_t h = 0 ; ; ++h){
+        RedisModule_ThreadSafeContextLock(ctx);
+        if(h >= array_len(vecList)){
+            RedisModule_ThreadSafeContextUnlock(ctx);
+            break;
+        }
+        VecsHolder* holder = vecList[h];
+        if(n + holder->size > cap){
+            cap = MAX(cap * 2, n + holder->size);
+            if(vecs){
+                vecs = RG_REALLOC(vecs, cap * VEC_SIZE * sizeof(float));
+                names = RG_REALLOC(names, cap * sizeof(*names));
+                nameLens = RG_REALLOC(nameLens, cap * sizeof(*nameLens));
+            }else{
+                vecs = RG_ALLOC(cap * VEC_SIZE * sizeof(float));
+                names = RG_ALLOC(cap * sizeof(*names));
+                nameLens = RG_ALLOC(cap * sizeof(*nameLens));
+            }
+        }
+        for(size_t i = 0 ; i < holder->size ; ++i){
+            const float* v = &HOLDER_VEC(holder, i);
+            VecKey* key = HOLDER_KEY(holder, i);
+            memcpy(&vecs[n * VEC_SIZE], v, VEC_SIZE * sizeof(float));
+            names[n] = RG_ALLOC(MAX(key->len, 1));
+            memcpy(names[n], key->name, key->len);
+            nameLens[n] = key->len;
+            ++n;
+        }
+        RedisModule_ThreadSafeContextUnlock(ctx);
+    }
+    RedisModule_FreeThreadSafeContext(ctx);
+
+    const char* err = NULL;
+    if(VecDisk_Build(args->path, vecs, names, nameLens, n, args->degree, args->listSize, &err) == REDISMODULE_OK){
+        VecDisk* d = VecDisk_Open(args->path, &err);
+        if(d){
+            VecDisk_Set(d);
+            RedisModule_Log(NULL, "notice", "Disk index built with %zu vectors on %s", n, args->path);
+        }
+    }
+    if(err){
+        RedisModule_Log(NULL, "warning", "Failed building the disk index on %s: %s", args->path, err);
+    }
+
+    for(size_t i = 0 ; i < n ; ++i){
+        RG_FREE(names[i]);
+    }
+    if(vecs){
+        RG_FREE(vecs);
+        RG_FREE(names);
+        RG_FREE(nameLens);
+    }
+    RG_FREE(args->path);
+    RG_FREE(args);
+
+    __atomic_store_n(&building, false, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+int VecDisk_StartBuild(const char* path, size_t degree, size_t listSize, const char** err){
+    if(__atomic_exchange_n(&building, true, __ATOMIC_ACQ_REL)){
+        *err = "A disk index build is already running";
+        return REDISMODULE_ERR;
+    }
+
+    VecDiskBuildArgs* args = RG_ALLOC(sizeof(*args));
+    args->path = RG_STRDUP(path);
+    args->degree = degree;
+    args->listSize = listSize;
+
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, VecDisk_BuildThread, args) != 0){
+        RG_FREE(args->path);
+        RG_FREE(args);
+        __atomic_store_n(&building, false, __ATOMIC_RELEASE);
+        *err = "Failed starting the disk index build";
+        return REDISMODULE_ERR;
+    }
+    pthread_detach(thread);
+    return REDISMODULE_OK;
+}
@@ -0,0 +1,78 @@
+/*
+ * vec_disk.h
+ *
+ * An SSD resident index (DiskANN). The vectors are linked by a Vamana graph which is
+ * kept on a file along with the full vectors, every node sits on a single sector next
+ * to its neighbors list. Only PQ codes of the vectors are kept in memory, a search
+ * walks the graph best first on the PQ scores reading a beam of nodes at a time
+ * (with io_uring when the kernel allows it, pread otherwise) and ranks the nodes it
+ * read on their full vectors.
+ *
+ * The index is built from a snapshot of the stored vectors by a background thread, or
+ * opened from a file built before, so it can be searched by shards that do not hold
+ * the vectors in memory. Writes made after the snapshot are not on the index.
+ */
+
+#ifndef SRC_VEC_DISK_H_
+#define SRC_VEC_DISK_H_
+
+#include "vec_store.h"
+#include "topk.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define VEC_DISK_DEFAULT_DEGREE 32
+#define VEC_DISK_DEFAULT_LIST 64
+
+typedef struct VecDisk VecDisk;
+
+/*
+ * Build an index of the n vectors (normalized) with their key names into path. The
+ * graph nodes have up to degree neighbors, listSize is the search list length used
+ * while building. On failure returns REDISMODULE_ERR and sets err (a static string).
+ */
+int VecDisk_Build(const char* path, const float* vecs, char** names, const uint32_t* nameLens, size_t n,
+                  size_t degree, size_t listSize, const char** err);
+
+/*
+ * Open an index file, the PQ codes are loaded to memory. Returns NULL and sets err
+ * (a static string) on failure.
+ */
+VecDisk* VecDisk_Open(const char* path, const char** err);
+void VecDisk_Free(VecDisk* d);
+
+size_t VecDisk_Size(VecDisk* d);
+size_t VecDisk_MemUsage(VecDisk* d);
+
+/*
+ * Search the best k vectors, the search list is at least listSize long. The results
+ * are written to out sorted ascending by score (as TopK_Sort) and their ids can be
+ * passed to VecDisk_Name. reads is set to the amount of nodes read. Returns the amount
+ * of results. Safe to call from any thread.
+ */
+size_t VecDisk_Search(VecDisk* d, const float* vec, size_t k, size_t listSize, TopKItem* out, size_t* reads);
+
+/*
+ * Read the key name of a node, returns NULL on a read error. Should be freed with RG_FREE.
+ */
+char* VecDisk_Name(VecDisk* d, uint32_t id, size_t* len);
+
+/*
+ * The index searched by RG.VEC_SIM DISK. Acquire returns it (or NULL) with a reference
+ * that should be released, so it is not freed while searched when a new one is set.
+ */
+VecDisk* VecDisk_Acquire();
+void VecDisk_Release(VecDisk* d);
+void VecDisk_Set(VecDisk* d);
+
+/*
+ * Snapshot the stored vectors (the lock is taken by the build thread) and build an
+ * index on path on a background thread, it replaces the current index once done.
+ * Returns REDISMODULE_ERR and sets err if a build is already running.
+ */
+int VecDisk_StartBuild(const char* path, size_t degree, size_t listSize, const char** err);
+
+bool VecDisk_Building();
+
+#endif /* SRC_VEC_DISK_H_ */
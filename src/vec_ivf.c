@@ -0,0 +1,373 @@
+#include "vec_ivf.h"
+#include "vec_config.h"
+#include "topk.h"
+#include "arr_rm_alloc.h"
+#include "redisgears_memory.h"
+#include <cblas.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
+
+// the centroids are trained on up to that many vectors per list
+#define VEC_IVF_SAMPLE_PER_LIST 256
+#define VEC_IVF_MAX_SAMPLE (64 * 1024)
+
+// the index is not trained before there are that many vectors per list
+#define VEC_IVF_MIN_PER_LIST 32
+
+#define VEC_IVF_ITERATIONS 10
+
+// the centroids are retrained once the amount of vectors grew by that factor
+#define VEC_IVF_RETRAIN_GROWTH 4
+
+// the amount of vectors assigned with a single matrix product
+#define VEC_IVF_TILE 256
+
+// the worker sleeps that long when there is nothing to do
+#define VEC_IVF_IDLE_USEC 10000
+
+// all but the worker only read those, under the lock
+static float* centroids = NULL;
+static size_t nLists = 0;
+static uint64_t epoch = 0;
+
+// the amount of vectors on the last training, only used by the worker
+static size_t trainedOn = 0;
+
+// where the worker stopped looking for unassigned slots
+static size_t cursorHolder = 0;
+static size_t cursorSlot = 0;
+
+size_t VecIvf_Lists(){
+    return nLists;
+}
+
+uint64_t VecIvf_Epoch(){
+    return epoch;
+}
+
+size_t VecIvf_MemUsage(){
+    return nLists * VEC_SIZE * sizeof(float);
+}
+
+uint8_t* VecIvf_Probe(const float* vec, size_t nprobe){
+    float* scores = RG_ALLOC(nLists * sizeof(float));
+    cblas_sgemv(CblasRowMajor, CblasNoTrans, nLists, VEC_SIZE, 1, centroids, VEC_SIZE, vec, 1, 0, scores, 1);
+
+    TopK* t = TopK_Create(MIN(nprobe, nLists));
+    for(size_t i = 0 ; i < nLists ; ++i){
+        TopK_Push(t, scores[i], i);
+    }
+    uint8_t* probe = RG_CALLOC(nLists, sizeof(*probe));
+    for(size_t i = 0 ; i < t->count ; ++i){
+        probe[t->items[i].id] = 1;
+    }
+
+    TopK_Free(t);
+    RG_FREE(scores);
+    return probe;
+}
+
+static bool VecIvf_HolderIndexed(VecsHolder* holder){
+    return holder->lists && holder->listsEpoch == epoch;
+}
+
+size_t VecIvf_Select(VecsHolder* holder, const uint8_t* probe, uint64_t* mask){
+    size_t words = (holder->size + 63) / 64;
+    if(!VecIvf_HolderIndexed(holder)){
+        // nothing on the holder is indexed, it is all scored
+        memset(mask, 0xff, words * sizeof(*mask));
+        if(holder->size % 64){
+            mask[words - 1] = (1ULL << (holder->size % 64)) - 1;
+        }
+        return holder->size;
+    }
+
+    memset(mask, 0, words * sizeof(*mask));
+    size_t selected = 0;
+    for(size_t i = 0 ; i < holder->size ; ++i){
+        uint16_t list = holder->lists[i];
+        if(list == VEC_LIST_NONE || probe[list]){
+            mask[i / 64] |= 1ULL << (i % 64);
+            ++selected;
+        }
+    }
+    return selected;
+}
+
+size_t VecIvf_Unindexed(VecsHolder* holder){
+    return VecIvf_HolderIndexed(holder) ? holder->unindexed : holder->size;
+}
+
+/*
+ * Set lists[i] to the closest of the k centroids to the i-th of the n vectors,
+ * buf should have room for VEC_IVF_TILE * k scores.
+ */
+static void VecIvf_Assign(const float* vecs, size_t n, const float* cents, size_t k, uint16_t* lists, float* buf){
+    for(size_t first = 0 ; first < n ; first += VEC_IVF_TILE){
+        size_t rows = MIN(VEC_IVF_TILE, n - first);
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, rows, k, VEC_SIZE, 1, &vecs[first * VEC_SIZE], VEC_SIZE,
+                    cents, VEC_SIZE, 0, buf, k);
+        for(size_t r = 0 ; r < rows ; ++r){
+            const float* s = &buf[r * k];
+            size_t best = 0;
+            for(size_t c = 1 ; c < k ; ++c){
+                if(s[c] > s[best]){
+                    best = c;
+                }
+            }
+            lists[first + r] = best;
+        }
+    }
+}
+
+/*
+ * Spherical k-means, the vectors are normalized so the centroids are kept normalized
+ * and a vector belongs to the centroid with the highest dot product.
+ */
+static float* VecIvf_KMeans(const float* sample, size_t n, size_t k){
+    float* cents = RG_ALLOC(k * VEC_SIZE * sizeof(float));
+    uint16_t* lists = RG_ALLOC(n * sizeof(*lists));
+    size_t* counts = RG_ALLOC(k * sizeof(*counts));
+    float* buf = RG_ALLOC(VEC_IVF_TILE * k * sizeof(float));
+
+    // start from evenly spread sample vectors
+    for(size_t c = 0 ; c < k ; ++c){
+        memcpy(&cents[c * VEC_SIZE], &sample[(c * n / k) * VEC_SIZE], VEC_SIZE * sizeof(float));
+    }
+
+    for(size_t iter = 0 ; iter < VEC_IVF_ITERATIONS ; ++iter){
+        VecIvf_Assign(sample, n, cents, k, lists, buf);
+
+        memset(cents, 0, k * VEC_SIZE * sizeof(float));
+        memset(counts, 0, k * sizeof(*counts));
+        for(size_t i = 0 ; i < n ; ++i){
+            cblas_saxpy(VEC_SIZE, 1, &sample[i * VEC_SIZE], 1, &cents[lists[i] * VEC_SIZE], 1);
+            ++counts[lists[i]];
+        }
+        for(size_t c = 0 ; c < k ; ++c){
+            float* cent = &cents[c * VEC_SIZE];
+            if(counts[c] == 0){
+                // an empty list, reseed it with some other sample vector
+                memcpy(cent, &sample[((c * 7919 + iter) % n) * VEC_SIZE], VEC_SIZE * sizeof(float));
+                continue;
+            }
+            float norm = cblas_snrm2(VEC_SIZE, cent, 1);
+            if(norm > 0){
+                cblas_sscal(VEC_SIZE, 1 / norm, cent, 1);
+            }
+        }
+    }
+
+    RG_FREE(buf);
+    RG_FREE(counts);
+    RG_FREE(lists);
+    return cents;
+}
+
+static size_t VecIvf_TotalVectors(){
+    size_t total = 0;
+    for(size_t i = 0 ; i < array_len(vecList) ; ++i){
+        total += vecList[i]->size;
+    }
+    return total;
+}
+
+/*
+ * Copy up to n evenly spread vectors into sample, the lock is held for a single
+ * holder at a time. Returns the amount of vectors copied.
+ */
+static size_t VecIvf_Sample(RedisModuleCtx* ctx, size_t total, size_t n, float* sample){
+    size_t stride = MAX(1, total / n);
+    size_t count = 0;
+    for(size_t h = 0 ; count < n ; ++h){
+        RedisModule_ThreadSafeContextLock(ctx);
+        if(h >= array_len(vecList)){
+            RedisModule_ThreadSafeContextUnlock(ctx);
+            break;
+        }
+        VecsHolder* holder = vecList[h];
+        for(size_t i = 0 ; i < holder->size && count < n ; i += stride){
+            memcpy(&sample[count++ * VEC_SIZE], &HOLDER_VEC(holder, i), VEC_SIZE * sizeof(float));
+        }
+        RedisModule_ThreadSafeContextUnlock(ctx);
+    }
+    return count;
+}
+
+/*
+ * Train k new centroids, the holders lists are reassigned lazily once the epoch changes.
+ */
+static bool VecIvf_Train(RedisModuleCtx* ctx, size_t k, size_t total){
+    size_t n = MIN(total, MIN(k * VEC_IVF_SAMPLE_PER_LIST, VEC_IVF_MAX_SAMPLE));
+    float* sample = RG_ALLOC(n * VEC_SIZE * sizeof(float));
+    n = VecIvf_Sample(ctx, total, n, sample);
+    if(n < k){
+        RG_FREE(sample);
+        return false;
+    }
+    float* cents = VecIvf_KMeans(sample, n, k);
+    RG_FREE(sample);
+
+    RedisModule_ThreadSafeContextLock(ctx);
+    if(centroids){
+        RG_FREE(centroids);
+    }
+    centroids = cents;
+    nLists = k;
+    ++epoch;
+    RedisModule_ThreadSafeContextUnlock(ctx);
+
+    trainedOn = total;
+    RedisModule_Log(NULL, "notice", "IVF index trained with %zu lists on %zu vectors", k, n);
+    return true;
+}
+
+/*
+ * Drop the index and free the holders lists, should be called under the lock.
+ */
+static void VecIvf_Drop(){
+    for(size_t i = 0 ; i < array_len(vecList) ; ++i){
+        VecsHolder* holder = vecList[i];
+        if(holder->lists){
+            RG_FREE(holder->lists);
+            holder->lists = NULL;
+            holder->unindexed = 0;
+        }
+    }
+    if(centroids){
+        RG_FREE(centroids);
+        centroids = NULL;
+    }
+    nLists = 0;
+    ++epoch;
+    trainedOn = 0;
+}
+
+/*
+ * Assign up to batch unassigned slots of a single holder to their lists. The vectors
+ * are copied under the lock and assigned outside of it, once we are back under the
+ * lock a slot is only updated if it is still unassigned and holds the same vector.
+ * Returns false if there was nothing to assign.
+ */
+static bool VecIvf_AssignBatch(RedisModuleCtx* ctx, size_t batch){
+    RedisModule_ThreadSafeContextLock(ctx);
+
+    VecsHolder* holder = NULL;
+    size_t h;
+    for(h = 0 ; h < array_len(vecList) ; ++h){
+        VecsHolder* curr = vecList[h];
+        if(!VecIvf_HolderIndexed(curr)){
+            // a new holder or its lists were assigned with older centroids
+            if(!curr->lists){
+                curr->lists = RG_ALLOC(VEC_HOLDER_SIZE * sizeof(*curr->lists));
+            }
+            memset(curr->lists, 0xff, VEC_HOLDER_SIZE * sizeof(*curr->lists));
+            curr->listsEpoch = epoch;
+            curr->unindexed = curr->size;
+        }
+        if(curr->unindexed > 0){
+            holder = curr;
+            break;
+        }
+    }
+    if(!holder){
+        RedisModule_ThreadSafeContextUnlock(ctx);
+        return false;
+    }
+
+    uint32_t* slots = RG_ALLOC(batch * sizeof(*slots));
+    float* vecs = RG_ALLOC(batch * VEC_SIZE * sizeof(float));
+    size_t from = h == cursorHolder && cursorSlot < holder->size ? cursorSlot : 0;
+    size_t n = 0;
+    size_t step;
+    for(step = 0 ; step < holder->size && n < batch ; ++step){
+        size_t i = (from + step) % holder->size;
+        if(holder->lists[i] == VEC_LIST_NONE){
+            slots[n] = i;
+            memcpy(&vecs[n * VEC_SIZE], &HOLDER_VEC(holder, i), VEC_SIZE * sizeof(float));
+            ++n;
+        }
+    }
+    cursorHolder = h;
+    cursorSlot = (from + step) % holder->size;
+    uint64_t assignEpoch = epoch;
+
+    RedisModule_ThreadSafeContextUnlock(ctx);
+
+    uint16_t* lists = RG_ALLOC(MAX(n, 1) * sizeof(*lists));
+    float* buf = RG_ALLOC(VEC_IVF_TILE * nLists * sizeof(float));
+    VecIvf_Assign(vecs, n, centroids, nLists, lists, buf);
+
+    RedisModule_ThreadSafeContextLock(ctx);
+    // the holder might have been freed, or even reallocated at the same address, in the
+    // meantime. Comparing the vectors protects from both.
+    if(h < array_len(vecList) && vecList[h] == holder && holder->listsEpoch == assignEpoch){
+        for(size_t i = 0 ; i < n ; ++i){
+            size_t slot = slots[i];
+            if(slot < holder->size && holder->lists[slot] == VEC_LIST_NONE &&
+               memcmp(&HOLDER_VEC(holder, slot), &vecs[i * VEC_SIZE], VEC_SIZE * sizeof(float)) == 0){
+                holder->lists[slot] = lists[i];
+                --holder->unindexed;
+            }
+        }
+    }
+    RedisModule_ThreadSafeContextUnlock(ctx);
+
+    RG_FREE(buf);
+    RG_FREE(lists);
+    RG_FREE(vecs);
+    RG_FREE(slots);
+    return n > 0;
+}
+
+/*
+ * A single unit of work, returns false if there was nothing to do.
+ */
+static bool VecIvf_Step(RedisModuleCtx* ctx){
+    // the k-means is spherical, there is no index on the metrics that keep the raw vectors
+    size_t k = vecMetric == VEC_METRIC_COSINE ? VecConfig_Get(VEC_CONFIG_IVF_LISTS) : 0;
+    if(k == 0){
+        if(nLists > 0){
+            RedisModule_ThreadSafeContextLock(ctx);
+            VecIvf_Drop();
+            RedisModule_ThreadSafeContextUnlock(ctx);
+        }
+        return false;
+    }
+
+    RedisModule_ThreadSafeContextLock(ctx);
+    size_t total = VecIvf_TotalVectors();
+    RedisModule_ThreadSafeContextUnlock(ctx);
+
+    bool stale = k != nLists || total >= trainedOn * VEC_IVF_RETRAIN_GROWTH;
+    if(stale && total >= k * VEC_IVF_MIN_PER_LIST){
+        return VecIvf_Train(ctx, k, total);
+    }
+    if(nLists == 0){
+        return false;
+    }
+    return VecIvf_AssignBatch(ctx, VecConfig_Get(VEC_CONFIG_IVF_BATCH_SIZE));
+}
+
+static void* VecIvf_Worker(void* arg){
+    RedisModuleCtx* ctx = RedisModule_GetThreadSafeContext(NULL);
+    while(true){
+        if(!VecIvf_Step(ctx)){
+            usleep(VEC_IVF_IDLE_USEC);
+        }
+    }
+    return NULL;
+}
+
+int VecIvf_StartWorker(){
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, VecIvf_Worker, NULL) != 0){
+        return REDISMODULE_ERR;
+    }
+    pthread_detach(thread);
+    return REDISMODULE_OK;
+}
@@ -0,0 +1,65 @@
+/*
+ * vec_ivf.h
+ *
+ * An IVF index over the holders. The vectors are clustered around ivf-lists centroids
+ * and every holder slot records the list of its closest centroid (see VecsHolder).
+ * A query with NPROBE scores only the slots on its nprobe closest lists plus all the
+ * slots that were not assigned to a list yet.
+ *
+ * Writes never wait for the index, new and updated vectors are just left unassigned
+ * and are always scored exactly. A background worker trains the centroids and assigns
+ * the unassigned slots in batches of ivf-batch-size, it copies the vectors under the
+ * lock and does the heavy work outside of it so writes keep their latency while the
+ * index is built or retrained.
+ */
+
+#ifndef SRC_VEC_IVF_H_
+#define SRC_VEC_IVF_H_
+
+#include "vec_store.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Start the background worker, called once on load.
+ */
+int VecIvf_StartWorker();
+
+/*
+ * The functions below should be called under the lock.
+ */
+
+/*
+ * The amount of lists of the current centroids, 0 while there is no index.
+ */
+size_t VecIvf_Lists();
+
+/*
+ * Bumped whenever the centroids change, a probe is only valid on the epoch it was
+ * computed on.
+ */
+uint64_t VecIvf_Epoch();
+
+/*
+ * Return the lists probed by vec, a byte per list which is set on its nprobe closest
+ * lists. Should be freed with RG_FREE.
+ */
+uint8_t* VecIvf_Probe(const float* vec, size_t nprobe);
+
+/*
+ * Set on mask the slots of the holder that are on a probed list or not assigned to
+ * any list, returns the amount of slots set.
+ */
+size_t VecIvf_Select(VecsHolder* holder, const uint8_t* probe, uint64_t* mask);
+
+/*
+ * The amount of slots of the holder that are not on the index yet.
+ */
+size_t VecIvf_Unindexed(VecsHolder* holder);
+
+/*
+ * The memory of the centroids, the lists are part of the holders.
+ */
+size_t VecIvf_MemUsage();
+
+#endif /* SRC_VEC_IVF_H_ */
@@ -0,0 +1,88 @@
+#include "vec_slowlog.h"
+#include "vec_config.h"
+#include <stdbool.h>
+#include "arr_rm_alloc.h"
+#include <pthread.h>
+#include <time.h>
+
+typedef struct VecSlowlogEntry{
+    long long id;
+    long long time;
+    uint64_t duration;
+    char* params;
+}VecSlowlogEntry;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static VecSlowlogEntry* entries = NULL; // oldest first
+static long long nextId = 0;
+
+/*
+ * Drop the oldest entries until at most maxLen are left, should be called with the lock held.
+ */
+static void VecSlowlog_Trim(size_t maxLen){
+    size_t len = array_len(entries);
+    if(len <= maxLen){
+        return;
+    }
+    size_t drop = len - maxLen;
+    for(size_t i = 0 ; i < drop ; ++i){
+        RG_FREE(entries[i].params);
+    }
+    memmove(entries, entries + drop, maxLen * sizeof(*entries));
+    entries = array_trimm_len(entries, maxLen);
+}
+
+void VecSlowlog_Add(uint64_t durationUsec, const char* params){
+    long long slowerThan = VecConfig_Get(VEC_CONFIG_SLOWLOG_LOG_SLOWER_THAN);
+    if(slowerThan < 0 || durationUsec < (uint64_t)slowerThan){
+        return;
+    }
+
+    VecSlowlogEntry e = {
+        .time = time(NULL),
+        .duration = durationUsec,
+        .params = RG_STRDUP(params),
+    };
+
+    pthread_mutex_lock(&lock);
+    if(!entries){
+        entries = array_new(VecSlowlogEntry, 16);
+    }
+    e.id = nextId++;
+    entries = array_append(entries, e);
+    VecSlowlog_Trim(VecConfig_Get(VEC_CONFIG_SLOWLOG_MAX_LEN));
+    pthread_mutex_unlock(&lock);
+}
+
+void VecSlowlog_Reply(RedisModuleCtx* ctx, long long count){
+    pthread_mutex_lock(&lock);
+    size_t len = array_len(entries);
+    if(count < 0 || count > len){
+        count = len;
+    }
+    RedisModule_ReplyWithArray(ctx, count);
+    for(long long i = 0 ; i < count ; ++i){
+        VecSlowlogEntry* e = &entries[len - 1 - i];
+        RedisModule_ReplyWithArray(ctx, 4);
+        RedisModule_ReplyWithLongLong(ctx, e->id);
+        RedisModule_ReplyWithLongLong(ctx, e->time);
+        RedisModule_ReplyWithLongLong(ctx, e->duration);
+        RedisModule_ReplyWithStringBuffer(ctx, e->params, strlen(e->params));
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+size_t VecSlowlog_Len(){
+    pthread_mutex_lock(&lock);
+    size_t len = array_len(entries);
+    pthread_mutex_unlock(&lock);
+    return len;
+}
+
+void VecSlowlog_Reset(){
+    pthread_mutex_lock(&lock);
+    if(entries){
+        VecSlowlog_Trim(0);
+    }
+    pthread_mutex_unlock(&lock);
+}
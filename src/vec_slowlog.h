@@ -0,0 +1,29 @@
+/*
+ * vec_slowlog.h
+ *
+ * Keeps the recent queries that took longer than slowlog-log-slower-than,
+ * up to slowlog-max-len entries (the oldest entries are dropped first).
+ */
+
+#ifndef SRC_VEC_SLOWLOG_H_
+#define SRC_VEC_SLOWLOG_H_
+
+#include "redismodule.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Add the query if it is slow enough, params is copied. Safe to call from any thread.
+ */
+void VecSlowlog_Add(uint64_t durationUsec, const char* params);
+
+/*
+ * Reply with the last count entries (all of them if count is negative), newest first.
+ * Each entry is [id, unix time, duration in microseconds, params].
+ */
+void VecSlowlog_Reply(RedisModuleCtx* ctx, long long count);
+
+size_t VecSlowlog_Len();
+void VecSlowlog_Reset();
+
+#endif /* SRC_VEC_SLOWLOG_H_ */
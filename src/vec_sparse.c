@@ -0,0 +1,475 @@
+#include "vec_sparse.h"
+#include "redismodule.h"
+#include "arr_rm_alloc.h"
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
+
+#define STR1(a) #a
+#define STR(e) STR1(e)
+
+// the lists are built again once the deleted documents are the majority, and at least that many
+#define VEC_SPARSE_MIN_REBUILD 1024
+
+// the bounds are summed in a different order than the scores, a bound has to miss by more than that
+#define VEC_SPARSE_EPSILON 1e-5f
+
+#define VEC_SPARSE_END UINT32_MAX
+
+typedef struct VecSparseBlock{
+    uint32_t last; // the last doc id of the block
+    uint32_t offset; // where the block starts on the list bytes
+}VecSparseBlock;
+
+typedef struct VecSparseList{
+    uint32_t count;
+    float max; // the highest and lowest weights on the list, they bound what the dimension adds to a score
+    float min;
+    VecSparseBlock* blocks;
+    uint8_t* bytes; // the doc ids deltas as varints, a block starts from the last doc id of the previous block
+    float* weights;
+}VecSparseList;
+
+static VecSparseList** lists = NULL; // indexed by dimension, NULL on dimensions no document has
+static size_t listsCap = 0;
+static VecSparseDoc** docs = NULL; // indexed by doc id, NULL on deleted documents
+static size_t live = 0;
+static size_t docsBytes = 0;
+static size_t scans = 0; // the running scans, see VecSparse_ScanStart
+static uint64_t epoch = 0;
+
+typedef struct VecSparseEntry{
+    uint32_t dim;
+    float weight;
+}VecSparseEntry;
+
+static int VecSparseEntry_Cmp(const void* a, const void* b){
+    uint32_t da = ((const VecSparseEntry*)a)->dim;
+    uint32_t db = ((const VecSparseEntry*)b)->dim;
+    return da < db ? -1 : da > db;
+}
+
+int VecSparse_Validate(const uint32_t* dims, const float* weights, size_t nnz, const char** err){
+    if(nnz == 0 || nnz > VEC_SPARSE_MAX_NNZ){
+        *err = "Sparse vector should have 1 to " STR(VEC_SPARSE_MAX_NNZ) " weights";
+        return REDISMODULE_ERR;
+    }
+    for(size_t i = 0 ; i < nnz ; ++i){
+        if(dims[i] >= VEC_SPARSE_MAX_DIM){
+            *err = "Sparse vector dimension is out of range";
+            return REDISMODULE_ERR;
+        }
+        if(!isfinite(weights[i])){
+            *err = "Sparse vector weights should be finite";
+            return REDISMODULE_ERR;
+        }
+    }
+    return REDISMODULE_OK;
+}
+
+size_t VecSparse_Sort(uint32_t* dims, float* weights, size_t nnz){
+    VecSparseEntry* entries = RG_ALLOC(sizeof(*entries) * MAX(nnz, 1));
+    for(size_t i = 0 ; i < nnz ; ++i){
+        entries[i] = (VecSparseEntry){.dim = dims[i], .weight = weights[i]};
+    }
+    qsort(entries, nnz, sizeof(*entries), VecSparseEntry_Cmp);
+
+    size_t n = 0;
+    for(size_t i = 0 ; i < nnz ; ++i){
+        if(n > 0 && dims[n - 1] == entries[i].dim){
+            weights[n - 1] += entries[i].weight;
+            continue;
+        }
+        dims[n] = entries[i].dim;
+        weights[n] = entries[i].weight;
+        ++n;
+    }
+    RG_FREE(entries);
+
+    size_t kept = 0;
+    for(size_t i = 0 ; i < n ; ++i){
+        if(weights[i] != 0){
+            dims[kept] = dims[i];
+            weights[kept] = weights[i];
+            ++kept;
+        }
+    }
+    return kept;
+}
+
+static VecSparseList* VecSparse_List(uint32_t dim){
+    if(dim >= listsCap){
+        size_t cap = MIN(MAX(listsCap * 2, dim + 1), VEC_SPARSE_MAX_DIM);
+        lists = lists ? RG_REALLOC(lists, cap * sizeof(*lists)) : RG_ALLOC(cap * sizeof(*lists));
+        memset(lists + listsCap, 0, (cap - listsCap) * sizeof(*lists));
+        listsCap = cap;
+    }
+    if(!lists[dim]){
+        VecSparseList* l = RG_ALLOC(sizeof(*l));
+        l->count = 0;
+        l->max = -INFINITY;
+        l->min = INFINITY;
+        l->blocks = array_new(VecSparseBlock, 1);
+        l->bytes = array_new(uint8_t, 16);
+        l->weights = array_new(float, 16);
+        lists[dim] = l;
+    }
+    return lists[dim];
+}
+
+static void VecSparse_Append(uint32_t dim, uint32_t id, float weight){
+    VecSparseList* l = VecSparse_List(dim);
+    uint32_t base = array_len(l->blocks) ? array_tail(l->blocks).last : 0;
+    if(l->count % VEC_SPARSE_BLOCK == 0){
+        l->blocks = array_append(l->blocks, ((VecSparseBlock){.last = id, .offset = array_len(l->bytes)}));
+    }
+
+    uint32_t delta = id - base;
+    uint32_t len = array_len(l->bytes);
+    l->bytes = array_ensure_cap(l->bytes, len + 5);
+    while(delta >= 0x80){
+        l->bytes[len++] = (delta & 0x7f) | 0x80;
+        delta >>= 7;
+    }
+    l->bytes[len++] = delta;
+    array_hdr(l->bytes)->len = len;
+
+    array_tail(l->blocks).last = id;
+    l->weights = array_append(l->weights, weight);
+    ++l->count;
+    l->max = MAX(l->max, weight);
+    l->min = MIN(l->min, weight);
+}
+
+static void VecSparse_Index(VecSparseDoc* doc){
+    for(size_t i = 0 ; i < doc->nnz ; ++i){
+        VecSparse_Append(doc->dims[i], doc->id, doc->weights[i]);
+    }
+}
+
+static void VecSparse_FreeLists(){
+    for(size_t i = 0 ; i < listsCap ; ++i){
+        VecSparseList* l = lists[i];
+        if(!l){
+            continue;
+        }
+        array_free(l->blocks);
+        array_free(l->bytes);
+        array_free(l->weights);
+        RG_FREE(l);
+    }
+    if(lists){
+        RG_FREE(lists);
+    }
+    lists = NULL;
+    listsCap = 0;
+}
+
+/*
+ * Renumber the live documents and build the lists again out of them.
+ */
+static void VecSparse_Rebuild(){
+    VecSparse_FreeLists();
+    size_t n = 0;
+    for(size_t id = 0 ; id < array_len(docs) ; ++id){
+        if(!docs[id]){
+            continue;
+        }
+        docs[n] = docs[id];
+        docs[n]->id = n;
+        VecSparse_Index(docs[n]);
+        ++n;
+    }
+    docs = array_trimm_cap(docs, n);
+}
+
+static void VecSparse_RebuildIfNeeded(){
+    size_t dead = array_len(docs) - live;
+    if(scans == 0 && dead >= VEC_SPARSE_MIN_REBUILD && dead > live){
+        VecSparse_Rebuild();
+    }
+}
+
+VecSparseDoc* VecSparse_Insert(const char* key, size_t len, const uint32_t* dims, const float* weights, size_t nnz){
+    VecSparseDoc* doc = RG_ALLOC(sizeof(*doc) + len);
+    doc->dims = RG_ALLOC(sizeof(*doc->dims) * nnz);
+    doc->weights = RG_ALLOC(sizeof(*doc->weights) * nnz);
+    memcpy(doc->dims, dims, sizeof(*doc->dims) * nnz);
+    memcpy(doc->weights, weights, sizeof(*doc->weights) * nnz);
+    doc->nnz = VecSparse_Sort(doc->dims, doc->weights, nnz);
+    doc->len = len;
+    memcpy(doc->name, key, len);
+
+    if(!docs){
+        docs = array_new(VecSparseDoc*, 1024);
+    }
+    doc->id = array_len(docs);
+    docs = array_append(docs, doc);
+    VecSparse_Index(doc);
+
+    ++live;
+    docsBytes += VecSparse_DocMemUsage(doc);
+    return doc;
+}
+
+static void VecSparse_FreeDoc(VecSparseDoc* doc){
+    RG_FREE(doc->dims);
+    RG_FREE(doc->weights);
+    RG_FREE(doc);
+}
+
+void VecSparse_Delete(VecSparseDoc* doc){
+    if(doc->id == VEC_SPARSE_DETACHED){
+        VecSparse_FreeDoc(doc);
+        return;
+    }
+
+    docs[doc->id] = NULL;
+    --live;
+    docsBytes -= VecSparse_DocMemUsage(doc);
+    VecSparse_FreeDoc(doc);
+
+    if(live == 0){
+        VecSparse_FreeLists();
+        array_free(docs);
+        docs = NULL;
+        ++epoch;
+        return;
+    }
+    VecSparse_RebuildIfNeeded();
+}
+
+void VecSparse_DetachAll(){
+    for(size_t id = 0 ; id < array_len(docs) ; ++id){
+        if(docs[id]){
+            docs[id]->id = VEC_SPARSE_DETACHED;
+        }
+    }
+    VecSparse_FreeLists();
+    if(docs){
+        array_free(docs);
+    }
+    docs = NULL;
+    live = 0;
+    docsBytes = 0;
+    ++epoch;
+}
+
+size_t VecSparse_Size(){
+    return live;
+}
+
+uint32_t VecSparse_IdEnd(){
+    return array_len(docs);
+}
+
+VecSparseDoc* VecSparse_Doc(uint32_t id){
+    return docs[id];
+}
+
+void VecSparse_ScanStart(){
+    ++scans;
+}
+
+void VecSparse_ScanEnd(){
+    --scans;
+    // a rebuild that was put off by the scan
+    if(docs){
+        VecSparse_RebuildIfNeeded();
+    }
+}
+
+uint64_t VecSparse_Epoch(){
+    return epoch;
+}
+
+size_t VecSparse_MemUsage(){
+    size_t bytes = docsBytes + listsCap * sizeof(*lists);
+    if(docs){
+        bytes += array_sizeof(array_hdr(docs));
+    }
+    for(size_t i = 0 ; i < listsCap ; ++i){
+        VecSparseList* l = lists[i];
+        if(l){
+            bytes += sizeof(*l) + array_sizeof(array_hdr(l->blocks)) + array_sizeof(array_hdr(l->bytes)) + array_sizeof(array_hdr(l->weights));
+        }
+    }
+    return bytes;
+}
+
+size_t VecSparse_DocMemUsage(const void* value){
+    const VecSparseDoc* doc = value;
+    return sizeof(*doc) + doc->len + doc->nnz * (sizeof(*doc->dims) + sizeof(*doc->weights));
+}
+
+/*
+ * A query dimension on its way through its posting list, one decoded block at a time.
+ */
+typedef struct VecSparseCursor{
+    const VecSparseList* list;
+    float weight; // the query weight
+    float bound; // the most the dimension adds to a score
+    uint32_t block;
+    uint32_t pos; // on the decoded block
+    uint32_t n; // the postings of the decoded block
+    uint32_t doc; // the current doc id, VEC_SPARSE_END once the list is done
+    uint32_t ids[VEC_SPARSE_BLOCK];
+}VecSparseCursor;
+
+static int VecSparseCursor_Cmp(const void* a, const void* b){
+    float ba = ((const VecSparseCursor*)a)->bound;
+    float bb = ((const VecSparseCursor*)b)->bound;
+    return ba < bb ? -1 : ba > bb;
+}
+
+static void VecSparseCursor_Decode(VecSparseCursor* c, uint32_t block){
+    const VecSparseList* l = c->list;
+    uint32_t id = block > 0 ? l->blocks[block - 1].last : 0;
+    const uint8_t* p = l->bytes + l->blocks[block].offset;
+    c->n = MIN(VEC_SPARSE_BLOCK, l->count - block * VEC_SPARSE_BLOCK);
+    for(uint32_t i = 0 ; i < c->n ; ++i){
+        uint32_t delta = 0;
+        int shift = 0;
+        uint8_t byte;
+        do{
+            byte = *(p++);
+            delta |= (uint32_t)(byte & 0x7f) << shift;
+            shift += 7;
+        }while(byte & 0x80);
+        id += delta;
+        c->ids[i] = id;
+    }
+    c->block = block;
+    c->pos = 0;
+    c->doc = c->ids[0];
+}
+
+static inline float VecSparseCursor_Score(const VecSparseCursor* c){
+    return c->weight * c->list->weights[c->block * VEC_SPARSE_BLOCK + c->pos];
+}
+
+static inline void VecSparseCursor_Next(VecSparseCursor* c){
+    if(++c->pos < c->n){
+        c->doc = c->ids[c->pos];
+    }else if(c->block + 1 < array_len(c->list->blocks)){
+        VecSparseCursor_Decode(c, c->block + 1);
+    }else{
+        c->doc = VEC_SPARSE_END;
+    }
+}
+
+/*
+ * Move to the first doc id >= target, the blocks that end before it are not decoded.
+ */
+static void VecSparseCursor_Seek(VecSparseCursor* c, uint32_t target){
+    if(c->doc >= target){
+        return;
+    }
+    const VecSparseList* l = c->list;
+    if(l->blocks[c->block].last < target){
+        uint32_t lo = c->block + 1, hi = array_len(l->blocks);
+        while(lo < hi){
+            uint32_t mid = (lo + hi) / 2;
+            if(l->blocks[mid].last < target){
+                lo = mid + 1;
+            }else{
+                hi = mid;
+            }
+        }
+        if(lo == array_len(l->blocks)){
+            c->doc = VEC_SPARSE_END;
+            return;
+        }
+        VecSparseCursor_Decode(c, lo);
+    }
+    while(c->ids[c->pos] < target){
+        ++c->pos;
+    }
+    c->doc = c->ids[c->pos];
+}
+
+size_t VecSparse_TopK(const uint32_t* dims, const float* weights, size_t nnz, uint32_t lo, uint32_t hi, float floor, TopK* t){
+    hi = MIN(hi, array_len(docs));
+    if(lo >= hi){
+        return 0;
+    }
+
+    VecSparseCursor* cursors = RG_ALLOC(sizeof(*cursors) * MAX(nnz, 1));
+    size_t m = 0;
+    for(size_t i = 0 ; i < nnz ; ++i){
+        VecSparseList* l = dims[i] < listsCap ? lists[dims[i]] : NULL;
+        if(!l || weights[i] == 0){
+            continue;
+        }
+        VecSparseCursor* c = &cursors[m++];
+        c->list = l;
+        c->weight = weights[i];
+        c->bound = MAX(0, weights[i] > 0 ? weights[i] * l->max : weights[i] * l->min);
+    }
+
+    // the lowest bounds first, sums[i] bounds what the cursors up to i add together
+    qsort(cursors, m, sizeof(*cursors), VecSparseCursor_Cmp);
+    float* sums = RG_ALLOC(sizeof(*sums) * MAX(m, 1));
+    for(size_t i = 0 ; i < m ; ++i){
+        sums[i] = (i > 0 ? sums[i - 1] : 0) + cursors[i].bound;
+        VecSparseCursor_Decode(&cursors[i], 0);
+        VecSparseCursor_Seek(&cursors[i], lo);
+    }
+
+    // the cursors before essential can not get a document above bar on their own
+    float bar = MAX(floor, TopK_Threshold(t));
+    size_t essential = 0;
+    while(essential < m && sums[essential] + VEC_SPARSE_EPSILON <= bar){
+        ++essential;
+    }
+
+    size_t scored = 0;
+    while(essential < m){
+        uint32_t doc = VEC_SPARSE_END;
+        for(size_t i = essential ; i < m ; ++i){
+            doc = MIN(doc, cursors[i].doc);
+        }
+        if(doc >= hi){
+            break;
+        }
+
+        float score = 0;
+        for(size_t i = essential ; i < m ; ++i){
+            if(cursors[i].doc == doc){
+                score += VecSparseCursor_Score(&cursors[i]);
+                VecSparseCursor_Next(&cursors[i]);
+            }
+        }
+        if(!docs[doc]){
+            continue;
+        }
+
+        // the other cursors are probed best bound first, as long as the document can still make it
+        size_t i = essential;
+        for( ; i > 0 ; --i){
+            if(score + sums[i - 1] + VEC_SPARSE_EPSILON <= bar){
+                break;
+            }
+            VecSparseCursor* c = &cursors[i - 1];
+            VecSparseCursor_Seek(c, doc);
+            if(c->doc == doc){
+                score += VecSparseCursor_Score(c);
+            }
+        }
+        ++scored;
+
+        if(i == 0 && score > bar && TopK_Push(t, score, doc)){
+            bar = MAX(floor, TopK_Threshold(t));
+            while(essential < m && sums[essential] + VEC_SPARSE_EPSILON <= bar){
+                ++essential;
+            }
+        }
+    }
+
+    RG_FREE(sums);
+    RG_FREE(cursors);
+    return scored;
+}
@@ -0,0 +1,106 @@
+/*
+ * vec_sparse.h
+ *
+ * Sparse vectors (e.g. SPLADE), a few hundred non zero weights out of a vocabulary
+ * of many thousands of dimensions. They are not kept on the holders, every document
+ * gets a doc id and every dimension a posting list of the documents that have it,
+ * the doc ids are delta encoded as varints in blocks of VEC_SPARSE_BLOCK postings and
+ * the weights are kept next to them.
+ *
+ * A query scores the inner product by MaxScore: the query dimensions are ordered by
+ * the most they can add to a score (the query weight times the list max weight), the
+ * lists whose bounds sum up to less than the k-th best score so far can not make a
+ * document by themselves and are only probed (skipping whole blocks) for documents
+ * found on the other lists that can still make it.
+ *
+ * Deleted documents leave their postings behind until they are the majority, then
+ * the lists are built again out of the live documents (once no scan is running). All
+ * the functions should be called under the lock.
+ */
+
+#ifndef SRC_VEC_SPARSE_H_
+#define SRC_VEC_SPARSE_H_
+
+#include "topk.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define VEC_SPARSE_MAX_DIM (1 << 20) // the dimensions are below it
+#define VEC_SPARSE_MAX_NNZ 4096
+#define VEC_SPARSE_BLOCK 128
+#define VEC_SPARSE_RANGE (1 << 16) // the doc ids searched per lock hold
+
+typedef struct VecSparseDoc{
+    uint32_t id; // VEC_SPARSE_DETACHED once the index was freed
+    uint32_t nnz;
+    uint32_t* dims; // ascending
+    float* weights;
+    uint32_t len;
+    char name[];
+}VecSparseDoc;
+
+#define VEC_SPARSE_DETACHED UINT32_MAX
+
+/*
+ * Check the dimensions and weights of a sparse vector, on failure returns
+ * REDISMODULE_ERR and sets err (a static string).
+ */
+int VecSparse_Validate(const uint32_t* dims, const float* weights, size_t nnz, const char** err);
+
+/*
+ * Sort a valid sparse vector by dimension in place, the weights of a dimension given
+ * more than once are summed and zero weights are dropped. Returns the amount of
+ * weights left.
+ */
+size_t VecSparse_Sort(uint32_t* dims, float* weights, size_t nnz);
+
+/*
+ * Add a document (a valid sparse vector) with the given key name, the key name and
+ * the vector are copied and sorted (see VecSparse_Sort).
+ */
+VecSparseDoc* VecSparse_Insert(const char* key, size_t len, const uint32_t* dims, const float* weights, size_t nnz);
+
+/*
+ * Free the document, its postings are left until the lists are built again.
+ */
+void VecSparse_Delete(VecSparseDoc* doc);
+
+/*
+ * Free the posting lists and leave the documents detached, they should still be
+ * deleted (used on flush).
+ */
+void VecSparse_DetachAll();
+
+/*
+ * The amount of documents, the doc ids are below VecSparse_IdEnd.
+ */
+size_t VecSparse_Size();
+uint32_t VecSparse_IdEnd();
+
+/*
+ * The document of a doc id, NULL if it was deleted.
+ */
+VecSparseDoc* VecSparse_Doc(uint32_t id);
+
+/*
+ * A scan that releases the lock between ranges is wrapped with ScanStart and ScanEnd,
+ * meanwhile the lists are not built again so the doc ids stay in place. The epoch
+ * changes when the doc ids start over (on flush or once all the documents were
+ * deleted), a scan should stop then.
+ */
+void VecSparse_ScanStart();
+void VecSparse_ScanEnd();
+uint64_t VecSparse_Epoch();
+
+size_t VecSparse_MemUsage();
+size_t VecSparse_DocMemUsage(const void* value);
+
+/*
+ * Offer the documents with ids in [lo, hi) whose inner product with the query (a
+ * sorted sparse vector, see VecSparse_Sort) scores above floor to t (the ids are the
+ * doc ids), by MaxScore. The result is the same as scoring all of them. Returns the
+ * amount of documents scored.
+ */
+size_t VecSparse_TopK(const uint32_t* dims, const float* weights, size_t nnz, uint32_t lo, uint32_t hi, float floor, TopK* t);
+
+#endif /* SRC_VEC_SPARSE_H_ */
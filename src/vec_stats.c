@@ -0,0 +1,129 @@
+#include "vec_stats.h"
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+typedef struct VecRate{
+    uint64_t total;
+    uint64_t secs[VEC_RATE_WINDOW + 1];
+    uint64_t counts[VEC_RATE_WINDOW + 1];
+}VecRate;
+
+static VecHist stages[VEC_STAGE_COUNT];
+static VecRate counters[VEC_COUNTER_COUNT];
+
+static const char* stageNames[VEC_STAGE_COUNT] = {
+    [VEC_STAGE_LOCK_WAIT] = "lock_wait",
+    [VEC_STAGE_SCAN] = "scan",
+    [VEC_STAGE_TOPK] = "topk",
+    [VEC_STAGE_COLLECT] = "collect",
+    [VEC_STAGE_REPLY] = "reply",
+    [VEC_STAGE_TOTAL] = "total",
+};
+
+#define ATOMIC_ADD(p, v) __atomic_fetch_add(p, v, __ATOMIC_RELAXED)
+#define ATOMIC_LOAD(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+
+uint64_t VecStats_Now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Values below 32 get a bucket each, above that the 4 bits following
+ * the most significant bit select the bucket inside its power of two.
+ */
+static size_t VecHist_Bucket(uint64_t value){
+    if(value < 2 * VEC_HIST_SUB_BUCKETS){
+        return value;
+    }
+    int shift = 63 - __builtin_clzll(value) - 4;
+    return (shift + 1) * VEC_HIST_SUB_BUCKETS + (value >> shift) - VEC_HIST_SUB_BUCKETS;
+}
+
+static uint64_t VecHist_BucketHighest(size_t bucket){
+    if(bucket < 2 * VEC_HIST_SUB_BUCKETS){
+        return bucket;
+    }
+    int shift = bucket / VEC_HIST_SUB_BUCKETS - 1;
+    uint64_t sub = VEC_HIST_SUB_BUCKETS + bucket % VEC_HIST_SUB_BUCKETS;
+    return ((sub + 1) << shift) - 1;
+}
+
+void VecHist_Record(VecHist* h, uint64_t value){
+    ATOMIC_ADD(&h->buckets[VecHist_Bucket(value)], 1);
+    ATOMIC_ADD(&h->count, 1);
+    ATOMIC_ADD(&h->sum, value);
+    uint64_t max = ATOMIC_LOAD(&h->max);
+    while(value > max && !__atomic_compare_exchange_n(&h->max, &max, value, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+uint64_t VecHist_Percentile(const VecHist* h, double percentile){
+    uint64_t count = ATOMIC_LOAD(&h->count);
+    if(count == 0){
+        return 0;
+    }
+    uint64_t target = (uint64_t)(count * percentile / 100);
+    if(target == 0){
+        target = 1;
+    }
+    uint64_t seen = 0;
+    for(size_t i = 0 ; i < VEC_HIST_BUCKETS ; ++i){
+        seen += ATOMIC_LOAD(&h->buckets[i]);
+        if(seen >= target){
+            uint64_t res = VecHist_BucketHighest(i);
+            uint64_t max = ATOMIC_LOAD(&h->max);
+            return res < max ? res : max;
+        }
+    }
+    return ATOMIC_LOAD(&h->max);
+}
+
+void VecStats_RecordStage(VecStage stage, uint64_t usec){
+    VecHist_Record(&stages[stage], usec);
+}
+
+const VecHist* VecStats_GetStage(VecStage stage){
+    return &stages[stage];
+}
+
+const char* VecStats_StageName(VecStage stage){
+    return stageNames[stage];
+}
+
+void VecStats_Incr(VecCounter counter){
+    VecRate* r = &counters[counter];
+    uint64_t sec = VecStats_Now() / 1000000;
+    size_t slot = sec % (VEC_RATE_WINDOW + 1);
+    // a slot left from an older second is reset on first use, losing
+    // a concurrent increment here is fine for a rate estimation
+    if(ATOMIC_LOAD(&r->secs[slot]) != sec){
+        __atomic_store_n(&r->counts[slot], 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&r->secs[slot], sec, __ATOMIC_RELAXED);
+    }
+    ATOMIC_ADD(&r->counts[slot], 1);
+    ATOMIC_ADD(&r->total, 1);
+}
+
+uint64_t VecStats_Count(VecCounter counter){
+    return ATOMIC_LOAD(&counters[counter].total);
+}
+
+double VecStats_Rate(VecCounter counter){
+    VecRate* r = &counters[counter];
+    uint64_t sec = VecStats_Now() / 1000000;
+    uint64_t sum = 0;
+    for(size_t i = 0 ; i < VEC_RATE_WINDOW + 1 ; ++i){
+        uint64_t slotSec = ATOMIC_LOAD(&r->secs[i]);
+        if(slotSec < sec && slotSec + VEC_RATE_WINDOW >= sec){
+            sum += ATOMIC_LOAD(&r->counts[i]);
+        }
+    }
+    return (double)sum / VEC_RATE_WINDOW;
+}
+
+void VecStats_Reset(){
+    memset(stages, 0, sizeof(stages));
+    memset(counters, 0, sizeof(counters));
+}
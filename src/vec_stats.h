@@ -0,0 +1,70 @@
+/*
+ * vec_stats.h
+ *
+ * Counters and latency histograms of the vector commands. The histograms are
+ * log-linear (HDR style), each power of two is split into 16 equal buckets so
+ * every recorded value is kept with about 6% precision.
+ */
+
+#ifndef SRC_VEC_STATS_H_
+#define SRC_VEC_STATS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define VEC_HIST_SUB_BUCKETS 16
+#define VEC_HIST_BUCKETS ((64 - 3) * VEC_HIST_SUB_BUCKETS)
+
+/* rates are averaged over this many seconds (the current second is not counted) */
+#define VEC_RATE_WINDOW 10
+
+typedef enum VecStage{
+    VEC_STAGE_LOCK_WAIT, // waiting for the redis lock while scanning
+    VEC_STAGE_SCAN, // distance calculation
+    VEC_STAGE_TOPK, // top k selection out of the scores
+    VEC_STAGE_COLLECT, // sending the shards results to the initiator and merging them
+    VEC_STAGE_REPLY, // reply serialization
+    VEC_STAGE_TOTAL, // the entire execution
+    VEC_STAGE_COUNT,
+}VecStage;
+
+typedef enum VecCounter{
+    VEC_COUNTER_QUERIES,
+    VEC_COUNTER_INSERTS,
+    VEC_COUNTER_COUNT,
+}VecCounter;
+
+typedef struct VecHist{
+    uint64_t buckets[VEC_HIST_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+}VecHist;
+
+/*
+ * Monotonic time in microseconds.
+ */
+uint64_t VecStats_Now();
+
+void VecHist_Record(VecHist* h, uint64_t value);
+
+/*
+ * Return the highest value equivalent to the given percentile (0-100).
+ */
+uint64_t VecHist_Percentile(const VecHist* h, double percentile);
+
+void VecStats_RecordStage(VecStage stage, uint64_t usec);
+const VecHist* VecStats_GetStage(VecStage stage);
+const char* VecStats_StageName(VecStage stage);
+
+void VecStats_Incr(VecCounter counter);
+uint64_t VecStats_Count(VecCounter counter);
+
+/*
+ * Per second rate of the counter over the last VEC_RATE_WINDOW seconds.
+ */
+double VecStats_Rate(VecCounter counter);
+
+void VecStats_Reset();
+
+#endif /* SRC_VEC_STATS_H_ */
@@ -0,0 +1,924 @@
+#include "vec_store.h"
+#include "arr_rm_alloc.h"
+#include <cblas.h>
+#include <strings.h>
+#include <float.h>
+#include <math.h>
+
+VecsHolder** vecList = NULL;
+VecsHolder** multiList = NULL;
+
+VecMetric vecMetric = VEC_METRIC_COSINE;
+
+static const char* metricNames[VEC_METRIC_COUNT] = {
+    [VEC_METRIC_COSINE] = "COSINE",
+    [VEC_METRIC_IP] = "IP",
+    [VEC_METRIC_L2] = "L2",
+};
+
+size_t vecKeysBytes = 0;
+size_t vecDTsBytes = 0;
+
+static uint64_t generation = 0;
+
+// new holders get their prefixes, see vec_prefixes_set
+static bool vecPrefixes = false;
+
+#define VEC_DT_CHUNK_SIZE (64 * 1024)
+
+/*
+ * A free VecDT slot links to the next free one.
+ */
+typedef union VecDTSlot{
+    VecDT vDT;
+    union VecDTSlot* next;
+}VecDTSlot;
+
+static VecDTSlot** vecDTChunks = NULL;
+static VecDTSlot* vecDTFree = NULL;
+static size_t vecDTCount = 0;
+
+/*
+ * Chunks of VecDTs detached on flush. The keys might be freed by the lazyfree thread
+ * so it only decrements the count, the chunks are freed by the main thread once it is 0.
+ */
+static VecDTSlot** vecDTRetired = NULL;
+static size_t vecDTRetiredCount = 0;
+
+static void vec_dt_reclaim(){
+    if(!vecDTRetired || __atomic_load_n(&vecDTRetiredCount, __ATOMIC_ACQUIRE) > 0){
+        return;
+    }
+    for(size_t i = 0 ; i < array_len(vecDTRetired) ; ++i){
+        RG_FREE(vecDTRetired[i]);
+    }
+    vecDTsBytes -= array_len(vecDTRetired) * sizeof(VecDTSlot) * VEC_DT_CHUNK_SIZE;
+    array_free(vecDTRetired);
+    vecDTRetired = NULL;
+}
+
+static VecDT* vec_dt_alloc(){
+    vec_dt_reclaim();
+    if(!vecDTFree){
+        VecDTSlot* chunk = RG_ALLOC(sizeof(*chunk) * VEC_DT_CHUNK_SIZE);
+        vecDTsBytes += sizeof(*chunk) * VEC_DT_CHUNK_SIZE;
+        if(!vecDTChunks){
+            vecDTChunks = array_new(VecDTSlot*, 1);
+        }
+        vecDTChunks = array_append(vecDTChunks, chunk);
+        for(size_t i = VEC_DT_CHUNK_SIZE ; i > 0 ; --i){
+            chunk[i - 1].next = vecDTFree;
+            vecDTFree = &chunk[i - 1];
+        }
+    }
+    VecDTSlot* slot = vecDTFree;
+    vecDTFree = slot->next;
+    ++vecDTCount;
+    return &slot->vDT;
+}
+
+static void vec_dt_free(VecDT* vDT){
+    VecDTSlot* slot = (VecDTSlot*)vDT;
+    slot->next = vecDTFree;
+    vecDTFree = slot;
+
+    if(--vecDTCount > 0){
+        return;
+    }
+
+    // no more keys, give the slab back
+    for(size_t i = 0 ; i < array_len(vecDTChunks) ; ++i){
+        RG_FREE(vecDTChunks[i]);
+    }
+    vecDTsBytes -= array_len(vecDTChunks) * sizeof(VecDTSlot) * VEC_DT_CHUNK_SIZE;
+    array_free(vecDTChunks);
+    vecDTChunks = NULL;
+    vecDTFree = NULL;
+}
+
+/*
+ * Move all the VecDTs chunks aside, called after all the keys were detached.
+ */
+static void vec_dt_retire(){
+    vec_dt_reclaim();
+    if(!vecDTChunks){
+        return;
+    }
+    if(!vecDTRetired){
+        vecDTRetired = array_new(VecDTSlot*, array_len(vecDTChunks));
+    }
+    for(size_t i = 0 ; i < array_len(vecDTChunks) ; ++i){
+        vecDTRetired = array_append(vecDTRetired, vecDTChunks[i]);
+    }
+    __atomic_add_fetch(&vecDTRetiredCount, vecDTCount, __ATOMIC_RELEASE);
+    array_free(vecDTChunks);
+    vecDTChunks = NULL;
+    vecDTFree = NULL;
+    vecDTCount = 0;
+}
+
+#define VEC_KEYS_BLOCK_SIZE (64 * 1024)
+
+#define VEC_KEY_SIZE(len) ((sizeof(VecKey) + (len) + 7) & ~((size_t)7))
+
+typedef struct VecKeysBlock{
+    size_t cap;
+    size_t used;
+    size_t live; // bytes of the keys that were not freed yet
+    char data[];
+}VecKeysBlock;
+
+// the keys arena blocks, freed blocks leave a NULL slot to be reused
+static VecKeysBlock** keyBlocks = NULL;
+static uint32_t keyBlockCurr = 0;
+
+static void vec_keys_free_block(uint32_t id){
+    vecKeysBytes -= sizeof(VecKeysBlock) + keyBlocks[id]->cap;
+    RG_FREE(keyBlocks[id]);
+    keyBlocks[id] = NULL;
+}
+
+static uint32_t vec_keys_new_block(size_t cap){
+    VecKeysBlock* block = RG_ALLOC(sizeof(*block) + cap);
+    block->cap = cap;
+    block->used = 0;
+    block->live = 0;
+    vecKeysBytes += sizeof(*block) + cap;
+
+    if(!keyBlocks){
+        keyBlocks = array_new(VecKeysBlock*, 16);
+    }
+    for(uint32_t i = 0 ; i < array_len(keyBlocks) ; ++i){
+        if(!keyBlocks[i]){
+            keyBlocks[i] = block;
+            return i;
+        }
+    }
+    keyBlocks = array_append(keyBlocks, block);
+    return array_len(keyBlocks) - 1;
+}
+
+static VecKey* vec_keys_alloc(VecDT* vDT, const char* name, size_t len){
+    size_t size = VEC_KEY_SIZE(len);
+    VecKeysBlock* block = keyBlocks ? keyBlocks[keyBlockCurr] : NULL;
+    if(!block || block->used + size > block->cap){
+        uint32_t prev = keyBlockCurr;
+        keyBlockCurr = vec_keys_new_block(size > VEC_KEYS_BLOCK_SIZE ? size : VEC_KEYS_BLOCK_SIZE);
+        if(block && block->live == 0){
+            vec_keys_free_block(prev);
+        }
+        block = keyBlocks[keyBlockCurr];
+    }
+
+    VecKey* key = (VecKey*)(block->data + block->used);
+    block->used += size;
+    block->live += size;
+    key->vDT = vDT;
+    key->len = len;
+    key->block = keyBlockCurr;
+    memcpy(key->name, name, len);
+    return key;
+}
+
+/*
+ * Point all the slots of the multi vector document of key to its moved key name.
+ */
+static void vec_multi_rekey(VecKey* key, VecKey* moved){
+    VecsHolder* holder = VEC_MULTI_HOLDER(key->vDT);
+    for(size_t i = key->vDT->index ; i < holder->size && HOLDER_KEY(holder, i) == key ; ++i){
+        HOLDER_KEY(holder, i) = moved;
+    }
+}
+
+/*
+ * Move the live keys of the block to the current block and free it.
+ */
+static void vec_keys_compact(uint32_t id){
+    VecKeysBlock* block = keyBlocks[id];
+    for(size_t offset = 0 ; offset < block->used ; ){
+        VecKey* key = (VecKey*)(block->data + offset);
+        offset += VEC_KEY_SIZE(key->len);
+        if(!key->vDT){
+            continue;
+        }
+        VecKey* moved = vec_keys_alloc(key->vDT, key->name, key->len);
+        if(key->vDT->holder & VEC_DT_MULTI){
+            vec_multi_rekey(key, moved);
+        }else{
+            HOLDER_KEY(VEC_DT_HOLDER(key->vDT), key->vDT->index) = moved;
+        }
+    }
+    vec_keys_free_block(id);
+}
+
+static void vec_keys_free(VecKey* key){
+    uint32_t id = key->block;
+    VecKeysBlock* block = keyBlocks[id];
+    block->live -= VEC_KEY_SIZE(key->len);
+    key->vDT = NULL;
+
+    if(id == keyBlockCurr){
+        return;
+    }
+    if(block->live == 0){
+        vec_keys_free_block(id);
+    }else if(block->live < block->used / 2){
+        vec_keys_compact(id);
+    }
+}
+
+static void vec_keys_free_all(){
+    if(!keyBlocks){
+        return;
+    }
+    for(size_t i = 0 ; i < array_len(keyBlocks) ; ++i){
+        if(keyBlocks[i]){
+            vec_keys_free_block(i);
+        }
+    }
+    array_free(keyBlocks);
+    keyBlocks = NULL;
+    keyBlockCurr = 0;
+}
+
+uint64_t vec_generation(){
+    return __atomic_load_n(&generation, __ATOMIC_RELAXED);
+}
+
+void vec_generation_bump(){
+    __atomic_add_fetch(&generation, 1, __ATOMIC_RELAXED);
+}
+
+int vec_metric_set(VecMetric metric){
+    if(vecList || multiList){
+        return REDISMODULE_ERR;
+    }
+    vecMetric = metric;
+    vec_generation_bump();
+    return REDISMODULE_OK;
+}
+
+const char* vec_metric_name(VecMetric metric){
+    return metricNames[metric];
+}
+
+int vec_metric_find(const char* name){
+    for(int i = 0 ; i < VEC_METRIC_COUNT ; ++i){
+        if(strcasecmp(metricNames[i], name) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+void vec_set_data(float* v, const float* data){
+    memcpy(v, data, sizeof(float) * VEC_SIZE);
+    if(vecMetric != VEC_METRIC_COSINE){
+        return;
+    }
+
+    float demon = cblas_snrm2(VEC_SIZE, v, 1);
+    if(!(demon > 0)){
+        // a zero vector has no direction, it scores 0 against everything
+        memset(v, 0, sizeof(float) * VEC_SIZE);
+        return;
+    }
+
+    for(size_t i = 0 ; i < VEC_SIZE ; ++i){
+        v[i] /= demon;
+    }
+}
+
+void vec_set_prefix(float* p, const float* v){
+    float norm = cblas_snrm2(VEC_PREFIX_DIMS, v, 1);
+    for(size_t i = 0 ; i < VEC_PREFIX_DIMS ; ++i){
+        p[i] = norm > 0 ? v[i] / norm : 0;
+    }
+}
+
+/*
+ * Set the vector of the slot along with its norms and prefix.
+ */
+static void vec_set_slot(VecsHolder* holder, size_t index, const float* data){
+    float* v = &HOLDER_VEC(holder, index);
+    vec_set_data(v, data);
+    holder->residuals[index] = cblas_snrm2(VEC_SIZE - VEC_PREFIX_DIMS, v + VEC_PREFIX_DIMS, 1);
+    holder->sqnorms[index] = cblas_sdot(VEC_SIZE, v, 1, v, 1);
+    if(holder->prefixes){
+        vec_set_prefix(&holder->prefixes[index * VEC_PREFIX_DIMS], v);
+    }
+}
+
+static VecsHolder* vec_holder_create(){
+    VecsHolder* holder = RG_CALLOC(1, sizeof(VecsHolder));
+    if(vecPrefixes){
+        holder->prefixes = RG_ALLOC(VEC_HOLDER_SIZE * VEC_PREFIX_DIMS * sizeof(float));
+    }
+    return holder;
+}
+
+VecDT* vec_insert(const char* key, size_t len, const float* data){
+    VecsHolder* holder = NULL;
+    if(!vecList){
+        vecList = array_new(VecsHolder*, 1);
+    }
+    if(array_len(vecList) == 0){
+        holder = vec_holder_create();
+        vecList = array_append(vecList, holder);
+    }else{
+        holder = vecList[array_len(vecList) - 1];
+    }
+
+    if(holder->size >= VEC_HOLDER_SIZE){
+        // we need to create a new holder
+        holder = vec_holder_create();
+        vecList = array_append(vecList, holder);
+    }
+
+    vec_set_slot(holder, holder->size, data);
+    if(holder->lists){
+        holder->lists[holder->size] = VEC_LIST_NONE;
+        ++holder->unindexed;
+    }
+
+    VecDT* vDT = vec_dt_alloc();
+    vDT->holder = array_len(vecList) - 1;
+    vDT->index = holder->size;
+    HOLDER_KEY(holder, holder->size) = vec_keys_alloc(vDT, key, len);
+
+    ++holder->size;
+    vec_generation_bump();
+
+    return vDT;
+}
+
+bool vec_same_data(const VecDT* vDT, const float* data){
+    float v[VEC_SIZE];
+    vec_set_data(v, data);
+    return memcmp(v, &HOLDER_VEC(VEC_DT_HOLDER(vDT), vDT->index), sizeof(v)) == 0;
+}
+
+void vec_update(VecDT* vDT, const float* data){
+    VecsHolder* holder = VEC_DT_HOLDER(vDT);
+    vec_set_slot(holder, vDT->index, data);
+    if(holder->lists && holder->lists[vDT->index] != VEC_LIST_NONE){
+        // the vector might belong to another list now
+        holder->lists[vDT->index] = VEC_LIST_NONE;
+        ++holder->unindexed;
+    }
+    vec_generation_bump();
+}
+
+VecDT* vec_multi_insert(const char* key, size_t len, const float* data, size_t n){
+    if(!multiList){
+        multiList = array_new(VecsHolder*, 1);
+    }
+    VecsHolder* holder = array_len(multiList) > 0 ? multiList[array_len(multiList) - 1] : NULL;
+    if(!holder || holder->size + n > VEC_HOLDER_SIZE){
+        // the document slots must be contiguous, start a new holder
+        holder = vec_holder_create();
+        multiList = array_append(multiList, holder);
+    }
+
+    VecDT* vDT = vec_dt_alloc();
+    vDT->holder = (array_len(multiList) - 1) | VEC_DT_MULTI;
+    vDT->index = holder->size;
+    VecKey* k = vec_keys_alloc(vDT, key, len);
+    for(size_t i = 0 ; i < n ; ++i){
+        vec_set_slot(holder, holder->size, data + i * VEC_SIZE);
+        HOLDER_KEY(holder, holder->size) = k;
+        ++holder->size;
+    }
+    vec_generation_bump();
+
+    return vDT;
+}
+
+size_t vec_multi_count(const VecDT* vDT){
+    VecsHolder* holder = VEC_MULTI_HOLDER(vDT);
+    VecKey* key = HOLDER_KEY(holder, vDT->index);
+    size_t i = vDT->index;
+    while(i < holder->size && HOLDER_KEY(holder, i) == key){
+        ++i;
+    }
+    return i - vDT->index;
+}
+
+/*
+ * Take the IVF list of the slot out of the holder, returns the list.
+ */
+static uint16_t vec_lists_take(VecsHolder* holder, size_t index){
+    if(!holder->lists){
+        return VEC_LIST_NONE;
+    }
+    uint16_t list = holder->lists[index];
+    if(list == VEC_LIST_NONE){
+        --holder->unindexed;
+    }
+    return list;
+}
+
+static void vec_lists_put(VecsHolder* holder, size_t index, uint16_t list){
+    if(!holder->lists){
+        return;
+    }
+    holder->lists[index] = list;
+    if(list == VEC_LIST_NONE){
+        ++holder->unindexed;
+    }
+}
+
+static void vec_holder_free(VecsHolder* holder){
+    if(holder->attrs){
+        VecAttrs_Free(holder->attrs);
+    }
+    if(holder->lists){
+        RG_FREE(holder->lists);
+    }
+    if(holder->prefixes){
+        RG_FREE(holder->prefixes);
+    }
+    RG_FREE(holder);
+}
+
+/*
+ * Slide the live documents of a multi vector holder over its dead slots.
+ */
+static void vec_multi_compact(VecsHolder* holder){
+    size_t to = 0;
+    for(size_t from = 0 ; from < holder->size ; ++from){
+        VecKey* key = HOLDER_KEY(holder, from);
+        if(!key){
+            continue;
+        }
+        if(from != to){
+            memcpy(&HOLDER_VEC(holder, to), &HOLDER_VEC(holder, from), VEC_SIZE * sizeof(float));
+            holder->residuals[to] = holder->residuals[from];
+            holder->sqnorms[to] = holder->sqnorms[from];
+            if(holder->prefixes){
+                memcpy(&holder->prefixes[to * VEC_PREFIX_DIMS], &holder->prefixes[from * VEC_PREFIX_DIMS], VEC_PREFIX_DIMS * sizeof(float));
+            }
+            HOLDER_KEY(holder, to) = key;
+            if(key->vDT->index == from){
+                key->vDT->index = to;
+            }
+        }
+        ++to;
+    }
+    holder->size = to;
+    holder->dead = 0;
+}
+
+static void vec_multi_delete(VecDT* vDT){
+    VecsHolder* holder = VEC_MULTI_HOLDER(vDT);
+    VecKey* key = HOLDER_KEY(holder, vDT->index);
+    vec_generation_bump();
+
+    for(size_t i = vDT->index ; i < holder->size && HOLDER_KEY(holder, i) == key ; ++i){
+        HOLDER_KEY(holder, i) = NULL;
+        ++holder->dead;
+    }
+    // dead slots at the end are just dropped
+    while(holder->size > 0 && !HOLDER_KEY(holder, holder->size - 1)){
+        --holder->size;
+        --holder->dead;
+    }
+    if(holder->dead > holder->size / 2){
+        vec_multi_compact(holder);
+    }
+
+    // empty holders at the end are freed, the ones in the middle are kept so the VecDTs holder ids stay valid
+    while(array_len(multiList) > 0 && multiList[array_len(multiList) - 1]->size == 0){
+        vec_holder_free(multiList[array_len(multiList) - 1]);
+        if(array_len(multiList) > 1){
+            multiList = array_trimm_cap(multiList, array_len(multiList) - 1);
+        }else{
+            array_free(multiList);
+            multiList = NULL;
+        }
+    }
+
+    if(vecList || multiList){
+        vec_keys_free(key);
+    }else{
+        vec_keys_free_all();
+    }
+    vec_dt_free(vDT);
+}
+
+void vec_delete(VecDT* vDT){
+    if(vDT->holder == VEC_DT_DETACHED){
+        // we probably inside flush (maybe on the lazyfree thread), the vector DT was detached and its chunk is freed by the main thread.
+        __atomic_sub_fetch(&vecDTRetiredCount, 1, __ATOMIC_RELEASE);
+        return;
+    }
+
+    if(vDT->holder & VEC_DT_MULTI){
+        vec_multi_delete(vDT);
+        return;
+    }
+
+    VecsHolder* holder = VEC_DT_HOLDER(vDT);
+    size_t index = vDT->index;
+    VecKey* key = HOLDER_KEY(holder, index);
+    vec_generation_bump();
+
+    if(holder->attrs){
+        VecAttrs_Clear(holder->attrs, index);
+    }
+    vec_lists_take(holder, index);
+
+    // get the last vector
+    VecsHolder* lastVH = vecList[array_len(vecList) - 1];
+    --lastVH->size;
+    VecKey* lastKey = HOLDER_KEY(lastVH, lastVH->size);
+
+    if(lastKey != key){
+        // swap last with current
+        memmove(&HOLDER_VEC(holder, index), &HOLDER_VEC(lastVH, lastVH->size), VEC_SIZE * sizeof(float));
+        holder->residuals[index] = lastVH->residuals[lastVH->size];
+        holder->sqnorms[index] = lastVH->sqnorms[lastVH->size];
+        if(holder->prefixes){
+            vec_set_prefix(&holder->prefixes[index * VEC_PREFIX_DIMS], &HOLDER_VEC(holder, index));
+        }
+        if(lastVH->attrs){
+            VecAttrs_Move(lastVH->attrs, lastVH->size, HOLDER_ATTRS(holder), index);
+        }
+        uint16_t list = vec_lists_take(lastVH, lastVH->size);
+        if(lastVH->listsEpoch != holder->listsEpoch){
+            // the list was assigned with other centroids
+            list = VEC_LIST_NONE;
+        }
+        vec_lists_put(holder, index, list);
+
+        HOLDER_KEY(holder, index) = lastKey;
+        lastKey->vDT->holder = vDT->holder;
+        lastKey->vDT->index = index;
+    }
+
+    if(lastVH->size == 0){
+        // free the holder, it has no more data.
+        vec_holder_free(lastVH);
+        if(array_len(vecList) > 1){
+            vecList = array_trimm_cap(vecList, array_len(vecList) - 1);
+        }else{
+            array_free(vecList);
+            vecList = NULL;
+        }
+    }
+
+    // only now, compacting the keys block might move other keys in the holders
+    if(vecList || multiList){
+        vec_keys_free(key);
+    }else{
+        vec_keys_free_all();
+    }
+    vec_dt_free(vDT);
+}
+
+/*
+ * Detach the keys of the holders and free them, the list is freed as well.
+ */
+static void vec_detach_list(VecsHolder** list){
+    for(size_t i = 0 ; i < array_len(list) ; ++i){
+        VecsHolder* holder = list[i];
+        for(size_t j = 0 ; j < holder->size ; ++j){
+            if(HOLDER_KEY(holder, j)){
+                HOLDER_KEY(holder, j)->vDT->holder = VEC_DT_DETACHED;
+            }
+        }
+        vec_holder_free(holder);
+    }
+    array_free(list);
+}
+
+void vec_detach_all(){
+    if(!vecList && !multiList){
+        return;
+    }
+
+    if(vecList){
+        vec_detach_list(vecList);
+        vecList = NULL;
+    }
+    if(multiList){
+        vec_detach_list(multiList);
+        multiList = NULL;
+    }
+    vec_generation_bump();
+
+    vec_keys_free_all();
+    vec_dt_retire();
+}
+
+size_t vec_slot_bytes(const VecsHolder* holder){
+    return VEC_SIZE * sizeof(float) + sizeof(VecKey*) + 2 * sizeof(float) +
+           (holder->lists ? sizeof(*holder->lists) : 0) +
+           (holder->prefixes ? VEC_PREFIX_DIMS * sizeof(float) : 0);
+}
+
+size_t vec_mem_usage(const void *value){
+    const VecDT* vDT = value;
+    size_t res = sizeof(*vDT);
+    if(vDT->holder == VEC_DT_DETACHED){
+        return res;
+    }
+    if(vDT->holder & VEC_DT_MULTI){
+        VecsHolder* holder = VEC_MULTI_HOLDER(vDT);
+        return res + VEC_KEY_SIZE(HOLDER_KEY(holder, vDT->index)->len) + vec_multi_count(vDT) * vec_slot_bytes(holder);
+    }
+    VecsHolder* holder = VEC_DT_HOLDER(vDT);
+    res += VEC_KEY_SIZE(HOLDER_KEY(holder, vDT->index)->len) + vec_slot_bytes(holder);
+    if(holder->attrs){
+        res += VecAttrs_MemUsage(holder->attrs) / VEC_HOLDER_SIZE;
+    }
+    return res;
+}
+
+/*
+ * Turn the dot products of the first rows slots into L2 scores, nothing to do on the other metrics.
+ */
+static void vec_metric_scores(VecsHolder* holder, const float* vec, size_t rows, float* scores){
+    if(vecMetric != VEC_METRIC_L2){
+        return;
+    }
+    float qn = cblas_sdot(VEC_SIZE, vec, 1, vec, 1);
+    for(size_t i = 0 ; i < rows ; ++i){
+        scores[i] = 2 * scores[i] - holder->sqnorms[i] - qn;
+    }
+}
+
+size_t vec_score_holder(VecsHolder* holder, const float* vec, VecFilter* filter, float* scores, uint64_t* mask){
+
+    if(!filter){
+        size_t words = (holder->size + 63) / 64;
+        memset(mask, 0xff, words * sizeof(*mask));
+        if(holder->size % 64){
+            mask[words - 1] = (1ULL << (holder->size % 64)) - 1;
+        }
+        cblas_sgemv(CblasRowMajor, CblasNoTrans, holder->size, VEC_SIZE, 1, holder->vecs, VEC_SIZE, vec, 1, 0, scores, 1);
+        vec_metric_scores(holder, vec, holder->size, scores);
+        return holder->size;
+    }
+
+    VecFilter_Resolve(filter);
+    size_t selected = VecFilter_Eval(filter, holder->attrs, holder->size, mask);
+    vec_score_holder_mask(holder, vec, selected, scores, mask);
+    return selected;
+}
+
+void vec_score_holder_mask(VecsHolder* holder, const float* vec, size_t selected, float* scores, const uint64_t* mask){
+    if(selected < holder->size * PREFILTER_MAX_SELECTIVITY){
+        // pre filter, only the selected vectors are scored
+        float qn = vecMetric == VEC_METRIC_L2 ? cblas_sdot(VEC_SIZE, vec, 1, vec, 1) : 0;
+        MASK_FOREACH(mask, holder->size, i, scores[i] = vec_metric_score(holder, i, cblas_sdot(VEC_SIZE, &HOLDER_VEC(holder, i), 1, vec, 1), qn));
+    }else if(selected > 0){
+        // post filter, score the entire holder, the vectors that were not selected are not on the mask
+        cblas_sgemv(CblasRowMajor, CblasNoTrans, holder->size, VEC_SIZE, 1, holder->vecs, VEC_SIZE, vec, 1, 0, scores, 1);
+        vec_metric_scores(holder, vec, holder->size, scores);
+    }
+}
+
+static void vec_holder_prefixes(VecsHolder* holder, bool enabled){
+    if(!enabled){
+        if(holder->prefixes){
+            RG_FREE(holder->prefixes);
+            holder->prefixes = NULL;
+        }
+        return;
+    }
+    if(holder->prefixes){
+        return;
+    }
+    holder->prefixes = RG_ALLOC(VEC_HOLDER_SIZE * VEC_PREFIX_DIMS * sizeof(float));
+    for(size_t i = 0 ; i < holder->size ; ++i){
+        vec_set_prefix(&holder->prefixes[i * VEC_PREFIX_DIMS], &HOLDER_VEC(holder, i));
+    }
+}
+
+void vec_prefixes_set(bool enabled){
+    vecPrefixes = enabled;
+    for(size_t i = 0 ; i < array_len(vecList) ; ++i){
+        vec_holder_prefixes(vecList[i], enabled);
+    }
+    for(size_t i = 0 ; i < array_len(multiList) ; ++i){
+        vec_holder_prefixes(multiList[i], enabled);
+    }
+}
+
+size_t vec_coarse_holder(VecsHolder* holder, const float* prefix, const uint64_t* mask, TopK* candidates, float* scores){
+    if(holder->size == 0){
+        return 0;
+    }
+
+    cblas_sgemv(CblasRowMajor, CblasNoTrans, holder->size, VEC_PREFIX_DIMS, 1, holder->prefixes, VEC_PREFIX_DIMS,
+                prefix, 1, 0, scores, 1);
+    for(size_t i = 0 ; i < holder->size ; ++i){
+        if(mask && !MASK_TEST(mask, i)){
+            continue;
+        }
+        if(scores[i] > TopK_Threshold(candidates)){
+            TopK_Push(candidates, scores[i], i);
+        }
+    }
+    return holder->size;
+}
+
+// slack on the pruning bound relative to the query and vector norms (the rounding error of a dot
+// product grows with them), so floating point rounding never prunes a vector that should be kept
+#define VEC_PRUNE_EPSILON (4 * VEC_SIZE * FLT_EPSILON)
+
+// once more than this fraction of a tile passes the bound the rest of the holder is scored in full
+#define VEC_PRUNE_MAX_PASS 0.5
+
+size_t vec_topk_holder_pruned(VecsHolder* holder, const float* vec, float floor, TopK* t, float* partial,
+                              size_t* candidates, size_t* heapOps){
+    const float* rest = vec + VEC_PREFIX_DIMS;
+    float restNorm = cblas_snrm2(VEC_SIZE - VEC_PREFIX_DIMS, rest, 1);
+    float slack = VEC_PRUNE_EPSILON * cblas_snrm2(VEC_SIZE, vec, 1);
+    float qn = vecMetric == VEC_METRIC_L2 ? cblas_sdot(VEC_SIZE, vec, 1, vec, 1) : 0;
+    bool full = false;
+    size_t scored = 0;
+
+    for(size_t first = 0 ; first < holder->size ; first += VEC_PRUNE_TILE){
+        size_t rows = holder->size - first < VEC_PRUNE_TILE ? holder->size - first : VEC_PRUNE_TILE;
+        float bar = TopK_Threshold(t) > floor ? TopK_Threshold(t) : floor;
+
+        if(full){
+            cblas_sgemv(CblasRowMajor, CblasNoTrans, rows, VEC_SIZE, 1, &HOLDER_VEC(holder, first), VEC_SIZE,
+                        vec, 1, 0, partial, 1);
+            for(size_t r = 0 ; r < rows ; ++r){
+                float score = vec_metric_score(holder, first + r, partial[r], qn);
+                if(score > floor){
+                    ++*candidates;
+                }
+                if(score > bar && TopK_Push(t, score, first + r)){
+                    ++*heapOps;
+                    bar = TopK_Threshold(t) > floor ? TopK_Threshold(t) : floor;
+                }
+            }
+            scored += rows;
+            continue;
+        }
+
+        // the prefix of every row, the rows are VEC_SIZE apart
+        cblas_sgemv(CblasRowMajor, CblasNoTrans, rows, VEC_PREFIX_DIMS, 1, &HOLDER_VEC(holder, first), VEC_SIZE,
+                    vec, 1, 0, partial, 1);
+        size_t passed = 0;
+        for(size_t r = 0 ; r < rows ; ++r){
+            size_t i = first + r;
+            // the score grows with the dot product on every metric, so the bound on the dot bounds the score
+            if(vec_metric_score(holder, i, partial[r] + restNorm * holder->residuals[i] + slack * sqrtf(holder->sqnorms[i]), qn) <= bar){
+                continue;
+            }
+            ++passed;
+            float dot = partial[r] + cblas_sdot(VEC_SIZE - VEC_PREFIX_DIMS, &HOLDER_VEC(holder, i) + VEC_PREFIX_DIMS, 1, rest, 1);
+            float score = vec_metric_score(holder, i, dot, qn);
+            if(score > floor){
+                ++*candidates;
+            }
+            if(score > bar && TopK_Push(t, score, i)){
+                ++*heapOps;
+                bar = TopK_Threshold(t) > floor ? TopK_Threshold(t) : floor;
+            }
+        }
+        scored += passed;
+
+        // while there is no bar to beat everything passes, it says nothing about the data
+        if(bar > -INFINITY && passed > rows * VEC_PRUNE_MAX_PASS){
+            full = true;
+        }
+    }
+
+    return scored;
+}
+
+void vec_score_holder_batch(VecsHolder* holder, size_t first, size_t rows, const float* queries, size_t nq, float* scores){
+    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, rows, nq, VEC_SIZE, 1, &HOLDER_VEC(holder, first), VEC_SIZE,
+                queries, VEC_SIZE, 0, scores, nq);
+}
+
+/*
+ * The MaxSim score of a document out of the scores of its rows, scores[r * nq + q] is
+ * the score of its r-th vector against query q.
+ */
+static float vec_maxsim_rows(const float* scores, size_t rows, size_t nq){
+    float sum = 0;
+    for(size_t q = 0 ; q < nq ; ++q){
+        float best = -INFINITY;
+        for(size_t r = 0 ; r < rows ; ++r){
+            if(scores[r * nq + q] > best){
+                best = scores[r * nq + q];
+            }
+        }
+        sum += best;
+    }
+    return sum;
+}
+
+/*
+ * Score a single document starting at slot first, rows is set to its amount of vectors.
+ */
+static float vec_maxsim_doc(VecsHolder* holder, size_t first, const float* queries, size_t nq, float* scores, size_t* rows){
+    VecKey* key = HOLDER_KEY(holder, first);
+    size_t n = 1;
+    while(first + n < holder->size && HOLDER_KEY(holder, first + n) == key){
+        ++n;
+    }
+    vec_score_holder_batch(holder, first, n, queries, nq, scores);
+    *rows = n;
+    return vec_maxsim_rows(scores, n, nq);
+}
+
+size_t vec_maxsim_holder(VecsHolder* holder, const float* queries, size_t nq, const uint64_t* docs, float floor, TopK* t, float* scores){
+    size_t scored = 0;
+
+    if(docs){
+        MASK_FOREACH(docs, holder->size, i, {
+            size_t rows;
+            float score = vec_maxsim_doc(holder, i, queries, nq, scores, &rows);
+            scored += rows;
+            if(score > floor){
+                TopK_Push(t, score, i);
+            }
+        });
+        return scored;
+    }
+
+    // the best score of every query against the current document so far, a document might span two tiles
+    float best[VEC_MULTI_MAX_QUERY];
+    VecKey* curr = NULL;
+    size_t currFirst = 0;
+    for(size_t first = 0 ; first < holder->size ; first += VEC_MULTI_TILE){
+        size_t rows = holder->size - first < VEC_MULTI_TILE ? holder->size - first : VEC_MULTI_TILE;
+        vec_score_holder_batch(holder, first, rows, queries, nq, scores);
+        for(size_t r = 0 ; r < rows ; ++r){
+            VecKey* key = HOLDER_KEY(holder, first + r);
+            if(key != curr){
+                if(curr){
+                    float score = vec_maxsim_rows(best, 1, nq);
+                    if(score > floor){
+                        TopK_Push(t, score, currFirst);
+                    }
+                }
+                curr = key;
+                currFirst = first + r;
+                for(size_t q = 0 ; q < nq ; ++q){
+                    best[q] = -INFINITY;
+                }
+            }
+            if(!key){
+                continue;
+            }
+            ++scored;
+            for(size_t q = 0 ; q < nq ; ++q){
+                if(scores[r * nq + q] > best[q]){
+                    best[q] = scores[r * nq + q];
+                }
+            }
+        }
+    }
+    if(curr){
+        float score = vec_maxsim_rows(best, 1, nq);
+        if(score > floor){
+            TopK_Push(t, score, currFirst);
+        }
+    }
+
+    return scored;
+}
+
+size_t vec_multi_candidates(VecsHolder* holder, const float* prefixes, size_t nq, TopK** candidates, uint64_t* docs, float* scores){
+    for(size_t q = 0 ; q < nq ; ++q){
+        TopK_Clear(candidates[q]);
+    }
+
+    for(size_t first = 0 ; first < holder->size ; first += VEC_MULTI_TILE){
+        size_t rows = holder->size - first < VEC_MULTI_TILE ? holder->size - first : VEC_MULTI_TILE;
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, rows, nq, VEC_PREFIX_DIMS, 1,
+                    &holder->prefixes[first * VEC_PREFIX_DIMS], VEC_PREFIX_DIMS, prefixes, VEC_PREFIX_DIMS, 0, scores, nq);
+        for(size_t r = 0 ; r < rows ; ++r){
+            if(!HOLDER_KEY(holder, first + r)){
+                continue;
+            }
+            for(size_t q = 0 ; q < nq ; ++q){
+                if(scores[r * nq + q] > TopK_Threshold(candidates[q])){
+                    TopK_Push(candidates[q], scores[r * nq + q], first + r);
+                }
+            }
+        }
+    }
+
+    memset(docs, 0, (holder->size + 63) / 64 * sizeof(*docs));
+    size_t count = 0;
+    for(size_t q = 0 ; q < nq ; ++q){
+        for(size_t j = 0 ; j < candidates[q]->count ; ++j){
+            size_t doc = HOLDER_KEY(holder, candidates[q]->items[j].id)->vDT->index;
+            if(!MASK_TEST(docs, doc)){
+                docs[doc / 64] |= 1ULL << (doc % 64);
+                ++count;
+            }
+        }
+    }
+    return count;
+}
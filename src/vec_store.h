@@ -0,0 +1,314 @@
+/*
+ * vec_store.h
+ *
+ * The vectors storage, vectors are kept (normalized on the COSINE metric) in holders
+ * of VEC_HOLDER_SIZE vectors each and every key owns a VecDT pointing to its slot. Deleting a vector
+ * moves the last vector into its slot so the holders are always dense.
+ *
+ * The VecDTs are allocated from a slab (their address is the key value so they
+ * never move) and the key names are copied into an arena of blocks, each holder
+ * slot points directly to its key name. Apart from the allocator the storage does
+ * not depend on redis, so it can also be linked into the benchmarks.
+ */
+
+#ifndef SRC_VEC_STORE_H_
+#define SRC_VEC_STORE_H_
+
+#include "redismodule.h"
+#include "vec_attrs.h"
+#include "topk.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define VEC_SIZE 128
+
+#define VEC_HOLDER_SIZE 1024 * 1024
+
+// when less than this fraction of a holder passes the filter we score only the
+// passing vectors one by one, otherwise we score the entire holder and skip them.
+#define PREFILTER_MAX_SELECTIVITY 0.25
+
+// the pruned scan first scores that many leading dimensions of every vector, the
+// rest of the vector is only read if the bound on its score can make it to the top k.
+// The coarse scan only scores them, on their own copy (see VecsHolder prefixes).
+#define VEC_PREFIX_DIMS 32
+
+// the amount of vectors whose prefix is scored at once by the pruned scan
+#define VEC_PRUNE_TILE 4096
+
+// the holder of a VecDT whose holders were freed by a flush
+#define VEC_DT_DETACHED UINT32_MAX
+
+// the IVF list of a slot that was not assigned to a list yet (see vec_ivf.h)
+#define VEC_LIST_NONE UINT16_MAX
+
+// set on the holder of the VecDT of a multi vector document, its holder is on multiList
+#define VEC_DT_MULTI (1U << 31)
+
+// the max amount of vectors of a multi vector document, and of a multi vector query
+#define VEC_MULTI_MAX_VECS 1024
+#define VEC_MULTI_MAX_QUERY 256
+
+// the amount of slots scored at once by the multi vector scans, a document always fits a tile
+#define VEC_MULTI_TILE VEC_MULTI_MAX_VECS
+
+/*
+ * The similarity metric of the store. The scores are always higher is better, the
+ * dot product on COSINE (of the normalized vectors) and IP (of the raw vectors) and
+ * minus the squared euclidean distance on L2, which is calculated out of the dot
+ * product and the stored squared norms (||x - q||^2 = ||x||^2 - 2 * x.q + ||q||^2).
+ */
+typedef enum VecMetric{
+    VEC_METRIC_COSINE,
+    VEC_METRIC_IP,
+    VEC_METRIC_L2,
+    VEC_METRIC_COUNT,
+}VecMetric;
+
+extern VecMetric vecMetric;
+
+typedef struct VecDT{
+    uint32_t holder; // index of the holder on vecList
+    uint32_t index;
+}VecDT;
+
+/*
+ * A key name on the keys arena, name is not NULL terminated.
+ */
+typedef struct VecKey{
+    VecDT* vDT;
+    uint32_t len;
+    uint32_t block;
+    char name[];
+}VecKey;
+
+typedef struct VecsHolder{
+    size_t size;
+    size_t dead; // on multiList, the slots of deleted documents (their key is NULL)
+    VecAttrs* attrs; // created on the first attribute set
+
+    // the IVF list of every slot, created by the IVF worker. The lists are only
+    // meaningful if listsEpoch is the current IVF epoch, unindexed counts the slots
+    // set to VEC_LIST_NONE.
+    uint16_t* lists;
+    uint64_t listsEpoch;
+    size_t unindexed;
+
+    // the leading VEC_PREFIX_DIMS dimensions of every slot normalized on their own,
+    // contiguous so the coarse scan reads only them. Created by the first coarse scan.
+    float* prefixes;
+
+    VecKey* keys[VEC_HOLDER_SIZE];
+    float residuals[VEC_HOLDER_SIZE]; // the norm of the dimensions after VEC_PREFIX_DIMS of every vector
+    float sqnorms[VEC_HOLDER_SIZE]; // the squared norm of every vector, for the L2 metric
+    float vecs[VEC_HOLDER_SIZE * VEC_SIZE];
+}VecsHolder;
+
+#define HOLDER_KEY(h, i) (h->keys[i])
+#define HOLDER_VEC(h, i) (h->vecs[i * VEC_SIZE])
+#define HOLDER_ATTRS(h) (h->attrs ? h->attrs : (h->attrs = VecAttrs_Create(VEC_HOLDER_SIZE)))
+
+#define MASK_TEST(m, i) (m[(i) / 64] & (1ULL << ((i) % 64)))
+
+/*
+ * Run blk with i set to each slot whose bit is set on m (out of size).
+ */
+#define MASK_FOREACH(m, size, i, blk)                       \
+    for(size_t _w = 0 ; _w * 64 < (size) ; ++_w){            \
+        uint64_t _bits = m[_w];                              \
+        while(_bits){                                        \
+            size_t i = _w * 64 + __builtin_ctzll(_bits);     \
+            _bits &= _bits - 1;                              \
+            blk;                                             \
+        }                                                    \
+    }
+
+extern VecsHolder** vecList;
+
+#define VEC_DT_HOLDER(vDT) (vecList[(vDT)->holder])
+
+/*
+ * The holders of the multi vector documents. A document owns a run of contiguous
+ * slots, all pointing to its key name, and its VecDT points to the first of them.
+ * Deleted documents leave their slots dead until more than half of the holder is
+ * dead, then the holder is compacted. Their holders are never searched by the
+ * single vector queries.
+ */
+extern VecsHolder** multiList;
+
+#define VEC_MULTI_HOLDER(vDT) (multiList[(vDT)->holder & ~VEC_DT_MULTI])
+
+// memory of the keys arena blocks and of the VecDTs slab
+extern size_t vecKeysBytes;
+extern size_t vecDTsBytes;
+
+/*
+ * Bumped on every change of the stored vectors or their attributes, results that
+ * were computed before the bump might be stale. Safe to read from any thread.
+ */
+uint64_t vec_generation();
+void vec_generation_bump();
+
+/*
+ * Set the metric, it can only be changed while there are no vectors. Returns
+ * REDISMODULE_ERR if there are.
+ */
+int vec_metric_set(VecMetric metric);
+const char* vec_metric_name(VecMetric metric);
+
+/*
+ * Return the metric with the given name (case insensitive), -1 if there is no such metric.
+ */
+int vec_metric_find(const char* name);
+
+/*
+ * The score of slot i of the holder out of its dot product with a query whose squared
+ * norm is qn (only used on L2).
+ */
+static inline float vec_metric_score(const VecsHolder* holder, size_t i, float dot, float qn){
+    return vecMetric == VEC_METRIC_L2 ? 2 * dot - holder->sqnorms[i] - qn : dot;
+}
+
+/*
+ * The score as replied to the user, the euclidean distance on L2.
+ */
+static inline float vec_reply_score(float score){
+    return vecMetric == VEC_METRIC_L2 ? sqrtf(score < 0 ? -score : 0) : score;
+}
+
+/*
+ * Copy data into v, on the COSINE metric it is normalized (a zero vector is kept zero).
+ */
+void vec_set_data(float* v, const float* data);
+
+/*
+ * Copy the leading VEC_PREFIX_DIMS dimensions of v into p and normalize them, a zero
+ * prefix is kept zero.
+ */
+void vec_set_prefix(float* p, const float* v);
+
+/*
+ * Add a vector at the end of the last holder, the key name is copied.
+ */
+VecDT* vec_insert(const char* key, size_t len, const float* data);
+
+/*
+ * Add a multi vector document of n vectors (one after the other on data) to the last
+ * multi holder, the key name is copied. n should be at most VEC_MULTI_MAX_VECS.
+ */
+VecDT* vec_multi_insert(const char* key, size_t len, const float* data, size_t n);
+
+/*
+ * The amount of vectors of a multi vector document.
+ */
+size_t vec_multi_count(const VecDT* vDT);
+
+/*
+ * Overwrite the vector in its slot, the slot and the key name are kept.
+ */
+void vec_update(VecDT* vDT, const float* data);
+
+/*
+ * Whether the slot already holds data (as vec_set_data would store it).
+ */
+bool vec_same_data(const VecDT* vDT, const float* data);
+
+/*
+ * Free the VecDT and its key name, the last vector is moved into its slot (the slots
+ * of a multi vector document are left dead instead). If the VecDT was detached only
+ * the VecDT is freed.
+ */
+void vec_delete(VecDT* vDT);
+
+/*
+ * Free all the holders (multi vector holders included) and key names, the VecDTs are left detached and should
+ * still be deleted (used on flush).
+ */
+void vec_detach_all();
+
+/*
+ * The bytes of a single slot of the holder: the vector, its norms, the key pointer
+ * and, when the holder has them, the IVF list and the prefix.
+ */
+size_t vec_slot_bytes(const VecsHolder* holder);
+
+/*
+ * The cost of a single key, its VecDT and key name plus its slots and their share of
+ * the holder attributes (divided by the holder capacity). Single vector keys and multi
+ * vector documents are charged the same way, the unused part of the holders is not
+ * charged to any key (see used_memory_slack).
+ */
+size_t vec_mem_usage(const void *value);
+
+/*
+ * Score the vectors of the holder that pass the filter (if not NULL) against vec into
+ * scores and mark them on mask, should be called under the lock. Returns the amount
+ * of scored vectors.
+ */
+size_t vec_score_holder(VecsHolder* holder, const float* vec, VecFilter* filter, float* scores, uint64_t* mask);
+
+/*
+ * Score only the selected vectors of the holder that are already set on mask, selected
+ * is the amount of bits set. Should be called under the lock.
+ */
+void vec_score_holder_mask(VecsHolder* holder, const float* vec, size_t selected, float* scores, const uint64_t* mask);
+
+/*
+ * Offer the vectors of the holder that score above floor to t (the ids are the slots),
+ * the result is the same as scoring all of them. Only the first VEC_PREFIX_DIMS
+ * dimensions of each vector are scored at first, the rest of the vector is read only
+ * if the prefix product plus a bound on the rest (the product of the query and vector
+ * residual norms) scores above both floor and the worst score kept by t. When most vectors
+ * pass the bound anyway the rest of the holder is scored in full. partial should have
+ * room for VEC_PRUNE_TILE scores, should be called under the lock. Returns the amount
+ * of vectors that were scored in full, the ones of them that scored above floor are
+ * added to candidates and the successful pushes to heapOps.
+ */
+size_t vec_topk_holder_pruned(VecsHolder* holder, const float* vec, float floor, TopK* t, float* partial,
+                              size_t* candidates, size_t* heapOps);
+
+/*
+ * Create (or free) the prefixes of all the holders, new holders get them as well while
+ * enabled. Should be called under the lock, queries never create them on their own.
+ */
+void vec_prefixes_set(bool enabled);
+
+/*
+ * The coarse scan, score the prefixes of the holder (see vec_set_prefix) against the
+ * query prefix and offer them to candidates (the ids are the slots). If mask is not
+ * NULL only the slots set on it are offered. The holder must have its prefixes (see
+ * vec_prefixes_set), should be called under the lock. scores should have room for the
+ * holder size, returns the amount of prefixes scored.
+ */
+size_t vec_coarse_holder(VecsHolder* holder, const float* prefix, const uint64_t* mask, TopK* candidates, float* scores);
+
+/*
+ * Score rows vectors of the holder, starting at slot first, against nq queries at once
+ * with a single matrix product. queries holds the nq vectors one after the other and
+ * scores[r * nq + q] is set to the dot product of slot first + r and query q (see
+ * vec_metric_score). Should be called under the lock.
+ */
+void vec_score_holder_batch(VecsHolder* holder, size_t first, size_t rows, const float* queries, size_t nq, float* scores);
+
+/*
+ * The late interaction (MaxSim) scan of a multi vector holder, a document scores the
+ * sum over the nq query vectors of their best score against its own vectors. The
+ * holder is scored in tiles of VEC_MULTI_TILE slots against all the queries with a
+ * single matrix product. Every document that scores above floor is offered to t (the
+ * id is its first slot). If docs is not NULL only the documents whose first slot is
+ * set on it are scored. scores should have room for VEC_MULTI_TILE * nq scores, should
+ * be called under the lock. Returns the amount of vectors scored.
+ */
+size_t vec_maxsim_holder(VecsHolder* holder, const float* queries, size_t nq, const uint64_t* docs, float floor, TopK* t, float* scores);
+
+/*
+ * The per vector candidates pass of a multi vector query. The prefixes of the holder
+ * slots (see vec_set_prefix) are scored against the nq query prefixes, candidates[q]
+ * keeps the best slots of query vector q and the first slot of every document that
+ * owns one of them is set on docs. The holder must have its prefixes (see
+ * vec_prefixes_set), should be called under the lock. scores should have room for
+ * VEC_MULTI_TILE * nq scores, returns the amount of documents set.
+ */
+size_t vec_multi_candidates(VecsHolder* holder, const float* prefixes, size_t nq, TopK** candidates, uint64_t* docs, float* scores);
+
+#endif /* SRC_VEC_STORE_H_ */
@@ -1,6 +1,15 @@
 #include "redisgears.h"
 #include "redisai.h"
-#include "minmax_heap.h"
+#include "topk.h"
+#include "vec_attrs.h"
+#include "vec_stats.h"
+#include "vec_store.h"
+#include "vec_config.h"
+#include "vec_slowlog.h"
+#include "vec_cache.h"
+#include "vec_ivf.h"
+#include "vec_disk.h"
+#include "vec_sparse.h"
 #include <math.h>
 #include "redisgears_memory.h"
 #include <cblas.h>
@@ -15,37 +24,63 @@
 static RedisModuleCtx* staticCtx;
 
 static RecordType* ScoreRecordType = NULL;
-static RecordType* HeapRecordType = NULL;
 
-#define VEC_SIZE 128
+#define DEFAULT_SAMPLE_SIZE 10000
 
-#define VEC_HOLDER_SIZE 1024 * 1024
-
-typedef struct VecsHolder VecsHolder;
-
-typedef struct VecDT{
-    size_t index;
-    VecsHolder* holder;
-    RedisModuleString* keyName;
-}VecDT;
-
-typedef struct VecsHolder{
-    size_t size;
-    VecDT* vecDT[VEC_HOLDER_SIZE];
-    float vecs[VEC_HOLDER_SIZE * VEC_SIZE];
-}VecsHolder;
-
-#define HOLDER_VECDT(h, i) (h->vecDT[i])
-#define HOLDER_VEC(h, i) (h->vecs[i * VEC_SIZE])
-
-VecsHolder** vecList = NULL;
 RedisModuleType *vecRedisDT;
+RedisModuleType *vecMultiRedisDT;
+RedisModuleType *vecSparseRedisDT;
 
 typedef struct VecReaderCtx{
     size_t index;
+    bool done;
     Record** pendings;
     float vec[VEC_SIZE];
     size_t topK;
+    float threshold; // results with lower score are dropped without entering the heap
+    size_t sample; // if not 0, only score about that many evenly spread vectors
+    VecFilter* filter; // if not NULL, only vectors that pass the filter are scored
+    size_t nprobe; // if not 0 and there is an IVF index, only score the vectors on the nprobe closest lists
+    size_t coarse; // if not 0, score the vector prefixes and re-rank only the best coarse of each holder
+    size_t disk; // if not 0, search the disk index with a search list of that length instead of the holders
+    bool range; // return all the vectors with score >= threshold instead of the top k
+    size_t limit; // on range mode, if not 0, stop after that many results
+    size_t emitted;
+    bool withVectors; // send the stored vector along with every result
+
+    // on multi mode the multi vector documents are searched by MaxSim instead of the
+    // vectors, queries holds the multi query vectors (see vec_set_data) one after the other
+    size_t multi;
+    float* queries;
+    size_t multiCandidates; // if not 0, only score the documents owning one of the best multiCandidates slots of a query vector
+
+    // on sparse mode the sparse vectors are searched too, by their inner product with the
+    // sparse query (sparse sorted dimensions and their weights, see VecSparse_Sort).
+    // sparseOnly leaves the dense vectors out.
+    size_t sparse;
+    uint32_t* sparseDims;
+    float* sparseWeights;
+    bool sparseOnly;
+
+    // on batch mode the reader searches batchSize queries at once and returns a single
+    // TopKBatchRecord, batch holds the queries (see vec_set_data) one after the other
+    size_t batchSize;
+    float* batch;
+    size_t* batchTopK;
+
+    // local stages time (in microseconds), recorded once the scan is done
+    uint64_t lockWait;
+    uint64_t scanTime;
+    uint64_t topkTime;
+
+    // profile counters, sent to the initiator along with the results on PROFILE
+    bool profile;
+    size_t holders;
+    size_t scored;
+    size_t candidates;
+    size_t heapOps;
+    uint64_t lockHold;
+    uint64_t lockAcquired;
 }VecReaderCtx;
 
 typedef struct TopKArg{
@@ -56,24 +91,119 @@ typedef struct ScoreRecord{
     Record baseRecord;
     RedisModuleString* key;
     float score;
+    float* vec; // the stored vector on WITHVECTORS, NULL otherwise
 }ScoreRecord;
 
-typedef struct HeapRecord{
+typedef enum VecProfileField{
+    VEC_PROFILE_HOLDERS,
+    VEC_PROFILE_SCORED,
+    VEC_PROFILE_CANDIDATES,
+    VEC_PROFILE_HEAP_OPS,
+    VEC_PROFILE_LOCK_WAIT,
+    VEC_PROFILE_LOCK_HOLD,
+    VEC_PROFILE_SCAN,
+    VEC_PROFILE_TOPK,
+    VEC_PROFILE_COUNT,
+}VecProfileField;
+
+static const char* profileFieldNames[VEC_PROFILE_COUNT] = {
+    [VEC_PROFILE_HOLDERS] = "holders_scanned",
+    [VEC_PROFILE_SCORED] = "vectors_scored",
+    [VEC_PROFILE_CANDIDATES] = "candidates",
+    [VEC_PROFILE_HEAP_OPS] = "heap_ops",
+    [VEC_PROFILE_LOCK_WAIT] = "lock_wait_usec",
+    [VEC_PROFILE_LOCK_HOLD] = "lock_hold_usec",
+    [VEC_PROFILE_SCAN] = "scan_usec",
+    [VEC_PROFILE_TOPK] = "topk_usec",
+};
+
+/*
+ * The local execution profile of a single shard. On PROFILE every shard sends one
+ * along with its results and they end up at the end of the results list.
+ */
+typedef struct ProfileRecord{
+    Record baseRecord;
+    char* shard;
+    long long values[VEC_PROFILE_COUNT];
+}ProfileRecord;
+
+static RecordType* ProfileRecordType = NULL;
+
+/*
+ * The top k results of a shard, or of a few shards once merged. The items are
+ * sorted ascending by score and keys[i] is the key of items[i].
+ */
+typedef struct TopKRecord{
+    Record baseRecord;
+    TopKItem* items;
+    size_t count;
+    RedisModuleString** keys;
+    float** vecs; // vecs[i] is the stored vector of items[i] on WITHVECTORS, NULL otherwise
+    Record** profiles; // the profile records of the merged shards, NULL without PROFILE
+    bool sampled; // some shard only scored a sample of its vectors (see VecReaderCtx.sample)
+}TopKRecord;
+
+static RecordType* TopKRecordType = NULL;
+
+/*
+ * The top k results of every query of a batch, results[i] holds the results of the
+ * i-th query and topK[i] is its k.
+ */
+typedef struct TopKBatchRecord{
     Record baseRecord;
-    heap_t* heap;
-}HeapRecord;
+    size_t count;
+    TopKRecord** results;
+    size_t* topK;
+}TopKBatchRecord;
+
+static RecordType* TopKBatchRecordType = NULL;
+
+static int ScoreRecord_SendReply(Record* base, RedisModuleCtx* rctx);
+static int TopKRecord_SendReply(Record* base, RedisModuleCtx* rctx);
+static int ProfileRecord_SendReply(Record* base, RedisModuleCtx* rctx);
+static int ProfileRecord_RecordSerialize(ExecutionCtx* ctx, Gears_BufferWriter* bw, Record* base);
+static Record* ProfileRecord_RecordDeserialize(ExecutionCtx* ctx, Gears_BufferReader* br);
 
 static VecReaderCtx* VecReaderCtx_Create(float* data, size_t topK){
     VecReaderCtx* ctx = RG_ALLOC(sizeof(*ctx));
     ctx->index = 0;
+    ctx->done = false;
     ctx->pendings = array_new(Record*, 10);
     ctx->topK = topK;
+    ctx->threshold = -INFINITY;
+    ctx->sample = 0;
+    ctx->filter = NULL;
+    ctx->nprobe = 0;
+    ctx->coarse = 0;
+    ctx->disk = 0;
+    ctx->range = false;
+    ctx->limit = 0;
+    ctx->emitted = 0;
+    ctx->withVectors = false;
+    ctx->multi = 0;
+    ctx->queries = NULL;
+    ctx->multiCandidates = 0;
+    ctx->sparse = 0;
+    ctx->sparseDims = NULL;
+    ctx->sparseWeights = NULL;
+    ctx->sparseOnly = false;
+    ctx->batchSize = 0;
+    ctx->batch = NULL;
+    ctx->batchTopK = NULL;
+    ctx->lockWait = 0;
+    ctx->scanTime = 0;
+    ctx->topkTime = 0;
+    ctx->profile = false;
+    ctx->holders = 0;
+    ctx->scored = 0;
+    ctx->candidates = 0;
+    ctx->heapOps = 0;
+    ctx->lockHold = 0;
+    ctx->lockAcquired = 0;
     if(data){
-        memcpy(ctx->vec, data, VEC_SIZE * sizeof(*data));
-        float denom_vec = cblas_snrm2(VEC_SIZE, ctx->vec, 1);
-        for(size_t i = 0 ; i < VEC_SIZE ; ++i){
-            ctx->vec[i] /= denom_vec;
-        }
+        vec_set_data(ctx->vec, data);
+    }else{
+        memset(ctx->vec, 0, sizeof(ctx->vec));
     }
     return ctx;
 }
@@ -86,124 +216,634 @@ static void VecReaderCtx_Free(VecReaderCtx* ctx){
 
     array_free(ctx->pendings);
 
+    if(ctx->filter){
+        VecFilter_Free(ctx->filter);
+    }
+
+    if(ctx->batch){
+        RG_FREE(ctx->batch);
+        RG_FREE(ctx->batchTopK);
+    }
+
+    if(ctx->queries){
+        RG_FREE(ctx->queries);
+    }
+
+    if(ctx->sparseDims){
+        RG_FREE(ctx->sparseDims);
+        RG_FREE(ctx->sparseWeights);
+    }
+
     RG_FREE(ctx);
 }
 
+static TopKRecord* TopKRecord_Create(TopKItem* items, size_t count, RedisModuleString** keys, float** vecs){
+    TopKRecord* tr = (TopKRecord*)RedisGears_RecordCreate(TopKRecordType);
+    tr->items = items;
+    tr->count = count;
+    tr->keys = keys;
+    tr->vecs = vecs;
+    tr->profiles = NULL;
+    tr->sampled = false;
+    return tr;
+}
+
+/*
+ * Free the results of the record (the ones that were not moved out).
+ */
+static void TopKRecord_FreeResults(TopKRecord* tr){
+    for(size_t i = 0 ; i < tr->count ; ++i){
+        if(tr->keys[i]){
+            RedisModule_FreeString(NULL, tr->keys[i]);
+        }
+        if(tr->vecs && tr->vecs[i]){
+            RG_FREE(tr->vecs[i]);
+        }
+    }
+    RG_FREE(tr->keys);
+    RG_FREE(tr->items);
+    if(tr->vecs){
+        RG_FREE(tr->vecs);
+    }
+}
+
+/*
+ * Each shard sends a single top k record with its local results, after the merge
+ * there is one such record left and we flatten it to a list of score records
+ * (sorted ascending by score) followed by the profile records. If some shard only
+ * scored a sample the list ends with a score record without a key, see on_sample_done.
+ */
 static Record* to_score_records(ExecutionCtx* rctx, Record *data, void* arg){
-    HeapRecord* hr = (HeapRecord*)data;
+    TopKRecord* tr = (TopKRecord*)data;
+    Record* res = RedisGears_ListRecordCreate(tr->count + array_len(tr->profiles));
+    for(size_t i = 0 ; i < tr->count ; ++i){
+        ScoreRecord* s = (ScoreRecord*)RedisGears_RecordCreate(ScoreRecordType);
+        s->key = tr->keys[i];
+        s->score = tr->items[i].score;
+        s->vec = tr->vecs ? tr->vecs[i] : NULL;
+        tr->keys[i] = NULL;
+        if(tr->vecs){
+            tr->vecs[i] = NULL;
+        }
+        RedisGears_ListRecordAdd(res, &s->baseRecord);
+    }
+    for(size_t i = 0 ; i < array_len(tr->profiles) ; ++i){
+        RedisGears_ListRecordAdd(res, tr->profiles[i]);
+    }
+    if(tr->profiles){
+        array_trimm_len(tr->profiles, 0);
+    }
+    if(tr->sampled){
+        ScoreRecord* s = (ScoreRecord*)RedisGears_RecordCreate(ScoreRecordType);
+        s->key = NULL;
+        s->score = -INFINITY;
+        s->vec = NULL;
+        RedisGears_ListRecordAdd(res, &s->baseRecord);
+    }
+    RedisGears_FreeRecord(data);
+    return res;
+}
 
-    Record* lr = RedisGears_ListRecordCreate(hr->heap->count);
+/*
+ * Merge the results of b into a keeping only the best k, the results that were
+ * moved to a are cleared on b and the rest are freed along with b.
+ */
+static void TopKRecord_Merge(TopKRecord* a, TopKRecord* b, size_t k){
+    // number the items so we know where each merged item came from
+    for(size_t i = 0 ; i < a->count ; ++i){
+        a->items[i].id = i;
+    }
+    for(size_t i = 0 ; i < b->count ; ++i){
+        b->items[i].id = a->count + i;
+    }
 
-    size_t count = hr->heap->count;
-    for(size_t i = 0 ; i < count ; ++i){
-        ScoreRecord* sr = mmh_pop_min(hr->heap);
-        RedisGears_ListRecordAdd(lr, &sr->baseRecord);
+    size_t n = MIN(a->count + b->count, k);
+    TopKItem* items = RG_ALLOC(sizeof(*items) * MAX(n, 1));
+    RedisModuleString** keys = RG_ALLOC(sizeof(*keys) * MAX(n, 1));
+    float** vecs = a->vecs ? RG_ALLOC(sizeof(*vecs) * MAX(n, 1)) : NULL;
+    n = TopK_MergeSorted(a->items, a->count, b->items, b->count, k, items);
+    for(size_t i = 0 ; i < n ; ++i){
+        uint32_t id = items[i].id;
+        TopKRecord* from = id < a->count ? a : b;
+        size_t j = id < a->count ? id : id - a->count;
+        keys[i] = from->keys[j];
+        from->keys[j] = NULL;
+        if(vecs){
+            vecs[i] = from->vecs[j];
+            from->vecs[j] = NULL;
+        }
     }
 
-    RedisGears_FreeRecord(data);
+    TopKRecord_FreeResults(a);
+    a->items = items;
+    a->keys = keys;
+    a->vecs = vecs;
+    a->count = n;
+}
+
+/*
+ * Merge two top k records into accumulate keeping only the best k results,
+ * the keys of the results that did not make it are freed along with r.
+ */
+static Record* top_k_merge(ExecutionCtx* rctx, Record *accumulate, Record *r, void* arg){
+    TopKArg* topKArg = arg;
+
+    if(!accumulate){
+        return r;
+    }
+
+    TopKRecord* a = (TopKRecord*)accumulate;
+    TopKRecord* b = (TopKRecord*)r;
+
+    TopKRecord_Merge(a, b, topKArg->topK);
+    a->sampled = a->sampled || b->sampled;
+
+    for(size_t i = 0 ; i < array_len(b->profiles) ; ++i){
+        if(!a->profiles){
+            a->profiles = array_new(Record*, 4);
+        }
+        a->profiles = array_append(a->profiles, b->profiles[i]);
+    }
+    if(b->profiles){
+        array_trimm_len(b->profiles, 0);
+    }
+    RedisGears_FreeRecord(r);
 
-    return lr;
+    return accumulate;
 }
 
-static int heap_cmp(const void *a, const void *b, const void *udata){
-    ScoreRecord* s1 = (ScoreRecord*)a;
-    ScoreRecord* s2 = (ScoreRecord*)b;
-    if(s1->score < s2->score){
-        return -1;
-    }else if(s1->score > s2->score){
-        return 1;
-    }else {
-        return 0;
+/*
+ * Merge the results of every query of two batch records, each with the k of its query.
+ */
+static Record* top_k_batch_merge(ExecutionCtx* rctx, Record *accumulate, Record *r, void* arg){
+    if(!accumulate){
+        return r;
+    }
+
+    TopKBatchRecord* a = (TopKBatchRecord*)accumulate;
+    TopKBatchRecord* b = (TopKBatchRecord*)r;
+    RedisModule_Assert(a->count == b->count);
+
+    for(size_t i = 0 ; i < a->count ; ++i){
+        TopKRecord_Merge(a->results[i], b->results[i], a->topK[i]);
     }
+    RedisGears_FreeRecord(r);
+
+    return accumulate;
 }
 
-static Record* top_k(ExecutionCtx* rctx, Record *accumulate, Record *r, void* arg){
-    TopKArg* topKArg = arg;
+/*
+ * The state of a single query, from the command until the reply.
+ */
+typedef struct VecQueryCtx{
+    RedisModuleBlockedClient *bc;
+    uint64_t start;
+    char* params; // the command arguments, for the slowlog
+    bool profile;
+    char* cacheKey; // if not NULL, the results are added to the cache under this key
+    size_t cacheKeyLen;
+    uint64_t generation; // the vectors generation when the query started
+}VecQueryCtx;
 
-    HeapRecord* heap = (HeapRecord*)accumulate;
+/*
+ * The command arguments as a single string for the slowlog, the vector blob and the
+ * sparse vector blobs (at sparseIndex and the one after it, -1 if there are none) are
+ * left out.
+ */
+static char* vec_query_params(RedisModuleString **argv, int argc, int blobIndex, int sparseIndex){
+    #define IS_BLOB(i) ((i) == blobIndex || (sparseIndex >= 0 && ((i) == sparseIndex || (i) == sparseIndex + 1)))
+    size_t len = 0;
+    for(int i = 0 ; i < argc ; ++i){
+        size_t argLen = strlen("<blob>");
+        if(!IS_BLOB(i)){
+            RedisModule_StringPtrLen(argv[i], &argLen);
+        }
+        len += argLen + 1;
+    }
 
-    if(!heap){
-        heap = (HeapRecord*)RedisGears_RecordCreate(HeapRecordType);
-        heap->heap = mmh_init_with_size(topKArg->topK, heap_cmp, NULL, (mmh_free_func)RedisGears_FreeRecord);
+    char* params = RG_ALLOC(len + 1);
+    char* curr = params;
+    for(int i = 0 ; i < argc ; ++i){
+        size_t argLen = strlen("<blob>");
+        const char* arg = IS_BLOB(i) ? "<blob>" : RedisModule_StringPtrLen(argv[i], &argLen);
+        if(i > 0){
+            *(curr++) = ' ';
+        }
+        memcpy(curr, arg, argLen);
+        curr += argLen;
     }
+    *curr = '\0';
+    #undef IS_BLOB
+
+    return params;
+}
 
-    heap_t* h = heap->heap;
+static VecQueryCtx* VecQueryCtx_Create(RedisModuleBlockedClient *bc, char* params){
+    VecQueryCtx* qCtx = RG_ALLOC(sizeof(*qCtx));
+    qCtx->bc = bc;
+    qCtx->start = VecStats_Now();
+    qCtx->params = params;
+    qCtx->profile = false;
+    qCtx->cacheKey = NULL;
+    qCtx->cacheKeyLen = 0;
+    qCtx->generation = vec_generation();
+    return qCtx;
+}
 
-    ScoreRecord* currSr = (ScoreRecord*)r;
+static void VecQueryCtx_Free(VecQueryCtx* qCtx){
+    RG_FREE(qCtx->params);
+    if(qCtx->cacheKey){
+        RG_FREE(qCtx->cacheKey);
+    }
+    RG_FREE(qCtx);
+}
 
-    // If the queue is not full - we just push the result into it
-    // If the pool size is 0 we always do that, letting the heap grow dynamically
-    if (h->count < topKArg->topK) {
-        mmh_insert(h, r);
-    } else {
-        // find the min result
-        ScoreRecord* sr = mmh_peek_min(h);
-        if(sr->score < currSr->score){
-            void* temp = mmh_pop_min(h);
-            RedisModule_Assert(temp == sr);
-            RedisGears_FreeRecord(&(sr->baseRecord));
-            mmh_insert(h, r);
-        }else{
-            RedisGears_FreeRecord(r);
+/*
+ * The generation is local to the shard and does not see the writes on the other
+ * shards, so on cluster the cache is only used when cache-ttl-ms allows stale results.
+ */
+static bool vec_cache_enabled(RedisModuleCtx *ctx){
+    if(VecConfig_Get(VEC_CONFIG_CACHE_MAX_MEMORY) == 0){
+        return false;
+    }
+    return VecConfig_Get(VEC_CONFIG_CACHE_TTL_MS) > 0 || !(RedisModule_GetContextFlags(ctx) & REDISMODULE_CTX_FLAGS_CLUSTER);
+}
+
+/*
+ * Add the results of a TopKRecord to the cache under the query cache key.
+ */
+static void vec_cache_add_top_k(VecQueryCtx* qCtx, TopKRecord* tr){
+    VecCacheResult* results = RG_ALLOC(sizeof(*results) * MAX(tr->count, 1));
+    for(size_t i = 0 ; i < tr->count ; ++i){
+        results[i].key = RedisModule_StringPtrLen(tr->keys[i], &results[i].len);
+        results[i].score = tr->items[i].score;
+    }
+    VecCache_Add(qCtx->cacheKey, qCtx->cacheKeyLen, qCtx->generation, results, tr->count);
+    RG_FREE(results);
+}
+
+/*
+ * Reply with [results, errors, profile], the profile holds the total and collect time
+ * of the query and the local profile of each shard.
+ */
+static void vec_reply_with_profile(ExecutionPlan* ep, RedisModuleCtx* rctx, VecQueryCtx* qCtx, long long collectTime){
+    long long len = RedisGears_GetRecordsLen(ep);
+    long long nProfiles = 0;
+    for(long long i = 0 ; i < len ; ++i){
+        if(RedisGears_RecordGetType(RedisGears_GetRecord(ep, i)) == ProfileRecordType){
+            ++nProfiles;
+        }
+    }
+
+    RedisModule_ReplyWithArray(rctx, 3);
+
+    RedisModule_ReplyWithArray(rctx, len - nProfiles);
+    for(long long i = 0 ; i < len ; ++i){
+        Record* r = RedisGears_GetRecord(ep, i);
+        if(RedisGears_RecordGetType(r) == ScoreRecordType){
+            ScoreRecord_SendReply(r, rctx);
         }
     }
 
-    return &(heap->baseRecord);
+    long long nErrors = RedisGears_GetErrorsLen(ep);
+    RedisModule_ReplyWithArray(rctx, nErrors);
+    for(long long i = 0 ; i < nErrors ; ++i){
+        size_t errLen;
+        char* err = RedisGears_StringRecordGet(RedisGears_GetError(ep, i), &errLen);
+        RedisModule_ReplyWithStringBuffer(rctx, err, errLen);
+    }
+
+    RedisModule_ReplyWithArray(rctx, 6);
+    RedisModule_ReplyWithSimpleString(rctx, "total_usec");
+    RedisModule_ReplyWithLongLong(rctx, VecStats_Now() - qCtx->start);
+    RedisModule_ReplyWithSimpleString(rctx, "collect_usec");
+    RedisModule_ReplyWithLongLong(rctx, collectTime);
+    RedisModule_ReplyWithSimpleString(rctx, "shards");
+    RedisModule_ReplyWithArray(rctx, nProfiles);
+    for(long long i = 0 ; i < len ; ++i){
+        Record* r = RedisGears_GetRecord(ep, i);
+        if(RedisGears_RecordGetType(r) == ProfileRecordType){
+            ProfileRecord_SendReply(r, rctx);
+        }
+    }
 }
 
 static void on_done(ExecutionPlan* ctx, void* privateData){
-    RedisModuleBlockedClient *bc = privateData;
-    RedisModuleCtx *rctx = RedisModule_GetThreadSafeContext(bc);
-    RedisGears_ReturnResultsAndErrors(ctx, rctx);
-    RedisModule_UnblockClient(bc, NULL);
+    VecQueryCtx* qCtx = privateData;
+    RedisModuleCtx *rctx = RedisModule_GetThreadSafeContext(qCtx->bc);
+
+    // everything that is not reading is the results collection and merge
+    long long collectTime = MAX(0, RedisGears_GetTotalDuration(ctx) - RedisGears_GetReadDuration(ctx));
+    VecStats_RecordStage(VEC_STAGE_COLLECT, collectTime);
+
+    uint64_t start = VecStats_Now();
+    if(qCtx->profile){
+        vec_reply_with_profile(ctx, rctx, qCtx, collectTime);
+    }else{
+        RedisGears_ReturnResultsAndErrors(ctx, rctx);
+    }
+    uint64_t end = VecStats_Now();
+
+    if(qCtx->cacheKey && RedisGears_GetErrorsLen(ctx) == 0){
+        // without PROFILE all the records are score records
+        long long len = RedisGears_GetRecordsLen(ctx);
+        VecCacheResult* results = RG_ALLOC(sizeof(*results) * MAX(len, 1));
+        for(long long i = 0 ; i < len ; ++i){
+            ScoreRecord* sr = (ScoreRecord*)RedisGears_GetRecord(ctx, i);
+            results[i].key = RedisModule_StringPtrLen(sr->key, &results[i].len);
+            results[i].score = sr->score;
+        }
+        VecCache_Add(qCtx->cacheKey, qCtx->cacheKeyLen, qCtx->generation, results, len);
+        RG_FREE(results);
+    }
+    VecStats_RecordStage(VEC_STAGE_REPLY, end - start);
+    VecStats_RecordStage(VEC_STAGE_TOTAL, end - qCtx->start);
+    VecSlowlog_Add(end - qCtx->start, qCtx->params);
+
+    RedisModule_UnblockClient(qCtx->bc, NULL);
     RedisGears_DropExecution(ctx);
     RedisModule_FreeThreadSafeContext(rctx);
+    VecQueryCtx_Free(qCtx);
 }
 
-VecDT* vec_insert(RedisModuleString *keyName, const float* data){
-    VecsHolder* holder = NULL;
-    if(!vecList){
-        vecList = array_new(VecsHolder*, 1);
+typedef struct TwoPhaseCtx{
+    VecQueryCtx* qCtx;
+    VecReaderCtx* rCtx; // the full scan reader, runs once the threshold is known
+}TwoPhaseCtx;
+
+static ExecutionPlan* vec_sim_run(VecReaderCtx* rCtx, RedisGears_OnExecutionDoneCallback onDone, void* privateData, char** err);
+
+/*
+ * The sample execution is done, its k-th best score is a lower bound on the k-th
+ * best score of the full data set (the sample is a subset of it). Broadcast it as
+ * a threshold to the full scan so shards can drop most of the candidates early.
+ *
+ * If no shard had more vectors than the sample size the sample was the full scan,
+ * its results are replied as is unless the query asks for more than they have
+ * (PROFILE or WITHVECTORS).
+ */
+static void on_sample_done(ExecutionPlan* ctx, void* privateData){
+    TwoPhaseCtx* tpCtx = privateData;
+    VecReaderCtx* rCtx = tpCtx->rCtx;
+    VecQueryCtx* qCtx = tpCtx->qCtx;
+    RG_FREE(tpCtx);
+
+    long long len = RedisGears_GetRecordsLen(ctx);
+    bool sampled = len > 0 && !((ScoreRecord*)RedisGears_GetRecord(ctx, len - 1))->key;
+    if(!sampled && RedisGears_GetErrorsLen(ctx) == 0 && !rCtx->profile && !rCtx->withVectors){
+        VecReaderCtx_Free(rCtx);
+        on_done(ctx, qCtx);
+        return;
     }
-    if(array_len(vecList) == 0){
-        holder = RG_CALLOC(1, sizeof(VecsHolder));
-        vecList = array_append(vecList, holder);
-    }else{
-        holder = vecList[array_len(vecList) - 1];
+
+    if(sampled){
+        --len;
+    }
+    if(RedisGears_GetErrorsLen(ctx) == 0 && len >= rCtx->topK && rCtx->topK > 0){
+        // results are sorted ascending, the k-th best is k places from the end
+        ScoreRecord* sr = (ScoreRecord*)RedisGears_GetRecord(ctx, len - rCtx->topK);
+        rCtx->threshold = sr->score;
     }
+    RedisGears_DropExecution(ctx);
 
-    if(holder->size >= VEC_HOLDER_SIZE){
-        // we need to create a new holder
-        holder = RG_CALLOC(1, sizeof(VecsHolder));
-        vecList = array_append(vecList, holder);
+    char* err = NULL;
+    ExecutionPlan* ep = vec_sim_run(rCtx, on_done, qCtx, &err);
+    if(!ep){
+        RedisModuleCtx *rctx = RedisModule_GetThreadSafeContext(qCtx->bc);
+        RedisModule_ReplyWithError(rctx, err ? err : "Failed running vector similarity execution");
+        RedisModule_UnblockClient(qCtx->bc, NULL);
+        RedisModule_FreeThreadSafeContext(rctx);
+        VecQueryCtx_Free(qCtx);
     }
+}
 
-    float* v = &HOLDER_VEC(holder, holder->size);
-    memcpy(v, data, sizeof(float) * VEC_SIZE);
 
-    float demon = cblas_snrm2(VEC_SIZE, v, 1);
+/*
+ * Plain RG.VEC_SIM queries waiting to be searched together. The batch is searched once
+ * it reaches batch-max-size queries or batch-window-ms after its first query arrived,
+ * whichever comes first. Only accessed from the main thread.
+ */
+typedef struct VecBatch{
+    VecQueryCtx** queries;
+    float* vecs; // the queries (see vec_set_data) one after the other
+    size_t* topK;
+    size_t capacity; // batch-max-size when the batch was started
+    RedisModuleTimerID timer;
+}VecBatch;
+
+static VecBatch* pendingBatch = NULL;
+
+static VecBatch* VecBatch_Create(size_t capacity){
+    VecBatch* batch = RG_ALLOC(sizeof(*batch));
+    batch->queries = array_new(VecQueryCtx*, capacity);
+    batch->vecs = RG_ALLOC(capacity * VEC_SIZE * sizeof(float));
+    batch->topK = RG_ALLOC(capacity * sizeof(size_t));
+    batch->capacity = capacity;
+    return batch;
+}
 
-    for(size_t i = 0 ; i < VEC_SIZE ; ++i){
-        v[i] /= demon;
+static void VecBatch_Free(VecBatch* batch){
+    for(size_t i = 0 ; i < array_len(batch->queries) ; ++i){
+        VecQueryCtx_Free(batch->queries[i]);
+    }
+    array_free(batch->queries);
+    if(batch->vecs){
+        RG_FREE(batch->vecs);
     }
+    if(batch->topK){
+        RG_FREE(batch->topK);
+    }
+    RG_FREE(batch);
+}
 
-    VecDT* vDT = RG_CALLOC(1, sizeof(*vDT));
-    vDT->holder = holder;
-    vDT->index = holder->size;
-    vDT->keyName = keyName;
-    RedisModule_RetainString(NULL, vDT->keyName);
-    HOLDER_VECDT(holder, holder->size) = vDT;
+/*
+ * Reply to every query of the batch with its own results, the execution errors
+ * are sent to all of them.
+ */
+static void on_batch_done(ExecutionPlan* ctx, void* privateData){
+    VecBatch* batch = privateData;
 
-    ++holder->size;
+    long long collectTime = MAX(0, RedisGears_GetTotalDuration(ctx) - RedisGears_GetReadDuration(ctx));
 
-    return vDT;
+    // shards without vectors return an empty batch record, so there is at most one
+    // record unless the execution failed
+    TopKBatchRecord* br = NULL;
+    if(RedisGears_GetRecordsLen(ctx) > 0){
+        br = (TopKBatchRecord*)RedisGears_GetRecord(ctx, 0);
+    }
+    long long nErrors = RedisGears_GetErrorsLen(ctx);
+
+    for(size_t i = 0 ; i < array_len(batch->queries) ; ++i){
+        VecQueryCtx* qCtx = batch->queries[i];
+        RedisModuleCtx *rctx = RedisModule_GetThreadSafeContext(qCtx->bc);
+        VecStats_RecordStage(VEC_STAGE_COLLECT, collectTime);
+
+        uint64_t start = VecStats_Now();
+        RedisModule_ReplyWithArray(rctx, 2);
+        if(br){
+            TopKRecord_SendReply(&br->results[i]->baseRecord, rctx);
+            if(qCtx->cacheKey && nErrors == 0){
+                vec_cache_add_top_k(qCtx, br->results[i]);
+            }
+        }else{
+            RedisModule_ReplyWithArray(rctx, 0);
+        }
+        RedisModule_ReplyWithArray(rctx, nErrors);
+        for(long long j = 0 ; j < nErrors ; ++j){
+            size_t errLen;
+            char* err = RedisGears_StringRecordGet(RedisGears_GetError(ctx, j), &errLen);
+            RedisModule_ReplyWithStringBuffer(rctx, err, errLen);
+        }
+        uint64_t end = VecStats_Now();
+        VecStats_RecordStage(VEC_STAGE_REPLY, end - start);
+        VecStats_RecordStage(VEC_STAGE_TOTAL, end - qCtx->start);
+        VecSlowlog_Add(end - qCtx->start, qCtx->params);
+
+        RedisModule_UnblockClient(qCtx->bc, NULL);
+        RedisModule_FreeThreadSafeContext(rctx);
+    }
+
+    RedisGears_DropExecution(ctx);
+    VecBatch_Free(batch);
+}
+
+/*
+ * Search the pending batch, its queries are scored together with a single pass over the holders.
+ */
+static void vec_batch_flush(RedisModuleCtx *ctx){
+    VecBatch* batch = pendingBatch;
+    pendingBatch = NULL;
+    RedisModule_StopTimer(ctx, batch->timer, NULL);
+
+    VecReaderCtx* rCtx = VecReaderCtx_Create(NULL, 0);
+    rCtx->batchSize = array_len(batch->queries);
+    rCtx->batch = batch->vecs;
+    rCtx->batchTopK = batch->topK;
+    batch->vecs = NULL;
+    batch->topK = NULL;
+
+    char* err = NULL;
+    FlatExecutionPlan* fep = RGM_CreateCtx(VecReader, &err);
+    ExecutionPlan* ep = NULL;
+    if(fep){
+        RGM_Collect(fep);
+        RGM_Accumulate(fep, top_k_batch_merge, NULL);
+        ep = RGM_Run(fep, ExecutionModeAsync, rCtx, NULL, NULL, &err);
+        RedisGears_FreeFlatExecution(fep);
+    }
+
+    if(ep){
+        RedisGears_AddOnDoneCallback(ep, on_batch_done, batch);
+        return;
+    }
+    VecReaderCtx_Free(rCtx);
+
+    for(size_t i = 0 ; i < array_len(batch->queries) ; ++i){
+        RedisModuleCtx *rctx = RedisModule_GetThreadSafeContext(batch->queries[i]->bc);
+        RedisModule_ReplyWithError(rctx, err ? err : "Failed running vector similarity execution");
+        RedisModule_UnblockClient(batch->queries[i]->bc, NULL);
+        RedisModule_FreeThreadSafeContext(rctx);
+    }
+    VecBatch_Free(batch);
+}
+
+static void vec_batch_on_timer(RedisModuleCtx *ctx, void *data){
+    if(pendingBatch){
+        vec_batch_flush(ctx);
+    }
+}
+
+/*
+ * Add the query to the pending batch, a new batch is started if there is none.
+ */
+static void vec_batch_add(RedisModuleCtx *ctx, VecQueryCtx* qCtx, const float* data, size_t topK){
+    size_t maxSize = VecConfig_Get(VEC_CONFIG_BATCH_MAX_SIZE);
+    if(!pendingBatch){
+        pendingBatch = VecBatch_Create(maxSize);
+        pendingBatch->timer = RedisModule_CreateTimer(ctx, VecConfig_Get(VEC_CONFIG_BATCH_WINDOW_MS), vec_batch_on_timer, NULL);
+    }
+    size_t i = array_len(pendingBatch->queries);
+    vec_set_data(&pendingBatch->vecs[i * VEC_SIZE], data);
+    pendingBatch->topK[i] = topK;
+    pendingBatch->queries = array_append(pendingBatch->queries, qCtx);
+    // batch-max-size might have changed since the batch was started
+    if(array_len(pendingBatch->queries) >= MIN(maxSize, pendingBatch->capacity)){
+        vec_batch_flush(ctx);
+    }
+}
+
+static int vec_attr_type(RedisModuleString *type){
+    const char* name = RedisModule_StringPtrLen(type, NULL);
+    if(strcasecmp(name, "TAG") == 0){
+        return VEC_ATTR_TAG;
+    }
+    if(strcasecmp(name, "NUMERIC") == 0){
+        return VEC_ATTR_NUMERIC;
+    }
+    return 0;
+}
+
+/*
+ * Validate the [TAG <field> <value>] [NUMERIC <field> <value>] ... attributes starting
+ * at argv[first], nothing is created so the command can still fail afterwards. Replies
+ * with an error on failure.
+ */
+static int vec_validate_attrs(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, int first){
+    for(int i = first ; i < argc ; i += 3){
+        int type = vec_attr_type(argv[i]);
+        const char* field = RedisModule_StringPtrLen(argv[i + 1], NULL);
+        double val;
+        if(!type){
+            RedisModule_ReplyWithError(ctx, "Unknown attribute type given");
+            return REDISMODULE_ERR;
+        }
+        if(type == VEC_ATTR_NUMERIC && RedisModule_StringToDouble(argv[i + 2], &val) != REDISMODULE_OK){
+            RedisModule_ReplyWithError(ctx, "Failed extracting numeric attribute value");
+            return REDISMODULE_ERR;
+        }
+
+        int existing = VecAttrs_FieldType(field);
+        for(int j = first ; j < i && !existing ; j += 3){
+            if(strcmp(RedisModule_StringPtrLen(argv[j + 1], NULL), field) == 0){
+                existing = vec_attr_type(argv[j]);
+            }
+        }
+        if(existing && existing != type){
+            RedisModule_ReplyWithError(ctx, "Attribute field already exists with another type");
+            return REDISMODULE_ERR;
+        }
+    }
+    return REDISMODULE_OK;
+}
+
+/*
+ * Set the attributes starting at argv[first] on the vector, the fields are created if
+ * needed. They must be validated first.
+ */
+static void vec_set_attrs(VecDT* vDT, RedisModuleString **argv, int argc, int first){
+    VecsHolder* holder = VEC_DT_HOLDER(vDT);
+    for(int i = first ; i < argc ; i += 3){
+        int type = vec_attr_type(argv[i]);
+        int field = VecAttrs_GetField(RedisModule_StringPtrLen(argv[i + 1], NULL), type, true);
+        VecAttrs* attrs = HOLDER_ATTRS(holder);
+        if(type == VEC_ATTR_TAG){
+            size_t len;
+            const char* val = RedisModule_StringPtrLen(argv[i + 2], &len);
+            VecAttrs_SetTag(attrs, vDT->index, field, val, len);
+        }else{
+            double val;
+            RedisModule_StringToDouble(argv[i + 2], &val);
+            VecAttrs_SetNumeric(attrs, vDT->index, field, val);
+        }
+    }
+    vec_generation_bump();
 }
 
 /*
- * rg.vec_add <k> <blob>
+ * rg.vec_add <key> <blob> [TAG <field> <value>] [NUMERIC <field> <value>] ...
  */
 int vec_add_command(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
-    if(argc != 3){
+    if(argc < 3 || (argc - 3) % 3 != 0){
         return RedisModule_WrongArity(ctx);
     }
 
@@ -214,6 +854,11 @@ int vec_add_command(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
         return REDISMODULE_OK;
     }
 
+    // validate all the attributes before we insert anything
+    if(vec_validate_attrs(ctx, argv, argc, 3) != REDISMODULE_OK){
+        return REDISMODULE_OK;
+    }
+
     RedisModuleKey *kp = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_WRITE);
     if(RedisModule_KeyType(kp) != REDISMODULE_KEYTYPE_EMPTY){
         RedisModule_ReplyWithError(ctx, "Key is not empty");
@@ -221,7 +866,12 @@ int vec_add_command(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
         return REDISMODULE_OK;
     }
 
-    VecDT* vDT = vec_insert(argv[1], data);
+    size_t keyLen;
+    const char* key = RedisModule_StringPtrLen(argv[1], &keyLen);
+    VecDT* vDT = vec_insert(key, keyLen, data);
+    VecStats_Incr(VEC_COUNTER_INSERTS);
+
+    vec_set_attrs(vDT, argv, argc, 3);
 
     RedisModule_ModuleTypeSetValue(kp, vecRedisDT, vDT);
 
@@ -235,251 +885,2395 @@ int vec_add_command(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
 }
 
 /*
- * rg.vec_sim <k> <blob>
+ * Insert the vector of an empty key or overwrite the vector of an existing one,
+ * returns NULL if the key holds another type.
  */
-int vec_sim_command(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+static VecDT* vec_upsert(RedisModuleKey *kp, RedisModuleString *keyName, const float* data){
+    VecDT* vDT;
+    if(RedisModule_KeyType(kp) == REDISMODULE_KEYTYPE_EMPTY){
+        size_t keyLen;
+        const char* key = RedisModule_StringPtrLen(keyName, &keyLen);
+        vDT = vec_insert(key, keyLen, data);
+        RedisModule_ModuleTypeSetValue(kp, vecRedisDT, vDT);
+    }else if(RedisModule_ModuleTypeGetType(kp) == vecRedisDT){
+        vDT = RedisModule_ModuleTypeGetValue(kp);
+        vec_update(vDT, data);
+    }else{
+        return NULL;
+    }
+    VecStats_Incr(VEC_COUNTER_INSERTS);
+    return vDT;
+}
 
-    if(argc != 3){
+/*
+ * rg.vec_set <key> <blob> [TAG <field> <value>] [NUMERIC <field> <value>] ...
+ *
+ * Like rg.vec_add but an existing vector is overwritten in its slot, the given
+ * attributes are set and the other attributes of the vector are kept.
+ */
+int vec_set_command(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+    if(argc < 3 || (argc - 3) % 3 != 0){
         return RedisModule_WrongArity(ctx);
     }
 
-    char* err = NULL;
+    size_t dataLen;
+    float* data = (float*)RedisModule_StringPtrLen(argv[2], &dataLen);
+    if(dataLen != (VEC_SIZE * sizeof(float))){
+        RedisModule_ReplyWithError(ctx, "Given blob is not float vector of size " STR(VEC_SIZE));
+        return REDISMODULE_OK;
+    }
 
-    long long topK;
-    if(RedisModule_StringToLongLong(argv[1], &topK) != REDISMODULE_OK){
-        RedisModule_ReplyWithError(ctx, "Failed extracting <k>");
+    if(vec_validate_attrs(ctx, argv, argc, 3) != REDISMODULE_OK){
         return REDISMODULE_OK;
     }
 
-    size_t dataSize;
-    float* data = (float*)RedisModule_StringPtrLen(argv[2], &dataSize);
-    if(dataSize != (VEC_SIZE * sizeof(float))){
-        RedisModule_ReplyWithError(ctx, "Given blob is not at the right size");
+    RedisModuleKey *kp = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_WRITE);
+    VecDT* vDT = vec_upsert(kp, argv[1], data);
+    if(!vDT){
+        RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
+        RedisModule_CloseKey(kp);
         return REDISMODULE_OK;
     }
 
-    TopKArg* topKArg2 = RG_ALLOC(sizeof(*topKArg2));
-    topKArg2->topK = topK;
+    vec_set_attrs(vDT, argv, argc, 3);
 
+    RedisModule_CloseKey(kp);
 
-    FlatExecutionPlan* fep = RGM_CreateCtx(VecReader, &err);
+    RedisModule_ReplicateVerbatim(ctx);
 
-    VecReaderCtx* rCtx = VecReaderCtx_Create(data, topK);
+    RedisModule_ReplyWithSimpleString(ctx, "OK");
 
-    RGM_Collect(fep);
+    return REDISMODULE_OK;
+}
 
-    RGM_Accumulate(fep, top_k, topKArg2);
+/*
+ * rg.vec_multi_add <key> <blob>
+ *
+ * Add a multi vector document, the blob holds its vectors one after the other (up to
+ * VEC_MULTI_MAX_VECS). The document is only searched by rg.vec_multi_sim.
+ */
+int vec_multi_add_command(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+    if(argc != 3){
+        return RedisModule_WrongArity(ctx);
+    }
 
-    RGM_FlatMap(fep, to_score_records, NULL);
+    if(vecMetric == VEC_METRIC_L2){
+        RedisModule_ReplyWithError(ctx, "Multi vector documents are not supported on the L2 metric");
+        return REDISMODULE_OK;
+    }
 
-    ExecutionPlan* ep = RGM_Run(fep, ExecutionModeAsync, rCtx, NULL, NULL, &err);
+    size_t dataLen;
+    float* data = (float*)RedisModule_StringPtrLen(argv[2], &dataLen);
+    size_t n = dataLen / (VEC_SIZE * sizeof(float));
+    if(n == 0 || n > VEC_MULTI_MAX_VECS || dataLen % (VEC_SIZE * sizeof(float)) != 0){
+        RedisModule_ReplyWithError(ctx, "Given blob is not 1 to " STR(VEC_MULTI_MAX_VECS) " float vectors of size " STR(VEC_SIZE));
+        return REDISMODULE_OK;
+    }
 
-    if(!ep){
-        RedisGears_FreeFlatExecution(fep);
-        RedisModule_ReplyWithError(ctx, err);
+    RedisModuleKey *kp = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_WRITE);
+    if(RedisModule_KeyType(kp) != REDISMODULE_KEYTYPE_EMPTY){
+        RedisModule_ReplyWithError(ctx, "Key is not empty");
+        RedisModule_CloseKey(kp);
         return REDISMODULE_OK;
     }
 
-    RedisModuleBlockedClient *bc = RedisModule_BlockClient(ctx, NULL, NULL, NULL, 0);
-    RedisGears_AddOnDoneCallback(ep, on_done, bc);
-    RedisGears_FreeFlatExecution(fep);
+    size_t keyLen;
+    const char* key = RedisModule_StringPtrLen(argv[1], &keyLen);
+    VecDT* vDT = vec_multi_insert(key, keyLen, data, n);
+    VecStats_Incr(VEC_COUNTER_INSERTS);
 
-    return REDISMODULE_OK;
-}
+    RedisModule_ModuleTypeSetValue(kp, vecMultiRedisDT, vDT);
 
-static int ScoreRecord_SendReply(Record* base, RedisModuleCtx* rctx){
+    RedisModule_CloseKey(kp);
+
+    RedisModule_ReplicateVerbatim(ctx);
+
+    RedisModule_ReplyWithSimpleString(ctx, "OK");
+
+    return REDISMODULE_OK;
+}
+
+/*
+ * Copy a sparse vector out of its dimensions blob (uint32) and weights blob (float32)
+ * and sort it (see VecSparse_Sort), on failure returns REDISMODULE_ERR and sets err.
+ * The copies should be freed with RG_FREE.
+ */
+static int vec_parse_sparse(RedisModuleString* dimsStr, RedisModuleString* weightsStr, uint32_t** dims, float** weights, size_t* nnz, char** err){
+    size_t dimsLen, weightsLen;
+    const char* dimsData = RedisModule_StringPtrLen(dimsStr, &dimsLen);
+    const char* weightsData = RedisModule_StringPtrLen(weightsStr, &weightsLen);
+    if(dimsLen % sizeof(uint32_t) != 0 || weightsLen != dimsLen){
+        *err = "Given sparse blobs should hold the same amount of uint32 dimensions and float weights";
+        return REDISMODULE_ERR;
+    }
+
+    const char* validateErr = NULL;
+    size_t n = dimsLen / sizeof(uint32_t);
+    uint32_t* d = RG_ALLOC(MAX(dimsLen, 1));
+    float* w = RG_ALLOC(MAX(weightsLen, 1));
+    memcpy(d, dimsData, dimsLen);
+    memcpy(w, weightsData, weightsLen);
+    if(VecSparse_Validate(d, w, n, &validateErr) != REDISMODULE_OK){
+        RG_FREE(d);
+        RG_FREE(w);
+        *err = (char*)validateErr;
+        return REDISMODULE_ERR;
+    }
+
+    n = VecSparse_Sort(d, w, n);
+    if(n == 0){
+        RG_FREE(d);
+        RG_FREE(w);
+        *err = "Sparse vector should have a non zero weight";
+        return REDISMODULE_ERR;
+    }
+
+    *dims = d;
+    *weights = w;
+    *nnz = n;
+    return REDISMODULE_OK;
+}
+
+/*
+ * rg.vec_sparse_add <key> <dims blob> <weights blob>
+ *
+ * Add a sparse vector, the dims blob holds its dimensions as uint32 (below
+ * VEC_SPARSE_MAX_DIM) and the weights blob their float weights in the same order. The
+ * vector is searched by rg.vec_sparse_sim and RG.VEC_SIM SPARSE by its inner product
+ * with the query.
+ */
+int vec_sparse_add_command(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+    if(argc != 4){
+        return RedisModule_WrongArity(ctx);
+    }
+
+    if(vecMetric == VEC_METRIC_L2){
+        RedisModule_ReplyWithError(ctx, "Sparse vectors are not supported on the L2 metric");
+        return REDISMODULE_OK;
+    }
+
+    char* err = NULL;
+    uint32_t* dims;
+    float* weights;
+    size_t nnz;
+    if(vec_parse_sparse(argv[2], argv[3], &dims, &weights, &nnz, &err) != REDISMODULE_OK){
+        RedisModule_ReplyWithError(ctx, err);
+        return REDISMODULE_OK;
+    }
+
+    RedisModuleKey *kp = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_WRITE);
+    if(RedisModule_KeyType(kp) != REDISMODULE_KEYTYPE_EMPTY){
+        RedisModule_ReplyWithError(ctx, "Key is not empty");
+        RedisModule_CloseKey(kp);
+        RG_FREE(dims);
+        RG_FREE(weights);
+        return REDISMODULE_OK;
+    }
+
+    size_t keyLen;
+    const char* key = RedisModule_StringPtrLen(argv[1], &keyLen);
+    VecSparseDoc* doc = VecSparse_Insert(key, keyLen, dims, weights, nnz);
+    RG_FREE(dims);
+    RG_FREE(weights);
+    VecStats_Incr(VEC_COUNTER_INSERTS);
+
+    RedisModule_ModuleTypeSetValue(kp, vecSparseRedisDT, doc);
+
+    RedisModule_CloseKey(kp);
+
+    RedisModule_ReplicateVerbatim(ctx);
+
+    RedisModule_ReplyWithSimpleString(ctx, "OK");
+
+    return REDISMODULE_OK;
+}
+
+/*
+ * Reply with the stored vector (normalized on the COSINE metric) of the given key,
+ * straight out of its holder slot, all the vectors of a multi vector document or the
+ * dimensions and weights blobs of a sparse vector (sorted by dimension). Replies nil
+ * if the key does not exist and, unless strict is false, WRONGTYPE if it is not a
+ * vector.
+ */
+static void vec_reply_vector(RedisModuleCtx *ctx, RedisModuleString *keyName, bool strict){
+    RedisModuleKey *kp = RedisModule_OpenKey(ctx, keyName, REDISMODULE_READ);
+    if(RedisModule_KeyType(kp) == REDISMODULE_KEYTYPE_EMPTY){
+        RedisModule_ReplyWithNull(ctx);
+    }else if(RedisModule_ModuleTypeGetType(kp) == vecMultiRedisDT){
+        VecDT* vDT = RedisModule_ModuleTypeGetValue(kp);
+        VecsHolder* holder = VEC_MULTI_HOLDER(vDT);
+        RedisModule_ReplyWithStringBuffer(ctx, (char*)&HOLDER_VEC(holder, vDT->index), vec_multi_count(vDT) * VEC_SIZE * sizeof(float));
+    }else if(RedisModule_ModuleTypeGetType(kp) == vecSparseRedisDT){
+        VecSparseDoc* doc = RedisModule_ModuleTypeGetValue(kp);
+        RedisModule_ReplyWithArray(ctx, 2);
+        RedisModule_ReplyWithStringBuffer(ctx, (char*)doc->dims, doc->nnz * sizeof(uint32_t));
+        RedisModule_ReplyWithStringBuffer(ctx, (char*)doc->weights, doc->nnz * sizeof(float));
+    }else if(RedisModule_ModuleTypeGetType(kp) != vecRedisDT){
+        if(strict){
+            RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
+        }else{
+            RedisModule_ReplyWithNull(ctx);
+        }
+    }else{
+        VecDT* vDT = RedisModule_ModuleTypeGetValue(kp);
+        VecsHolder* holder = VEC_DT_HOLDER(vDT);
+        RedisModule_ReplyWithStringBuffer(ctx, (char*)&HOLDER_VEC(holder, vDT->index), VEC_SIZE * sizeof(float));
+    }
+    RedisModule_CloseKey(kp);
+}
+
+/*
+ * rg.vec_get <key>
+ */
+int vec_get_command(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+    if(argc != 2){
+        return RedisModule_WrongArity(ctx);
+    }
+    vec_reply_vector(ctx, argv[1], true);
+    return REDISMODULE_OK;
+}
+
+/*
+ * rg.vec_mget <key> [<key> ...]
+ *
+ * Keys that do not exist or are not vectors are replied as nil, like MGET does.
+ */
+int vec_mget_command(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+    if(argc < 2){
+        return RedisModule_WrongArity(ctx);
+    }
+    RedisModule_ReplyWithArray(ctx, argc - 1);
+    for(int i = 1 ; i < argc ; ++i){
+        vec_reply_vector(ctx, argv[i], false);
+    }
+    return REDISMODULE_OK;
+}
+
+/*
+ * Parse a single FILTER clause starting at argv[*i] (the FILTER keyword) into filter,
+ * which is created if needed. On success *i points to the last argument of the clause.
+ */
+static int vec_parse_filter(RedisModuleString **argv, int argc, int* i, VecFilter** filter, char** err){
+    if(*i + 3 >= argc){
+        *err = "Not enough arguments given to FILTER";
+        return REDISMODULE_ERR;
+    }
+    const char* type = RedisModule_StringPtrLen(argv[*i + 1], NULL);
+    const char* field = RedisModule_StringPtrLen(argv[*i + 2], NULL);
+    if(!*filter){
+        *filter = VecFilter_Create();
+    }
+    if(strcasecmp(type, "TAG") == 0){
+        VecFilter_AddTag(*filter, field, RedisModule_StringPtrLen(argv[*i + 3], NULL));
+        *i += 3;
+    }else if(strcasecmp(type, "NUMERIC") == 0 && *i + 4 < argc){
+        double min, max;
+        if(RedisModule_StringToDouble(argv[*i + 3], &min) != REDISMODULE_OK ||
+           RedisModule_StringToDouble(argv[*i + 4], &max) != REDISMODULE_OK){
+            *err = "Failed extracting numeric filter range";
+            return REDISMODULE_ERR;
+        }
+        VecFilter_AddNumeric(*filter, field, min, max);
+        *i += 4;
+    }else{
+        *err = "Unknown filter type given";
+        return REDISMODULE_ERR;
+    }
+    return REDISMODULE_OK;
+}
+
+/*
+ * Build the search execution plan and run it on the given reader ctx, which is owned
+ * by the execution from here on (and freed here if it could not be started).
+ */
+static ExecutionPlan* vec_sim_run(VecReaderCtx* rCtx, RedisGears_OnExecutionDoneCallback onDone, void* privateData, char** err){
+    FlatExecutionPlan* fep = RGM_CreateCtx(VecReader, err);
+    if(!fep){
+        VecReaderCtx_Free(rCtx);
+        return NULL;
+    }
+
+    TopKArg* topKArg = RG_ALLOC(sizeof(*topKArg));
+    topKArg->topK = rCtx->topK;
+
+    // each shard reduces to its own top k inside the reader, so only
+    // one sorted list per shard is sent over to the initiator.
+    RGM_Collect(fep);
+
+    RGM_Accumulate(fep, top_k_merge, topKArg);
+
+    RGM_FlatMap(fep, to_score_records, NULL);
+
+    ExecutionPlan* ep = RGM_Run(fep, ExecutionModeAsync, rCtx, NULL, NULL, err);
+
+    if(ep){
+        RedisGears_AddOnDoneCallback(ep, onDone, privateData);
+    }else{
+        VecReaderCtx_Free(rCtx);
+    }
+
+    RedisGears_FreeFlatExecution(fep);
+
+    return ep;
+}
+
+/*
+ * rg.vec_sim <k> <blob> [TWOPHASE [SAMPLE <n>]] [NPROBE <n>] [COARSE <r>] [DISK <l>] [SPARSE <dims blob> <weights blob>] [PROFILE] [WITHVECTORS] [FILTER TAG <field> <value>] [FILTER NUMERIC <field> <min> <max>] ...
+ *
+ * TWOPHASE first runs a search over a sample of <n> vectors on each shard (default
+ * DEFAULT_SAMPLE_SIZE) and uses its k-th best score as a threshold for the full scan.
+ *
+ * NPROBE only scores the vectors on the <n> closest lists of the IVF index, and the
+ * vectors that were not indexed yet. Without an index (see ivf-lists) all the vectors
+ * are scored.
+ *
+ * COARSE scores only the leading VEC_PREFIX_DIMS dimensions of the vectors, on their
+ * own compact copy, and re-ranks the best <r> of each holder on the full vectors.
+ *
+ * DISK searches the disk index (see vec_disk.h) with a search list of length <l>
+ * instead of the stored vectors, it can not be combined with the other search options.
+ *
+ * SPARSE also searches the sparse vectors (see rg.vec_sparse_add) by their inner product
+ * with the given sparse query, the best k out of both the vectors and the sparse vectors
+ * are returned. Scaling the sparse query weights weighs one against the other.
+ *
+ * FILTER restricts the search to vectors with the given attributes, all the filters must match.
+ *
+ * PROFILE adds the query timings and the local profile of each shard to the reply.
+ *
+ * When batch-window-ms is set, queries without any of the options above are batched, see VecBatch.
+ *
+ * When cache-max-memory is set, the results of queries without PROFILE, WITHVECTORS and
+ * SPARSE are cached, see vec_cache.h.
+ */
+int vec_sim_command(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+
+    if(argc < 3){
+        return RedisModule_WrongArity(ctx);
+    }
+
+    char* err = NULL;
+
+    long long topK;
+    if(RedisModule_StringToLongLong(argv[1], &topK) != REDISMODULE_OK || topK < 0){
+        RedisModule_ReplyWithError(ctx, "Failed extracting <k>");
+        return REDISMODULE_OK;
+    }
+
+    size_t dataSize;
+    float* data = (float*)RedisModule_StringPtrLen(argv[2], &dataSize);
+    if(dataSize != (VEC_SIZE * sizeof(float))){
+        RedisModule_ReplyWithError(ctx, "Given blob is not at the right size");
+        return REDISMODULE_OK;
+    }
+
+    bool twoPhase = false;
+    bool profile = false;
+    bool withVectors = false;
+    long long sample = DEFAULT_SAMPLE_SIZE;
+    long long nprobe = 0;
+    long long coarse = 0;
+    long long disk = 0;
+    int sparseIndex = -1;
+    VecFilter* filter = NULL;
+    for(int i = 3 ; i < argc ; ++i){
+        const char* opt = RedisModule_StringPtrLen(argv[i], NULL);
+        if(strcasecmp(opt, "TWOPHASE") == 0){
+            twoPhase = true;
+        }else if(strcasecmp(opt, "PROFILE") == 0){
+            profile = true;
+        }else if(strcasecmp(opt, "WITHVECTORS") == 0){
+            withVectors = true;
+        }else if(strcasecmp(opt, "SAMPLE") == 0 && i + 1 < argc){
+            if(RedisModule_StringToLongLong(argv[++i], &sample) != REDISMODULE_OK || sample <= 0){
+                err = "Failed extracting <sample>";
+                break;
+            }
+        }else if(strcasecmp(opt, "NPROBE") == 0 && i + 1 < argc){
+            if(RedisModule_StringToLongLong(argv[++i], &nprobe) != REDISMODULE_OK || nprobe <= 0){
+                err = "Failed extracting <nprobe>";
+                break;
+            }
+        }else if(strcasecmp(opt, "COARSE") == 0 && i + 1 < argc){
+            if(RedisModule_StringToLongLong(argv[++i], &coarse) != REDISMODULE_OK || coarse <= 0){
+                err = "Failed extracting <r>";
+                break;
+            }
+        }else if(strcasecmp(opt, "DISK") == 0 && i + 1 < argc){
+            if(RedisModule_StringToLongLong(argv[++i], &disk) != REDISMODULE_OK || disk <= 0){
+                err = "Failed extracting <l>";
+                break;
+            }
+        }else if(strcasecmp(opt, "SPARSE") == 0 && i + 2 < argc){
+            sparseIndex = i + 1;
+            i += 2;
+        }else if(strcasecmp(opt, "FILTER") == 0){
+            if(vec_parse_filter(argv, argc, &i, &filter, &err) != REDISMODULE_OK){
+                break;
+            }
+        }else{
+            err = "Unknown argument given";
+            break;
+        }
+    }
+
+    if(!err && disk && (twoPhase || withVectors || nprobe || coarse || filter)){
+        err = "DISK can not be used with TWOPHASE, WITHVECTORS, NPROBE, COARSE or FILTER";
+    }
+
+    if(!err && disk && vecMetric != VEC_METRIC_COSINE){
+        err = "DISK is only supported on the COSINE metric";
+    }
+
+    // the exact sample threshold could drop everything an approximate scan finds
+    if(!err && twoPhase && (nprobe || coarse)){
+        err = "TWOPHASE can not be used with NPROBE or COARSE";
+    }
+
+    if(!err && coarse && !VecConfig_Get(VEC_CONFIG_COARSE_PREFIXES)){
+        err = "COARSE requires the coarse-prefixes config";
+    }
+
+    if(!err && sparseIndex >= 0 && (twoPhase || withVectors || disk || filter)){
+        err = "SPARSE can not be used with TWOPHASE, WITHVECTORS, DISK or FILTER";
+    }
+
+    if(!err && sparseIndex >= 0 && vecMetric == VEC_METRIC_L2){
+        err = "Sparse vectors are not supported on the L2 metric";
+    }
+
+    uint32_t* sparseDims = NULL;
+    float* sparseWeights = NULL;
+    size_t sparse = 0;
+    if(!err && sparseIndex >= 0){
+        vec_parse_sparse(argv[sparseIndex], argv[sparseIndex + 1], &sparseDims, &sparseWeights, &sparse, &err);
+    }
+
+    if(err){
+        if(filter){
+            VecFilter_Free(filter);
+        }
+        RedisModule_ReplyWithError(ctx, err);
+        return REDISMODULE_OK;
+    }
+
+    char* params = vec_query_params(argv, argc, 2, sparseIndex);
+
+    // PROFILE, WITHVECTORS and SPARSE replies are not cached
+    char* cacheKey = NULL;
+    size_t cacheKeyLen = 0;
+    if(!profile && !withVectors && !sparseDims && vec_cache_enabled(ctx)){
+        float vec[VEC_SIZE];
+        vec_set_data(vec, data);
+        cacheKey = VecCache_Key(vec, params, &cacheKeyLen);
+        if(VecCache_Reply(ctx, cacheKey, cacheKeyLen)){
+            RG_FREE(cacheKey);
+            RG_FREE(params);
+            if(filter){
+                VecFilter_Free(filter);
+            }
+            VecStats_Incr(VEC_COUNTER_QUERIES);
+            return REDISMODULE_OK;
+        }
+    }
+
+    RedisModuleBlockedClient *bc = RedisModule_BlockClient(ctx, NULL, NULL, NULL, 0);
+    VecQueryCtx* qCtx = VecQueryCtx_Create(bc, params);
+    qCtx->cacheKey = cacheKey;
+    qCtx->cacheKeyLen = cacheKeyLen;
+
+    if(!twoPhase && !profile && !withVectors && !filter && !nprobe && !coarse && !disk && !sparseDims && VecConfig_Get(VEC_CONFIG_BATCH_WINDOW_MS) > 0){
+        vec_batch_add(ctx, qCtx, data, topK);
+        VecStats_Incr(VEC_COUNTER_QUERIES);
+        return REDISMODULE_OK;
+    }
+
+    VecReaderCtx* rCtx = VecReaderCtx_Create(data, topK);
+    rCtx->filter = filter;
+    rCtx->nprobe = nprobe;
+    rCtx->coarse = coarse;
+    rCtx->disk = disk;
+    rCtx->sparse = sparse;
+    rCtx->sparseDims = sparseDims;
+    rCtx->sparseWeights = sparseWeights;
+    rCtx->profile = profile;
+    rCtx->withVectors = withVectors;
+    qCtx->profile = profile;
+
+    ExecutionPlan* ep;
+    if(twoPhase){
+        VecReaderCtx* sampleCtx = VecReaderCtx_Create(rCtx->vec, topK);
+        sampleCtx->sample = sample;
+        if(filter){
+            sampleCtx->filter = VecFilter_Dup(filter);
+        }
+
+        TwoPhaseCtx* tpCtx = RG_ALLOC(sizeof(*tpCtx));
+        tpCtx->qCtx = qCtx;
+        tpCtx->rCtx = rCtx;
+
+        // sampleCtx is owned by the sample execution, rCtx by tpCtx until the full scan runs
+        ep = vec_sim_run(sampleCtx, on_sample_done, tpCtx, &err);
+        if(!ep){
+            RG_FREE(tpCtx);
+            VecReaderCtx_Free(rCtx);
+        }
+    }else{
+        ep = vec_sim_run(rCtx, on_done, qCtx, &err);
+    }
+
+    if(!ep){
+        VecQueryCtx_Free(qCtx);
+        RedisModule_AbortBlock(bc);
+        RedisModule_ReplyWithError(ctx, err);
+        return REDISMODULE_OK;
+    }
+
+    VecStats_Incr(VEC_COUNTER_QUERIES);
+
+    return REDISMODULE_OK;
+}
+
+/*
+ * rg.vec_multi_sim <k> <blob> [CANDIDATES <c>] [PROFILE]
+ *
+ * Search the multi vector documents by late interaction, the blob holds the query
+ * vectors one after the other (up to VEC_MULTI_MAX_QUERY) and a document scores the
+ * sum over the query vectors of their best score against its own vectors (MaxSim).
+ *
+ * CANDIDATES first runs a pass per query vector on the vector prefixes (as COARSE does)
+ * and scores only the documents that own one of the best <c> vectors of any query vector.
+ */
+int vec_multi_sim_command(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+    if(argc < 3){
+        return RedisModule_WrongArity(ctx);
+    }
+
+    char* err = NULL;
+
+    long long topK;
+    if(RedisModule_StringToLongLong(argv[1], &topK) != REDISMODULE_OK || topK < 0){
+        RedisModule_ReplyWithError(ctx, "Failed extracting <k>");
+        return REDISMODULE_OK;
+    }
+
+    size_t dataSize;
+    float* data = (float*)RedisModule_StringPtrLen(argv[2], &dataSize);
+    size_t nq = dataSize / (VEC_SIZE * sizeof(float));
+    if(nq == 0 || nq > VEC_MULTI_MAX_QUERY || dataSize % (VEC_SIZE * sizeof(float)) != 0){
+        RedisModule_ReplyWithError(ctx, "Given blob is not at the right size");
+        return REDISMODULE_OK;
+    }
+
+    bool profile = false;
+    long long candidates = 0;
+    for(int i = 3 ; i < argc ; ++i){
+        const char* opt = RedisModule_StringPtrLen(argv[i], NULL);
+        if(strcasecmp(opt, "PROFILE") == 0){
+            profile = true;
+        }else if(strcasecmp(opt, "CANDIDATES") == 0 && i + 1 < argc){
+            if(RedisModule_StringToLongLong(argv[++i], &candidates) != REDISMODULE_OK || candidates <= 0){
+                err = "Failed extracting <c>";
+                break;
+            }
+        }else{
+            err = "Unknown argument given";
+            break;
+        }
+    }
+
+    if(!err && vecMetric == VEC_METRIC_L2){
+        err = "Multi vector documents are not supported on the L2 metric";
+    }
+
+    if(!err && candidates && !VecConfig_Get(VEC_CONFIG_COARSE_PREFIXES)){
+        err = "CANDIDATES requires the coarse-prefixes config";
+    }
+
+    if(err){
+        RedisModule_ReplyWithError(ctx, err);
+        return REDISMODULE_OK;
+    }
+
+    VecReaderCtx* rCtx = VecReaderCtx_Create(NULL, topK);
+    rCtx->multi = nq;
+    rCtx->queries = RG_ALLOC(nq * VEC_SIZE * sizeof(float));
+    for(size_t q = 0 ; q < nq ; ++q){
+        vec_set_data(&rCtx->queries[q * VEC_SIZE], &data[q * VEC_SIZE]);
+    }
+    rCtx->multiCandidates = candidates;
+    rCtx->profile = profile;
+
+    RedisModuleBlockedClient *bc = RedisModule_BlockClient(ctx, NULL, NULL, NULL, 0);
+    VecQueryCtx* qCtx = VecQueryCtx_Create(bc, vec_query_params(argv, argc, 2, -1));
+    qCtx->profile = profile;
+
+    ExecutionPlan* ep = vec_sim_run(rCtx, on_done, qCtx, &err);
+    if(!ep){
+        VecQueryCtx_Free(qCtx);
+        RedisModule_AbortBlock(bc);
+        RedisModule_ReplyWithError(ctx, err);
+        return REDISMODULE_OK;
+    }
+
+    VecStats_Incr(VEC_COUNTER_QUERIES);
+
+    return REDISMODULE_OK;
+}
+
+/*
+ * rg.vec_sparse_sim <k> <dims blob> <weights blob> [PROFILE]
+ *
+ * Search the sparse vectors by their inner product with the given sparse query (see
+ * rg.vec_sparse_add), the vectors sharing no dimension with the query are not returned.
+ */
+int vec_sparse_sim_command(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+    if(argc < 4){
+        return RedisModule_WrongArity(ctx);
+    }
+
+    char* err = NULL;
+
+    long long topK;
+    if(RedisModule_StringToLongLong(argv[1], &topK) != REDISMODULE_OK || topK < 0){
+        RedisModule_ReplyWithError(ctx, "Failed extracting <k>");
+        return REDISMODULE_OK;
+    }
+
+    bool profile = false;
+    for(int i = 4 ; i < argc ; ++i){
+        const char* opt = RedisModule_StringPtrLen(argv[i], NULL);
+        if(strcasecmp(opt, "PROFILE") == 0){
+            profile = true;
+        }else{
+            err = "Unknown argument given";
+            break;
+        }
+    }
+
+    if(!err && vecMetric == VEC_METRIC_L2){
+        err = "Sparse vectors are not supported on the L2 metric";
+    }
+
+    uint32_t* dims;
+    float* weights;
+    size_t nnz;
+    if(!err){
+        vec_parse_sparse(argv[2], argv[3], &dims, &weights, &nnz, &err);
+    }
+
+    if(err){
+        RedisModule_ReplyWithError(ctx, err);
+        return REDISMODULE_OK;
+    }
+
+    VecReaderCtx* rCtx = VecReaderCtx_Create(NULL, topK);
+    rCtx->sparse = nnz;
+    rCtx->sparseDims = dims;
+    rCtx->sparseWeights = weights;
+    rCtx->sparseOnly = true;
+    rCtx->profile = profile;
+
+    RedisModuleBlockedClient *bc = RedisModule_BlockClient(ctx, NULL, NULL, NULL, 0);
+    VecQueryCtx* qCtx = VecQueryCtx_Create(bc, vec_query_params(argv, argc, -1, 2));
+    qCtx->profile = profile;
+
+    ExecutionPlan* ep = vec_sim_run(rCtx, on_done, qCtx, &err);
+    if(!ep){
+        VecQueryCtx_Free(qCtx);
+        RedisModule_AbortBlock(bc);
+        RedisModule_ReplyWithError(ctx, err);
+        return REDISMODULE_OK;
+    }
+
+    VecStats_Incr(VEC_COUNTER_QUERIES);
+
+    return REDISMODULE_OK;
+}
+
+/*
+ * rg.vec_range <threshold> <blob> [LIMIT <n>] [FILTER TAG <field> <value>] [FILTER NUMERIC <field> <min> <max>] ...
+ *
+ * Return all the vectors with score >= threshold, in no particular order. On the L2
+ * metric the threshold is a distance and the vectors with distance <= threshold are
+ * returned. Shards stream their matches without keeping a heap, LIMIT caps the amount
+ * of results returned.
+ */
+int vec_range_command(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+
+    if(argc < 3){
+        return RedisModule_WrongArity(ctx);
+    }
+
+    char* err = NULL;
+
+    double threshold;
+    if(RedisModule_StringToDouble(argv[1], &threshold) != REDISMODULE_OK || (vecMetric == VEC_METRIC_L2 && threshold < 0)){
+        RedisModule_ReplyWithError(ctx, "Failed extracting <threshold>");
+        return REDISMODULE_OK;
+    }
+    if(vecMetric == VEC_METRIC_L2){
+        // the L2 scores are the negated squared distances (see vec_metric_score)
+        threshold = -threshold * threshold;
+    }
+
+    size_t dataSize;
+    float* data = (float*)RedisModule_StringPtrLen(argv[2], &dataSize);
+    if(dataSize != (VEC_SIZE * sizeof(float))){
+        RedisModule_ReplyWithError(ctx, "Given blob is not at the right size");
+        return REDISMODULE_OK;
+    }
+
+    long long limit = 0;
+    VecFilter* filter = NULL;
+    for(int i = 3 ; i < argc ; ++i){
+        const char* opt = RedisModule_StringPtrLen(argv[i], NULL);
+        if(strcasecmp(opt, "LIMIT") == 0 && i + 1 < argc){
+            if(RedisModule_StringToLongLong(argv[++i], &limit) != REDISMODULE_OK || limit <= 0){
+                err = "Failed extracting <limit>";
+                break;
+            }
+        }else if(strcasecmp(opt, "FILTER") == 0){
+            if(vec_parse_filter(argv, argc, &i, &filter, &err) != REDISMODULE_OK){
+                break;
+            }
+        }else{
+            err = "Unknown argument given";
+            break;
+        }
+    }
+
+    if(err){
+        if(filter){
+            VecFilter_Free(filter);
+        }
+        RedisModule_ReplyWithError(ctx, err);
+        return REDISMODULE_OK;
+    }
+
+    VecReaderCtx* rCtx = VecReaderCtx_Create(data, 0);
+    rCtx->filter = filter;
+    rCtx->range = true;
+    rCtx->threshold = threshold;
+    rCtx->limit = limit;
+
+    FlatExecutionPlan* fep = RGM_CreateCtx(VecReader, &err);
+    if(!fep){
+        VecReaderCtx_Free(rCtx);
+        RedisModule_ReplyWithError(ctx, err);
+        return REDISMODULE_OK;
+    }
+
+    RGM_Collect(fep);
+
+    // each shard stops after limit results, cut the union down to limit as well
+    if(limit){
+        RGM_Limit(fep, 0, limit);
+    }
+
+    RedisModuleBlockedClient *bc = RedisModule_BlockClient(ctx, NULL, NULL, NULL, 0);
+    VecQueryCtx* qCtx = VecQueryCtx_Create(bc, vec_query_params(argv, argc, 2, -1));
+
+    ExecutionPlan* ep = RGM_Run(fep, ExecutionModeAsync, rCtx, NULL, NULL, &err);
+    if(!ep){
+        VecReaderCtx_Free(rCtx);
+        VecQueryCtx_Free(qCtx);
+        RedisModule_AbortBlock(bc);
+        RedisModule_ReplyWithError(ctx, err);
+    }else{
+        RedisGears_AddOnDoneCallback(ep, on_done, qCtx);
+        VecStats_Incr(VEC_COUNTER_QUERIES);
+    }
+
+    RedisGears_FreeFlatExecution(fep);
+
+    return REDISMODULE_OK;
+}
+
+static int ScoreRecord_SendReply(Record* base, RedisModuleCtx* rctx){
     ScoreRecord* sr = (ScoreRecord*)base;
-    RedisModule_ReplyWithArray(rctx, 2);
+    RedisModule_ReplyWithArray(rctx, sr->vec ? 3 : 2);
     RedisModule_ReplyWithString(rctx, sr->key);
-    RedisModule_ReplyWithDouble(rctx, sr->score);
+    RedisModule_ReplyWithDouble(rctx, vec_reply_score(sr->score));
+    if(sr->vec){
+        RedisModule_ReplyWithStringBuffer(rctx, (char*)sr->vec, VEC_SIZE * sizeof(float));
+    }
+    return REDISMODULE_OK;
+}
+
+static int ScoreRecord_RecordSerialize(ExecutionCtx* ctx, Gears_BufferWriter* bw, Record* base){
+    ScoreRecord* sr = (ScoreRecord*)base;
+    const char* keyStr = RedisModule_StringPtrLen(sr->key, NULL);
+    RedisGears_BWWriteString(bw, keyStr);
+    RedisGears_BWWriteBuffer(bw, (char*)(&(sr->score)), sizeof(sr->score));
+    RedisGears_BWWriteLong(bw, sr->vec != NULL);
+    if(sr->vec){
+        RedisGears_BWWriteBuffer(bw, (char*)sr->vec, VEC_SIZE * sizeof(float));
+    }
+    return REDISMODULE_OK;
+}
+
+/*
+ * Read a vector written with RedisGears_BWWriteBuffer into a new buffer.
+ */
+static float* vec_read_buffer(Gears_BufferReader* br){
+    size_t len;
+    char* data = RedisGears_BRReadBuffer(br, &len);
+    RedisModule_Assert(len == VEC_SIZE * sizeof(float));
+    float* vec = RG_ALLOC(len);
+    memcpy(vec, data, len);
+    return vec;
+}
+
+static Record* ScoreRecord_RecordDeserialize(ExecutionCtx* ctx, Gears_BufferReader* br){
+    ScoreRecord* sr = (ScoreRecord*)RedisGears_RecordCreate(ScoreRecordType);
+    const char* keyStr = RedisGears_BRReadString(br);
+    sr->key = RedisModule_CreateString(NULL, keyStr, strlen(keyStr));
+    size_t len;
+    char* data = RedisGears_BRReadBuffer(br, &len);
+    RedisModule_Assert(len == sizeof(float));
+    sr->score = *((float*)(data));
+    sr->vec = RedisGears_BRReadLong(br) ? vec_read_buffer(br) : NULL;
+
+    return &sr->baseRecord;
+}
+
+static void ScoreRecord_RecordFree(Record* base){
+    ScoreRecord* sr = (ScoreRecord*)base;
+    if(sr->key){
+        RedisModule_FreeString(NULL, sr->key);
+    }
+    if(sr->vec){
+        RG_FREE(sr->vec);
+    }
+}
+
+static int TopKRecord_SendReply(Record* base, RedisModuleCtx* rctx){
+    TopKRecord* tr = (TopKRecord*)base;
+    RedisModule_ReplyWithArray(rctx, tr->count);
+    for(size_t i = 0 ; i < tr->count ; ++i){
+        RedisModule_ReplyWithArray(rctx, tr->vecs ? 3 : 2);
+        RedisModule_ReplyWithString(rctx, tr->keys[i]);
+        RedisModule_ReplyWithDouble(rctx, vec_reply_score(tr->items[i].score));
+        if(tr->vecs){
+            RedisModule_ReplyWithStringBuffer(rctx, (char*)tr->vecs[i], VEC_SIZE * sizeof(float));
+        }
+    }
+    return REDISMODULE_OK;
+}
+
+static int TopKRecord_RecordSerialize(ExecutionCtx* ctx, Gears_BufferWriter* bw, Record* base){
+    TopKRecord* tr = (TopKRecord*)base;
+    RedisGears_BWWriteLong(bw, tr->count);
+    for(size_t i = 0 ; i < tr->count ; ++i){
+        size_t len;
+        const char* key = RedisModule_StringPtrLen(tr->keys[i], &len);
+        RedisGears_BWWriteBuffer(bw, key, len);
+    }
+    if(tr->count > 0){
+        RedisGears_BWWriteBuffer(bw, (char*)tr->items, sizeof(*tr->items) * tr->count);
+    }
+    RedisGears_BWWriteLong(bw, tr->vecs != NULL);
+    for(size_t i = 0 ; tr->vecs && i < tr->count ; ++i){
+        RedisGears_BWWriteBuffer(bw, (char*)tr->vecs[i], VEC_SIZE * sizeof(float));
+    }
+    RedisGears_BWWriteLong(bw, array_len(tr->profiles));
+    for(size_t i = 0 ; i < array_len(tr->profiles) ; ++i){
+        ProfileRecord_RecordSerialize(ctx, bw, tr->profiles[i]);
+    }
+    RedisGears_BWWriteLong(bw, tr->sampled);
+    return REDISMODULE_OK;
+}
+
+static Record* TopKRecord_RecordDeserialize(ExecutionCtx* ctx, Gears_BufferReader* br){
+    size_t count = RedisGears_BRReadLong(br);
+    RedisModuleString** keys = RG_ALLOC(sizeof(*keys) * MAX(count, 1));
+    TopKItem* items = RG_ALLOC(sizeof(*items) * MAX(count, 1));
+    for(size_t i = 0 ; i < count ; ++i){
+        size_t len;
+        const char* key = RedisGears_BRReadBuffer(br, &len);
+        keys[i] = RedisModule_CreateString(NULL, key, len);
+    }
+    if(count > 0){
+        size_t len;
+        char* data = RedisGears_BRReadBuffer(br, &len);
+        RedisModule_Assert(len == sizeof(*items) * count);
+        memcpy(items, data, len);
+    }
+    float** vecs = NULL;
+    if(RedisGears_BRReadLong(br)){
+        vecs = RG_ALLOC(sizeof(*vecs) * MAX(count, 1));
+        for(size_t i = 0 ; i < count ; ++i){
+            vecs[i] = vec_read_buffer(br);
+        }
+    }
+    TopKRecord* tr = TopKRecord_Create(items, count, keys, vecs);
+    size_t nProfiles = RedisGears_BRReadLong(br);
+    for(size_t i = 0 ; i < nProfiles ; ++i){
+        if(!tr->profiles){
+            tr->profiles = array_new(Record*, nProfiles);
+        }
+        tr->profiles = array_append(tr->profiles, ProfileRecord_RecordDeserialize(ctx, br));
+    }
+    tr->sampled = RedisGears_BRReadLong(br);
+    return &tr->baseRecord;
+}
+
+static void TopKRecord_RecordFree(Record* base){
+    TopKRecord* tr = (TopKRecord*)base;
+    TopKRecord_FreeResults(tr);
+    for(size_t i = 0 ; i < array_len(tr->profiles) ; ++i){
+        RedisGears_FreeRecord(tr->profiles[i]);
+    }
+    if(tr->profiles){
+        array_free(tr->profiles);
+    }
+}
+
+static int TopKBatchRecord_SendReply(Record* base, RedisModuleCtx* rctx){
+    TopKBatchRecord* br = (TopKBatchRecord*)base;
+    RedisModule_ReplyWithArray(rctx, br->count);
+    for(size_t i = 0 ; i < br->count ; ++i){
+        TopKRecord_SendReply(&br->results[i]->baseRecord, rctx);
+    }
+    return REDISMODULE_OK;
+}
+
+static int TopKBatchRecord_RecordSerialize(ExecutionCtx* ctx, Gears_BufferWriter* bw, Record* base){
+    TopKBatchRecord* br = (TopKBatchRecord*)base;
+    RedisGears_BWWriteLong(bw, br->count);
+    for(size_t i = 0 ; i < br->count ; ++i){
+        RedisGears_BWWriteLong(bw, br->topK[i]);
+        TopKRecord_RecordSerialize(ctx, bw, &br->results[i]->baseRecord);
+    }
+    return REDISMODULE_OK;
+}
+
+static Record* TopKBatchRecord_RecordDeserialize(ExecutionCtx* ctx, Gears_BufferReader* br){
+    TopKBatchRecord* batch = (TopKBatchRecord*)RedisGears_RecordCreate(TopKBatchRecordType);
+    batch->count = RedisGears_BRReadLong(br);
+    batch->results = RG_ALLOC(sizeof(*batch->results) * MAX(batch->count, 1));
+    batch->topK = RG_ALLOC(sizeof(*batch->topK) * MAX(batch->count, 1));
+    for(size_t i = 0 ; i < batch->count ; ++i){
+        batch->topK[i] = RedisGears_BRReadLong(br);
+        batch->results[i] = (TopKRecord*)TopKRecord_RecordDeserialize(ctx, br);
+    }
+    return &batch->baseRecord;
+}
+
+static void TopKBatchRecord_RecordFree(Record* base){
+    TopKBatchRecord* br = (TopKBatchRecord*)base;
+    for(size_t i = 0 ; i < br->count ; ++i){
+        RedisGears_FreeRecord(&br->results[i]->baseRecord);
+    }
+    RG_FREE(br->results);
+    RG_FREE(br->topK);
+}
+
+static int ProfileRecord_SendReply(Record* base, RedisModuleCtx* rctx){
+    ProfileRecord* pr = (ProfileRecord*)base;
+    RedisModule_ReplyWithArray(rctx, 2 + 2 * VEC_PROFILE_COUNT);
+    RedisModule_ReplyWithSimpleString(rctx, "shard");
+    RedisModule_ReplyWithStringBuffer(rctx, pr->shard, strlen(pr->shard));
+    for(size_t i = 0 ; i < VEC_PROFILE_COUNT ; ++i){
+        RedisModule_ReplyWithSimpleString(rctx, profileFieldNames[i]);
+        RedisModule_ReplyWithLongLong(rctx, pr->values[i]);
+    }
+    return REDISMODULE_OK;
+}
+
+static int ProfileRecord_RecordSerialize(ExecutionCtx* ctx, Gears_BufferWriter* bw, Record* base){
+    ProfileRecord* pr = (ProfileRecord*)base;
+    RedisGears_BWWriteString(bw, pr->shard);
+    for(size_t i = 0 ; i < VEC_PROFILE_COUNT ; ++i){
+        RedisGears_BWWriteLong(bw, pr->values[i]);
+    }
+    return REDISMODULE_OK;
+}
+
+static Record* ProfileRecord_RecordDeserialize(ExecutionCtx* ctx, Gears_BufferReader* br){
+    ProfileRecord* pr = (ProfileRecord*)RedisGears_RecordCreate(ProfileRecordType);
+    pr->shard = RG_STRDUP(RedisGears_BRReadString(br));
+    for(size_t i = 0 ; i < VEC_PROFILE_COUNT ; ++i){
+        pr->values[i] = RedisGears_BRReadLong(br);
+    }
+    return &pr->baseRecord;
+}
+
+static void ProfileRecord_RecordFree(Record* base){
+    ProfileRecord* pr = (ProfileRecord*)base;
+    if(pr->shard){
+        RG_FREE(pr->shard);
+    }
+}
+
+static void TopKArg_ObjectFree(void* arg){
+    RG_FREE(arg);
+}
+
+static void* TopKArg_ArgDuplicate(void* arg){
+    TopKArg* topK = arg;
+    TopKArg* topKDup = RG_ALLOC(sizeof(*topKDup));
+    topKDup->topK = topK->topK;
+    return topKDup;
+}
+
+static int TopKArg_ArgSerialize(FlatExecutionPlan* fep, void* arg, Gears_BufferWriter* bw, char** err){
+    TopKArg* topK = arg;
+    RedisGears_BWWriteLong(bw, topK->topK);
+    return REDISMODULE_OK;
+}
+
+static void* TopKArg_ArgDeserialize(FlatExecutionPlan* fep, Gears_BufferReader* br, int version, char** err){
+    TopKArg* topKDup = RG_ALLOC(sizeof(*topKDup));
+    topKDup->topK = RedisGears_BRReadLong(br);
+    return topKDup;
+}
+
+static char* TopKArg_ArgToString(void* arg){
+    return RG_STRDUP("I am topk argument :)");
+}
+
+#define TopKTypeVersion 1
+
+#define VS_PLUGIN_NAME "VECTOR_SIM"
+#define REDISGEARSJVM_PLUGIN_VERSION 1
+
+#define VEC_TYPE_VERSION 4 // 4 saves the numeric attributes as doubles
+
+static void* VecDT_Load(RedisModuleIO *rdb, int encver){
+    size_t keyLen;
+    char* key = RedisModule_LoadStringBuffer(rdb, &keyLen);
+    size_t dataLen;
+    float* data = (float*)RedisModule_LoadStringBuffer(rdb, &dataLen);
+    RedisModule_Assert(dataLen == sizeof(float) * VEC_SIZE);
+
+    VecDT* vDT = vec_insert(key, keyLen, data);
+
+    if(encver >= 2){
+        VecAttrs_RdbLoad(rdb, &VEC_DT_HOLDER(vDT)->attrs, VEC_HOLDER_SIZE, vDT->index, encver < 4);
+    }
+
+    RedisModule_Free(key);
+    RedisModule_Free(data);
+
+    return vDT;
+}
+
+static void VecDT_Save(RedisModuleIO *rdb, void *value){
+    VecDT* vDT = value;
+    VecsHolder* holder = VEC_DT_HOLDER(vDT);
+    VecKey* key = HOLDER_KEY(holder, vDT->index);
+
+    RedisModule_SaveStringBuffer(rdb, key->name, key->len);
+    RedisModule_SaveStringBuffer(rdb, (char*)&HOLDER_VEC(holder, vDT->index), sizeof(float) * VEC_SIZE);
+    VecAttrs_RdbSave(rdb, holder->attrs, vDT->index);
+}
+
+static void VecDT_Free(void *value){
+    vec_delete(value);
+}
+
+#define VEC_MULTI_TYPE_VERSION 1
+
+static void* VecMultiDT_Load(RedisModuleIO *rdb, int encver){
+    size_t keyLen;
+    char* key = RedisModule_LoadStringBuffer(rdb, &keyLen);
+    size_t dataLen;
+    float* data = (float*)RedisModule_LoadStringBuffer(rdb, &dataLen);
+    RedisModule_Assert(dataLen > 0 && dataLen % (sizeof(float) * VEC_SIZE) == 0);
+
+    VecDT* vDT = vec_multi_insert(key, keyLen, data, dataLen / (sizeof(float) * VEC_SIZE));
+
+    RedisModule_Free(key);
+    RedisModule_Free(data);
+
+    return vDT;
+}
+
+static void VecMultiDT_Save(RedisModuleIO *rdb, void *value){
+    VecDT* vDT = value;
+    VecsHolder* holder = VEC_MULTI_HOLDER(vDT);
+    VecKey* key = HOLDER_KEY(holder, vDT->index);
+
+    RedisModule_SaveStringBuffer(rdb, key->name, key->len);
+    RedisModule_SaveStringBuffer(rdb, (char*)&HOLDER_VEC(holder, vDT->index), sizeof(float) * VEC_SIZE * vec_multi_count(vDT));
+}
+
+
+#define VEC_SPARSE_TYPE_VERSION 1
+
+static void* VecSparseDT_Load(RedisModuleIO *rdb, int encver){
+    size_t keyLen;
+    char* key = RedisModule_LoadStringBuffer(rdb, &keyLen);
+    size_t dimsLen;
+    uint32_t* dims = (uint32_t*)RedisModule_LoadStringBuffer(rdb, &dimsLen);
+    size_t weightsLen;
+    float* weights = (float*)RedisModule_LoadStringBuffer(rdb, &weightsLen);
+    RedisModule_Assert(dimsLen > 0 && dimsLen % sizeof(uint32_t) == 0 && weightsLen == dimsLen);
+
+    VecSparseDoc* doc = VecSparse_Insert(key, keyLen, dims, weights, dimsLen / sizeof(uint32_t));
+
+    RedisModule_Free(key);
+    RedisModule_Free(dims);
+    RedisModule_Free(weights);
+
+    return doc;
+}
+
+static void VecSparseDT_Save(RedisModuleIO *rdb, void *value){
+    VecSparseDoc* doc = value;
+    RedisModule_SaveStringBuffer(rdb, doc->name, doc->len);
+    RedisModule_SaveStringBuffer(rdb, (char*)doc->dims, sizeof(uint32_t) * doc->nnz);
+    RedisModule_SaveStringBuffer(rdb, (char*)doc->weights, sizeof(float) * doc->nnz);
+}
+
+static void VecSparseDT_Free(void *value){
+    VecSparse_Delete(value);
+}
+
+typedef struct HashIndexSpec{
+    char* prefix;
+    char* field;
+}HashIndexSpec;
+
+// the hash keys prefix and field to index, NULL if hashes are not indexed
+static HashIndexSpec* hashIndex = NULL;
+
+// key name -> VecDT of the indexed hash keys
+static RedisModuleDict* hashVecs = NULL;
+
+static void HashIndex_Free(){
+    if(!hashIndex){
+        return;
+    }
+    RG_FREE(hashIndex->prefix);
+    RG_FREE(hashIndex->field);
+    RG_FREE(hashIndex);
+    hashIndex = NULL;
+}
+
+static bool HashIndex_Match(RedisModuleString* keyName){
+    if(!hashIndex){
+        return false;
+    }
+    size_t len;
+    const char* key = RedisModule_StringPtrLen(keyName, &len);
+    size_t prefixLen = strlen(hashIndex->prefix);
+    return len >= prefixLen && memcmp(key, hashIndex->prefix, prefixLen) == 0;
+}
+
+/*
+ * Sync the index with the current state of the given key, the vector is indexed
+ * if the key is a hash with a valid vector on the indexed field and removed otherwise.
+ * kp can be NULL, in which case the key is opened here.
+ */
+static void HashIndex_SyncKey(RedisModuleCtx* ctx, RedisModuleString* keyName, RedisModuleKey* kp){
+    bool closeKey = false;
+    if(!kp){
+        kp = RedisModule_OpenKey(ctx, keyName, REDISMODULE_READ);
+        closeKey = true;
+    }
+
+    RedisModuleString* val = NULL;
+    if(RedisModule_KeyType(kp) == REDISMODULE_KEYTYPE_HASH){
+        RedisModule_HashGet(kp, REDISMODULE_HASH_CFIELDS, hashIndex->field, &val, NULL);
+    }
+
+    if(closeKey){
+        RedisModule_CloseKey(kp);
+    }
+
+    size_t dataLen = 0;
+    const float* data = val ? (const float*)RedisModule_StringPtrLen(val, &dataLen) : NULL;
+
+    VecDT* vDT = RedisModule_DictGet(hashVecs, keyName, NULL);
+    if(data && dataLen == VEC_SIZE * sizeof(float)){
+        if(!vDT){
+            VecStats_Incr(VEC_COUNTER_INSERTS);
+            size_t keyLen;
+            const char* key = RedisModule_StringPtrLen(keyName, &keyLen);
+            vDT = vec_insert(key, keyLen, data);
+            RedisModule_DictSet(hashVecs, keyName, vDT);
+        }else if(!vec_same_data(vDT, data)){
+            // when another field of the hash changed the vector is kept, rewriting it would take
+            // the slot out of its IVF list and invalidate the results cache for nothing
+            VecStats_Incr(VEC_COUNTER_INSERTS);
+            vec_update(vDT, data);
+        }
+    }else if(vDT){
+        RedisModule_DictDel(hashVecs, keyName, NULL);
+        VecDT_Free(vDT);
+    }
+
+    if(val){
+        RedisModule_FreeString(ctx, val);
+    }
+}
+
+static int HashIndex_OnKeyspaceEvent(RedisModuleCtx *ctx, int type, const char *event, RedisModuleString *key){
+    if(!HashIndex_Match(key)){
+        return REDISMODULE_OK;
+    }
+
+    // whatever happened to the key (hset, hdel, del, expired, evicted, rename, ...)
+    // we just look at its current state.
+    HashIndex_SyncKey(ctx, key, NULL);
+
+    return REDISMODULE_OK;
+}
+
+static void HashIndex_ScanCallback(RedisModuleCtx *ctx, RedisModuleString *keyname, RedisModuleKey *key, void *privdata){
+    if(!HashIndex_Match(keyname)){
+        return;
+    }
+    HashIndex_SyncKey(ctx, keyname, key);
+}
+
+/*
+ * Index all the existing hash keys that matches the index spec.
+ */
+static void HashIndex_ScanKeys(RedisModuleCtx *ctx){
+    if(!hashIndex){
+        return;
+    }
+    RedisModuleScanCursor* cursor = RedisModule_ScanCursorCreate();
+    while(RedisModule_Scan(ctx, cursor, HashIndex_ScanCallback, NULL));
+    RedisModule_ScanCursorDestroy(cursor);
+}
+
+/*
+ * Remove all the hash keys vectors from the index.
+ */
+static void HashIndex_Clear(){
+    RedisModuleDictIter* iter = RedisModule_DictIteratorStartC(hashVecs, "^", NULL, 0);
+    VecDT* vDT;
+    while(RedisModule_DictNextC(iter, NULL, (void**)&vDT)){
+        VecDT_Free(vDT);
+    }
+    RedisModule_DictIteratorStop(iter);
+    RedisModule_FreeDict(NULL, hashVecs);
+    hashVecs = RedisModule_CreateDict(NULL);
+}
+
+/*
+ * rg.vec_hash_index <prefix> <field>
+ *
+ * Index the vectors found on <field> of all the hash keys starting with <prefix>,
+ * the index follows the hashes using keyspace notifications.
+ */
+int vec_hash_index_command(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+    if(argc != 3){
+        return RedisModule_WrongArity(ctx);
+    }
+
+    HashIndex_Clear();
+    HashIndex_Free();
+
+    hashIndex = RG_ALLOC(sizeof(*hashIndex));
+    hashIndex->prefix = RG_STRDUP(RedisModule_StringPtrLen(argv[1], NULL));
+    hashIndex->field = RG_STRDUP(RedisModule_StringPtrLen(argv[2], NULL));
+
+    HashIndex_ScanKeys(ctx);
+
+    RedisModule_ReplicateVerbatim(ctx);
+
+    RedisModule_ReplyWithSimpleString(ctx, "OK");
+
+    return REDISMODULE_OK;
+}
+
+/*
+ * The aux data holds the hash index and the metric, it is saved before the keys so the
+ * vectors are loaded on their metric.
+ */
+static void HashIndex_AuxSave(RedisModuleIO *rdb, int when){
+    RedisModule_SaveUnsigned(rdb, hashIndex ? 1 : 0);
+    if(hashIndex){
+        RedisModule_SaveStringBuffer(rdb, hashIndex->prefix, strlen(hashIndex->prefix));
+        RedisModule_SaveStringBuffer(rdb, hashIndex->field, strlen(hashIndex->field));
+    }
+    RedisModule_SaveUnsigned(rdb, vecMetric);
+}
+
+static char* HashIndex_LoadCString(RedisModuleIO *rdb){
+    size_t len;
+    char* buff = RedisModule_LoadStringBuffer(rdb, &len);
+    char* str = RG_ALLOC(len + 1);
+    memcpy(str, buff, len);
+    str[len] = '\0';
+    RedisModule_Free(buff);
+    return str;
+}
+
+static int HashIndex_AuxLoad(RedisModuleIO *rdb, int encver, int when){
+    HashIndex_Free();
+    if(RedisModule_LoadUnsigned(rdb)){
+        hashIndex = RG_ALLOC(sizeof(*hashIndex));
+        hashIndex->prefix = HashIndex_LoadCString(rdb);
+        hashIndex->field = HashIndex_LoadCString(rdb);
+    }
+    uint64_t metric = encver >= 3 ? RedisModule_LoadUnsigned(rdb) : VEC_METRIC_COSINE;
+    if(metric >= VEC_METRIC_COUNT || vec_metric_set(metric) != REDISMODULE_OK){
+        RedisModule_LogIOError(rdb, "warning", "Can not load the vectors metric");
+        return REDISMODULE_ERR;
+    }
+    return REDISMODULE_OK;
+}
+
+/*
+ * Streams ingestion, RG.VEC_STREAM_REGISTER registers a StreamReader execution on the
+ * streams starting with a prefix. Every stream entry holds a key name and a vector
+ * blob, the entries are repartitioned to the shard of their key and inserted in bulk,
+ * a single lock hold per batch. The StreamReader only triggers the next batch of a
+ * stream once the previous one is done and trims the consumed entries.
+ */
+
+#define VEC_STREAM_DEFAULT_BATCH 1000
+#define VEC_STREAM_DEFAULT_DURATION_MS 100
+
+typedef struct VecStreamArg{
+    char* keyField;
+    char* vecField;
+}VecStreamArg;
+
+static ArgType* VecStreamArgType = NULL;
+
+#define VecStreamArgTypeVersion 1
+
+/*
+ * A single stream entry, on its way to the shard of its key.
+ */
+typedef struct VecEntryRecord{
+    Record baseRecord;
+    char* key;
+    size_t keyLen;
+    float vec[VEC_SIZE];
+}VecEntryRecord;
+
+static RecordType* VecEntryRecordType = NULL;
+
+static VecStreamArg* VecStreamArg_Create(const char* keyField, const char* vecField){
+    VecStreamArg* arg = RG_ALLOC(sizeof(*arg));
+    arg->keyField = RG_STRDUP(keyField);
+    arg->vecField = RG_STRDUP(vecField);
+    return arg;
+}
+
+static void VecStreamArg_ObjectFree(void* arg){
+    VecStreamArg* a = arg;
+    RG_FREE(a->keyField);
+    RG_FREE(a->vecField);
+    RG_FREE(a);
+}
+
+static void* VecStreamArg_ArgDuplicate(void* arg){
+    VecStreamArg* a = arg;
+    return VecStreamArg_Create(a->keyField, a->vecField);
+}
+
+static int VecStreamArg_ArgSerialize(FlatExecutionPlan* fep, void* arg, Gears_BufferWriter* bw, char** err){
+    VecStreamArg* a = arg;
+    RedisGears_BWWriteString(bw, a->keyField);
+    RedisGears_BWWriteString(bw, a->vecField);
     return REDISMODULE_OK;
 }
 
-static int ScoreRecord_RecordSerialize(ExecutionCtx* ctx, Gears_BufferWriter* bw, Record* base){
-    ScoreRecord* sr = (ScoreRecord*)base;
-    const char* keyStr = RedisModule_StringPtrLen(sr->key, NULL);
-    RedisGears_BWWriteString(bw, keyStr);
-    RedisGears_BWWriteBuffer(bw, (char*)(&(sr->score)), sizeof(sr->score));
+static void* VecStreamArg_ArgDeserialize(FlatExecutionPlan* fep, Gears_BufferReader* br, int version, char** err){
+    const char* keyField = RedisGears_BRReadString(br);
+    const char* vecField = RedisGears_BRReadString(br);
+    return VecStreamArg_Create(keyField, vecField);
+}
+
+static char* VecStreamArg_ArgToString(void* arg){
+    VecStreamArg* a = arg;
+    size_t len = strlen(a->keyField) + strlen(a->vecField) + 32;
+    char* str = RG_ALLOC(len);
+    snprintf(str, len, "keyField=%s vecField=%s", a->keyField, a->vecField);
+    return str;
+}
+
+static int VecEntryRecord_SendReply(Record* base, RedisModuleCtx* rctx){
+    VecEntryRecord* e = (VecEntryRecord*)base;
+    RedisModule_ReplyWithStringBuffer(rctx, e->key, e->keyLen);
     return REDISMODULE_OK;
 }
 
-static Record* ScoreRecord_RecordDeserialize(ExecutionCtx* ctx, Gears_BufferReader* br){
-    ScoreRecord* sr = (ScoreRecord*)RedisGears_RecordCreate(ScoreRecordType);
-    const char* keyStr = RedisGears_BRReadString(br);
-    sr->key = RedisModule_CreateString(NULL, keyStr, strlen(keyStr));
+static int VecEntryRecord_RecordSerialize(ExecutionCtx* ctx, Gears_BufferWriter* bw, Record* base){
+    VecEntryRecord* e = (VecEntryRecord*)base;
+    RedisGears_BWWriteBuffer(bw, e->key, e->keyLen);
+    RedisGears_BWWriteBuffer(bw, (char*)e->vec, VEC_SIZE * sizeof(float));
+    return REDISMODULE_OK;
+}
+
+static Record* VecEntryRecord_RecordDeserialize(ExecutionCtx* ctx, Gears_BufferReader* br){
+    VecEntryRecord* e = (VecEntryRecord*)RedisGears_RecordCreate(VecEntryRecordType);
+    const char* key = RedisGears_BRReadBuffer(br, &e->keyLen);
+    e->key = RG_ALLOC(e->keyLen);
+    memcpy(e->key, key, e->keyLen);
     size_t len;
-    char* data = RedisGears_BRReadBuffer(br, &len);
-    RedisModule_Assert(len == sizeof(float));
-    sr->score = *((float*)(data));
+    const char* vec = RedisGears_BRReadBuffer(br, &len);
+    RedisModule_Assert(len == VEC_SIZE * sizeof(float));
+    memcpy(e->vec, vec, len);
+    return &e->baseRecord;
+}
 
-    return &sr->baseRecord;
+static void VecEntryRecord_RecordFree(Record* base){
+    VecEntryRecord* e = (VecEntryRecord*)base;
+    if(e->key){
+        RG_FREE(e->key);
+    }
 }
 
-static void ScoreRecord_RecordFree(Record* base){
-    ScoreRecord* sr = (ScoreRecord*)base;
-    if(sr->key){
-        RedisModule_FreeString(NULL, sr->key);
+/*
+ * Return the string value of the field of a StreamReader record, NULL if it is missing.
+ */
+static const char* vec_stream_field(Record* data, char* field, size_t* len){
+    Record* value = RedisGears_HashSetRecordGet(data, "value");
+    Record* r = value ? RedisGears_HashSetRecordGet(value, field) : NULL;
+    if(!r || RedisGears_RecordGetType(r) != RedisGears_GetStringRecordType()){
+        return NULL;
+    }
+    return RedisGears_StringRecordGet(r, len);
+}
+
+/*
+ * Drop the entries without a key name or with a vector of the wrong size, they are
+ * logged and skipped so a bad entry does not stop the stream.
+ */
+static int vec_stream_entry_valid(ExecutionCtx* rctx, Record *data, void* arg){
+    VecStreamArg* a = arg;
+    size_t keyLen, vecLen;
+    const char* key = vec_stream_field(data, a->keyField, &keyLen);
+    const char* vec = vec_stream_field(data, a->vecField, &vecLen);
+    if(key && keyLen > 0 && vec && vecLen == VEC_SIZE * sizeof(float)){
+        return 1;
     }
+    size_t idLen = 0;
+    Record* id = RedisGears_HashSetRecordGet(data, "id");
+    const char* idStr = id ? RedisGears_StringRecordGet(id, &idLen) : "";
+    RedisModule_Log(NULL, "warning", "Skipping stream entry %.*s, it needs a key name on '%s' and a float vector of size "
+                    STR(VEC_SIZE) " on '%s'", (int)idLen, idStr, a->keyField, a->vecField);
+    return 0;
+}
+
+static Record* vec_stream_to_entry(ExecutionCtx* rctx, Record *data, void* arg){
+    VecStreamArg* a = arg;
+    VecEntryRecord* e = (VecEntryRecord*)RedisGears_RecordCreate(VecEntryRecordType);
+    size_t len;
+    const char* key = vec_stream_field(data, a->keyField, &e->keyLen);
+    e->key = RG_ALLOC(e->keyLen);
+    memcpy(e->key, key, e->keyLen);
+    memcpy(e->vec, vec_stream_field(data, a->vecField, &len), VEC_SIZE * sizeof(float));
+    RedisGears_FreeRecord(data);
+    return &e->baseRecord;
+}
 
+static char* vec_entry_key(ExecutionCtx* rctx, Record *data, void* arg, size_t* len){
+    VecEntryRecord* e = (VecEntryRecord*)data;
+    *len = e->keyLen;
+    return e->key;
 }
 
-static int HeapRecord_SendReply(Record* base, RedisModuleCtx* rctx){
-    RedisModule_Assert(false);
-    return REDISMODULE_OK;
+/*
+ * Gather the entries that arrived at the shard into a single list so they are
+ * inserted together.
+ */
+static Record* vec_entries_batch(ExecutionCtx* rctx, Record *accumulate, Record *r, void* arg){
+    if(!accumulate){
+        accumulate = RedisGears_ListRecordCreate(VEC_STREAM_DEFAULT_BATCH);
+    }
+    RedisGears_ListRecordAdd(accumulate, r);
+    return accumulate;
 }
 
-static int HeapRecord_Serialize(ExecutionCtx* ctx, Gears_BufferWriter* bw, Record* base){
-    RedisModule_Assert(false);
+/*
+ * Insert (or overwrite) the vectors of the batch under a single lock hold, every
+ * vector is replicated as RG.VEC_SET. Keys of another type are skipped.
+ */
+static int vec_entries_insert(ExecutionCtx* rctx, Record *data, void* arg){
+    RedisModuleCtx* ctx = RedisGears_GetRedisModuleCtx(rctx);
+    size_t n = RedisGears_ListRecordLen(data);
+    size_t skipped = 0;
+
+    RedisGears_LockHanlderAcquire(ctx);
+    for(size_t i = 0 ; i < n ; ++i){
+        VecEntryRecord* e = (VecEntryRecord*)RedisGears_ListRecordGet(data, i);
+        RedisModuleString* keyName = RedisModule_CreateString(ctx, e->key, e->keyLen);
+        RedisModuleKey *kp = RedisModule_OpenKey(ctx, keyName, REDISMODULE_WRITE);
+        if(vec_upsert(kp, keyName, e->vec)){
+            RedisModule_Replicate(ctx, "RG.VEC_SET", "sb", keyName, (const char*)e->vec, VEC_SIZE * sizeof(float));
+        }else{
+            ++skipped;
+        }
+        RedisModule_CloseKey(kp);
+        RedisModule_FreeString(ctx, keyName);
+    }
+    RedisGears_LockHanlderRelease(ctx);
+
+    if(skipped){
+        RedisModule_Log(NULL, "warning", "Skipped %zu stream entries whose keys hold another type", skipped);
+    }
     return REDISMODULE_OK;
 }
 
-static Record* HeapRecord_Deserialize(ExecutionCtx* ctx, Gears_BufferReader* br){
-    RedisModule_Assert(false);
+/*
+ * rg.vec_stream_register <prefix> [BATCH <n>] [DURATION <ms>] [KEYFIELD <field>] [VECFIELD <field>]
+ *
+ * Ingest the entries of all the streams starting with <prefix>, each entry sets the
+ * vector on <vecfield> (default "vec") to the key named on <keyfield> (default "key").
+ * A batch is processed once it has <n> entries (default VEC_STREAM_DEFAULT_BATCH) or
+ * <ms> milliseconds passed since its first entry (default VEC_STREAM_DEFAULT_DURATION_MS).
+ * The registration is kept by RedisGears, use RG.DUMPREGISTRATIONS and RG.UNREGISTER
+ * to manage it.
+ */
+int vec_stream_register_command(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+    if(argc < 2 || argc % 2 != 0){
+        return RedisModule_WrongArity(ctx);
+    }
+
+    long long batch = VEC_STREAM_DEFAULT_BATCH;
+    long long duration = VEC_STREAM_DEFAULT_DURATION_MS;
+    const char* keyField = "key";
+    const char* vecField = "vec";
+    char* err = NULL;
+    for(int i = 2 ; i < argc ; i += 2){
+        const char* opt = RedisModule_StringPtrLen(argv[i], NULL);
+        if(strcasecmp(opt, "BATCH") == 0){
+            if(RedisModule_StringToLongLong(argv[i + 1], &batch) != REDISMODULE_OK || batch <= 0){
+                err = "Failed extracting <batch>";
+                break;
+            }
+        }else if(strcasecmp(opt, "DURATION") == 0){
+            if(RedisModule_StringToLongLong(argv[i + 1], &duration) != REDISMODULE_OK || duration < 0){
+                err = "Failed extracting <duration>";
+                break;
+            }
+        }else if(strcasecmp(opt, "KEYFIELD") == 0){
+            keyField = RedisModule_StringPtrLen(argv[i + 1], NULL);
+        }else if(strcasecmp(opt, "VECFIELD") == 0){
+            vecField = RedisModule_StringPtrLen(argv[i + 1], NULL);
+        }else{
+            err = "Unknown argument given";
+            break;
+        }
+    }
+
+    if(err){
+        RedisModule_ReplyWithError(ctx, err);
+        return REDISMODULE_OK;
+    }
+
+    FlatExecutionPlan* fep = RGM_CreateCtx(StreamReader, &err);
+    if(!fep){
+        RedisModule_ReplyWithError(ctx, err ? err : "Failed creating stream registration");
+        return REDISMODULE_OK;
+    }
+    RGM_Filter(fep, vec_stream_entry_valid, VecStreamArg_Create(keyField, vecField));
+    RGM_Map(fep, vec_stream_to_entry, VecStreamArg_Create(keyField, vecField));
+    RGM_Repartition(fep, vec_entry_key, NULL);
+    RGM_Accumulate(fep, vec_entries_batch, NULL);
+    RGM_ForEach(fep, vec_entries_insert, NULL);
+
+    // bad entries are skipped by the filter, so the stream never gets stuck on them
+    StreamReaderTriggerArgs* args = RedisGears_StreamReaderTriggerArgsCreate(RedisModule_StringPtrLen(argv[1], NULL),
+                                                                             batch, duration, OnFailedPolicyContinue, 0, true);
+    int res = RGM_Register(fep, ExecutionModeAsync, args, &err);
+    RedisGears_FreeFlatExecution(fep);
+    if(res != REDISMODULE_OK){
+        RedisModule_ReplyWithError(ctx, err ? err : "Failed registering stream ingestion");
+        return REDISMODULE_OK;
+    }
+
+    RedisModule_ReplyWithSimpleString(ctx, "OK");
     return REDISMODULE_OK;
 }
 
-static void HeapRecord_Free(Record* base){
-    HeapRecord* hr = (HeapRecord*)base;
-    mmh_free(hr->heap);
+static void OnLoading(struct RedisModuleCtx *ctx, RedisModuleEvent eid, uint64_t subevent, void *data){
+    // keyspace notifications are not fired while loading, index the hashes once we are done.
+    if(subevent == REDISMODULE_SUBEVENT_LOADING_ENDED){
+        HashIndex_ScanKeys(ctx);
+    }
 }
 
-static void TopKArg_ObjectFree(void* arg){
-    RG_FREE(arg);
+static float scores[VEC_HOLDER_SIZE];
+
+/*
+ * The amount of holder rows scored at once on batch mode, small enough for the rows
+ * to stay in the cache while they are scored against all the queries of the batch.
+ */
+#define VEC_BATCH_TILE 1024
+static uint64_t mask[VEC_HOLDER_SIZE / 64];
+static uint64_t filterMask[VEC_HOLDER_SIZE / 64];
+
+static ScoreRecord* ScoreRecord_Create(VecsHolder* holder, size_t i, float score){
+    ScoreRecord* s = (ScoreRecord*)RedisGears_RecordCreate(ScoreRecordType);
+    VecKey* key = HOLDER_KEY(holder, i);
+    s->key = RedisModule_CreateString(NULL, key->name, key->len);
+    s->score = score;
+    s->vec = NULL;
+    return s;
 }
 
-static void* TopKArg_ArgDuplicate(void* arg){
-    TopKArg* topK = arg;
-    TopKArg* topKDup = RG_ALLOC(sizeof(*topKDup));
-    topKDup->topK = topK->topK;
-    return topKDup;
+/*
+ * Offer the score of slot i to the holder top k, floor is the score to beat in
+ * order to get into the results collected so far.
+ */
+static inline void VecReader_Offer(VecReaderCtx* readerCtx, TopK* t, float floor, size_t i, float score){
+    if(score < readerCtx->threshold){
+        return;
+    }
+    ++readerCtx->candidates;
+    if(score > floor && TopK_Push(t, score, i)){
+        ++readerCtx->heapOps;
+    }
 }
 
-static int TopKArg_ArgSerialize(FlatExecutionPlan* fep, void* arg, Gears_BufferWriter* bw, char** err){
-    TopKArg* topK = arg;
-    RedisGears_BWWriteLong(bw, topK->topK);
-    return REDISMODULE_OK;
+/*
+ * Acquire the redis lock, the time spent waiting for it is added to the reader lock wait.
+ */
+static inline void VecReader_LockAcquire(RedisModuleCtx* redisCtx, VecReaderCtx* readerCtx){
+    uint64_t start = VecStats_Now();
+    RedisGears_LockHanlderAcquire(redisCtx);
+    readerCtx->lockAcquired = VecStats_Now();
+    readerCtx->lockWait += readerCtx->lockAcquired - start;
 }
 
-static void* TopKArg_ArgDeserialize(FlatExecutionPlan* fep, Gears_BufferReader* br, int version, char** err){
-    TopKArg* topKDup = RG_ALLOC(sizeof(*topKDup));
-    topKDup->topK = RedisGears_BRReadLong(br);
-    return topKDup;
+static inline void VecReader_LockRelease(RedisModuleCtx* redisCtx, VecReaderCtx* readerCtx){
+    readerCtx->lockHold += VecStats_Now() - readerCtx->lockAcquired;
+    RedisGears_LockHanlderRelease(redisCtx);
 }
 
-static char* TopKArg_ArgToString(void* arg){
-    return RG_STRDUP("I am topk argument :)");
+static Record* VecReader_CreateProfile(VecReaderCtx* readerCtx){
+    ProfileRecord* pr = (ProfileRecord*)RedisGears_RecordCreate(ProfileRecordType);
+    const char* shard = RedisModule_GetMyClusterID();
+    pr->shard = RG_STRDUP(shard ? shard : "standalone");
+    pr->values[VEC_PROFILE_HOLDERS] = readerCtx->holders;
+    pr->values[VEC_PROFILE_SCORED] = readerCtx->scored;
+    pr->values[VEC_PROFILE_CANDIDATES] = readerCtx->candidates;
+    pr->values[VEC_PROFILE_HEAP_OPS] = readerCtx->heapOps;
+    pr->values[VEC_PROFILE_LOCK_WAIT] = readerCtx->lockWait;
+    pr->values[VEC_PROFILE_LOCK_HOLD] = readerCtx->lockHold;
+    pr->values[VEC_PROFILE_SCAN] = readerCtx->scanTime;
+    pr->values[VEC_PROFILE_TOPK] = readerCtx->topkTime;
+    return &pr->baseRecord;
+}
+
+static void VecReader_RecordStages(VecReaderCtx* readerCtx){
+    VecStats_RecordStage(VEC_STAGE_LOCK_WAIT, readerCtx->lockWait);
+    VecStats_RecordStage(VEC_STAGE_SCAN, readerCtx->scanTime);
+    if(!readerCtx->range){
+        VecStats_RecordStage(VEC_STAGE_TOPK, readerCtx->topkTime);
+    }
+}
+
+
+/*
+ * The results collected so far by the reader, sorted ascending by score. The ids
+ * are indexes on keys, keys of results that were pushed out are freed on every merge.
+ */
+typedef struct VecReaderResults{
+    TopKItem* items;
+    size_t count;
+    RedisModuleString** keys;
+    float** vecs; // the stored vectors of the keys on WITHVECTORS, NULL otherwise
+}VecReaderResults;
+
+/*
+ * Free the keys (and vectors) that were pushed out of the results and renumber the
+ * results by their place, so no more than topK keys are kept between merges.
+ */
+static void VecReaderResults_Compact(VecReaderResults* res){
+    size_t total = array_len(res->keys);
+    if(total == res->count){
+        return;
+    }
+    RedisModuleString** keys = RG_ALLOC(sizeof(*keys) * MAX(res->count, 1));
+    float** vecs = res->vecs ? RG_ALLOC(sizeof(*vecs) * MAX(res->count, 1)) : NULL;
+    for(size_t i = 0 ; i < res->count ; ++i){
+        uint32_t id = res->items[i].id;
+        keys[i] = res->keys[id];
+        res->keys[id] = NULL;
+        if(vecs){
+            vecs[i] = res->vecs[id];
+            res->vecs[id] = NULL;
+        }
+        res->items[i].id = i;
+    }
+    for(size_t i = 0 ; i < total ; ++i){
+        if(res->keys[i]){
+            RedisModule_FreeString(NULL, res->keys[i]);
+        }
+        if(vecs && res->vecs[i]){
+            RG_FREE(res->vecs[i]);
+        }
+    }
+    memcpy(res->keys, keys, sizeof(*keys) * res->count);
+    res->keys = array_trimm_len(res->keys, res->count);
+    RG_FREE(keys);
+    if(vecs){
+        memcpy(res->vecs, vecs, sizeof(*vecs) * res->count);
+        res->vecs = array_trimm_len(res->vecs, res->count);
+        RG_FREE(vecs);
+    }
+}
+
+/*
+ * Merge the n sorted items of t, already renumbered to their keys, into the results
+ * keeping the best topK.
+ */
+static void VecReaderResults_Merge(VecReaderResults* res, TopK* t, size_t n, size_t topK){
+    TopKItem* merged = RG_ALLOC(sizeof(*merged) * MIN(res->count + n, topK));
+    res->count = TopK_MergeSorted(res->items, res->count, t->items, n, topK, merged);
+    if(res->items){
+        RG_FREE(res->items);
+    }
+    res->items = merged;
+    VecReaderResults_Compact(res);
+}
+
+/*
+ * Merge the top k of the holder into the results keeping the best topK, should be
+ * called under the lock as the key names are taken from the holder.
+ */
+static void VecReader_CollectHolder(VecReaderResults* res, VecsHolder* holder, TopK* t, size_t topK){
+    size_t n = TopK_Sort(t);
+    if(n == 0){
+        return;
+    }
+    for(size_t i = 0 ; i < n ; ++i){
+        size_t slot = t->items[i].id;
+        VecKey* key = HOLDER_KEY(holder, slot);
+        t->items[i].id = array_len(res->keys);
+        res->keys = array_append(res->keys, RedisModule_CreateString(NULL, key->name, key->len));
+        if(res->vecs){
+            float* vec = RG_ALLOC(VEC_SIZE * sizeof(float));
+            memcpy(vec, &HOLDER_VEC(holder, slot), VEC_SIZE * sizeof(float));
+            res->vecs = array_append(res->vecs, vec);
+        }
+    }
+    VecReaderResults_Merge(res, t, n, topK);
+}
+
+/*
+ * Merge the top k of the sparse documents (the ids are doc ids) into the results, should
+ * be called under the lock.
+ */
+static void VecReader_CollectSparse(VecReaderResults* res, TopK* t, size_t topK){
+    size_t n = TopK_Sort(t);
+    if(n == 0){
+        return;
+    }
+    for(size_t i = 0 ; i < n ; ++i){
+        VecSparseDoc* doc = VecSparse_Doc(t->items[i].id);
+        t->items[i].id = array_len(res->keys);
+        res->keys = array_append(res->keys, RedisModule_CreateString(NULL, doc->name, doc->len));
+    }
+    VecReaderResults_Merge(res, t, n, topK);
+}
+
+/*
+ * Renumber the results by their place and free the keys that were pushed out.
+ */
+static TopKRecord* VecReaderResults_ToRecord(VecReaderResults* res){
+    RedisModuleString** keys = RG_ALLOC(sizeof(*keys) * MAX(res->count, 1));
+    float** vecs = res->vecs ? RG_ALLOC(sizeof(*vecs) * MAX(res->count, 1)) : NULL;
+    for(size_t i = 0 ; i < res->count ; ++i){
+        uint32_t id = res->items[i].id;
+        keys[i] = res->keys[id];
+        res->keys[id] = NULL;
+        if(vecs){
+            vecs[i] = res->vecs[id];
+            res->vecs[id] = NULL;
+        }
+        res->items[i].id = i;
+    }
+    for(size_t i = 0 ; i < array_len(res->keys) ; ++i){
+        if(res->keys[i]){
+            RedisModule_FreeString(NULL, res->keys[i]);
+        }
+        if(res->vecs && res->vecs[i]){
+            RG_FREE(res->vecs[i]);
+        }
+    }
+    array_free(res->keys);
+    if(res->vecs){
+        array_free(res->vecs);
+    }
+
+    return TopKRecord_Create(res->items ? res->items : RG_ALLOC(sizeof(TopKItem)), res->count, keys, vecs);
+}
+
+/*
+ * Set on mask the slots of the holder on the probed IVF lists (or not indexed yet) that
+ * also pass the filter, if any. Returns the amount of slots set.
+ */
+static size_t VecReader_SelectProbed(VecsHolder* holder, const uint8_t* probe, VecFilter* filter){
+    size_t selected = VecIvf_Select(holder, probe, mask);
+    if(!filter || selected == 0){
+        return selected;
+    }
+    VecFilter_Resolve(filter);
+    VecFilter_Eval(filter, holder->attrs, holder->size, filterMask);
+    selected = 0;
+    for(size_t w = 0 ; w * 64 < holder->size ; ++w){
+        mask[w] &= filterMask[w];
+        selected += __builtin_popcountll(mask[w]);
+    }
+    return selected;
+}
+
+/*
+ * The coarse scan of a holder, the best readerCtx->coarse prefixes (out of the slots
+ * set on sel, all of them if NULL) are scored again on their full vectors and offered
+ * to t.
+ */
+static void VecReader_CoarseHolder(VecReaderCtx* readerCtx, VecsHolder* holder, const float* prefix, const uint64_t* sel,
+                                     TopK* candidates, TopK* t, float floor){
+    TopK_Clear(candidates);
+    readerCtx->scored += vec_coarse_holder(holder, prefix, sel, candidates, scores);
+    float qn = vecMetric == VEC_METRIC_L2 ? cblas_sdot(VEC_SIZE, readerCtx->vec, 1, readerCtx->vec, 1) : 0;
+    for(size_t c = 0 ; c < candidates->count ; ++c){
+        size_t i = candidates->items[c].id;
+        float dot = cblas_sdot(VEC_SIZE, &HOLDER_VEC(holder, i), 1, readerCtx->vec, 1);
+        VecReader_Offer(readerCtx, t, floor, i, vec_metric_score(holder, i, dot, qn));
+    }
+}
+
+/*
+ * Search the sparse documents VEC_SPARSE_RANGE doc ids at a time (see VecSparse_TopK),
+ * the top k of every range is merged into the results. The lock is released between
+ * the ranges, the doc ids are kept in place meanwhile (see VecSparse_ScanStart) and
+ * documents added after the scan started are not searched, so every document is seen
+ * once at most.
+ */
+static void VecReader_ScanSparse(RedisModuleCtx* redisCtx, VecReaderCtx* readerCtx, VecReaderResults* res){
+    TopK* t = TopK_Create(MIN(readerCtx->topK, VEC_SPARSE_RANGE));
+    uint32_t end = 0;
+    uint64_t epoch = 0;
+    for(uint32_t lo = 0 ; ; lo += VEC_SPARSE_RANGE){
+        VecReader_LockAcquire(redisCtx, readerCtx);
+
+        if(lo == 0){
+            VecSparse_ScanStart();
+            end = VecSparse_IdEnd();
+            epoch = VecSparse_Epoch();
+        }
+        if(lo >= end || epoch != VecSparse_Epoch()){
+            VecSparse_ScanEnd();
+            VecReader_LockRelease(redisCtx, readerCtx);
+            break;
+        }
+
+        TopK_Clear(t);
+        float floor = readerCtx->topK > 0 && res->count >= readerCtx->topK ? res->items[0].score : -INFINITY;
+
+        uint64_t start = VecStats_Now();
+        readerCtx->scored += VecSparse_TopK(readerCtx->sparseDims, readerCtx->sparseWeights, readerCtx->sparse,
+                                            lo, MIN(lo + VEC_SPARSE_RANGE, end), floor, t);
+        readerCtx->candidates += t->count;
+        uint64_t scanned = VecStats_Now();
+        readerCtx->scanTime += scanned - start;
+
+        VecReader_CollectSparse(res, t, readerCtx->topK);
+        readerCtx->topkTime += VecStats_Now() - scanned;
+
+        VecReader_LockRelease(redisCtx, readerCtx);
+    }
+    TopK_Free(t);
+}
+
+/*
+ * Scan all the holders, each holder is reduced to its own top k which is then
+ * merged into the results. On sparse mode the sparse documents are merged into the
+ * same results. Returns a top k record or NULL if there are no results.
+ */
+static Record* VecReader_LocalTopK(RedisModuleCtx* redisCtx, VecReaderCtx* readerCtx){
+    TopK* t = TopK_Create(MIN(readerCtx->topK, VEC_HOLDER_SIZE));
+    VecReaderResults res = {
+        .items = NULL,
+        .count = 0,
+        .keys = array_new(RedisModuleString*, 16),
+        .vecs = readerCtx->withVectors ? array_new(float*, 16) : NULL,
+    };
+
+    const float* b1 = readerCtx->vec;
+    float qn = vecMetric == VEC_METRIC_L2 ? cblas_sdot(VEC_SIZE, b1, 1, b1, 1) : 0;
+
+    // the IVF lists probed on NPROBE, computed again if the centroids change in the middle
+    uint8_t* probe = NULL;
+    uint64_t probeEpoch = 0;
+
+    // on COARSE the candidates of each holder, re-ranked on the full vectors
+    TopK* candidates = NULL;
+    float prefix[VEC_PREFIX_DIMS];
+    if(readerCtx->coarse){
+        candidates = TopK_Create(MIN(MAX(readerCtx->coarse, readerCtx->topK), VEC_HOLDER_SIZE));
+        vec_set_prefix(prefix, readerCtx->vec);
+    }
+
+    // on sample mode we score every stride-th vector
+    size_t stride = 1;
+    size_t offset = 0;
+    if(readerCtx->sample){
+        VecReader_LockAcquire(redisCtx, readerCtx);
+        size_t total = 0;
+        for(size_t i = 0 ; i < array_len(vecList) ; ++i){
+            total += vecList[i]->size;
+        }
+        VecReader_LockRelease(redisCtx, readerCtx);
+        stride = MAX(1, total / readerCtx->sample);
+    }
+
+    while(true){
+        // release the lock between holders so we will not block redis for too long
+        VecReader_LockAcquire(redisCtx, readerCtx);
+
+        if(readerCtx->index >= array_len(vecList)){
+            VecReader_LockRelease(redisCtx, readerCtx);
+            break;
+        }
+
+        VecsHolder* holder = vecList[readerCtx->index++];
+        ++readerCtx->holders;
+
+        TopK_Clear(t);
+        float floor = res.count >= readerCtx->topK ? res.items[0].score : -INFINITY;
+
+        uint64_t start = VecStats_Now();
+        if(stride > 1){
+            VecFilter* filter = readerCtx->filter;
+            if(filter){
+                VecFilter_Resolve(filter);
+                VecFilter_Eval(filter, holder->attrs, holder->size, mask);
+            }
+            size_t i;
+            for(i = offset ; i < holder->size ; i += stride){
+                if(filter && !MASK_TEST(mask, i)){
+                    continue;
+                }
+                float dot = cblas_sdot(VEC_SIZE, &HOLDER_VEC(holder, i), 1, b1, 1);
+                VecReader_Offer(readerCtx, t, floor, i, vec_metric_score(holder, i, dot, qn));
+            }
+            readerCtx->scored += (i - offset) / stride;
+            offset = i - holder->size;
+            readerCtx->scanTime += VecStats_Now() - start;
+            start = VecStats_Now();
+        }else{
+            size_t selected = 0;
+            bool probed = readerCtx->nprobe && VecIvf_Lists() > 0;
+            if(probed){
+                if(!probe || probeEpoch != VecIvf_Epoch()){
+                    if(probe){
+                        RG_FREE(probe);
+                    }
+                    probe = VecIvf_Probe(readerCtx->vec, readerCtx->nprobe);
+                    probeEpoch = VecIvf_Epoch();
+                }
+                selected = VecReader_SelectProbed(holder, probe, readerCtx->filter);
+            }
+
+            if(candidates && holder->prefixes){
+                // the coarse scan offers its re-ranked candidates straight to t
+                const uint64_t* sel = NULL;
+                if(probed){
+                    sel = mask;
+                }else if(readerCtx->filter){
+                    VecFilter_Resolve(readerCtx->filter);
+                    VecFilter_Eval(readerCtx->filter, holder->attrs, holder->size, mask);
+                    sel = mask;
+                }
+                if(!probed || selected > 0){
+                    VecReader_CoarseHolder(readerCtx, holder, prefix, sel, candidates, t, floor);
+                }
+                selected = 0;
+            }else if(probed){
+                vec_score_holder_mask(holder, readerCtx->vec, selected, scores, mask);
+            }else if(!readerCtx->filter && VecConfig_Get(VEC_CONFIG_SCAN_PRUNE)){
+                // the pruned scan pushes straight to t, scores equal to the threshold are kept
+                float bar = MAX(floor, nextafterf(readerCtx->threshold, -INFINITY));
+                readerCtx->scored += vec_topk_holder_pruned(holder, readerCtx->vec, bar, t, scores,
+                                                            &readerCtx->candidates, &readerCtx->heapOps);
+                selected = 0;
+            }else{
+                selected = vec_score_holder(holder, readerCtx->vec, readerCtx->filter, scores, mask);
+            }
+            readerCtx->scored += selected;
+            uint64_t scanned = VecStats_Now();
+            readerCtx->scanTime += scanned - start;
+            start = scanned;
+            if(selected > 0){
+                MASK_FOREACH(mask, holder->size, i, VecReader_Offer(readerCtx, t, floor, i, scores[i]));
+            }
+        }
+
+        VecReader_CollectHolder(&res, holder, t, readerCtx->topK);
+        readerCtx->topkTime += VecStats_Now() - start;
+
+        VecReader_LockRelease(redisCtx, readerCtx);
+    }
+
+    TopK_Free(t);
+    if(candidates){
+        TopK_Free(candidates);
+    }
+    if(probe){
+        RG_FREE(probe);
+    }
+
+    if(readerCtx->sparse){
+        VecReader_ScanSparse(redisCtx, readerCtx, &res);
+    }
+
+    uint64_t start = VecStats_Now();
+    TopKRecord* tr = VecReaderResults_ToRecord(&res);
+    tr->sampled = stride > 1;
+    readerCtx->topkTime += VecStats_Now() - start;
+    VecReader_RecordStages(readerCtx);
+
+    if(tr->count == 0 && !readerCtx->profile && !tr->sampled){
+        RedisGears_FreeRecord(&tr->baseRecord);
+        return NULL;
+    }
+
+    if(readerCtx->profile){
+        tr->profiles = array_new(Record*, 1);
+        tr->profiles = array_append(tr->profiles, VecReader_CreateProfile(readerCtx));
+    }
+
+    return &tr->baseRecord;
 }
 
-#define TopKTypeVersion 1
+/*
+ * Batch mode, score all the queries of the batch together. Each tile of the holder
+ * is scored against every query with a single matrix product so the tile is read
+ * from memory once for the entire batch, and every query keeps its own top k.
+ * Always returns a batch record so the initiator gets a reply for every query.
+ */
+static Record* VecReader_LocalTopKBatch(RedisModuleCtx* redisCtx, VecReaderCtx* readerCtx){
+    size_t nq = readerCtx->batchSize;
+    // the scores of a tile of rows x nq must fit the scores buffer
+    size_t tile = MIN(VEC_BATCH_TILE, (VEC_HOLDER_SIZE) / nq);
+
+    TopK** t = RG_ALLOC(sizeof(*t) * nq);
+    VecReaderResults* res = RG_ALLOC(sizeof(*res) * nq);
+    float* floors = RG_ALLOC(sizeof(*floors) * nq);
+    // the squared norms of the queries, the matrix product gives dot products (see vec_metric_score)
+    float* qns = RG_ALLOC(sizeof(*qns) * nq);
+    for(size_t q = 0 ; q < nq ; ++q){
+        const float* query = &readerCtx->batch[q * VEC_SIZE];
+        qns[q] = vecMetric == VEC_METRIC_L2 ? cblas_sdot(VEC_SIZE, query, 1, query, 1) : 0;
+        t[q] = TopK_Create(MIN(readerCtx->batchTopK[q], VEC_HOLDER_SIZE));
+        res[q] = (VecReaderResults){.items = NULL, .count = 0, .keys = array_new(RedisModuleString*, 16), .vecs = NULL};
+    }
+
+    while(true){
+        VecReader_LockAcquire(redisCtx, readerCtx);
+
+        if(readerCtx->index >= array_len(vecList)){
+            VecReader_LockRelease(redisCtx, readerCtx);
+            break;
+        }
+
+        VecsHolder* holder = vecList[readerCtx->index++];
+        ++readerCtx->holders;
+
+        for(size_t q = 0 ; q < nq ; ++q){
+            TopK_Clear(t[q]);
+            floors[q] = res[q].count >= readerCtx->batchTopK[q] ? res[q].items[0].score : -INFINITY;
+        }
+
+        for(size_t first = 0 ; first < holder->size ; first += tile){
+            size_t rows = MIN(tile, holder->size - first);
+            uint64_t start = VecStats_Now();
+            vec_score_holder_batch(holder, first, rows, readerCtx->batch, nq, scores);
+            uint64_t scanned = VecStats_Now();
+            readerCtx->scanTime += scanned - start;
+            for(size_t r = 0 ; r < rows ; ++r){
+                for(size_t q = 0 ; q < nq ; ++q){
+                    VecReader_Offer(readerCtx, t[q], floors[q], first + r, vec_metric_score(holder, first + r, scores[r * nq + q], qns[q]));
+                }
+            }
+            readerCtx->topkTime += VecStats_Now() - scanned;
+        }
+        readerCtx->scored += holder->size * nq;
+
+        uint64_t start = VecStats_Now();
+        for(size_t q = 0 ; q < nq ; ++q){
+            VecReader_CollectHolder(&res[q], holder, t[q], readerCtx->batchTopK[q]);
+        }
+        readerCtx->topkTime += VecStats_Now() - start;
+
+        VecReader_LockRelease(redisCtx, readerCtx);
+    }
+
+    TopKBatchRecord* br = (TopKBatchRecord*)RedisGears_RecordCreate(TopKBatchRecordType);
+    br->count = nq;
+    br->results = RG_ALLOC(sizeof(*br->results) * nq);
+    br->topK = RG_ALLOC(sizeof(*br->topK) * nq);
+    memcpy(br->topK, readerCtx->batchTopK, sizeof(*br->topK) * nq);
+
+    uint64_t start = VecStats_Now();
+    for(size_t q = 0 ; q < nq ; ++q){
+        TopK_Free(t[q]);
+        br->results[q] = VecReaderResults_ToRecord(&res[q]);
+    }
+    readerCtx->topkTime += VecStats_Now() - start;
+    VecReader_RecordStages(readerCtx);
+
+    RG_FREE(t);
+    RG_FREE(res);
+    RG_FREE(floors);
+    RG_FREE(qns);
+
+    return &br->baseRecord;
+}
+
+/*
+ * Range mode, scan the holders one at a time and push every vector with score >= threshold
+ * to the pendings, so results are streamed out in chunks of a single holder.
+ */
+static Record* VecReader_NextInRange(RedisModuleCtx* redisCtx, VecReaderCtx* readerCtx){
+    while(array_len(readerCtx->pendings) == 0){
+        if(readerCtx->limit && readerCtx->emitted >= readerCtx->limit){
+            VecReader_RecordStages(readerCtx);
+            return NULL;
+        }
+
+        VecReader_LockAcquire(redisCtx, readerCtx);
+
+        if(readerCtx->index >= array_len(vecList)){
+            VecReader_LockRelease(redisCtx, readerCtx);
+            VecReader_RecordStages(readerCtx);
+            return NULL;
+        }
+
+        VecsHolder* holder = vecList[readerCtx->index++];
+
+        ++readerCtx->holders;
+
+        uint64_t start = VecStats_Now();
+        size_t selected = vec_score_holder(holder, readerCtx->vec, readerCtx->filter, scores, mask);
+        readerCtx->scored += selected;
+        if(selected > 0){
+            MASK_FOREACH(mask, holder->size, i, {
+                if(scores[i] < readerCtx->threshold){
+                    continue;
+                }
+                /* a break would only end the current mask word, skip the rest of the holder instead */
+                if(readerCtx->limit && readerCtx->emitted >= readerCtx->limit){
+                    continue;
+                }
+                ScoreRecord* s = ScoreRecord_Create(holder, i, scores[i]);
+                readerCtx->pendings = array_append(readerCtx->pendings, &s->baseRecord);
+                ++readerCtx->emitted;
+            });
+        }
+        readerCtx->scanTime += VecStats_Now() - start;
 
-#define VS_PLUGIN_NAME "VECTOR_SIM"
-#define REDISGEARSJVM_PLUGIN_VERSION 1
+        VecReader_LockRelease(redisCtx, readerCtx);
+    }
 
-#define VEC_TYPE_VERSION 1
+    return array_pop(readerCtx->pendings);
+}
 
-static void* VecDT_Load(RedisModuleIO *rdb, int encver){
-    RedisModuleString *keyName = RedisModule_LoadString(rdb);
-    size_t dataLen;
-    float* data = (float*)RedisModule_LoadStringBuffer(rdb, &dataLen);
-    RedisModule_Assert(dataLen == sizeof(float) * VEC_SIZE);
+/*
+ * Search the disk index, the holders are not touched so the lock is not needed.
+ * Returns a top k record or NULL if there are no results (or no disk index).
+ */
+static Record* VecReader_LocalDisk(VecReaderCtx* readerCtx){
+    VecDisk* d = VecDisk_Acquire();
+    size_t topK = d ? MIN(readerCtx->topK, VecDisk_Size(d)) : 0;
+    TopKItem* items = RG_ALLOC(sizeof(*items) * MAX(topK, 1));
+    RedisModuleString** keys = RG_ALLOC(sizeof(*keys) * MAX(topK, 1));
+    size_t count = 0;
+
+    uint64_t start = VecStats_Now();
+    if(d){
+        size_t reads;
+        size_t n = VecDisk_Search(d, readerCtx->vec, topK, readerCtx->disk, items, &reads);
+        readerCtx->scored += reads;
+        readerCtx->candidates += n;
+        for(size_t i = 0 ; i < n ; ++i){
+            size_t len;
+            char* name = VecDisk_Name(d, items[i].id, &len);
+            if(!name){
+                continue;
+            }
+            keys[count] = RedisModule_CreateString(NULL, name, len);
+            items[count] = (TopKItem){.score = items[i].score, .id = count};
+            ++count;
+            RG_FREE(name);
+        }
+        VecDisk_Release(d);
+    }
+    readerCtx->scanTime += VecStats_Now() - start;
+    VecReader_RecordStages(readerCtx);
 
-    VecDT* vDT = vec_insert(keyName, data);
+    TopKRecord* tr = TopKRecord_Create(items, count, keys, NULL);
+    if(tr->count == 0 && !readerCtx->profile){
+        RedisGears_FreeRecord(&tr->baseRecord);
+        return NULL;
+    }
 
-    RedisModule_FreeString(NULL, keyName);
-    RedisModule_Free(data);
+    if(readerCtx->profile){
+        tr->profiles = array_new(Record*, 1);
+        tr->profiles = array_append(tr->profiles, VecReader_CreateProfile(readerCtx));
+    }
 
-    return vDT;
+    return &tr->baseRecord;
 }
 
-static void VecDT_Save(RedisModuleIO *rdb, void *value){
-    VecDT* vDT = value;
+/*
+ * Multi mode, scan the multi vector holders by MaxSim (see vec_maxsim_holder). On
+ * CANDIDATES only the documents picked by the per vector pass of each holder are
+ * scored. Returns a top k record or NULL if there are no results.
+ */
+static Record* VecReader_LocalMulti(RedisModuleCtx* redisCtx, VecReaderCtx* readerCtx){
+    size_t nq = readerCtx->multi;
+    TopK* t = TopK_Create(MIN(readerCtx->topK, VEC_HOLDER_SIZE));
+    VecReaderResults res = {
+        .items = NULL,
+        .count = 0,
+        .keys = array_new(RedisModuleString*, 16),
+        .vecs = NULL,
+    };
 
-    RedisModule_SaveString(rdb, vDT->keyName);
-    RedisModule_SaveStringBuffer(rdb, (char*)&HOLDER_VEC(vDT->holder, vDT->index), sizeof(float) * VEC_SIZE);
-}
+    TopK** candidates = NULL;
+    float* prefixes = NULL;
+    if(readerCtx->multiCandidates){
+        candidates = RG_ALLOC(sizeof(*candidates) * nq);
+        prefixes = RG_ALLOC(sizeof(*prefixes) * nq * VEC_PREFIX_DIMS);
+        for(size_t q = 0 ; q < nq ; ++q){
+            candidates[q] = TopK_Create(MIN(readerCtx->multiCandidates, VEC_HOLDER_SIZE));
+            vec_set_prefix(&prefixes[q * VEC_PREFIX_DIMS], &readerCtx->queries[q * VEC_SIZE]);
+        }
+    }
 
-static void VecDT_Free(void *value){
-    VecDT* vDT = value;
-    VecsHolder* holder = vDT->holder;
-    size_t index = vDT->index;
+    while(true){
+        // release the lock between holders so we will not block redis for too long
+        VecReader_LockAcquire(redisCtx, readerCtx);
 
-    RedisModule_FreeString(NULL, vDT->keyName);
-    RG_FREE(vDT);
+        if(readerCtx->index >= array_len(multiList)){
+            VecReader_LockRelease(redisCtx, readerCtx);
+            break;
+        }
 
-    if(!holder){
-        // we probably inside flush, the vector DT was detached and we can just return.
-        return;
-    }
+        VecsHolder* holder = multiList[readerCtx->index++];
+        ++readerCtx->holders;
 
-    // get the last vector
-    VecsHolder* lastVH = vecList[array_len(vecList) - 1];
-    --lastVH->size;
-    VecDT* lastVDT = HOLDER_VECDT(lastVH, lastVH->size);
+        TopK_Clear(t);
+        float floor = res.count >= readerCtx->topK ? res.items[0].score : -INFINITY;
 
+        uint64_t start = VecStats_Now();
+        const uint64_t* docs = NULL;
+        if(candidates && holder->prefixes){
+            readerCtx->candidates += vec_multi_candidates(holder, prefixes, nq, candidates, mask, scores);
+            docs = mask;
+        }
+        readerCtx->scored += vec_maxsim_holder(holder, readerCtx->queries, nq, docs, floor, t, scores);
+        uint64_t scanned = VecStats_Now();
+        readerCtx->scanTime += scanned - start;
 
-    if(lastVDT != vDT){
-        // swap last with current
-        memmove(&HOLDER_VEC(holder, index), &HOLDER_VEC(lastVH, lastVH->size), VEC_SIZE * sizeof(float));
+        VecReader_CollectHolder(&res, holder, t, readerCtx->topK);
+        readerCtx->topkTime += VecStats_Now() - scanned;
 
-        HOLDER_VECDT(holder, index) = lastVDT;
-        lastVDT->holder = holder;
-        lastVDT->index = index;
+        VecReader_LockRelease(redisCtx, readerCtx);
     }
 
-    if(lastVH->size == 0){
-        // free the holder, it has no more data.
-        RG_FREE(lastVH);
-        if(array_len(vecList) > 1){
-            vecList = array_trimm_cap(vecList, array_len(vecList) - 1);
-        }else{
-            array_free(vecList);
-            vecList = NULL;
+    TopK_Free(t);
+    if(candidates){
+        for(size_t q = 0 ; q < nq ; ++q){
+            TopK_Free(candidates[q]);
         }
+        RG_FREE(candidates);
+        RG_FREE(prefixes);
+    }
+
+    uint64_t start = VecStats_Now();
+    TopKRecord* tr = VecReaderResults_ToRecord(&res);
+    readerCtx->topkTime += VecStats_Now() - start;
+    VecReader_RecordStages(readerCtx);
+
+    if(tr->count == 0 && !readerCtx->profile){
+        RedisGears_FreeRecord(&tr->baseRecord);
+        return NULL;
+    }
+
+    if(readerCtx->profile){
+        tr->profiles = array_new(Record*, 1);
+        tr->profiles = array_append(tr->profiles, VecReader_CreateProfile(readerCtx));
     }
+
+    return &tr->baseRecord;
 }
 
-static float scores[VEC_HOLDER_SIZE];
+/*
+ * Sparse mode without the dense vectors, see VecReader_ScanSparse. Returns a top k
+ * record or NULL if there are no results.
+ */
+static Record* VecReader_LocalSparse(RedisModuleCtx* redisCtx, VecReaderCtx* readerCtx){
+    VecReaderResults res = {
+        .items = NULL,
+        .count = 0,
+        .keys = array_new(RedisModuleString*, 16),
+        .vecs = NULL,
+    };
 
-static Record* VecReader_Next(ExecutionCtx* rctx, void* ctx){
-//    struct timeval stop, start;
-    if(!vecList){
+    VecReader_ScanSparse(redisCtx, readerCtx, &res);
+
+    uint64_t start = VecStats_Now();
+    TopKRecord* tr = VecReaderResults_ToRecord(&res);
+    readerCtx->topkTime += VecStats_Now() - start;
+    VecReader_RecordStages(readerCtx);
+
+    if(tr->count == 0 && !readerCtx->profile){
+        RedisGears_FreeRecord(&tr->baseRecord);
         return NULL;
     }
 
+    if(readerCtx->profile){
+        tr->profiles = array_new(Record*, 1);
+        tr->profiles = array_append(tr->profiles, VecReader_CreateProfile(readerCtx));
+    }
+
+    return &tr->baseRecord;
+}
+
+static Record* VecReader_Next(ExecutionCtx* rctx, void* ctx){
     VecReaderCtx* readerCtx = ctx;
-    RedisModuleCtx* redisCtx = RedisGears_GetRedisModuleCtx(rctx);
     if(array_len(readerCtx->pendings) > 0){
         return array_pop(readerCtx->pendings);
     }
 
-    RedisGears_LockHanlderAcquire(redisCtx);
+    RedisModuleCtx* redisCtx = RedisGears_GetRedisModuleCtx(rctx);
 
-    const float* b1 = readerCtx->vec;
+    if(readerCtx->range){
+        return VecReader_NextInRange(redisCtx, readerCtx);
+    }
 
-    while(readerCtx->index < array_len(vecList)){
-        VecsHolder* holder = vecList[readerCtx->index++];
+    if(readerCtx->done){
+        return NULL;
+    }
+    readerCtx->done = true;
 
-        cblas_sgemv(CblasRowMajor, CblasNoTrans, holder->size, VEC_SIZE, 1, holder->vecs, VEC_SIZE, b1, 1, 0, scores, 1);
+    if(readerCtx->batchSize){
+        return VecReader_LocalTopKBatch(redisCtx, readerCtx);
+    }
 
-        for(size_t i = 0 ; i < MIN(holder->size, readerCtx->topK) ; ++i){
-            size_t index = cblas_isamax(holder->size, scores, 1);
-            ScoreRecord* s = (ScoreRecord*)RedisGears_RecordCreate(ScoreRecordType);
-            s->key = HOLDER_VECDT(holder, index)->keyName;
-            RedisModule_RetainString(NULL, s->key);
-            s->score = scores[index];
-            readerCtx->pendings = array_append(readerCtx->pendings, &s->baseRecord);
-            scores[index] = 0;
-        }
+    if(readerCtx->disk){
+        return VecReader_LocalDisk(readerCtx);
+    }
 
-        if(array_len(readerCtx->pendings) > 0){
-            RedisGears_LockHanlderRelease(redisCtx);
-            return array_pop(readerCtx->pendings);
-        }
+    if(readerCtx->multi){
+        return VecReader_LocalMulti(redisCtx, readerCtx);
     }
 
-    RedisGears_LockHanlderRelease(redisCtx);
+    if(readerCtx->sparseOnly){
+        return VecReader_LocalSparse(redisCtx, readerCtx);
+    }
 
-    return NULL;
+    return VecReader_LocalTopK(redisCtx, readerCtx);
 }
 
 static void VecReader_Free(void* ctx){
@@ -490,6 +3284,47 @@ static int VecReader_Serialize(ExecutionCtx* ectx, void* ctx, Gears_BufferWriter
     VecReaderCtx* readerCtx = ctx;
     RedisGears_BWWriteBuffer(bw, (char*)readerCtx->vec, VEC_SIZE * sizeof(float));
     RedisGears_BWWriteLong(bw, readerCtx->topK);
+    RedisGears_BWWriteBuffer(bw, (char*)&readerCtx->threshold, sizeof(readerCtx->threshold));
+    RedisGears_BWWriteLong(bw, readerCtx->sample);
+    RedisGears_BWWriteLong(bw, readerCtx->nprobe);
+    RedisGears_BWWriteLong(bw, readerCtx->coarse);
+    RedisGears_BWWriteLong(bw, readerCtx->disk);
+    RedisGears_BWWriteLong(bw, readerCtx->range);
+    RedisGears_BWWriteLong(bw, readerCtx->limit);
+    RedisGears_BWWriteLong(bw, readerCtx->profile);
+    RedisGears_BWWriteLong(bw, readerCtx->withVectors);
+    RedisGears_BWWriteLong(bw, readerCtx->batchSize);
+    if(readerCtx->batchSize){
+        RedisGears_BWWriteBuffer(bw, (char*)readerCtx->batch, readerCtx->batchSize * VEC_SIZE * sizeof(float));
+        for(size_t i = 0 ; i < readerCtx->batchSize ; ++i){
+            RedisGears_BWWriteLong(bw, readerCtx->batchTopK[i]);
+        }
+    }
+    RedisGears_BWWriteLong(bw, readerCtx->multi);
+    if(readerCtx->multi){
+        RedisGears_BWWriteBuffer(bw, (char*)readerCtx->queries, readerCtx->multi * VEC_SIZE * sizeof(float));
+        RedisGears_BWWriteLong(bw, readerCtx->multiCandidates);
+    }
+    RedisGears_BWWriteLong(bw, readerCtx->sparseOnly);
+    RedisGears_BWWriteLong(bw, readerCtx->sparse);
+    if(readerCtx->sparse){
+        RedisGears_BWWriteBuffer(bw, (char*)readerCtx->sparseDims, readerCtx->sparse * sizeof(uint32_t));
+        RedisGears_BWWriteBuffer(bw, (char*)readerCtx->sparseWeights, readerCtx->sparse * sizeof(float));
+    }
+
+    size_t nClauses = readerCtx->filter ? array_len(readerCtx->filter->clauses) : 0;
+    RedisGears_BWWriteLong(bw, nClauses);
+    for(size_t i = 0 ; i < nClauses ; ++i){
+        VecFilterClause* c = &readerCtx->filter->clauses[i];
+        RedisGears_BWWriteLong(bw, c->type);
+        RedisGears_BWWriteString(bw, c->fieldName);
+        if(c->type == VEC_ATTR_TAG){
+            RedisGears_BWWriteString(bw, c->tag);
+        }else{
+            RedisGears_BWWriteBuffer(bw, (char*)&c->min, sizeof(c->min));
+            RedisGears_BWWriteBuffer(bw, (char*)&c->max, sizeof(c->max));
+        }
+    }
     return REDISMODULE_OK;
 }
 
@@ -501,6 +3336,73 @@ static int VecReader_Deserialize(ExecutionCtx* ectx, void* ctx, Gears_BufferRead
 
     readerCtx->topK = RedisGears_BRReadLong(br);
 
+    size_t thresholdLen;
+    char* threshold = RedisGears_BRReadBuffer(br, &thresholdLen);
+    RedisModule_Assert(thresholdLen == sizeof(readerCtx->threshold));
+    readerCtx->threshold = *((float*)threshold);
+
+    readerCtx->sample = RedisGears_BRReadLong(br);
+    readerCtx->nprobe = RedisGears_BRReadLong(br);
+    readerCtx->coarse = RedisGears_BRReadLong(br);
+    readerCtx->disk = RedisGears_BRReadLong(br);
+    readerCtx->range = RedisGears_BRReadLong(br);
+    readerCtx->limit = RedisGears_BRReadLong(br);
+    readerCtx->profile = RedisGears_BRReadLong(br);
+    readerCtx->withVectors = RedisGears_BRReadLong(br);
+    readerCtx->batchSize = RedisGears_BRReadLong(br);
+    if(readerCtx->batchSize){
+        size_t len;
+        char* batch = RedisGears_BRReadBuffer(br, &len);
+        RedisModule_Assert(len == readerCtx->batchSize * VEC_SIZE * sizeof(float));
+        readerCtx->batch = RG_ALLOC(len);
+        memcpy(readerCtx->batch, batch, len);
+        readerCtx->batchTopK = RG_ALLOC(readerCtx->batchSize * sizeof(size_t));
+        for(size_t i = 0 ; i < readerCtx->batchSize ; ++i){
+            readerCtx->batchTopK[i] = RedisGears_BRReadLong(br);
+        }
+    }
+    readerCtx->multi = RedisGears_BRReadLong(br);
+    if(readerCtx->multi){
+        size_t len;
+        char* queries = RedisGears_BRReadBuffer(br, &len);
+        RedisModule_Assert(len == readerCtx->multi * VEC_SIZE * sizeof(float));
+        readerCtx->queries = RG_ALLOC(len);
+        memcpy(readerCtx->queries, queries, len);
+        readerCtx->multiCandidates = RedisGears_BRReadLong(br);
+    }
+    readerCtx->sparseOnly = RedisGears_BRReadLong(br);
+    readerCtx->sparse = RedisGears_BRReadLong(br);
+    if(readerCtx->sparse){
+        size_t len;
+        char* dims = RedisGears_BRReadBuffer(br, &len);
+        RedisModule_Assert(len == readerCtx->sparse * sizeof(uint32_t));
+        readerCtx->sparseDims = RG_ALLOC(len);
+        memcpy(readerCtx->sparseDims, dims, len);
+        char* weights = RedisGears_BRReadBuffer(br, &len);
+        RedisModule_Assert(len == readerCtx->sparse * sizeof(float));
+        readerCtx->sparseWeights = RG_ALLOC(len);
+        memcpy(readerCtx->sparseWeights, weights, len);
+    }
+
+    size_t nClauses = RedisGears_BRReadLong(br);
+    if(nClauses > 0){
+        readerCtx->filter = VecFilter_Create();
+    }
+    for(size_t i = 0 ; i < nClauses ; ++i){
+        int type = RedisGears_BRReadLong(br);
+        const char* field = RedisGears_BRReadString(br);
+        if(type == VEC_ATTR_TAG){
+            VecFilter_AddTag(readerCtx->filter, field, RedisGears_BRReadString(br));
+        }else{
+            size_t len;
+            double min = *((double*)RedisGears_BRReadBuffer(br, &len));
+            RedisModule_Assert(len == sizeof(double));
+            double max = *((double*)RedisGears_BRReadBuffer(br, &len));
+            RedisModule_Assert(len == sizeof(double));
+            VecFilter_AddNumeric(readerCtx->filter, field, min, max);
+        }
+    }
+
     memcpy(readerCtx->vec, data, VEC_SIZE * sizeof(*data));
 
     return REDISMODULE_OK;
@@ -526,28 +3428,432 @@ RedisGears_ReaderCallbacks VecReader = {
         .create = VecReader_CreateReaderCallback,
 };
 
+/*
+ * Estimated memory of a hash index entry, the dict (rax) node and its key copy.
+ */
+#define HASH_INDEX_ENTRY_OVERHEAD 48
+
+typedef struct VecMemory{
+    size_t vectors; // the vectors data
+    size_t metadata; // the VecDTs slab, the keys arena and the holders slots pointing to the keys
+    size_t index; // attributes columns and indexes, the holders list and the hash index dict
+    size_t slack; // allocated holders slots that are not used
+}VecMemory;
+
+static size_t VecMemory_Total(const VecMemory* m){
+    return m->vectors + m->metadata + m->index + m->slack;
+}
+
+static void VecMemory_Get(VecMemory* m, size_t* vectorsCount, size_t* holdersCount){
+    size_t holders = vecList ? array_len(vecList) : 0;
+    size_t vectors = 0;
+
+    // the IVF lists and prefixes of the used slots are index, the unused slots are slack
+    size_t slotBytes = VEC_SIZE * sizeof(float) + sizeof(VecKey*) + 2 * sizeof(float);
+    *m = (VecMemory){0};
+    for(size_t i = 0 ; i < holders ; ++i){
+        VecsHolder* holder = vecList[i];
+        vectors += holder->size;
+        if(holder->attrs){
+            m->index += VecAttrs_MemUsage(holder->attrs);
+        }
+        m->index += holder->size * (vec_slot_bytes(holder) - slotBytes);
+        m->slack += (VEC_HOLDER_SIZE - holder->size) * vec_slot_bytes(holder);
+    }
+
+    // the multi vector holders, their dead slots are slack
+    size_t multiHolders = multiList ? array_len(multiList) : 0;
+    size_t multiVectors = 0;
+    for(size_t i = 0 ; i < multiHolders ; ++i){
+        VecsHolder* holder = multiList[i];
+        size_t used = holder->size - holder->dead;
+        multiVectors += used;
+        m->index += used * (vec_slot_bytes(holder) - slotBytes);
+        m->slack += (VEC_HOLDER_SIZE - used) * vec_slot_bytes(holder);
+    }
+
+    size_t allVectors = vectors + multiVectors;
+    size_t allHolders = holders + multiHolders;
+    m->vectors = allVectors * VEC_SIZE * sizeof(float);
+    m->metadata = allVectors * sizeof(VecKey*) + vecDTsBytes + vecKeysBytes + allHolders * offsetof(VecsHolder, keys);
+    m->index += 2 * allVectors * sizeof(float) + allHolders * sizeof(VecsHolder*) + RedisModule_DictSize(hashVecs) * HASH_INDEX_ENTRY_OVERHEAD + VecIvf_MemUsage() + VecSparse_MemUsage();
+    VecDisk* d = VecDisk_Acquire();
+    if(d){
+        m->index += VecDisk_MemUsage(d);
+        VecDisk_Release(d);
+    }
+
+    *vectorsCount = vectors;
+    *holdersCount = holders;
+}
+
+/*
+ * The amount of vectors of the multi vector documents.
+ */
+static size_t VecMulti_TotalVectors(){
+    size_t n = 0;
+    for(size_t i = 0 ; i < array_len(multiList) ; ++i){
+        n += multiList[i]->size - multiList[i]->dead;
+    }
+    return n;
+}
+
+/*
+ * The amount of vectors that are not on the IVF index, all of them without an index.
+ */
+static size_t VecIvf_TotalUnindexed(){
+    size_t unindexed = 0;
+    for(size_t i = 0 ; i < array_len(vecList) ; ++i){
+        unindexed += VecIvf_Unindexed(vecList[i]);
+    }
+    return unindexed;
+}
+
+static size_t VecDisk_TotalVectors(){
+    VecDisk* d = VecDisk_Acquire();
+    if(!d){
+        return 0;
+    }
+    size_t n = VecDisk_Size(d);
+    VecDisk_Release(d);
+    return n;
+}
+
+static void VecStats_InfoFunc(RedisModuleInfoCtx *ctx, int for_crash_report){
+    size_t holders, vectors;
+    VecMemory mem;
+    VecMemory_Get(&mem, &vectors, &holders);
+
+    RedisModule_InfoAddSection(ctx, "vecsim");
+    RedisModule_InfoAddFieldULongLong(ctx, "vectors", vectors);
+    RedisModule_InfoAddFieldULongLong(ctx, "holders", holders);
+    RedisModule_InfoAddFieldULongLong(ctx, "multi_vectors", VecMulti_TotalVectors());
+    RedisModule_InfoAddFieldULongLong(ctx, "sparse_vectors", VecSparse_Size());
+    RedisModule_InfoAddFieldULongLong(ctx, "used_memory", VecMemory_Total(&mem));
+    RedisModule_InfoAddFieldULongLong(ctx, "used_memory_vectors", mem.vectors);
+    RedisModule_InfoAddFieldULongLong(ctx, "used_memory_metadata", mem.metadata);
+    RedisModule_InfoAddFieldULongLong(ctx, "used_memory_index", mem.index);
+    RedisModule_InfoAddFieldULongLong(ctx, "used_memory_slack", mem.slack);
+    RedisModule_InfoAddFieldULongLong(ctx, "queries", VecStats_Count(VEC_COUNTER_QUERIES));
+    RedisModule_InfoAddFieldULongLong(ctx, "inserts", VecStats_Count(VEC_COUNTER_INSERTS));
+    RedisModule_InfoAddFieldDouble(ctx, "queries_per_sec", VecStats_Rate(VEC_COUNTER_QUERIES));
+    RedisModule_InfoAddFieldDouble(ctx, "inserts_per_sec", VecStats_Rate(VEC_COUNTER_INSERTS));
+
+    VecCacheStats cache;
+    VecCache_GetStats(&cache);
+    RedisModule_InfoAddSection(ctx, "vecsim_cache");
+    RedisModule_InfoAddFieldULongLong(ctx, "cache_entries", cache.entries);
+    RedisModule_InfoAddFieldULongLong(ctx, "cache_used_memory", cache.memory);
+    RedisModule_InfoAddFieldULongLong(ctx, "cache_hits", cache.hits);
+    RedisModule_InfoAddFieldULongLong(ctx, "cache_misses", cache.misses);
+    RedisModule_InfoAddFieldULongLong(ctx, "cache_evictions", cache.evictions);
+    RedisModule_InfoAddFieldULongLong(ctx, "cache_invalidations", cache.invalidations);
+
+    RedisModule_InfoAddSection(ctx, "vecsim_ivf");
+    RedisModule_InfoAddFieldULongLong(ctx, "ivf_lists", VecIvf_Lists());
+    RedisModule_InfoAddFieldULongLong(ctx, "ivf_unindexed", VecIvf_TotalUnindexed());
+
+    RedisModule_InfoAddSection(ctx, "vecsim_disk");
+    RedisModule_InfoAddFieldULongLong(ctx, "disk_vectors", VecDisk_TotalVectors());
+    RedisModule_InfoAddFieldULongLong(ctx, "disk_building", VecDisk_Building());
+
+    RedisModule_InfoAddSection(ctx, "vecsim_latency");
+    for(VecStage stage = 0 ; stage < VEC_STAGE_COUNT ; ++stage){
+        const VecHist* h = VecStats_GetStage(stage);
+        char name[64];
+        snprintf(name, sizeof(name), "%s_usec", VecStats_StageName(stage));
+        RedisModule_InfoBeginDictField(ctx, name);
+        RedisModule_InfoAddFieldULongLong(ctx, "count", h->count);
+        RedisModule_InfoAddFieldULongLong(ctx, "p50", VecHist_Percentile(h, 50));
+        RedisModule_InfoAddFieldULongLong(ctx, "p90", VecHist_Percentile(h, 90));
+        RedisModule_InfoAddFieldULongLong(ctx, "p99", VecHist_Percentile(h, 99));
+        RedisModule_InfoAddFieldULongLong(ctx, "p999", VecHist_Percentile(h, 99.9));
+        RedisModule_InfoAddFieldULongLong(ctx, "max", h->max);
+        RedisModule_InfoEndDictField(ctx);
+    }
+}
+
+/*
+ * rg.vec_stats [RESET]
+ *
+ * Reply with the same counters as the vecsim INFO section, the latency of each
+ * stage is given as [count, mean, p50, p90, p99, p999, max] in microseconds.
+ */
+int vec_stats_command(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+    if(argc > 2){
+        return RedisModule_WrongArity(ctx);
+    }
+
+    if(argc == 2){
+        if(strcasecmp(RedisModule_StringPtrLen(argv[1], NULL), "RESET") != 0){
+            RedisModule_ReplyWithError(ctx, "Unknown argument given");
+            return REDISMODULE_OK;
+        }
+        VecStats_Reset();
+        VecCache_ResetStats();
+        RedisModule_ReplyWithSimpleString(ctx, "OK");
+        return REDISMODULE_OK;
+    }
+
+    size_t holders, vectors;
+    VecMemory mem;
+    VecMemory_Get(&mem, &vectors, &holders);
+
+    VecCacheStats cache;
+    VecCache_GetStats(&cache);
+
+    RedisModule_ReplyWithArray(ctx, 48 + 2 * VEC_STAGE_COUNT);
+    RedisModule_ReplyWithSimpleString(ctx, "vectors");
+    RedisModule_ReplyWithLongLong(ctx, vectors);
+    RedisModule_ReplyWithSimpleString(ctx, "holders");
+    RedisModule_ReplyWithLongLong(ctx, holders);
+    RedisModule_ReplyWithSimpleString(ctx, "multi_vectors");
+    RedisModule_ReplyWithLongLong(ctx, VecMulti_TotalVectors());
+    RedisModule_ReplyWithSimpleString(ctx, "sparse_vectors");
+    RedisModule_ReplyWithLongLong(ctx, VecSparse_Size());
+    RedisModule_ReplyWithSimpleString(ctx, "used_memory");
+    RedisModule_ReplyWithLongLong(ctx, VecMemory_Total(&mem));
+    RedisModule_ReplyWithSimpleString(ctx, "used_memory_vectors");
+    RedisModule_ReplyWithLongLong(ctx, mem.vectors);
+    RedisModule_ReplyWithSimpleString(ctx, "used_memory_metadata");
+    RedisModule_ReplyWithLongLong(ctx, mem.metadata);
+    RedisModule_ReplyWithSimpleString(ctx, "used_memory_index");
+    RedisModule_ReplyWithLongLong(ctx, mem.index);
+    RedisModule_ReplyWithSimpleString(ctx, "used_memory_slack");
+    RedisModule_ReplyWithLongLong(ctx, mem.slack);
+    RedisModule_ReplyWithSimpleString(ctx, "queries");
+    RedisModule_ReplyWithLongLong(ctx, VecStats_Count(VEC_COUNTER_QUERIES));
+    RedisModule_ReplyWithSimpleString(ctx, "inserts");
+    RedisModule_ReplyWithLongLong(ctx, VecStats_Count(VEC_COUNTER_INSERTS));
+    RedisModule_ReplyWithSimpleString(ctx, "queries_per_sec");
+    RedisModule_ReplyWithDouble(ctx, VecStats_Rate(VEC_COUNTER_QUERIES));
+    RedisModule_ReplyWithSimpleString(ctx, "inserts_per_sec");
+    RedisModule_ReplyWithDouble(ctx, VecStats_Rate(VEC_COUNTER_INSERTS));
+    RedisModule_ReplyWithSimpleString(ctx, "cache_entries");
+    RedisModule_ReplyWithLongLong(ctx, cache.entries);
+    RedisModule_ReplyWithSimpleString(ctx, "cache_used_memory");
+    RedisModule_ReplyWithLongLong(ctx, cache.memory);
+    RedisModule_ReplyWithSimpleString(ctx, "cache_hits");
+    RedisModule_ReplyWithLongLong(ctx, cache.hits);
+    RedisModule_ReplyWithSimpleString(ctx, "cache_misses");
+    RedisModule_ReplyWithLongLong(ctx, cache.misses);
+    RedisModule_ReplyWithSimpleString(ctx, "cache_evictions");
+    RedisModule_ReplyWithLongLong(ctx, cache.evictions);
+    RedisModule_ReplyWithSimpleString(ctx, "cache_invalidations");
+    RedisModule_ReplyWithLongLong(ctx, cache.invalidations);
+    RedisModule_ReplyWithSimpleString(ctx, "ivf_lists");
+    RedisModule_ReplyWithLongLong(ctx, VecIvf_Lists());
+    RedisModule_ReplyWithSimpleString(ctx, "ivf_unindexed");
+    RedisModule_ReplyWithLongLong(ctx, VecIvf_TotalUnindexed());
+    RedisModule_ReplyWithSimpleString(ctx, "disk_vectors");
+    RedisModule_ReplyWithLongLong(ctx, VecDisk_TotalVectors());
+    RedisModule_ReplyWithSimpleString(ctx, "disk_building");
+    RedisModule_ReplyWithLongLong(ctx, VecDisk_Building());
+    RedisModule_ReplyWithSimpleString(ctx, "latency_stages");
+    RedisModule_ReplyWithLongLong(ctx, VEC_STAGE_COUNT);
+
+    for(VecStage stage = 0 ; stage < VEC_STAGE_COUNT ; ++stage){
+        const VecHist* h = VecStats_GetStage(stage);
+        RedisModule_ReplyWithSimpleString(ctx, VecStats_StageName(stage));
+        RedisModule_ReplyWithArray(ctx, 7);
+        RedisModule_ReplyWithLongLong(ctx, h->count);
+        RedisModule_ReplyWithDouble(ctx, h->count ? (double)h->sum / h->count : 0);
+        RedisModule_ReplyWithLongLong(ctx, VecHist_Percentile(h, 50));
+        RedisModule_ReplyWithLongLong(ctx, VecHist_Percentile(h, 90));
+        RedisModule_ReplyWithLongLong(ctx, VecHist_Percentile(h, 99));
+        RedisModule_ReplyWithLongLong(ctx, VecHist_Percentile(h, 99.9));
+        RedisModule_ReplyWithLongLong(ctx, h->max);
+    }
+
+    return REDISMODULE_OK;
+}
+
+/*
+ * rg.vec_slowlog GET [<count>] | LEN | RESET
+ */
+int vec_slowlog_command(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+    if(argc < 2 || argc > 3){
+        return RedisModule_WrongArity(ctx);
+    }
+
+    const char* subcommand = RedisModule_StringPtrLen(argv[1], NULL);
+    if(strcasecmp(subcommand, "GET") == 0){
+        long long count = 10;
+        if(argc == 3 && (RedisModule_StringToLongLong(argv[2], &count) != REDISMODULE_OK || count < -1)){
+            RedisModule_ReplyWithError(ctx, "Failed extracting <count>");
+            return REDISMODULE_OK;
+        }
+        VecSlowlog_Reply(ctx, count);
+    }else if(strcasecmp(subcommand, "LEN") == 0 && argc == 2){
+        RedisModule_ReplyWithLongLong(ctx, VecSlowlog_Len());
+    }else if(strcasecmp(subcommand, "RESET") == 0 && argc == 2){
+        VecSlowlog_Reset();
+        RedisModule_ReplyWithSimpleString(ctx, "OK");
+    }else{
+        RedisModule_ReplyWithError(ctx, "Unknown subcommand given");
+    }
+
+    return REDISMODULE_OK;
+}
+
+/*
+ * rg.vec_config GET <name|*>
+ * rg.vec_config SET <name> <value>
+ *
+ * The metric is set by name (COSINE, IP or L2) and only while there are no vectors.
+ */
+int vec_config_command(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+    if(argc < 3){
+        return RedisModule_WrongArity(ctx);
+    }
+
+    const char* subcommand = RedisModule_StringPtrLen(argv[1], NULL);
+    const char* name = RedisModule_StringPtrLen(argv[2], NULL);
+
+    if(strcasecmp(subcommand, "GET") == 0 && argc == 3){
+        int param = VecConfig_Find(name);
+        if(strcmp(name, "*") == 0){
+            RedisModule_ReplyWithArray(ctx, 2 * VEC_CONFIG_COUNT + 2);
+            for(int i = 0 ; i < VEC_CONFIG_COUNT ; ++i){
+                RedisModule_ReplyWithSimpleString(ctx, VecConfig_Name(i));
+                RedisModule_ReplyWithLongLong(ctx, VecConfig_Get(i));
+            }
+            RedisModule_ReplyWithSimpleString(ctx, "metric");
+            RedisModule_ReplyWithSimpleString(ctx, vec_metric_name(vecMetric));
+        }else if(strcasecmp(name, "metric") == 0){
+            RedisModule_ReplyWithArray(ctx, 2);
+            RedisModule_ReplyWithSimpleString(ctx, "metric");
+            RedisModule_ReplyWithSimpleString(ctx, vec_metric_name(vecMetric));
+        }else if(param >= 0){
+            RedisModule_ReplyWithArray(ctx, 2);
+            RedisModule_ReplyWithSimpleString(ctx, VecConfig_Name(param));
+            RedisModule_ReplyWithLongLong(ctx, VecConfig_Get(param));
+        }else{
+            RedisModule_ReplyWithError(ctx, "Unknown config param given");
+        }
+        return REDISMODULE_OK;
+    }
+
+    if(strcasecmp(subcommand, "SET") == 0 && argc == 4 && strcasecmp(name, "metric") == 0){
+        // the metric is part of the data (it is saved on the rdb), so unlike the params it is replicated
+        int metric = vec_metric_find(RedisModule_StringPtrLen(argv[3], NULL));
+        if(metric < 0){
+            RedisModule_ReplyWithError(ctx, "Unknown metric given");
+            return REDISMODULE_OK;
+        }
+        if((metric == VEC_METRIC_L2 && VecSparse_Size() > 0) || vec_metric_set(metric) != REDISMODULE_OK){
+            RedisModule_ReplyWithError(ctx, "The metric can only be changed while there are no vectors");
+            return REDISMODULE_OK;
+        }
+        VecCache_Clear();
+        RedisModule_ReplicateVerbatim(ctx);
+        RedisModule_ReplyWithSimpleString(ctx, "OK");
+        return REDISMODULE_OK;
+    }
+
+    if(strcasecmp(subcommand, "SET") == 0 && argc == 4){
+        int param = VecConfig_Find(name);
+        if(param < 0){
+            RedisModule_ReplyWithError(ctx, "Unknown config param given");
+            return REDISMODULE_OK;
+        }
+        long long val;
+        if(RedisModule_StringToLongLong(argv[3], &val) != REDISMODULE_OK){
+            RedisModule_ReplyWithError(ctx, "Failed extracting <value>");
+            return REDISMODULE_OK;
+        }
+        const char* err = NULL;
+        if(VecConfig_Set(param, val, &err) != REDISMODULE_OK){
+            RedisModule_ReplyWithError(ctx, err);
+            return REDISMODULE_OK;
+        }
+        if(param == VEC_CONFIG_COARSE_PREFIXES){
+            vec_prefixes_set(val);
+        }
+        RedisModule_ReplyWithSimpleString(ctx, "OK");
+        return REDISMODULE_OK;
+    }
+
+    RedisModule_ReplyWithError(ctx, "Unknown subcommand given");
+    return REDISMODULE_OK;
+}
+
+/*
+ * rg.vec_disk BUILD <path> [DEGREE <n>] [LIST <n>]
+ * rg.vec_disk LOAD <path>
+ *
+ * BUILD snapshots the vectors of this shard and builds a disk index on path in the
+ * background, LOAD opens an index that was built before. Either way the index then
+ * replaces the one searched by RG.VEC_SIM DISK.
+ */
+int vec_disk_command(RedisModuleCtx *ctx, RedisModuleString **argv, int argc){
+    if(argc < 3){
+        return RedisModule_WrongArity(ctx);
+    }
+
+    const char* subcommand = RedisModule_StringPtrLen(argv[1], NULL);
+    const char* path = RedisModule_StringPtrLen(argv[2], NULL);
+    const char* err = NULL;
+
+    if(vecMetric != VEC_METRIC_COSINE){
+        // the graph and the PQ codes are built on the normalized vectors
+        err = "The disk index is only supported on the COSINE metric";
+    }else if(strcasecmp(subcommand, "BUILD") == 0){
+        long long degree = VEC_DISK_DEFAULT_DEGREE;
+        long long listSize = VEC_DISK_DEFAULT_LIST;
+        for(int i = 3 ; i < argc ; ++i){
+            const char* opt = RedisModule_StringPtrLen(argv[i], NULL);
+            if(strcasecmp(opt, "DEGREE") == 0 && i + 1 < argc){
+                if(RedisModule_StringToLongLong(argv[++i], &degree) != REDISMODULE_OK || degree <= 0 || degree > 512){
+                    err = "Failed extracting <degree>";
+                    break;
+                }
+            }else if(strcasecmp(opt, "LIST") == 0 && i + 1 < argc){
+                if(RedisModule_StringToLongLong(argv[++i], &listSize) != REDISMODULE_OK || listSize <= 0){
+                    err = "Failed extracting <list>";
+                    break;
+                }
+            }else{
+                err = "Unknown argument given";
+                break;
+            }
+        }
+        if(!err){
+            VecDisk_StartBuild(path, degree, listSize, &err);
+        }
+    }else if(strcasecmp(subcommand, "LOAD") == 0 && argc == 3){
+        VecDisk* d = VecDisk_Open(path, &err);
+        if(d){
+            VecDisk_Set(d);
+        }
+    }else{
+        err = "Unknown subcommand given";
+    }
+
+    if(err){
+        RedisModule_ReplyWithError(ctx, err);
+        return REDISMODULE_OK;
+    }
+    RedisModule_ReplyWithSimpleString(ctx, "OK");
+    return REDISMODULE_OK;
+}
+
 static void OnFlush(struct RedisModuleCtx *ctx, RedisModuleEvent eid, uint64_t subevent, void *data){
     if(subevent != REDISMODULE_SUBEVENT_FLUSHDB_START){
         return;
     }
 
-    if(!vecList){
+    if(!vecList && !multiList && VecSparse_Size() == 0){
         return;
     }
 
     // before flush we need to clean all the Vector Holders and disconnect the keys
-    for(size_t i = 0 ; i < array_len(vecList) ; ++i){
-        VecsHolder* holder = vecList[i];
-        for(size_t j = 0 ; j < holder->size ; ++j){
-            VecDT* vDT = HOLDER_VECDT(holder, j);
-            vDT->holder = NULL;
-        }
-        RG_FREE(holder);
-    }
-
-    array_free(vecList);
+    vec_detach_all();
+    VecSparse_DetachAll();
+    VecCache_Clear();
 
-    vecList = NULL;
+    // the hash keys vectors are not freed by redis, they were detached above so we just free them.
+    HashIndex_Clear();
 }
 
 int RedisGears_OnLoad(RedisModuleCtx *ctx) {
@@ -567,6 +3873,10 @@ int RedisGears_OnLoad(RedisModuleCtx *ctx) {
         .rdb_load = VecDT_Load,
         .rdb_save = VecDT_Save,
         .free = VecDT_Free,
+        .mem_usage = vec_mem_usage,
+        .aux_load = HashIndex_AuxLoad,
+        .aux_save = HashIndex_AuxSave,
+        .aux_save_triggers = REDISMODULE_AUX_BEFORE_RDB,
     };
 
     vecRedisDT = RedisModule_CreateDataType(ctx, "vec_index", VEC_TYPE_VERSION, &vecDT);
@@ -575,6 +3885,36 @@ int RedisGears_OnLoad(RedisModuleCtx *ctx) {
         return REDISMODULE_ERR;
     }
 
+    RedisModuleTypeMethods vecMultiDT = {
+        .version = REDISMODULE_TYPE_METHOD_VERSION,
+        .rdb_load = VecMultiDT_Load,
+        .rdb_save = VecMultiDT_Save,
+        .free = VecDT_Free,
+        .mem_usage = vec_mem_usage,
+    };
+
+    vecMultiRedisDT = RedisModule_CreateDataType(ctx, "vec_multi", VEC_MULTI_TYPE_VERSION, &vecMultiDT);
+    if (vecMultiRedisDT == NULL) {
+        RedisModule_Log(ctx, "error", "Could not create multi vector type");
+        return REDISMODULE_ERR;
+    }
+
+    RedisModuleTypeMethods vecSparseDT = {
+        .version = REDISMODULE_TYPE_METHOD_VERSION,
+        .rdb_load = VecSparseDT_Load,
+        .rdb_save = VecSparseDT_Save,
+        .free = VecSparseDT_Free,
+        .mem_usage = VecSparse_DocMemUsage,
+    };
+
+    vecSparseRedisDT = RedisModule_CreateDataType(ctx, "vec_spars", VEC_SPARSE_TYPE_VERSION, &vecSparseDT);
+    if (vecSparseRedisDT == NULL) {
+        RedisModule_Log(ctx, "error", "Could not create sparse vector type");
+        return REDISMODULE_ERR;
+    }
+
+    hashVecs = RedisModule_CreateDict(NULL);
+
     RGM_RegisterReader(VecReader);
 
     ScoreRecordType = RedisGears_RecordTypeCreate("ScoreRecord",
@@ -584,12 +3924,26 @@ int RedisGears_OnLoad(RedisModuleCtx *ctx) {
                                                    ScoreRecord_RecordDeserialize,
                                                    ScoreRecord_RecordFree);
 
-    HeapRecordType = RedisGears_RecordTypeCreate("HeapRecord",
-                                                 sizeof(HeapRecord),
-                                                 HeapRecord_SendReply,
-                                                 HeapRecord_Serialize,
-                                                 HeapRecord_Deserialize,
-                                                 HeapRecord_Free);
+    ProfileRecordType = RedisGears_RecordTypeCreate("ProfileRecord",
+                                                     sizeof(ProfileRecord),
+                                                     ProfileRecord_SendReply,
+                                                     ProfileRecord_RecordSerialize,
+                                                     ProfileRecord_RecordDeserialize,
+                                                     ProfileRecord_RecordFree);
+
+    TopKRecordType = RedisGears_RecordTypeCreate("TopKRecord",
+                                                  sizeof(TopKRecord),
+                                                  TopKRecord_SendReply,
+                                                  TopKRecord_RecordSerialize,
+                                                  TopKRecord_RecordDeserialize,
+                                                  TopKRecord_RecordFree);
+
+    TopKBatchRecordType = RedisGears_RecordTypeCreate("TopKBatchRecord",
+                                                       sizeof(TopKBatchRecord),
+                                                       TopKBatchRecord_SendReply,
+                                                       TopKBatchRecord_RecordSerialize,
+                                                       TopKBatchRecord_RecordDeserialize,
+                                                       TopKBatchRecord_RecordFree);
 
     ArgType* TopKType = RedisGears_CreateType("TopKType",
                                               TopKTypeVersion,
@@ -600,19 +3954,125 @@ int RedisGears_OnLoad(RedisModuleCtx *ctx) {
                                               TopKArg_ArgToString);
 
     RGM_RegisterMap(to_score_records, NULL);
-    RGM_RegisterAccumulator(top_k, TopKType);
+    RGM_RegisterAccumulator(top_k_merge, TopKType);
+    RGM_RegisterAccumulator(top_k_batch_merge, NULL);
+
+    VecEntryRecordType = RedisGears_RecordTypeCreate("VecEntryRecord",
+                                                      sizeof(VecEntryRecord),
+                                                      VecEntryRecord_SendReply,
+                                                      VecEntryRecord_RecordSerialize,
+                                                      VecEntryRecord_RecordDeserialize,
+                                                      VecEntryRecord_RecordFree);
+
+    VecStreamArgType = RedisGears_CreateType("VecStreamArgType",
+                                             VecStreamArgTypeVersion,
+                                             VecStreamArg_ObjectFree,
+                                             VecStreamArg_ArgDuplicate,
+                                             VecStreamArg_ArgSerialize,
+                                             VecStreamArg_ArgDeserialize,
+                                             VecStreamArg_ArgToString);
+
+    RGM_RegisterFilter(vec_stream_entry_valid, VecStreamArgType);
+    RGM_RegisterMap(vec_stream_to_entry, VecStreamArgType);
+    RGM_RegisterGroupByExtractor(vec_entry_key, NULL);
+    RGM_RegisterAccumulator(vec_entries_batch, NULL);
+    RGM_RegisterForEach(vec_entries_insert, NULL);
 
     if (RedisModule_CreateCommand(ctx, "rg.vec_sim", vec_sim_command, "readonly", 0, 0, 0) != REDISMODULE_OK) {
         RedisModule_Log(ctx, "warning", "could not register command rg.vec_sim");
         return REDISMODULE_ERR;
     }
 
+    if (RedisModule_CreateCommand(ctx, "rg.vec_multi_sim", vec_multi_sim_command, "readonly", 0, 0, 0) != REDISMODULE_OK) {
+        RedisModule_Log(ctx, "warning", "could not register command rg.vec_multi_sim");
+        return REDISMODULE_ERR;
+    }
+
+    if (RedisModule_CreateCommand(ctx, "rg.vec_sparse_sim", vec_sparse_sim_command, "readonly", 0, 0, 0) != REDISMODULE_OK) {
+        RedisModule_Log(ctx, "warning", "could not register command rg.vec_sparse_sim");
+        return REDISMODULE_ERR;
+    }
+
+    if (RedisModule_CreateCommand(ctx, "rg.vec_range", vec_range_command, "readonly", 0, 0, 0) != REDISMODULE_OK) {
+        RedisModule_Log(ctx, "warning", "could not register command rg.vec_range");
+        return REDISMODULE_ERR;
+    }
+
+    if (RedisModule_CreateCommand(ctx, "rg.vec_stats", vec_stats_command, "readonly", 0, 0, 0) != REDISMODULE_OK) {
+        RedisModule_Log(ctx, "warning", "could not register command rg.vec_stats");
+        return REDISMODULE_ERR;
+    }
+
+    if (RedisModule_CreateCommand(ctx, "rg.vec_slowlog", vec_slowlog_command, "admin", 0, 0, 0) != REDISMODULE_OK) {
+        RedisModule_Log(ctx, "warning", "could not register command rg.vec_slowlog");
+        return REDISMODULE_ERR;
+    }
+
+    if (RedisModule_CreateCommand(ctx, "rg.vec_config", vec_config_command, "admin", 0, 0, 0) != REDISMODULE_OK) {
+        RedisModule_Log(ctx, "warning", "could not register command rg.vec_config");
+        return REDISMODULE_ERR;
+    }
+
+    if (RedisModule_CreateCommand(ctx, "rg.vec_disk", vec_disk_command, "admin", 0, 0, 0) != REDISMODULE_OK) {
+        RedisModule_Log(ctx, "warning", "could not register command rg.vec_disk");
+        return REDISMODULE_ERR;
+    }
+
     if (RedisModule_CreateCommand(ctx, "rg.vec_add", vec_add_command, "write deny-oom", 1, 1, 1) != REDISMODULE_OK) {
         RedisModule_Log(ctx, "warning", "could not register command rg.vec_add");
         return REDISMODULE_ERR;
     }
 
+    if (RedisModule_CreateCommand(ctx, "rg.vec_set", vec_set_command, "write deny-oom", 1, 1, 1) != REDISMODULE_OK) {
+        RedisModule_Log(ctx, "warning", "could not register command rg.vec_set");
+        return REDISMODULE_ERR;
+    }
+
+    if (RedisModule_CreateCommand(ctx, "rg.vec_multi_add", vec_multi_add_command, "write deny-oom", 1, 1, 1) != REDISMODULE_OK) {
+        RedisModule_Log(ctx, "warning", "could not register command rg.vec_multi_add");
+        return REDISMODULE_ERR;
+    }
+
+    if (RedisModule_CreateCommand(ctx, "rg.vec_sparse_add", vec_sparse_add_command, "write deny-oom", 1, 1, 1) != REDISMODULE_OK) {
+        RedisModule_Log(ctx, "warning", "could not register command rg.vec_sparse_add");
+        return REDISMODULE_ERR;
+    }
+
+    if (RedisModule_CreateCommand(ctx, "rg.vec_get", vec_get_command, "readonly", 1, 1, 1) != REDISMODULE_OK) {
+        RedisModule_Log(ctx, "warning", "could not register command rg.vec_get");
+        return REDISMODULE_ERR;
+    }
+
+    if (RedisModule_CreateCommand(ctx, "rg.vec_mget", vec_mget_command, "readonly", 1, -1, 1) != REDISMODULE_OK) {
+        RedisModule_Log(ctx, "warning", "could not register command rg.vec_mget");
+        return REDISMODULE_ERR;
+    }
+
+    if (RedisModule_CreateCommand(ctx, "rg.vec_stream_register", vec_stream_register_command, "write", 0, 0, 0) != REDISMODULE_OK) {
+        RedisModule_Log(ctx, "warning", "could not register command rg.vec_stream_register");
+        return REDISMODULE_ERR;
+    }
+
+    if (RedisModule_CreateCommand(ctx, "rg.vec_hash_index", vec_hash_index_command, "write deny-oom", 0, 0, 0) != REDISMODULE_OK) {
+        RedisModule_Log(ctx, "warning", "could not register command rg.vec_hash_index");
+        return REDISMODULE_ERR;
+    }
+
+    if (RedisModule_RegisterInfoFunc(ctx, VecStats_InfoFunc) != REDISMODULE_OK) {
+        RedisModule_Log(ctx, "warning", "could not register info function");
+    }
+
     RedisModule_SubscribeToServerEvent(ctx, RedisModuleEvent_FlushDB, OnFlush);
+    RedisModule_SubscribeToServerEvent(ctx, RedisModuleEvent_Loading, OnLoading);
+
+    RedisModule_SubscribeToKeyspaceEvents(ctx, REDISMODULE_NOTIFY_GENERIC | REDISMODULE_NOTIFY_HASH |
+                                               REDISMODULE_NOTIFY_EXPIRED | REDISMODULE_NOTIFY_EVICTED,
+                                          HashIndex_OnKeyspaceEvent);
+
+    if(VecIvf_StartWorker() != REDISMODULE_OK){
+        RedisModule_Log(ctx, "warning", "could not start the IVF worker");
+        return REDISMODULE_ERR;
+    }
 
     return REDISMODULE_OK;
 }